@@ -0,0 +1,55 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "atomic_file_writer.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+absl::Status WriteFileAtomically(
+    const std::string& path,
+    absl::FunctionRef<absl::Status(std::ostream&)> write) {
+  const std::string tmp_path = absl::StrCat(path, ".tmp.", getpid());
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return absl::InternalError(absl::StrCat("Cannot open ", tmp_path));
+  }
+  absl::Status status = write(out);
+  out.close();
+  if (status.ok() && !out) {
+    status = absl::InternalError(absl::StrCat("Cannot write ", tmp_path));
+  }
+  if (status.ok() && std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    status = absl::InternalError(absl::StrCat(
+        "Cannot rename ", tmp_path, " to ", path, ": ", strerror(errno)));
+  }
+  if (!status.ok()) {
+    std::remove(tmp_path.c_str());
+  }
+  return status;
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
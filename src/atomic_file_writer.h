@@ -0,0 +1,37 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ATOMIC_FILE_WRITER_H_
+#define ATOMIC_FILE_WRITER_H_
+
+#include <ostream>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Writes the file at 'path' with 'write'. The file is written to a temporary
+// file next to it, which is renamed to 'path' once fully written, so that
+// readers, and other processes writing the same file, never see a partial
+// file. On error, 'path' is left as it was.
+absl::Status WriteFileAtomically(
+    const std::string& path,
+    absl::FunctionRef<absl::Status(std::ostream&)> write);
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // ATOMIC_FILE_WRITER_H_
@@ -0,0 +1,74 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "atomic_file_writer.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+TEST(AtomicFileWriterTest, ReplacesTheFile) {
+  const std::string path = ::testing::TempDir() + "/replaces_the_file";
+  ASSERT_TRUE(WriteFileAtomically(path, [](std::ostream& out) {
+                out << "first";
+                return absl::OkStatus();
+              }).ok());
+  EXPECT_EQ(ReadFile(path), "first");
+  ASSERT_TRUE(WriteFileAtomically(path, [](std::ostream& out) {
+                out << "second";
+                return absl::OkStatus();
+              }).ok());
+  EXPECT_EQ(ReadFile(path), "second");
+}
+
+TEST(AtomicFileWriterTest, KeepsTheFileOnError) {
+  const std::string dir = ::testing::TempDir() + "/keeps_the_file_on_error";
+  std::filesystem::create_directories(dir);
+  const std::string path = dir + "/file";
+  ASSERT_TRUE(WriteFileAtomically(path, [](std::ostream& out) {
+                out << "kept";
+                return absl::OkStatus();
+              }).ok());
+  EXPECT_EQ(WriteFileAtomically(path,
+                                [](std::ostream& out) {
+                                  out << "partial";
+                                  return absl::DataLossError("failed");
+                                })
+                .code(),
+            absl::StatusCode::kDataLoss);
+  EXPECT_EQ(ReadFile(path), "kept");
+  // The temporary file is removed.
+  EXPECT_EQ(std::distance(std::filesystem::directory_iterator(dir),
+                          std::filesystem::directory_iterator()),
+            1);
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
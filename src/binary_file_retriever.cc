@@ -17,7 +17,10 @@
 #include "binary_file_retriever.h"
 
 #include <fstream>
+#include <future>  // NOLINT(build/c++11)
 #include <memory>
+#include <string>
+#include <utility>
 
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
@@ -54,6 +57,18 @@ absl::StatusOr<std::string> BinaryFileRetriever::RetrieveDwpFile(
   return RetrieveFile(stored_path);
 }
 
+std::future<BinaryFileRetriever::RetrievedFiles>
+BinaryFileRetriever::RetrieveFilesAsync(std::string build_id,
+                                        std::string stored_path) const {
+  return std::async(
+      std::launch::async,
+      [this, build_id = std::move(build_id),
+       stored_path = std::move(stored_path)]() {
+        return RetrievedFiles{.binary = RetrieveBinary(build_id, stored_path),
+                              .dwp = RetrieveDwpFile(build_id)};
+      });
+}
+
 absl::StatusOr<std::string> BinaryFileRetriever::RetrieveFile(
     const std::string &stored_path) const {
   if (CheckExists(stored_path)) {
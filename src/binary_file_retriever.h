@@ -17,6 +17,7 @@
 #ifndef BINARY_FILE_RETRIEVER_H_
 #define BINARY_FILE_RETRIEVER_H_
 
+#include <future>  // NOLINT(build/c++11)
 #include <memory>
 #include <string>
 
@@ -37,6 +38,21 @@ class BinaryFileRetriever final {
   absl::StatusOr<std::string> RetrieveDwpFile(
       const std::string &build_id) const;
 
+  // The binary and dwp file of a build id, as returned by RetrieveBinary and
+  // RetrieveDwpFile.
+  struct RetrievedFiles {
+    absl::StatusOr<std::string> binary;
+    absl::StatusOr<std::string> dwp;
+  };
+
+  // Retrieve the binary and dwp file of build_id on a thread of its own, so
+  // that the files of several build ids can be fetched at once, and while
+  // others are parsed. Each call holds a thread until its files are
+  // retrieved, so callers bound how many run at once. The retriever must
+  // outlive the returned future.
+  std::future<RetrievedFiles> RetrieveFilesAsync(std::string build_id,
+                                                 std::string stored_path) const;
+
  private:
   bool CheckExists(const std::string &stored_path) const;
 
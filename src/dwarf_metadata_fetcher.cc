@@ -15,6 +15,8 @@
 #include "dwarf_metadata_fetcher.h"
 
 #include <fcntl.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -24,16 +26,21 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>  // NOLINT(build/c++11)
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <ostream>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_set.h"
+#include "absl/functional/function_ref.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -45,7 +52,11 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "atomic_file_writer.h"
 #include "binary_file_retriever.h"
+#include "parallel_for.h"
+#include "perf_stats.h"
+#include "src/dwarf_metadata_cache.pb.h"
 #include "status_macros.h"
 #include "llvm/include/llvm/BinaryFormat/Dwarf.h"
 #include "llvm/include/llvm/DebugInfo/DIContext.h"
@@ -56,7 +67,14 @@
 #include "llvm/include/llvm/Object/Binary.h"
 #include "llvm/include/llvm/Object/ObjectFile.h"
 #include "llvm/include/llvm/Support/Debug.h"
+#include "llvm/include/llvm/Support/WithColor.h"
 #include "llvm/include/llvm/Support/raw_ostream.h"
+#include "llvm/include/llvm/Support/xxhash.h"
+
+using devtools_crosstool_fdo_field_access::PerfCounter;
+using devtools_crosstool_fdo_field_access::PerfPhase;
+using devtools_crosstool_fdo_field_access::PerfStats;
+using devtools_crosstool_fdo_field_access::ScopedPhase;
 
 // Wrappers for allocated types.
 const absl::string_view kMembufWrappers[] = {
@@ -67,28 +85,48 @@ const absl::string_view kMembufWrappers[] = {
 constexpr std::string_view kAnonPrefix = "Anon_";
 constexpr std::string_view kAnonSigPrefix = "AnonSig_";
 
+// Version of the cache files, see dwarf_metadata_cache.proto. Bump it whenever
+// the format, or the way the DWARF is parsed, changes.
+constexpr uint32_t kCacheVersion = 1;
+constexpr std::string_view kCacheFileSuffix = ".dwarf_metadata";
+
+// Maximum number of binaries whose files are retrieved at once, ahead of
+// parsing. Each retrieval holds a thread.
+constexpr size_t kMaxPrefetchedBinaries = 4;
+
+// Lazily parsed packs keep pending DIEs in their own namespaces, so they
+// cannot be merged, see MetadataPack::Insert. Checked before any work is done.
+static absl::Status CheckLazyParseBinaryCount(bool lazy_parse,
+                                              size_t binary_count) {
+  if (lazy_parse && binary_count > 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Lazy DWARF parsing supports a single binary, but ",
+                     binary_count, " binaries were given."));
+  }
+  return absl::OkStatus();
+}
+
 DwarfMetadataFetcher::DwarfMetadataFetcher(
     std::unique_ptr<BinaryFileRetriever> file_retriever, std::string cache_dir,
     bool should_read_subprograms, bool write_to_cache,
-    uint32_t parse_thread_count)
+    uint32_t parse_thread_count, bool lazy_parse)
     : file_retriever_(std::move(file_retriever)), cache_dir_(cache_dir),
       should_read_subprograms_(should_read_subprograms),
-      write_to_cache_(write_to_cache), parse_thread_count_(parse_thread_count) {
-}
-
-absl::Status DwarfMetadataFetcher::ReadFromDWARF(const std::string &build_id,
-                                                 const std::string &path,
-                                                 MetadataPack *pack_ptr) {
-  auto binary_or = file_retriever_->RetrieveBinary(build_id, path);
-  auto dwp_or = file_retriever_->RetrieveDwpFile(build_id);
-  if (binary_or.status().ok() && dwp_or.status().ok()) {
-    RETURN_IF_ERROR(pack_ptr->ParseDWARF(binary_or.value(), dwp_or.value(),
+      write_to_cache_(write_to_cache), parse_thread_count_(parse_thread_count),
+      lazy_parse_(lazy_parse) {}
+
+absl::Status DwarfMetadataFetcher::ReadFromDWARF(
+    const std::string &build_id,
+    const BinaryFileRetriever::RetrievedFiles &files, MetadataPack *pack_ptr) {
+  if (files.binary.ok() && files.dwp.ok()) {
+    RETURN_IF_ERROR(pack_ptr->ParseDWARF(*files.binary, *files.dwp,
                                          should_read_subprograms_,
-                                         parse_thread_count_));
-  } else if (binary_or.status().ok()) {
+                                         parse_thread_count_, lazy_parse_));
+  } else if (files.binary.ok()) {
     LOG(WARNING) << "Failed to get dwp for build_id" << build_id;
-    RETURN_IF_ERROR(pack_ptr->ParseDWARF(
-        binary_or.value(), "", should_read_subprograms_, parse_thread_count_));
+    RETURN_IF_ERROR(pack_ptr->ParseDWARF(*files.binary, "",
+                                         should_read_subprograms_,
+                                         parse_thread_count_, lazy_parse_));
   } else {
     LOG(WARNING) << "Failed to get binary and dwp for build_id" << build_id;
   }
@@ -100,38 +138,160 @@ std::string MergeNames(const std::vector<absl::string_view> &names) {
   return absl::StrJoin(names, "::");
 }
 
+std::string DwarfMetadataFetcher::CachePath(absl::string_view build_id) const {
+  return absl::StrCat(cache_dir_, "/", build_id, kCacheFileSuffix);
+}
+
+absl::Status DwarfMetadataFetcher::ReadFromCache(const std::string &build_id,
+                                                 MetadataPack *pack_ptr) const {
+  if (cache_dir_.empty() || build_id.empty()) {
+    return absl::NotFoundError("No cache directory or build id");
+  }
+  ScopedPhase phase("ReadDwarfCache");
+  const std::string path = CachePath(build_id);
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return absl::NotFoundError(absl::StrCat("Cannot open cache file ", path));
+  }
+  return pack_ptr->Deserialize(in, build_id, should_read_subprograms_);
+}
+
+absl::Status DwarfMetadataFetcher::WriteToCache(const std::string &build_id,
+                                                const MetadataPack &pack) const {
+  ScopedPhase phase("WriteDwarfCache");
+  std::error_code error;
+  std::filesystem::create_directories(cache_dir_, error);
+  if (error) {
+    return absl::InternalError(absl::StrCat(
+        "Cannot create cache directory ", cache_dir_, ": ", error.message()));
+  }
+  return WriteFileAtomically(CachePath(build_id), [&](std::ostream &out) {
+    return pack.Serialize(out, build_id, should_read_subprograms_);
+  });
+}
+
+absl::Status DwarfMetadataFetcher::FetchPack(
+    const std::string &build_id, bool force_update_cache,
+    absl::FunctionRef<absl::Status(MetadataPack *)> parse,
+    MetadataPack *pack_ptr) {
+  if (!force_update_cache) {
+    absl::Status cache_status = ReadFromCache(build_id, pack_ptr);
+    if (cache_status.ok()) {
+      LOG(INFO) << "Read build_id " << build_id << " from cache";
+      return absl::OkStatus();
+    }
+    LOG(INFO) << "No usable cache for build_id " << build_id << ": "
+              << cache_status;
+    *pack_ptr = MetadataPack();
+  }
+  LOG(INFO) << "Read from DWARF content instead of cache";
+  RETURN_IF_ERROR(parse(pack_ptr));
+  {
+    ScopedPhase phase("PostProcessAndIndexTypeData");
+    RETURN_IF_ERROR(pack_ptr->PostProcessAndIndexTypeData(
+        pack_ptr->root_space.get(), "", parse_thread_count_));
+  }
+  // A lazily parsed pack holds only the namespaces so far.
+  if (write_to_cache_ && !cache_dir_.empty() && !build_id.empty() &&
+      !pack_ptr->Empty() && pack_ptr->lazy_index == nullptr) {
+    absl::Status cache_status = WriteToCache(build_id, *pack_ptr);
+    if (!cache_status.ok()) {
+      LOG(WARNING) << "Failed to write cache for build_id " << build_id
+                   << ": " << cache_status;
+    }
+  }
+  return absl::OkStatus();
+}
+
 absl::Status DwarfMetadataFetcher::FetchWithPath(
     const absl::flat_hash_set<DwarfMetadataFetcher::BinaryInfo>
         &build_ids_and_paths,
     bool force_update_cache) {
+  RETURN_IF_ERROR(
+      CheckLazyParseBinaryCount(lazy_parse_, build_ids_and_paths.size()));
   pack_ = MetadataPack();
-  for (auto &bin_info : build_ids_and_paths) {
-    LOG(INFO) << "Process build_id: " << bin_info.build_id;
-    MetadataPack pack;
-    if (force_update_cache) {
-      LOG(INFO) << "Read from DWARF content instead of cache";
-      RETURN_IF_ERROR(ReadFromDWARF(bin_info.build_id, bin_info.path, &pack));
+  const std::vector<BinaryInfo> binaries(build_ids_and_paths.begin(),
+                                         build_ids_and_paths.end());
+  // The files of the binaries that are not expected in the cache are
+  // retrieved ahead of parsing, so that retrieving the next binaries overlaps
+  // with parsing the current one. At most kMaxPrefetchedBinaries of them are
+  // in flight at once. The others are only retrieved if their cache turns out
+  // to be unusable.
+  std::vector<size_t> to_prefetch;
+  for (size_t i = 0; i < binaries.size(); ++i) {
+    const BinaryInfo &bin_info = binaries[i];
+    if (force_update_cache || cache_dir_.empty() || bin_info.build_id.empty() ||
+        !std::filesystem::exists(CachePath(bin_info.build_id))) {
+      to_prefetch.push_back(i);
     }
-    RETURN_IF_ERROR(
-        pack.PostProcessAndIndexTypeData(pack.root_space.get(), ""));
-    RETURN_IF_ERROR(pack_.Insert(pack));
   }
-  return absl::OkStatus();
+  std::vector<std::future<BinaryFileRetriever::RetrievedFiles>> prefetched(
+      binaries.size());
+  // to_prefetch[first_pending, next_prefetch) are the retrievals started for
+  // the binaries not processed yet.
+  size_t first_pending = 0;
+  size_t next_prefetch = 0;
+
+  std::vector<MetadataPack> packs(binaries.size());
+  for (size_t i = 0; i < binaries.size(); ++i) {
+    while (first_pending < next_prefetch && to_prefetch[first_pending] < i) {
+      ++first_pending;
+    }
+    for (; next_prefetch < to_prefetch.size() &&
+           next_prefetch - first_pending < kMaxPrefetchedBinaries;
+         ++next_prefetch) {
+      const BinaryInfo &next = binaries[to_prefetch[next_prefetch]];
+      prefetched[to_prefetch[next_prefetch]] =
+          file_retriever_->RetrieveFilesAsync(next.build_id, next.path);
+    }
+    const BinaryInfo &bin_info = binaries[i];
+    LOG(INFO) << "Process build_id: " << bin_info.build_id;
+    RETURN_IF_ERROR(FetchPack(
+        bin_info.build_id, force_update_cache,
+        [&](MetadataPack *pack_ptr) {
+          BinaryFileRetriever::RetrievedFiles files;
+          if (prefetched[i].valid()) {
+            ScopedPhase phase("WaitForBinaryFiles");
+            files = prefetched[i].get();
+          } else {
+            files = {.binary = file_retriever_->RetrieveBinary(
+                         bin_info.build_id, bin_info.path),
+                     .dwp = file_retriever_->RetrieveDwpFile(
+                         bin_info.build_id)};
+          }
+          return ReadFromDWARF(bin_info.build_id, files, pack_ptr);
+        },
+        &packs[i]));
+    // Waits for a retrieval the cache made unnecessary, so that it does not
+    // count against kMaxPrefetchedBinaries.
+    prefetched[i] = {};
+  }
+  ScopedPhase phase("MergeMetadataPacks");
+  return pack_.InsertAll(packs, parse_thread_count_);
 }
 
 absl::Status DwarfMetadataFetcher::FetchDWPWithPath(
     const absl::flat_hash_set<DwarfMetadataFetcher::BinaryInfo>
         &build_ids_and_paths,
     bool force_update_cache) {
+  RETURN_IF_ERROR(
+      CheckLazyParseBinaryCount(lazy_parse_, build_ids_and_paths.size()));
   pack_ = MetadataPack();
+  std::vector<MetadataPack> packs(build_ids_and_paths.size());
+  size_t i = 0;
   for (auto &bin_info : build_ids_and_paths) {
-    std::string dwp_path = bin_info.path;
-    RETURN_IF_ERROR(pack_.ParseDWARF(
-        dwp_path, dwp_path, should_read_subprograms_, parse_thread_count_));
-    RETURN_IF_ERROR(
-        pack_.PostProcessAndIndexTypeData(pack_.root_space.get(), ""));
-  }
-  return absl::OkStatus();
+    const std::string &dwp_path = bin_info.path;
+    RETURN_IF_ERROR(FetchPack(
+        bin_info.build_id, force_update_cache,
+        [&](MetadataPack *pack_ptr) {
+          return pack_ptr->ParseDWARF(dwp_path, dwp_path,
+                                      should_read_subprograms_,
+                                      parse_thread_count_, lazy_parse_);
+        },
+        &packs[i++]));
+  }
+  ScopedPhase phase("MergeMetadataPacks");
+  return pack_.InsertAll(packs, parse_thread_count_);
 }
 
 absl::Status
@@ -144,36 +304,105 @@ DwarfMetadataFetcher::Fetch(const absl::flat_hash_set<std::string> &build_ids,
   return FetchWithPath(build_ids_and_paths, force_update_cache);
 }
 
-absl::Status DwarfMetadataFetcher::MetadataPack::PostProcessAndIndexTypeData(
-    TypeData *type_data, std::string namespace_ctxt) {
-  if (type_data == nullptr) {
-    return absl::OkStatus();
+using FormalParamMap =
+    absl::flat_hash_map<std::string, std::vector<std::string>>;
+
+// Index 'type_data' alone into the maps, and add its name to namespace_ctxt
+// if it is a namespace.
+static void
+IndexTypeNode(DwarfMetadataFetcher::TypeData &type_data, int64_t pointer_size,
+              std::string &namespace_ctxt,
+              DwarfMetadataFetcher::HeapAllocSiteMap &heapalloc_sites,
+              FormalParamMap &formal_params) {
+  using DataType = DwarfMetadataFetcher::DataType;
+  if (type_data.data_type == DataType::NAMESPACE && !type_data.name.empty()) {
+    absl::StrAppend(&namespace_ctxt, "::", type_data.name);
+  }
+  heapalloc_sites.merge(type_data.heapalloc_sites);
+
+  if (!type_data.formal_parameters.empty()) {
+    if (type_data.data_type == DataType::SUBPROGRAM) {
+      formal_params.insert({type_data.name, type_data.formal_parameters});
+    } else {
+      // Add full name with namespace to the formal parameters map.
+      formal_params.insert(
+          {absl::StrCat(namespace_ctxt, "::", type_data.name),
+           type_data.formal_parameters});
+    }
   }
 
-  if (type_data->data_type == DataType::NAMESPACE && !type_data->name.empty()) {
-    absl::StrAppend(&namespace_ctxt, "::", type_data->name);
+  if (type_data.data_type == DataType::POINTER_LIKE) {
+    type_data.size = pointer_size;
   }
-  heapalloc_sites.merge(type_data->heapalloc_sites);
+}
 
-  if (!type_data->formal_parameters.empty()) {
-    if (type_data->data_type == DataType::SUBPROGRAM) {
-      formal_and_template_param_map.insert(
-          {type_data->name, type_data->formal_parameters});
-    } else {
-      // Add full name with namespace to the formal parameters map.
-      formal_and_template_param_map.insert(
-          {absl::StrCat(namespace_ctxt, "::", type_data->name),
-           type_data->formal_parameters});
-    }
+// Index 'type_data' and all the types below it into the maps.
+static void
+IndexTypeTree(DwarfMetadataFetcher::TypeData &type_data, int64_t pointer_size,
+              std::string namespace_ctxt,
+              DwarfMetadataFetcher::HeapAllocSiteMap &heapalloc_sites,
+              FormalParamMap &formal_params) {
+  IndexTypeNode(type_data, pointer_size, namespace_ctxt, heapalloc_sites,
+                formal_params);
+  for (auto &[unused, child_type_data] : type_data.types) {
+    IndexTypeTree(*child_type_data, pointer_size, namespace_ctxt,
+                  heapalloc_sites, formal_params);
   }
+}
 
-  if (type_data->data_type == DataType::POINTER_LIKE) {
-    type_data->size = pointer_size;
+// Number of child batches handed out per indexing thread, see
+// kUnitBatchesPerThread.
+constexpr size_t kIndexBatchesPerThread = 4;
+
+absl::Status DwarfMetadataFetcher::MetadataPack::PostProcessAndIndexTypeData(
+    TypeData *type_data, std::string namespace_ctxt, uint32_t thread_count) {
+  if (type_data == nullptr) {
+    return absl::OkStatus();
+  }
+  if (thread_count <= 1 || type_data->types.size() <= 1) {
+    IndexTypeTree(*type_data, pointer_size, std::move(namespace_ctxt),
+                  heapalloc_sites, formal_and_template_param_map);
+    return absl::OkStatus();
   }
 
+  IndexTypeNode(*type_data, pointer_size, namespace_ctxt, heapalloc_sites,
+                formal_and_template_param_map);
+  std::vector<TypeData *> children;
+  children.reserve(type_data->types.size());
   for (auto &[unused, child_type_data] : type_data->types) {
-    RETURN_IF_ERROR(
-        PostProcessAndIndexTypeData(child_type_data.get(), namespace_ctxt));
+    children.push_back(child_type_data.get());
+  }
+
+  // Batches are contiguous ranges of children, each indexed into its own
+  // maps. Both maps keep the entry inserted first, so merging the batches in
+  // order gives the same maps as the serial walk.
+  struct Batch {
+    size_t begin = 0;
+    size_t end = 0;
+    HeapAllocSiteMap heapalloc_sites;
+    FormalParamMap formal_params;
+  };
+  const size_t batch_count = std::min<size_t>(
+      children.size(), size_t{thread_count} * kIndexBatchesPerThread);
+  std::vector<Batch> batches(batch_count);
+  for (size_t i = 0; i < batch_count; ++i) {
+    batches[i].begin = children.size() * i / batch_count;
+    batches[i].end = children.size() * (i + 1) / batch_count;
+  }
+
+  ParallelFor(batch_count, thread_count, [&](size_t i) {
+    Batch &batch = batches[i];
+    for (size_t child = batch.begin; child < batch.end; ++child) {
+      IndexTypeTree(*children[child], pointer_size, namespace_ctxt,
+                    batch.heapalloc_sites, batch.formal_params);
+    }
+  });
+
+  for (Batch &batch : batches) {
+    heapalloc_sites.merge(batch.heapalloc_sites);
+    for (auto &[name, params] : batch.formal_params) {
+      formal_and_template_param_map.try_emplace(name, std::move(params));
+    }
   }
   return absl::OkStatus();
 }
@@ -313,6 +542,301 @@ static std::string GetTypeQualifiedName(const llvm::DWARFDie &die) {
   return full_type_name;
 }
 
+// Name of the type or namespace 'die' in the types of its parent.
+static std::string
+GetChildTypeName(const llvm::DWARFDie &die,
+                 const DwarfMetadataFetcher::ParseContext &context) {
+  std::optional<std::string> signature_type_name =
+      ResolveSignature(die, context);
+  if (signature_type_name) {
+    return *signature_type_name;
+  }
+  return RecursiveGetNameOrResolveAnon(die);
+}
+
+// Name of the subprogram 'die' in the types of its parent, nullptr if none.
+static const char *GetSubprogramName(const llvm::DWARFDie &die) {
+  const char *name = die.getLinkageName();
+  if (name == nullptr) {
+    // This is important if an allocation is made in 'main' for heapalloc
+    // dwarf. This is because main does not have a
+    // linkage name.
+    name = die.getShortName();
+  }
+  return name;
+}
+
+// Source location of the heapalloc site 'die'.
+static DwarfMetadataFetcher::Frame
+GetHeapAllocFrame(const llvm::DWARFDie &die) {
+  uint64_t line_offset = die.getDeclLine();
+  uint64_t col_number =
+      llvm::dwarf::toUnsigned(die.find(llvm::dwarf::DW_AT_decl_column), 0);
+  std::string func_name;
+  if (die.find(llvm::dwarf::DW_AT_name)) {
+    func_name = die.getShortName();
+  } else {
+    func_name = "";
+  }
+  return DwarfMetadataFetcher::Frame(func_name, line_offset, col_number);
+}
+
+// Type name of the allocation made at the heapalloc site 'die'.
+static std::string GetHeapAllocTypeName(const llvm::DWARFDie &die) {
+  llvm::DWARFDie type_die =
+      die.getAttributeValueAsReferencedDie(llvm::dwarf::DW_AT_type);
+  return GetTypeQualifiedName(RecursiveGetTypedefDIE(type_die));
+}
+
+// Visit all the top level DIEs of 'unit' into 'root'.
+static void VisitSibAndChildren(
+    llvm::DWARFUnit &unit, bool should_read_subprogram,
+    const DwarfMetadataFetcher::ParseContext &context,
+    DwarfMetadataFetcher::TypeData &root) {
+  llvm::DWARFDie sib_die = unit.getUnitDIE(false);
+  while (sib_die) {
+    llvm::DWARFDie child_die = sib_die.getFirstChild();
+    while (child_die) {
+      root.VisitChildDIE(child_die, should_read_subprogram, context);
+      child_die = child_die.getSibling();
+    }
+    sib_die = sib_die.getSibling();
+  }
+}
+
+// Number of unit batches handed out per parser thread. More batches balance
+// the load better, fewer batches deduplicate more types before merging.
+constexpr size_t kUnitBatchesPerThread = 4;
+
+// Parse 'units' on 'thread_count' threads into 'root'. The units are split
+// into contiguous batches that the threads claim in order. Each batch is
+// parsed into its own subtree, so the threads never share a TypeData, and the
+// subtrees are merged into 'root' in batch order. This makes the result the
+// same as visiting 'units' one after the other on a single thread. Batches are
+// merged as soon as every batch before them is, by whichever thread is free
+// to do so, which bounds the number of subtrees alive at once.
+static void ParseUnitsConcurrently(
+    const std::vector<llvm::DWARFUnit *> &units, uint32_t thread_count,
+    bool should_read_subprogram,
+    const DwarfMetadataFetcher::ParseContext &context,
+    DwarfMetadataFetcher::TypeData &root) {
+  using TypeData = DwarfMetadataFetcher::TypeData;
+  if (units.empty()) {
+    return;
+  }
+  const size_t batch_size = std::max<size_t>(
+      1, units.size() / (size_t{thread_count} * kUnitBatchesPerThread));
+  const size_t batch_count = (units.size() + batch_size - 1) / batch_size;
+
+  absl::Mutex batches_mu;
+  std::vector<std::unique_ptr<TypeData>> batches(batch_count);
+  // Held by the thread merging batches into 'root'.
+  absl::Mutex merge_mu;
+  // Guarded by merge_mu.
+  size_t next_to_merge = 0;
+
+  // Must be called with merge_mu held.
+  auto MergeReadyBatches = [&]() {
+    while (next_to_merge < batch_count) {
+      std::unique_ptr<TypeData> batch;
+      {
+        absl::MutexLock lock(&batches_mu);
+        batch = std::move(batches[next_to_merge]);
+      }
+      if (batch == nullptr) {
+        return;
+      }
+      root.MergeFrom(*batch);
+      ++next_to_merge;
+    }
+  };
+
+  ParallelFor(batch_count, thread_count, [&](size_t batch) {
+    auto subtree = std::make_unique<TypeData>();
+    const size_t end = std::min(units.size(), (batch + 1) * batch_size);
+    for (size_t i = batch * batch_size; i < end; ++i) {
+      VisitSibAndChildren(*units[i], should_read_subprogram, context,
+                          *subtree);
+    }
+    {
+      absl::MutexLock lock(&batches_mu);
+      batches[batch] = std::move(subtree);
+    }
+    // Only one thread merges at a time, the others go back to parsing.
+    // Whatever is left behind is merged once all the threads are done.
+    if (merge_mu.TryLock()) {
+      MergeReadyBatches();
+      merge_mu.Unlock();
+    }
+  });
+  absl::MutexLock lock(&merge_mu);
+  MergeReadyBatches();
+}
+
+struct DwarfMetadataFetcher::LazyIndex {
+  // The DWARF the pending DIEs point into.
+  llvm::object::OwningBinary<llvm::object::ObjectFile> object_binary;
+  std::unique_ptr<llvm::DWARFContext> dwarf_info;
+  std::shared_ptr<llvm::DWARFContext> dwp_dwarf_info;
+  ParseContext context;
+  bool should_read_subprogram = false;
+
+  // The top level DIEs of a namespace that are not parsed yet, keyed by the
+  // name they get in its types or typedefs, in unit order.
+  struct PendingScope {
+    TypeData *type_data = nullptr;
+    // Namespace context of the children of type_data, as built by
+    // PostProcessAndIndexTypeData.
+    std::string namespace_ctxt;
+    absl::flat_hash_map<std::string, std::vector<llvm::DWARFDie>> dies;
+  };
+  absl::flat_hash_map<const TypeData *, PendingScope> scopes;
+
+  // Namespace of the subprogram of each linkage name.
+  absl::flat_hash_map<std::string, const TypeData *> subprogram_scopes;
+
+  // First heapalloc site DIE of each frame, not resolved yet.
+  absl::flat_hash_map<Frame, llvm::DWARFDie, FrameHash, FrameEq>
+      heapalloc_dies;
+
+  // Index the children of the namespace or unit 'die', whose content goes to
+  // 'scope'. Namespaces are added to 'scope' as they are met, the other types
+  // only once looked up.
+  void IndexScope(const llvm::DWARFDie &die, TypeData &scope,
+                  const std::string &namespace_ctxt);
+
+  void IndexHeapAllocSite(const llvm::DWARFDie &die) {
+    heapalloc_dies.try_emplace(GetHeapAllocFrame(die), die);
+  }
+};
+
+void DwarfMetadataFetcher::LazyIndex::IndexScope(
+    const llvm::DWARFDie &die, TypeData &scope,
+    const std::string &namespace_ctxt) {
+  for (llvm::DWARFDie child_die = die.getFirstChild(); child_die;
+       child_die = child_die.getSibling()) {
+    std::string name;
+    switch (child_die.getTag()) {
+    case llvm::dwarf::DW_TAG_namespace: {
+      std::string child_name = GetChildTypeName(child_die, context);
+      if (!scope.types.contains(child_name)) {
+        scope.AddType(child_name, std::make_unique<TypeData>());
+      }
+      TypeData &child = *scope.types[child_name];
+      child.data_type = DataType::NAMESPACE;
+      std::string child_ctxt = namespace_ctxt;
+      if (!child.name.empty()) {
+        absl::StrAppend(&child_ctxt, "::", child.name);
+      }
+      IndexScope(child_die, child, child_ctxt);
+      continue;
+    }
+    case llvm::dwarf::DW_TAG_class_type:
+    case llvm::dwarf::DW_TAG_structure_type:
+    case llvm::dwarf::DW_TAG_base_type:
+    case llvm::dwarf::DW_TAG_array_type:
+    case llvm::dwarf::DW_TAG_pointer_type:
+    case llvm::dwarf::DW_TAG_ptr_to_member_type:
+    case llvm::dwarf::DW_TAG_reference_type:
+    case llvm::dwarf::DW_TAG_rvalue_reference_type:
+    case llvm::dwarf::DW_TAG_enumeration_type:
+    case llvm::dwarf::DW_TAG_union_type:
+      name = GetChildTypeName(child_die, context);
+      break;
+    case llvm::dwarf::DW_TAG_typedef:
+      name = RecursiveGetName(child_die);
+      break;
+    case llvm::dwarf::DW_TAG_subprogram: {
+      const char *subprogram_name = GetSubprogramName(child_die);
+      if (!should_read_subprogram || subprogram_name == nullptr) {
+        continue;
+      }
+      name = subprogram_name;
+      subprogram_scopes.try_emplace(name, &scope);
+      // Heapalloc sites are looked up by frame, not through their subprogram.
+      for (llvm::DWARFDie site_die = child_die.getFirstChild(); site_die;
+           site_die = site_die.getSibling()) {
+        if (site_die.getTag() == llvm::dwarf::DW_TAG_GOOGLE_heapalloc) {
+          IndexHeapAllocSite(site_die);
+        }
+      }
+      break;
+    }
+    case llvm::dwarf::DW_TAG_GOOGLE_heapalloc:
+      IndexHeapAllocSite(child_die);
+      continue;
+    default:
+      // What is left, e.g. constants, has nothing nested to parse.
+      scope.VisitChildDIE(child_die, should_read_subprogram, context);
+      continue;
+    }
+    PendingScope &pending = scopes[&scope];
+    if (pending.type_data == nullptr) {
+      pending.type_data = &scope;
+      pending.namespace_ctxt = namespace_ctxt;
+    }
+    pending.dies[name].push_back(child_die);
+  }
+}
+
+DwarfMetadataFetcher::MetadataPack::MetadataPack()
+    : pointer_size(0), root_space(std::make_unique<TypeData>()) {}
+DwarfMetadataFetcher::MetadataPack::MetadataPack(MetadataPack &&other) =
+    default;
+DwarfMetadataFetcher::MetadataPack &
+DwarfMetadataFetcher::MetadataPack::operator=(MetadataPack &&other) = default;
+DwarfMetadataFetcher::MetadataPack::~MetadataPack() = default;
+
+absl::Status
+DwarfMetadataFetcher::MetadataPack::ParsePendingDIEs(const TypeData *scope,
+                                                     absl::string_view name) {
+  auto scope_it = lazy_index->scopes.find(scope);
+  if (scope_it == lazy_index->scopes.end()) {
+    return absl::OkStatus();
+  }
+  LazyIndex::PendingScope &pending = scope_it->second;
+  auto it = pending.dies.find(name);
+  if (it == pending.dies.end()) {
+    return absl::OkStatus();
+  }
+  static PerfPhase &parse_phase =
+      PerfStats::Global().Phase("ParsePendingDIEs");
+  ScopedPhase phase(parse_phase, /*trace=*/false);
+  const std::vector<llvm::DWARFDie> dies = std::move(it->second);
+  pending.dies.erase(it);
+  for (const llvm::DWARFDie &die : dies) {
+    pending.type_data->VisitChildDIE(
+        die, lazy_index->should_read_subprogram, lazy_index->context);
+  }
+  auto type_it = pending.type_data->types.find(name);
+  if (type_it != pending.type_data->types.end()) {
+    RETURN_IF_ERROR(PostProcessAndIndexTypeData(type_it->second.get(),
+                                                pending.namespace_ctxt));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DwarfMetadataFetcher::MetadataPack::ParsePendingSubprogram(
+    absl::string_view linkage_name) {
+  auto it = lazy_index->subprogram_scopes.find(linkage_name);
+  if (it == lazy_index->subprogram_scopes.end()) {
+    return absl::OkStatus();
+  }
+  const TypeData *scope = it->second;
+  lazy_index->subprogram_scopes.erase(it);
+  return ParsePendingDIEs(scope, linkage_name);
+}
+
+void DwarfMetadataFetcher::MetadataPack::ParsePendingHeapAllocSite(
+    const FrameView &frame) {
+  auto it = lazy_index->heapalloc_dies.find(frame);
+  if (it == lazy_index->heapalloc_dies.end()) {
+    return;
+  }
+  heapalloc_sites.insert({it->first, GetHeapAllocTypeName(it->second)});
+  lazy_index->heapalloc_dies.erase(it);
+}
+
 absl::Status
 DwarfMetadataFetcher::MetadataPack::TryUpdatePointerSize(int64_t new_size) {
   if (pointer_size == 0) {
@@ -326,7 +850,8 @@ DwarfMetadataFetcher::MetadataPack::TryUpdatePointerSize(int64_t new_size) {
 
 absl::Status DwarfMetadataFetcher::MetadataPack::ParseDWARF(
     absl::string_view bin_file_path, const std::string &dwp_file_path,
-    bool should_read_subprogram, uint32_t parse_thread_count_) {
+    bool should_read_subprogram, uint32_t parse_thread_count, bool lazy) {
+  ScopedPhase phase(lazy ? "IndexDWARF" : "ParseDWARF");
   LOG(INFO) << "parsing dwarf file: " << bin_file_path;
   auto object_owning_binary_or_err = llvm::object::ObjectFile::createObjectFile(
       llvm::StringRef(bin_file_path));
@@ -339,33 +864,32 @@ absl::Status DwarfMetadataFetcher::MetadataPack::ParseDWARF(
   llvm::object::OwningBinary<llvm::object::ObjectFile> object_binary(
       std::move(object_owning_binary_or_err.get()));
 
+  // The parser threads resolve cross unit references concurrently, which
+  // requires the context to guard its lazily built state.
   auto dwarf_info = llvm::DWARFContext::create(
       *object_binary.getBinary(),
       llvm::DWARFContext::ProcessDebugRelocations::Ignore, nullptr,
-      dwp_file_path);
-
-  auto VisitSibAndChildren = [this, should_read_subprogram](
-                                 const std::unique_ptr<llvm::DWARFUnit> &unit,
-                                 const ParseContext &context) -> absl::Status {
-    RETURN_IF_ERROR(this->TryUpdatePointerSize(unit->getAddressByteSize()));
-    llvm::DWARFDie sib_die = unit->getUnitDIE(false);
-    while (sib_die) {
-      llvm::DWARFDie child_die = sib_die.getFirstChild();
-      while (child_die) {
-        this->root_space->VisitChildDIE(child_die, should_read_subprogram,
-                                        context);
-        child_die = child_die.getSibling();
-      }
-      sib_die = sib_die.getSibling();
-    }
-    return absl::OkStatus();
-  };
+      dwp_file_path, llvm::WithColor::defaultErrorHandler,
+      llvm::WithColor::defaultWarningHandler,
+      /*ThreadSafe=*/parse_thread_count > 1);
 
   absl::Time start_time = absl::Now();
   ParseContext context;
+  // Units to parse, in the order a single thread would visit them.
+  std::vector<llvm::DWARFUnit *> units;
+  auto CollectUnits =
+      [this, &units](
+          llvm::DWARFContext::unit_iterator_range range) -> absl::Status {
+    for (const std::unique_ptr<llvm::DWARFUnit> &unit : range) {
+      RETURN_IF_ERROR(TryUpdatePointerSize(unit->getAddressByteSize()));
+      units.push_back(unit.get());
+    }
+    return absl::OkStatus();
+  };
 
+  std::shared_ptr<llvm::DWARFContext> dwp_dwarf_info;
   if (!dwp_file_path.empty()) {
-    auto dwp_dwarf_info = dwarf_info->getDWOContext(dwp_file_path.c_str());
+    dwp_dwarf_info = dwarf_info->getDWOContext(dwp_file_path.c_str());
     LOG(INFO) << "Looking for type units ...";
 
     for (const std::unique_ptr<llvm::DWARFUnit> &unit :
@@ -412,65 +936,40 @@ absl::Status DwarfMetadataFetcher::MetadataPack::ParseDWARF(
       }
     }
 
-    LOG(INFO) << "Start parsing dwp file ...";
-    for (const std::unique_ptr<llvm::DWARFUnit> &unit :
-         dwp_dwarf_info->dwo_types_section_units()) {
-      RETURN_IF_ERROR(VisitSibAndChildren(unit, context));
-    }
-    for (const std::unique_ptr<llvm::DWARFUnit> &unit :
-         dwp_dwarf_info->dwo_info_section_units()) {
-      RETURN_IF_ERROR(VisitSibAndChildren(unit, context));
-    }
+    RETURN_IF_ERROR(CollectUnits(dwp_dwarf_info->dwo_types_section_units()));
+    RETURN_IF_ERROR(CollectUnits(dwp_dwarf_info->dwo_info_section_units()));
   }
+  RETURN_IF_ERROR(CollectUnits(dwarf_info->types_section_units()));
+  RETURN_IF_ERROR(CollectUnits(dwarf_info->info_section_units()));
 
-  LOG(INFO) << "Start parsing binary file ...";
-  for (const std::unique_ptr<llvm::DWARFUnit> &unit :
-       dwarf_info->types_section_units()) {
-    RETURN_IF_ERROR(VisitSibAndChildren(unit, context));
-  }
-  for (const std::unique_ptr<llvm::DWARFUnit> &unit :
-       dwarf_info->info_section_units()) {
-    // unit->dump(llvm::outs(), llvm::DIDumpOptions());
-    RETURN_IF_ERROR(VisitSibAndChildren(unit, context));
+  if (lazy) {
+    LOG(INFO) << "Start indexing " << units.size() << " units ...";
+    auto index = std::make_unique<LazyIndex>();
+    index->context = std::move(context);
+    index->should_read_subprogram = should_read_subprogram;
+    for (llvm::DWARFUnit *unit : units) {
+      index->IndexScope(unit->getUnitDIE(/*ExtractUnitDIEOnly=*/false),
+                        *root_space, "");
+    }
+    index->object_binary = std::move(object_binary);
+    index->dwarf_info = std::move(dwarf_info);
+    index->dwp_dwarf_info = std::move(dwp_dwarf_info);
+    lazy_index = std::move(index);
+    LOG(INFO) << "Indexing took " << absl::Now() - start_time;
+    return absl::OkStatus();
   }
 
-  /* ======== Multithreaded version: Some issues for now ======== */
-
-  // for (const auto& [signature, type_name] : context.signature_to_type_name) {
-  //   llvm::errs() << "signature: " << signature << " type_name: " << type_name
-  //                << "\n";
-  //   absl::StatusOr<TypeData*> type_data = SearchType(type_name);
-  //   if (!type_data.ok()) {
-  //     llvm::errs() << "type_data not ok: " << type_data.status() << "\n";
-  //   }
-  // }
-
-  // for (const std::unique_ptr<llvm::DWARFUnit>& unit :
-  //      dwp_dwarf_info->dwo_compile_units()) {
-  //   dwp_dwarf_info->dump(llvm::outs(), llvm::DIDumpOptions());
-  //   // RETURN_IF_ERROR(VisitSibAndChildren(unit));
-  // }
-
-  // DwarfParserState state(std::move(dwarf_info), dwp_file_path);
-
-  // thread::Bundle parser_threads;
-
-  // for (uint32_t i = 0; i < parse_thread_count_; ++i) {
-  //   parser_threads.Add([&state, &VisitSibAndChildren]() -> void {
-  //     std::unique_ptr<llvm::DWARFUnit> unit = state.getNextDwarfUnit();
-  //     while (unit) {
-  //       auto status = VisitSibAndChildren(unit);
-  //       if (!status.ok()) {
-  //         LOG(ERROR) << "Failed to visit sib and children: " << status;
-  //       }
-  //       unit = state.getNextDwarfUnit();
-  //     }
-  //   });
-  // }
-  // parser_threads.JoinAll();
-
-  /* ======== End of Multithreaded version: Issues with muppet for now ========
-   */
+  LOG(INFO) << "Start parsing " << units.size() << " units on "
+            << parse_thread_count << " thread(s) ...";
+  if (parse_thread_count <= 1) {
+    for (llvm::DWARFUnit *unit : units) {
+      VisitSibAndChildren(*unit, should_read_subprogram, context,
+                          *root_space);
+    }
+  } else {
+    ParseUnitsConcurrently(units, parse_thread_count, should_read_subprogram,
+                           context, *root_space);
+  }
 
   absl::Time end_time = absl::Now();
   LOG(INFO) << "Parsing took " << end_time - start_time;
@@ -606,6 +1105,34 @@ void DwarfMetadataFetcher::TypeData::Debug(std::ostream &out, int level) const {
   }
 }
 
+// Returns true if 'fields' already has a field with the same name, type name
+// and offset as 'field'.
+static bool ContainsField(
+    const std::vector<std::unique_ptr<DwarfMetadataFetcher::FieldData>> &fields,
+    const DwarfMetadataFetcher::FieldData &field) {
+  for (const auto &f : fields) {
+    if (field.offset == f->offset && field.type_name == f->type_name &&
+        field.name == f->name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DwarfMetadataFetcher::TypeData::AddField(
+    std::unique_ptr<FieldData> field) {
+  // Make sure we haven't already inserted somewhere else. This can happen
+  // if we have multiple instances of the same type with different
+  // instantiations. Unwrapped names are compared, so that the fields of the
+  // same type merged from several parser threads are deduplicated the same
+  // way as when a single thread visits them.
+  if (field->offset < 0 || ContainsField(fields, *field)) {
+    return;
+  }
+  offset_idx[field->offset].insert(fields.size());
+  fields.push_back(std::move(field));
+}
+
 void DwarfMetadataFetcher::TypeData::VisitChildDIE(
     const llvm::DWARFDie &die, bool should_read_subprogram,
     const ParseContext &context) {
@@ -622,14 +1149,7 @@ void DwarfMetadataFetcher::TypeData::VisitChildDIE(
   case llvm::dwarf::DW_TAG_rvalue_reference_type:
   case llvm::dwarf::DW_TAG_enumeration_type:
   case llvm::dwarf::DW_TAG_union_type: {
-    std::string child_name;
-    std::optional<std::string> signature_type_name =
-        ResolveSignature(die, context);
-    if (signature_type_name) {
-      child_name = *signature_type_name;
-    } else {
-      child_name = RecursiveGetNameOrResolveAnon(die);
-    }
+    std::string child_name = GetChildTypeName(die, context);
     if (child_name.empty()) {
       LOG(ERROR) << "child_name is empty for die: \n";
       die.dump();
@@ -644,15 +1164,9 @@ void DwarfMetadataFetcher::TypeData::VisitChildDIE(
     if (!should_read_subprogram) {
       break;
     }
-    auto child_name = die.getLinkageName();
+    const char *child_name = GetSubprogramName(die);
     if (child_name == nullptr) {
-      // This is important if an allocation is made in 'main' for heapalloc
-      // dwarf. This is because main does not have a
-      // linkage name.
-      child_name = die.getShortName();
-      if (child_name == nullptr) {
-        break;
-      }
+      break;
     }
     if (!types.contains(child_name)) {
       types[child_name] = std::make_unique<TypeData>();
@@ -661,25 +1175,10 @@ void DwarfMetadataFetcher::TypeData::VisitChildDIE(
     break;
   }
   case llvm::dwarf::DW_TAG_GOOGLE_heapalloc: {
-    llvm::DWARFDie type_die =
-        die.getAttributeValueAsReferencedDie(llvm::dwarf::DW_AT_type);
-
-    type_die = RecursiveGetTypedefDIE(type_die);
     if (!die.isValid()) {
       break;
     }
-    std::string type_name = GetTypeQualifiedName(type_die);
-    uint64_t line_offset = die.getDeclLine();
-    uint64_t col_number =
-        llvm::dwarf::toUnsigned(die.find(llvm::dwarf::DW_AT_decl_column), 0);
-    std::string func_name;
-    if (die.find(llvm::dwarf::DW_AT_name)) {
-      func_name = die.getShortName();
-    } else {
-      func_name = "";
-    }
-    heapalloc_sites.insert(
-        {Frame(func_name, line_offset, col_number), type_name});
+    heapalloc_sites.insert({GetHeapAllocFrame(die), GetHeapAllocTypeName(die)});
     break;
   }
   case llvm::dwarf::DW_TAG_typedef: {
@@ -698,36 +1197,11 @@ void DwarfMetadataFetcher::TypeData::VisitChildDIE(
   case llvm::dwarf::DW_TAG_inheritance: {
     auto field = std::make_unique<FieldData>();
     field->ParseDIE(die, context);
-    // Make sure we haven't already inserted somewhere else. This can happen
-    // if we have multiple instances of the same type with different
-    // instantiations.
-    bool skip_field = false;
-    for (const auto &f : fields) {
-      if (field->offset == f->offset && field->type_name == f->type_name &&
-          field->name == f->name) {
-        skip_field = true;
-      }
-    }
-    if (skip_field) {
-      break;
-    }
     auto opt = UnwrapParameterizedStorage(field->type_name);
     if (opt) {
       field->type_name = opt.value();
     }
-    if (field->offset >= 0) {
-      auto it = offset_idx.find(field->offset);
-      if (it == offset_idx.end()) {
-        absl::flat_hash_set<size_t> indices;
-        indices.insert(fields.size());
-        offset_idx[field->offset] = indices;
-      } else {
-        absl::flat_hash_set<size_t> *indices = &it->second;
-
-        indices->insert(fields.size());
-      }
-      fields.push_back(std::move(field));
-    }
+    AddField(std::move(field));
     break;
   }
   // For now we treat both template and formal parameters the same. In
@@ -771,6 +1245,56 @@ void DwarfMetadataFetcher::TypeData::VisitChildDIE(
   }
 }
 
+void DwarfMetadataFetcher::TypeData::MergeFrom(TypeData &other) {
+  // Follow what ParseDIE and VisitChildDIE do when they visit a type again:
+  // the latest kind, size and linkage name win, fields and formal parameters
+  // are deduplicated, typedefs are overwritten, and heapalloc sites and
+  // constants keep the value seen first.
+  if (!other.name.empty()) {
+    name = std::move(other.name);
+  }
+  data_type = other.data_type;
+  if (other.size != -1) {
+    size = other.size;
+  }
+  for (auto &field : other.fields) {
+    AddField(std::move(field));
+  }
+  for (auto &[typedef_name, canonical_name] : other.typedef_type) {
+    typedef_type.insert_or_assign(typedef_name, std::move(canonical_name));
+  }
+  for (auto &[type_name, type] : other.types) {
+    auto [it, inserted] = types.try_emplace(type_name, nullptr);
+    if (inserted) {
+      it->second = std::move(type);
+    } else {
+      it->second->MergeFrom(*type);
+    }
+  }
+  for (auto &param : other.formal_parameters) {
+    if (std::find(formal_parameters.begin(), formal_parameters.end(), param) ==
+        formal_parameters.end()) {
+      formal_parameters.push_back(std::move(param));
+    }
+  }
+  heapalloc_sites.merge(other.heapalloc_sites);
+  constant_variables.merge(other.constant_variables);
+}
+
+uint64_t DwarfMetadataFetcher::TypeData::Fingerprint() const {
+  // Names hold no NUL, so separating them with one keeps the encoding
+  // unambiguous. absl::Hash is seeded per process, hence xxh3.
+  constexpr absl::string_view kSeparator("\0", 1);
+  std::string layout = absl::StrCat(name, kSeparator, size, kSeparator,
+                                    static_cast<int>(data_type));
+  for (const auto &field : fields) {
+    absl::StrAppend(&layout, kSeparator, field->name, kSeparator,
+                    field->offset, kSeparator, field->type_name, kSeparator,
+                    field->inherited);
+  }
+  return llvm::xxh3_64bits(llvm::StringRef(layout.data(), layout.size()));
+}
+
 void DwarfMetadataFetcher::TypeData::ParseDIE(const llvm::DWARFDie &die,
                                               bool should_read_subprogram,
                                               const ParseContext &context) {
@@ -920,12 +1444,18 @@ DwarfMetadataFetcher::SearchType(
         "type not found, stuck in anonymous namespace: ", MergeNames(names)));
   }
 
+  // Only the namespaces of a lazily parsed pack are there from the start.
+  if (pack_.lazy_index != nullptr) {
+    RETURN_IF_ERROR(pack_.ParsePendingDIEs(parent_type, cur_name));
+    RETURN_IF_ERROR(pack_.ParsePendingDIEs(parent_type, ""));
+  }
+
   // If we find a typedef, we need to start over searching from the root type
   // space. This is because the type referred to by a typedef can be in a
   // completely different namespace hierarchy.
   if (parent_type->typedef_type.contains(cur_name)) {
     cur_name = parent_type->typedef_type.at(cur_name);
-    return GetType(cur_name);
+    return FindType(cur_name);
   }
 
   // If it is the last item, i.e. the short type_name without namespaces,
@@ -960,6 +1490,12 @@ DwarfMetadataFetcher::SearchType(
 
 absl::StatusOr<const DwarfMetadataFetcher::TypeData *>
 DwarfMetadataFetcher::GetType(absl::string_view type_name) const {
+  absl::MutexLockMaybe lock(pack_.lazy_index != nullptr ? &lazy_mu_ : nullptr);
+  return FindType(type_name);
+}
+
+absl::StatusOr<const DwarfMetadataFetcher::TypeData *>
+DwarfMetadataFetcher::FindType(absl::string_view type_name) const {
   if (type_name.empty()) {
     return absl::InvalidArgumentError("type_name cannot be empty.");
   }
@@ -976,21 +1512,32 @@ DwarfMetadataFetcher::GetType(absl::string_view type_name) const {
 
 absl::StatusOr<const DwarfMetadataFetcher::TypeData *>
 DwarfMetadataFetcher::GetCacheableType(absl::string_view type_name) {
-  if (cache_.contains(type_name)) {
-    return cache_.at(type_name);
-  } else {
-    auto type_data_or_err = GetType(type_name);
-    if (!type_data_or_err.ok()) {
-      return type_data_or_err.status();
-    }
-    const TypeData *type_data = type_data_or_err.value();
-    cache_.insert({std::string(type_name), type_data});
-    return type_data;
+  static PerfCounter &hits =
+      PerfStats::Global().Counter("GetCacheableType_hits");
+  static PerfCounter &misses =
+      PerfStats::Global().Counter("GetCacheableType_misses");
+  absl::MutexLock lock(&cache_mu_);
+  auto it = cache_.find(type_name);
+  if (it != cache_.end()) {
+    hits.Add();
+    return it->second;
+  }
+  misses.Add();
+  auto type_data_or_err = GetType(type_name);
+  if (!type_data_or_err.ok()) {
+    return type_data_or_err.status();
   }
+  const TypeData *type_data = type_data_or_err.value();
+  cache_.insert({std::string(type_name), type_data});
+  return type_data;
 }
 
 absl::StatusOr<std::string>
-DwarfMetadataFetcher::GetHeapAllocType(const Frame &frame) const {
+DwarfMetadataFetcher::GetHeapAllocType(const FrameView &frame) const {
+  absl::MutexLockMaybe lock(pack_.lazy_index != nullptr ? &lazy_mu_ : nullptr);
+  if (pack_.lazy_index != nullptr) {
+    pack_.ParsePendingHeapAllocSite(frame);
+  }
   auto it = pack_.heapalloc_sites.find(frame);
   if (it == pack_.heapalloc_sites.end()) {
     return absl::NotFoundError(absl::StrCat(
@@ -1003,6 +1550,17 @@ DwarfMetadataFetcher::GetHeapAllocType(const Frame &frame) const {
 absl::StatusOr<std::vector<std::string>>
 DwarfMetadataFetcher::GetFormalParameters(
     absl::string_view linkage_name) const {
+  absl::MutexLockMaybe lock(pack_.lazy_index != nullptr ? &lazy_mu_ : nullptr);
+  if (pack_.lazy_index != nullptr &&
+      !pack_.formal_and_template_param_map.contains(linkage_name)) {
+    // Types are indexed by their full name, with a leading "::", when they
+    // are parsed.
+    if (absl::StartsWith(linkage_name, "::")) {
+      FindType(linkage_name.substr(2)).IgnoreError();
+    } else {
+      RETURN_IF_ERROR(pack_.ParsePendingSubprogram(linkage_name));
+    }
+  }
   if (!pack_.formal_and_template_param_map.contains(linkage_name)) {
     return absl::NotFoundError(
         absl::StrCat("No Subprogram data for ", linkage_name));
@@ -1011,64 +1569,22 @@ DwarfMetadataFetcher::GetFormalParameters(
   }
 }
 
-std::unique_ptr<llvm::DWARFUnit>
-DwarfMetadataFetcher::DwarfParserState::getNextDwarfUnit() {
-  m_.Lock();
-  switch (curr_state_) {
-  case State::kTypesSectionUnits:
-    if (curr_it_ == dwarf_info_->types_section_units().begin()) {
-      LOG(INFO) << "starting parsing binary file" << "\n";
-    }
-    if (curr_it_ == dwarf_info_->types_section_units().end()) {
-      curr_it_ = dwarf_info_->info_section_units().begin();
-      curr_state_ = State::kInfoSectionUnits;
-      m_.Unlock();
-      return getNextDwarfUnit();
-    }
-    break;
-  case State::kInfoSectionUnits:
-    if (curr_it_ == dwarf_info_->info_section_units().end()) {
-      if (dwp_dwarf_info_ != nullptr) {
-        curr_it_ = dwp_dwarf_info_->dwo_types_section_units().begin();
-        curr_state_ = State::kDwpTypesSectionUnits;
-        LOG(INFO) << "starting parsing dwp file" << "\n";
-        m_.Unlock();
-        return getNextDwarfUnit();
-      } else {
-        m_.Unlock();
-        return nullptr;
-      }
-    }
-    break;
-  case State::kDwpTypesSectionUnits:
-    if (curr_it_ == dwp_dwarf_info_->dwo_types_section_units().end()) {
-      curr_it_ = dwp_dwarf_info_->dwo_info_section_units().begin();
-      curr_state_ = State::kDwpInfoSectionUnits;
-      m_.Unlock();
-      return getNextDwarfUnit();
-    }
-    break;
-  case State::kDwpInfoSectionUnits:
-    if (curr_it_ == dwp_dwarf_info_->dwo_info_section_units().end()) {
-      m_.Unlock();
-      return nullptr;
-    }
-    break;
-  }
-  std::unique_ptr<llvm::DWARFUnit> next = std::move(*curr_it_);
-  curr_it_++;
-
-  next->dump(llvm::outs(), llvm::DIDumpOptions::getForSingleDIE());
-  llvm::outs() << "\n";
-  m_.Unlock();
-  return next;
-}
-
 bool DwarfMetadataFetcher::MetadataPack::Empty() const {
-  return root_space->types.empty() && root_space->typedef_type.empty();
+  return root_space->types.empty() && root_space->typedef_type.empty() &&
+         lazy_index == nullptr;
 }
 
 absl::Status DwarfMetadataFetcher::MetadataPack::Insert(MetadataPack &other) {
+  if (other.lazy_index != nullptr) {
+    // The pending DIEs of 'other' go to its own namespaces, which may clash
+    // with those already here. Never the case, as FetchWithPath and
+    // FetchDWPWithPath reject lazy fetches of several binaries.
+    if (!Empty()) {
+      return absl::InternalError("Cannot merge a lazily parsed pack");
+    }
+    *this = std::move(other);
+    return absl::OkStatus();
+  }
   if (other.Empty()) {
     return absl::OkStatus();
   }
@@ -1090,6 +1606,233 @@ absl::Status DwarfMetadataFetcher::MetadataPack::Insert(MetadataPack &other) {
   return absl::OkStatus();
 }
 
+absl::Status
+DwarfMetadataFetcher::MetadataPack::InsertAll(std::vector<MetadataPack> &others,
+                                              uint32_t thread_count) {
+  // Each round inserts the pack at 'i + stride' into the one at 'i', for every
+  // 'i' multiple of twice the stride, so packs[0] ends up with the content of
+  // all the packs, inserted in order.
+  std::vector<absl::Status> statuses(others.size());
+  for (size_t stride = 1; thread_count > 1 && stride < others.size();
+       stride *= 2) {
+    std::vector<size_t> targets;
+    for (size_t i = 0; i + stride < others.size(); i += 2 * stride) {
+      targets.push_back(i);
+    }
+    ParallelFor(targets.size(), thread_count, [&](size_t t) {
+      const size_t i = targets[t];
+      if (statuses[i].ok()) {
+        statuses[i] = others[i].Insert(others[i + stride]);
+      }
+      if (statuses[i].ok()) {
+        statuses[i] = statuses[i + stride];
+      }
+    });
+  }
+  if (thread_count > 1 && !others.empty()) {
+    RETURN_IF_ERROR(statuses[0]);
+    return Insert(others[0]);
+  }
+  for (MetadataPack &other : others) {
+    RETURN_IF_ERROR(Insert(other));
+  }
+  return absl::OkStatus();
+}
+
+static void FrameToProto(const DwarfMetadataFetcher::Frame &frame,
+                         const std::string &type_name,
+                         DwarfMetadataCacheRecord::HeapAllocSite *site) {
+  site->set_function_name(frame.function_name);
+  site->set_line_offset(frame.line_offset);
+  site->set_column(frame.column);
+  site->set_type_name(type_name);
+}
+
+static DwarfMetadataFetcher::Frame
+FrameFromProto(const DwarfMetadataCacheRecord::HeapAllocSite &site) {
+  return DwarfMetadataFetcher::Frame(site.function_name(), site.line_offset(),
+                                     site.column());
+}
+
+// Write 'type' and, in pre-order, all of its nested types. 'next_index' is
+// the index the next written type gets.
+static absl::Status
+SerializeType(const DwarfMetadataFetcher::TypeData &type, uint64_t parent,
+              absl::string_view key, uint64_t &next_index,
+              google::protobuf::io::ZeroCopyOutputStream *output) {
+  DwarfMetadataCacheRecord record;
+  DwarfMetadataCacheRecord::Type *cached = record.mutable_type();
+  cached->set_parent(parent);
+  cached->set_key(key);
+  cached->set_name(type.name);
+  cached->set_size(type.size);
+  cached->set_data_type(static_cast<int32_t>(type.data_type));
+  for (const auto &field : type.fields) {
+    DwarfMetadataCacheRecord::Field *cached_field = cached->add_fields();
+    cached_field->set_name(field->name);
+    cached_field->set_offset(field->offset);
+    cached_field->set_type_name(field->type_name);
+    cached_field->set_inherited(field->inherited);
+  }
+  cached->mutable_typedef_type()->insert(type.typedef_type.begin(),
+                                         type.typedef_type.end());
+  for (const auto &param : type.formal_parameters) {
+    cached->add_formal_parameters(param);
+  }
+  for (const auto &[frame, type_name] : type.heapalloc_sites) {
+    FrameToProto(frame, type_name, cached->add_heapalloc_sites());
+  }
+  cached->mutable_constant_variables()->insert(
+      type.constant_variables.begin(), type.constant_variables.end());
+  if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(record,
+                                                                  output)) {
+    return absl::InternalError("Failed to serialize type record");
+  }
+
+  const uint64_t index = next_index++;
+  for (const auto &[child_key, child] : type.types) {
+    RETURN_IF_ERROR(
+        SerializeType(*child, index, child_key, next_index, output));
+  }
+  return absl::OkStatus();
+}
+
+static void TypeFromProto(const DwarfMetadataCacheRecord::Type &cached,
+                          DwarfMetadataFetcher::TypeData *type) {
+  type->name = cached.name();
+  type->size = cached.size();
+  type->data_type =
+      static_cast<DwarfMetadataFetcher::DataType>(cached.data_type());
+  for (const auto &cached_field : cached.fields()) {
+    auto field = std::make_unique<DwarfMetadataFetcher::FieldData>(
+        cached_field.name(), cached_field.offset(), cached_field.type_name());
+    field->inherited = cached_field.inherited();
+    type->offset_idx[field->offset].insert(type->fields.size());
+    type->fields.push_back(std::move(field));
+  }
+  type->typedef_type.insert(cached.typedef_type().begin(),
+                            cached.typedef_type().end());
+  type->formal_parameters.assign(cached.formal_parameters().begin(),
+                                 cached.formal_parameters().end());
+  for (const auto &site : cached.heapalloc_sites()) {
+    type->heapalloc_sites.insert({FrameFromProto(site), site.type_name()});
+  }
+  type->constant_variables.insert(cached.constant_variables().begin(),
+                                  cached.constant_variables().end());
+}
+
+absl::Status DwarfMetadataFetcher::MetadataPack::Serialize(
+    std::ostream &out, absl::string_view build_id,
+    bool has_subprograms) const {
+  google::protobuf::io::OstreamOutputStream output(&out);
+  DwarfMetadataCacheHeader header;
+  header.set_version(kCacheVersion);
+  header.set_build_id(build_id);
+  header.set_pointer_size(pointer_size);
+  header.set_has_subprograms(has_subprograms);
+  if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(header,
+                                                                  &output)) {
+    return absl::InternalError("Failed to serialize cache header");
+  }
+
+  uint64_t next_index = 0;
+  RETURN_IF_ERROR(SerializeType(*root_space, /*parent=*/0, /*key=*/"",
+                                next_index, &output));
+
+  DwarfMetadataCacheRecord record;
+  for (const auto &[frame, type_name] : heapalloc_sites) {
+    FrameToProto(frame, type_name, record.mutable_heapalloc_site());
+    if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(record,
+                                                                    &output)) {
+      return absl::InternalError("Failed to serialize heapalloc site record");
+    }
+  }
+  for (const auto &[name, params] : formal_and_template_param_map) {
+    DwarfMetadataCacheRecord::FormalParameters *cached_params =
+        record.mutable_formal_parameters();
+    cached_params->set_name(name);
+    cached_params->mutable_parameters()->Assign(params.begin(), params.end());
+    if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(record,
+                                                                    &output)) {
+      return absl::InternalError(
+          "Failed to serialize formal parameters record");
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DwarfMetadataFetcher::MetadataPack::Deserialize(
+    std::istream &in, absl::string_view build_id, bool need_subprograms) {
+  google::protobuf::io::IstreamInputStream input(&in);
+  bool clean_eof = false;
+  DwarfMetadataCacheHeader header;
+  if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+          &header, &input, &clean_eof)) {
+    return absl::DataLossError("Failed to parse cache header");
+  }
+  if (header.version() != kCacheVersion) {
+    return absl::NotFoundError(
+        absl::StrCat("Cache version ", header.version(), " is not ",
+                     kCacheVersion));
+  }
+  if (header.build_id() != build_id) {
+    return absl::NotFoundError(absl::StrCat("Cache is for build_id ",
+                                            header.build_id(), " instead of ",
+                                            build_id));
+  }
+  if (need_subprograms && !header.has_subprograms()) {
+    return absl::NotFoundError("Cache does not contain subprograms");
+  }
+  pointer_size = header.pointer_size();
+
+  // Types in the order they were written, to look up parents by index.
+  std::vector<TypeData *> types;
+  // Start every record from an empty message.
+  for (DwarfMetadataCacheRecord record;
+       google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+           &record, &input, &clean_eof);
+       record.Clear()) {
+    switch (record.record_case()) {
+    case DwarfMetadataCacheRecord::kType: {
+      const DwarfMetadataCacheRecord::Type &cached = record.type();
+      TypeData *type = root_space.get();
+      if (!types.empty()) {
+        if (cached.parent() >= types.size()) {
+          return absl::DataLossError(absl::StrCat(
+              "Invalid parent index ", cached.parent(), " in cache"));
+        }
+        auto child = std::make_unique<TypeData>();
+        type = child.get();
+        types[cached.parent()]->types[cached.key()] = std::move(child);
+      }
+      TypeFromProto(cached, type);
+      types.push_back(type);
+      break;
+    }
+    case DwarfMetadataCacheRecord::kHeapallocSite:
+      heapalloc_sites.insert({FrameFromProto(record.heapalloc_site()),
+                              record.heapalloc_site().type_name()});
+      break;
+    case DwarfMetadataCacheRecord::kFormalParameters:
+      formal_and_template_param_map.insert(
+          {record.formal_parameters().name(),
+           std::vector<std::string>(
+               record.formal_parameters().parameters().begin(),
+               record.formal_parameters().parameters().end())});
+      break;
+    default:
+      return absl::DataLossError("Unknown record in cache");
+    }
+  }
+  if (!clean_eof) {
+    return absl::DataLossError("Cache file is truncated or corrupted");
+  }
+  if (types.empty()) {
+    return absl::DataLossError("Cache file has no root type space");
+  }
+  return absl::OkStatus();
+}
+
 std::ostream &operator<<(std::ostream &out,
                          const DwarfMetadataFetcher::Frame &frame) {
   out << frame.function_name << ": " << frame.line_offset << ": "
@@ -21,6 +21,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <istream>
 #include <map>
 #include <memory>
 #include <optional>
@@ -29,9 +30,11 @@
 #include <utility>
 #include <vector>
 
-#include "absl/base/const_init.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/functional/function_ref.h"
+#include "absl/hash/hash.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
@@ -48,35 +51,6 @@
 // It reads from either cache directory or Symbol Server to parse the
 // DWARF file, and construct local index for later queries.
 class DwarfMetadataFetcher {
- private:
-  class DwarfParserState {
-   public:
-    explicit DwarfParserState(std::unique_ptr<llvm::DWARFContext> dwarf_info,
-                              const std::string &dwp_file_path)
-        : dwp_dwarf_info_(dwp_file_path.empty() ? nullptr
-                                                : dwarf_info->getDWOContext(
-                                                      dwp_file_path.c_str())),
-          dwarf_info_(std::move(dwarf_info)),
-          curr_state_(State::kTypesSectionUnits),
-          curr_it_(dwarf_info_->types_section_units().begin()),
-          m_(absl::kConstInit) {}
-
-    std::unique_ptr<llvm::DWARFUnit> getNextDwarfUnit();
-
-   private:
-    enum class State {
-      kTypesSectionUnits,
-      kInfoSectionUnits,
-      kDwpTypesSectionUnits,
-      kDwpInfoSectionUnits
-    };
-    std::shared_ptr<llvm::DWARFContext> dwp_dwarf_info_;
-    std::unique_ptr<llvm::DWARFContext> dwarf_info_;
-    DwarfParserState::State curr_state_;
-    llvm::DWARFUnitVector::iterator curr_it_;
-    absl::Mutex m_;
-  };
-
  public:
   struct ParseContext {
     absl::flat_hash_map<uint64_t, std::string> signature_to_type_name;
@@ -162,7 +136,7 @@ class DwarfMetadataFetcher {
     std::string name;
     int64_t offset;
     std::string type_name;
-    bool inherited;
+    bool inherited = false;
 
     // Parse field content from a given DIE
     void ParseDIE(const llvm::DWARFDie &die, const ParseContext &context);
@@ -196,6 +170,60 @@ class DwarfMetadataFetcher {
     }
   };
 
+  // Same as Frame, but borrows the function name, e.g. from the symbolized
+  // frames of a memprof profile, so that it is cheap to create. Hashes the
+  // same as the Frame it views, so it can look up maps keyed by Frame.
+  struct FrameView {
+    absl::string_view function_name;
+    uint64_t line_offset;
+    uint64_t column;
+
+    FrameView(absl::string_view function_name, uint64_t line_offset,
+              uint64_t column)
+        : function_name(function_name),
+          line_offset(line_offset),
+          column(column) {}
+
+    // Implicit, so that call sites holding a Frame can pass it as is.
+    FrameView(const Frame &frame)  // NOLINT(google-explicit-constructor)
+        : FrameView(frame.function_name, frame.line_offset, frame.column) {}
+
+    Frame ToFrame() const {
+      return Frame(std::string(function_name), line_offset, column);
+    }
+
+    bool operator==(const FrameView &other) const {
+      return function_name == other.function_name &&
+             line_offset == other.line_offset && column == other.column;
+    }
+
+    bool operator!=(const FrameView &other) const { return !(*this == other); }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const FrameView &f) {
+      return H::combine(std::move(h), f.function_name, f.line_offset, f.column);
+    }
+  };
+
+  // Hash and equality of Frame that also accept a FrameView.
+  struct FrameHash {
+    using is_transparent = void;
+    size_t operator()(const FrameView &frame) const {
+      return absl::HashOf(frame);
+    }
+  };
+  struct FrameEq {
+    using is_transparent = void;
+    bool operator()(const FrameView &a, const FrameView &b) const {
+      return a == b;
+    }
+  };
+
+  // Map between frame and the type name of the heap allocation made at that
+  // source location.
+  using HeapAllocSiteMap =
+      absl::flat_hash_map<Frame, std::string, FrameHash, FrameEq>;
+
   // Contains metadata for fields and inside types of a type/namespace.
   struct TypeData {
     TypeData() : size(-1), data_type(DataType::UNKNOWN) {}
@@ -222,7 +250,7 @@ class DwarfMetadataFetcher {
     std::vector<std::string> formal_parameters;
     // Map between frame and the type name of the heap allocation made at that
     // source location.
-    absl::flat_hash_map<Frame, std::string> heapalloc_sites;
+    HeapAllocSiteMap heapalloc_sites;
     // Map containing constant variables of a class.
     absl::flat_hash_map<std::string, uint64_t> constant_variables;
 
@@ -234,12 +262,28 @@ class DwarfMetadataFetcher {
       return data_type == DataType::STRUCTURE || data_type == DataType::CLASS;
     }
 
-    virtual void AddType(std::string type_name,
-                         std::unique_ptr<TypeData> type) {
+    void AddType(std::string type_name, std::unique_ptr<TypeData> type) {
       type->name = type_name;
       types[type_name] = std::move(type);
     }
 
+    // Appends 'field', whose type name is already unwrapped, see
+    // UnwrapParameterizedStorage, unless the type has a field with the same
+    // name, type name and offset. Fields without an offset are dropped.
+    void AddField(std::unique_ptr<FieldData> field);
+
+    // Merge the content of 'other' into this type, as if the DIEs that
+    // produced 'other' had been visited after the ones that produced this
+    // type. Used to combine the subtrees built by the parser threads. 'other'
+    // is left in a valid but unspecified state.
+    void MergeFrom(TypeData &other);
+
+    // Fingerprint of the layout of this type: its name, size, data type and
+    // fields, in order. The types it nests and those of its fields are not
+    // part of it. Stable across runs, so that the types of two builds of a
+    // binary can be compared.
+    uint64_t Fingerprint() const;
+
     // Visit child die, recursive parse if needed.
     void VisitChildDIE(const llvm::DWARFDie &child_die,
                        bool should_read_subprogram,
@@ -252,20 +296,6 @@ class DwarfMetadataFetcher {
     void Debug(std::ostream &out, int level) const;
   };
 
-  // A hacky way to get a quick thread safe root type data. We should only ever
-  // have a race condition on the types map in the root space.
-  struct RootTypeData : TypeData {
-    void AddType(std::string type_name,
-                 std::unique_ptr<TypeData> type) override {
-      m.Lock();
-      TypeData::AddType(type_name, std::move(type));
-      m.Unlock();
-    };
-
-   private:
-    absl::Mutex m = absl::Mutex(absl::kConstInit);
-  };
-
   struct BinaryInfo {
     std::string build_id;
     std::string path;
@@ -291,21 +321,32 @@ class DwarfMetadataFetcher {
       absl::string_view::const_iterator start,
       absl::string_view::const_iterator end);
 
+  // With lazy_parse, the DWARF is only scanned for the names of the top level
+  // DIEs of each namespace when fetched, and a DIE is parsed the first time a
+  // lookup reaches its name. Lookups then serialize on a mutex. A cache file,
+  // when there is one, is still read as a whole, and lazily parsed packs are
+  // never written to the cache. A lazy fetch of several binaries fails with
+  // InvalidArgumentError before any of them is retrieved.
   DwarfMetadataFetcher(std::unique_ptr<BinaryFileRetriever> file_retriever,
                        std::string cache_dir, bool read_subprograms = false,
                        bool write_to_cache = true,
-                       uint32_t parse_thread_count = 1);
+                       uint32_t parse_thread_count = 1,
+                       bool lazy_parse = false);
   virtual ~DwarfMetadataFetcher() = default;
 
   // Deserialize from cache directory or send out RPCs to fetch the debugging
   // info, and then construct local index so that later queries can be
-  // served immediately.
+  // served immediately. The cache is keyed by build id. With
+  // force_update_cache, or when a build id has no usable cache file yet, the
+  // DWARF is parsed instead, and the result is written to the cache directory
+  // if write_to_cache was set.
   virtual absl::Status Fetch(const absl::flat_hash_set<std::string> &build_ids,
                              bool force_update_cache);
 
   // Same as above, but uses both path and build id to fetch Dwarf data. This
   // allows the DwarfMetadataFetcher to be used with binaries that are not
-  // stored in the symbol server.
+  // stored in the symbol server. The files of all the binaries to parse are
+  // retrieved concurrently, while the binaries are parsed one after the other.
   virtual absl::Status FetchWithPath(
       const absl::flat_hash_set<BinaryInfo> &build_ids_and_paths,
       bool force_update_cache);
@@ -323,7 +364,8 @@ class DwarfMetadataFetcher {
   virtual absl::StatusOr<const TypeData *> GetType(absl::string_view) const;
 
   // Same as above, but caches the type data. This is useful for cases where
-  // the type data is needed multiple times.
+  // the type data is needed multiple times. Safe to call from multiple
+  // threads.
   virtual absl::StatusOr<const TypeData *> GetCacheableType(
       absl::string_view type_name);
 
@@ -337,15 +379,16 @@ class DwarfMetadataFetcher {
   // other words, a frame. Intended for use cases where the CallStack of
   // an allocation is known, but the type is unknown.
   virtual absl::StatusOr<std::string> GetHeapAllocType(
-      const Frame &frame) const;
+      const FrameView &frame) const;
 
   virtual absl::StatusOr<std::vector<std::string>> GetFormalParameters(
       absl::string_view linkage_name) const;
 
   // Return pointer size.
-  int64_t GetPointerSize() { return pack_.pointer_size; }
+  int64_t GetPointerSize() const { return pack_.pointer_size; }
 
-  // Dump type metadata info in C++ format to the given ostream.
+  // Dump type metadata info in C++ format to the given ostream. With
+  // lazy_parse, only the types looked up so far are dumped.
   void Dump(std::ostream &out) const;
 
   // Split the namespace(s) (or type/function name(s)) from a full name.
@@ -354,15 +397,38 @@ class DwarfMetadataFetcher {
       absl::string_view type_name);
 
  private:
+  // The DWARF of a lazily parsed pack, and the DIEs not parsed yet.
+  struct LazyIndex;
+
   struct MetadataPack {
-    MetadataPack()
-        : pointer_size(0), root_space(std::make_unique<RootTypeData>()) {}
+    MetadataPack();
+    MetadataPack(MetadataPack &&other);
+    MetadataPack &operator=(MetadataPack &&other);
+    ~MetadataPack();
 
     // Read relevant debugging info from given file to construct local index.
+    // With parse_thread_count > 1 the DWARF units are parsed concurrently into
+    // thread-local subtrees, which are then merged in unit order, so the
+    // result does not depend on the number of threads. With lazy, only the
+    // namespaces are added to root_space, the other top level DIEs of each
+    // namespace are indexed by name in lazy_index.
     absl::Status ParseDWARF(absl::string_view bin_file_path,
                             const std::string &dwp_file_path,
                             bool should_read_subprogram,
-                            uint32_t parse_thread_count);
+                            uint32_t parse_thread_count, bool lazy);
+
+    // Parse and post-process the DIEs of lazy_index named 'name' in the
+    // namespace 'scope', if not done yet.
+    absl::Status ParsePendingDIEs(const TypeData *scope,
+                                  absl::string_view name);
+
+    // Parse the subprogram of lazy_index with the given linkage name, if not
+    // done yet.
+    absl::Status ParsePendingSubprogram(absl::string_view linkage_name);
+
+    // Resolve the type of the heapalloc site of lazy_index at 'frame' into
+    // heapalloc_sites, if not done yet.
+    void ParsePendingHeapAllocSite(const FrameView &frame);
 
     // Update 'pointer_size_' if not updated before. Return error if the
     // new_size is not consistent with the previous size.
@@ -371,51 +437,107 @@ class DwarfMetadataFetcher {
     // Read and insert the content from another MetadataPack.
     absl::Status Insert(MetadataPack &other);
 
+    // Same as inserting each of 'others' in order. With thread_count > 1,
+    // neighbouring packs are inserted into each other concurrently, halving
+    // their number every round, which gives the same result since the content
+    // of an earlier pack always wins over that of a later one.
+    absl::Status InsertAll(std::vector<MetadataPack> &others,
+                           uint32_t thread_count);
+
     // Check if this pack is empty or not.
     bool Empty() const;
 
+    // Write this pack in the DwarfMetadataCache format, see
+    // dwarf_metadata_cache.proto.
+    absl::Status Serialize(std::ostream &out, absl::string_view build_id,
+                           bool has_subprograms) const;
+
+    // Read a pack written by Serialize into this, empty, pack. Returns
+    // NotFoundError if the content is from an other build id, version, or
+    // lacks subprograms when 'need_subprograms' is set.
+    absl::Status Deserialize(std::istream &in, absl::string_view build_id,
+                             bool need_subprograms);
+
     // Byte size of the pointer/address of the given debugging info file.
     int64_t pointer_size;
 
     // Root to store all metadata.
-    std::unique_ptr<RootTypeData> root_space;
+    std::unique_ptr<TypeData> root_space;
 
     // Map between between identifiers and their respective Formal
     // Parameters.
     absl::flat_hash_map<std::string, std::vector<std::string>>
         formal_and_template_param_map;
 
-    // Map between frame and the type name of the heap allocation made at that
-    // source location.
-    absl::flat_hash_map<Frame, std::string> heapalloc_sites;
+    // See HeapAllocSiteMap.
+    HeapAllocSiteMap heapalloc_sites;
+
+    // Set when the pack was parsed lazily.
+    std::unique_ptr<LazyIndex> lazy_index;
 
     // Go through all Subprograms to index them for fast lookup, populating
     // subprogram_data map. Also adds sizes to TypeData with DataType
-    // pointer_like.
+    // pointer_like. With thread_count > 1 the children of type_data are
+    // indexed concurrently into separate maps, which are merged in the order
+    // the children would have been visited on a single thread.
     absl::Status PostProcessAndIndexTypeData(TypeData *type_data,
-                                             std::string namespace_ctxt);
+                                             std::string namespace_ctxt,
+                                             uint32_t thread_count = 1);
   };
 
   // This function walks recursively through the TypeData tree to find the
   // TypeData that matches the list of names split by namespace from the full
   // unqualified type name. If there is no match, it continues looking in the
   // anonymous namespace. If there is a typedef, we restart the search since the
-  // namespace context is reset.
+  // namespace context is reset. With lazy_parse, the DIEs met on the way are
+  // parsed, so lazy_mu_ must be held.
   absl::StatusOr<const DwarfMetadataFetcher::TypeData *> SearchType(
       const DwarfMetadataFetcher::TypeData *parent_type,
       const std::vector<absl::string_view> &names, int cur) const;
 
-  // Read the DWARF content of the binary/dwp file to the given MetadataPack.
+  // Same as GetType, with lazy_mu_ held when parsing lazily.
+  absl::StatusOr<const TypeData *> FindType(absl::string_view type_name) const;
+
+  // Path of the cache file of the given build id.
+  std::string CachePath(absl::string_view build_id) const;
+
+  // Read the cached content of the given build id to the given MetadataPack.
+  // Returns NotFoundError if there is no usable cache file.
+  absl::Status ReadFromCache(const std::string &build_id,
+                             MetadataPack *pack_ptr) const;
+
+  // Write the given, post-processed, MetadataPack to the cache file of the
+  // given build id. The file is replaced atomically, so concurrent readers
+  // never see a partial cache.
+  absl::Status WriteToCache(const std::string &build_id,
+                            const MetadataPack &pack) const;
+
+  // Fill the given MetadataPack with the metadata of 'build_id', read from the
+  // cache unless force_update_cache is set. Otherwise, or if the cache is
+  // unusable, 'parse' reads the DWARF into the pack, which is then
+  // post-processed and written back to the cache.
+  absl::Status FetchPack(const std::string &build_id, bool force_update_cache,
+                         absl::FunctionRef<absl::Status(MetadataPack *)> parse,
+                         MetadataPack *pack_ptr);
+
+  // Read the DWARF content of the retrieved binary/dwp file of build_id to the
+  // given MetadataPack.
   // TODO: b/344968545 - ReadFromDwarf should be refactored to use
   // absl::string_view. Requires refactoring BinaryFileRetriever first.
   absl::Status ReadFromDWARF(const std::string &build_id,
-                             const std::string &path, MetadataPack *pack_ptr);
+                             const BinaryFileRetriever::RetrievedFiles &files,
+                             MetadataPack *pack_ptr);
 
   // Use for downloading debugging info file(s) from symbol server.
   std::unique_ptr<BinaryFileRetriever> file_retriever_;
 
-  // Contains the indexed type/field metadata data parsed from DWARF.
-  MetadataPack pack_;
+  // Contains the indexed type/field metadata data parsed from DWARF. Mutable
+  // so that the lookups of a lazily parsed pack can parse the DIEs they reach,
+  // which they do with lazy_mu_ held.
+  mutable MetadataPack pack_;
+
+  // Serializes the lookups of a lazily parsed pack.
+  mutable absl::Mutex lazy_mu_;
 
   // Directory contains cache data serialization files.
   std::string cache_dir_;
@@ -430,8 +552,14 @@ class DwarfMetadataFetcher {
   // Option to set the number of threads to use for parsing DWARF files.
   uint32_t parse_thread_count_;
 
+  // Option to set whether or not DwarfMetadataFetcher should only parse the
+  // DIEs that lookups reach.
+  bool lazy_parse_;
+
   // Cache of type data.
-  absl::flat_hash_map<std::string, const TypeData *> cache_;
+  absl::Mutex cache_mu_;
+  absl::flat_hash_map<std::string, const TypeData *> cache_
+      ABSL_GUARDED_BY(cache_mu_);
 };
 
 #endif  // DWARF_METADATA_FETCHER_H_
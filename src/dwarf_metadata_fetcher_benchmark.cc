@@ -0,0 +1,151 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the DWARF parsing and type lookups of DwarfMetadataFetcher.
+// Run with --benchmark_format=json, or --benchmark_out=<file>
+// --benchmark_out_format=json, for machine-readable results.
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "binary_file_retriever.h"
+#include "dwarf_metadata_fetcher.h"
+#include "src/main/cpp/util/path.h"
+
+namespace {
+
+constexpr const char* kBenchmarkTestdataPath = "src/testdata";
+constexpr const char* kBenchmarkBuildId = "benchmark";
+
+// Binaries parsed by BM_ParseDWARF, indexed by the first argument.
+constexpr absl::string_view kBinaries[] = {
+    "supported_stl_containers.exe",
+    "supported_abseil_containers.exe",
+    "supported_adt_containers.exe",
+};
+
+// Type names looked up by BM_GetType, the last ones are not in the DWARF.
+constexpr absl::string_view kTypeNames[] = {
+    "Foo",
+    "Foo::FooInsider",
+    "Bar<Foo>",
+    "Bar<Foo>*",
+    "Bar<char>::BarPrivateInsider",
+    "Bar<AAA::BBB::CCC>::BarPublicInsider",
+    "AAA::BBB::CCC",
+    "AAA::BBB::ChildFoo",
+    "myint32_t",
+    "Bar",
+    "AAA::BBB::Missing",
+};
+
+std::unique_ptr<DwarfMetadataFetcher> CreateFetcher(
+    const std::string& path, bool read_subprograms, uint32_t parse_thread_count,
+    bool lazy_parse) {
+  auto fetcher = std::make_unique<DwarfMetadataFetcher>(
+      BinaryFileRetriever::CreateMockRetriever({{kBenchmarkBuildId, path}}),
+      /*cache_dir=*/"", read_subprograms, /*write_to_cache=*/false,
+      parse_thread_count, lazy_parse);
+  QCHECK_OK(fetcher->FetchWithPath({{kBenchmarkBuildId, path}},
+                                   /*force_update_cache=*/true));
+  return fetcher;
+}
+
+// Args: index into kBinaries, parse thread count, lazy parse.
+void BM_ParseDWARF(benchmark::State& state) {
+  const std::string binary(kBinaries[state.range(0)]);
+  const std::string path = blaze_util::JoinPath(kBenchmarkTestdataPath, binary);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(CreateFetcher(
+        path, /*read_subprograms=*/true,
+        /*parse_thread_count=*/state.range(1), /*lazy_parse=*/state.range(2)));
+  }
+  state.SetLabel(binary);
+}
+BENCHMARK(BM_ParseDWARF)
+    ->ArgsProduct({{0, 1, 2}, {1, 4}, {0, 1}})
+    ->ArgNames({"binary", "threads", "lazy"})
+    ->Unit(benchmark::kMillisecond);
+
+// Args: lazy parse. A lazily parsed fetcher parses the DIEs of the types on
+// the first lookups, later ones measure the lookup under the mutex.
+void BM_GetType(benchmark::State& state) {
+  const std::unique_ptr<DwarfMetadataFetcher> fetcher = CreateFetcher(
+      blaze_util::JoinPath(kBenchmarkTestdataPath,
+                           "dwarfmetadata_testdata.dwarf"),
+      /*read_subprograms=*/false, /*parse_thread_count=*/1,
+      /*lazy_parse=*/state.range(0));
+  for (auto _ : state) {
+    for (absl::string_view type_name : kTypeNames) {
+      benchmark::DoNotOptimize(fetcher->GetType(type_name));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * std::size(kTypeNames));
+}
+BENCHMARK(BM_GetType)->ArgName("lazy")->Arg(0)->Arg(1);
+
+// Type names looked up by BM_SearchType, grouped by the path SearchType takes
+// through the namespaces: nested namespaces, typedefs restarting the search
+// from the root, and misses, which also search the unnamed namespaces.
+constexpr absl::string_view kNestedTypeNames[] = {
+    "AAA::BBB::CCC",
+    "AAA::BBB::ChildFoo",
+    "Foo::FooInsider",
+    "Bar<AAA::BBB::CCC>::BarPublicInsider",
+};
+constexpr absl::string_view kTypedefTypeNames[] = {
+    "FooFoo",
+    "myint32_t",
+    "MyCCC",
+};
+constexpr absl::string_view kMissingTypeNames[] = {
+    "AAA::BBB::Missing",
+    "AAA::Missing::CCC",
+    "(anonymous namespace)::Foo",
+};
+constexpr absl::Span<const absl::string_view> kSearchTypeNames[] = {
+    kNestedTypeNames,
+    kTypedefTypeNames,
+    kMissingTypeNames,
+};
+
+// Args: index into kSearchTypeNames. Measures SearchType on an eagerly parsed
+// fetcher, GetType only adds splitting the name to it.
+void BM_SearchType(benchmark::State& state) {
+  const std::unique_ptr<DwarfMetadataFetcher> fetcher = CreateFetcher(
+      blaze_util::JoinPath(kBenchmarkTestdataPath,
+                           "dwarfmetadata_testdata.dwarf"),
+      /*read_subprograms=*/false, /*parse_thread_count=*/1,
+      /*lazy_parse=*/false);
+  const absl::Span<const absl::string_view> type_names =
+      kSearchTypeNames[state.range(0)];
+  for (auto _ : state) {
+    for (absl::string_view type_name : type_names) {
+      benchmark::DoNotOptimize(fetcher->GetType(type_name));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * type_names.size());
+}
+BENCHMARK(BM_SearchType)->ArgName("names")->DenseRange(0, 2);
+
+}  // namespace
+
+BENCHMARK_MAIN();
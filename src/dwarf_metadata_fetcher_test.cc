@@ -16,8 +16,10 @@
 
 #include <stdio.h>
 
+#include <filesystem>
 #include <memory>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <utility>
 
@@ -83,6 +85,129 @@ TEST(DwarfMetadataFetcherTest, FetchAndProcessDebuggingInfo) {
   }
 }
 
+TEST(DwarfMetadataFetcherTest, FetchWithMultipleParseThreads) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "dwarfmetadata_testdata.dwarf");
+  const std::string linker_build_id = "1001";
+  std::unique_ptr<BinaryFileRetriever> retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+
+  DwarfMetadataFetcher test_target(std::move(retriever), ::testing::TempDir(),
+                                   /*read_subprograms=*/false,
+                                   /*write_to_cache=*/true,
+                                   /*parse_thread_count=*/4);
+  ASSERT_OK(test_target.FetchWithPath({{linker_build_id, dwarf_path}},
+                                      /*force_update_cache=*/true));
+  TestFunctionality(test_target);
+}
+
+TEST(DwarfMetadataFetcherTest, FetchMultipleBinariesWithMultipleThreads) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "dwarfmetadata_testdata.dwarf");
+  const std::string struct_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "basic_struct_type.dwarf");
+  std::unique_ptr<BinaryFileRetriever> retriever =
+      BinaryFileRetriever::CreateMockRetriever(
+          {{"1001", dwarf_path}, {"1002", struct_path}});
+
+  DwarfMetadataFetcher test_target(std::move(retriever), ::testing::TempDir(),
+                                   /*read_subprograms=*/false,
+                                   /*write_to_cache=*/false,
+                                   /*parse_thread_count=*/4);
+  ASSERT_OK(test_target.FetchWithPath(
+      {{"1001", dwarf_path}, {"1002", struct_path}},
+      /*force_update_cache=*/true));
+  TestFunctionality(test_target);
+  ASSERT_OK_AND_ASSIGN(const DwarfMetadataFetcher::TypeData *a,
+                       test_target.GetType("A"));
+  EXPECT_EQ(a->fields.size(), 2);
+}
+
+TEST(DwarfMetadataFetcherTest, FetchWithLazyParse) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "dwarfmetadata_testdata.dwarf");
+  const std::string cache_dir =
+      blaze_util::JoinPath(::testing::TempDir(), "fetch_with_lazy_parse");
+  const std::string linker_build_id = "1001";
+  std::unique_ptr<BinaryFileRetriever> retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+
+  DwarfMetadataFetcher test_target(std::move(retriever), cache_dir,
+                                   /*read_subprograms=*/false,
+                                   /*write_to_cache=*/true,
+                                   /*parse_thread_count=*/1,
+                                   /*lazy_parse=*/true);
+  ASSERT_OK(test_target.FetchWithPath({{linker_build_id, dwarf_path}},
+                                      /*force_update_cache=*/true));
+  EXPECT_EQ(test_target.GetPointerSize(), 8);
+  // Only the namespaces are there until a lookup reaches the types.
+  std::stringstream before_lookups;
+  test_target.Dump(before_lookups);
+  EXPECT_NE(before_lookups.str().find("AAA"), std::string::npos);
+  EXPECT_EQ(before_lookups.str().find("FooInsider"), std::string::npos);
+  TestFunctionality(test_target);
+  std::stringstream after_lookups;
+  test_target.Dump(after_lookups);
+  EXPECT_NE(after_lookups.str().find("FooInsider"), std::string::npos);
+  EXPECT_EQ(after_lookups.str().find(" MyCCC;"), std::string::npos);
+  // The partial metadata is not cached.
+  EXPECT_FALSE(std::filesystem::exists(
+      blaze_util::JoinPath(cache_dir, "1001.dwarf_metadata")));
+}
+
+TEST(DwarfMetadataFetcherTest, FetchWithLazyParseRejectsSeveralBinaries) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "dwarfmetadata_testdata.dwarf");
+  const std::string struct_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "basic_struct_type.dwarf");
+  DwarfMetadataFetcher test_target(
+      BinaryFileRetriever::CreateMockRetriever(
+          {{"1001", dwarf_path}, {"1002", struct_path}}),
+      ::testing::TempDir(), /*read_subprograms=*/false,
+      /*write_to_cache=*/false, /*parse_thread_count=*/1,
+      /*lazy_parse=*/true);
+  EXPECT_EQ(test_target
+                .FetchWithPath({{"1001", dwarf_path}, {"1002", struct_path}},
+                               /*force_update_cache=*/true)
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(DwarfMetadataFetcherTest, FetchFromCache) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kDwarfMetadataFetchTestPath, "dwarfmetadata_testdata.dwarf");
+  const std::string cache_dir =
+      blaze_util::JoinPath(::testing::TempDir(), "fetch_from_cache");
+  const std::string linker_build_id = "1001";
+  {
+    DwarfMetadataFetcher writer(BinaryFileRetriever::CreateMockRetriever(
+                                    {{linker_build_id, dwarf_path}}),
+                                cache_dir);
+    ASSERT_OK(writer.FetchWithPath({{linker_build_id, dwarf_path}},
+                                   /*force_update_cache=*/true));
+  }
+  // The binary does not exist anymore, so everything has to come from the
+  // cache written above.
+  const std::string missing_path =
+      blaze_util::JoinPath(kDwarfMetadataFetchTestPath, "missing.dwarf");
+  DwarfMetadataFetcher test_target(BinaryFileRetriever::CreateMockRetriever(
+                                       {{linker_build_id, missing_path}}),
+                                   cache_dir);
+  ASSERT_OK(test_target.FetchWithPath({{linker_build_id, missing_path}},
+                                      /*force_update_cache=*/false));
+  TestFunctionality(test_target);
+  EXPECT_EQ(test_target.GetPointerSize(), 8);
+
+  // A fetcher that needs subprograms cannot use a cache written without them.
+  DwarfMetadataFetcher subprogram_target(
+      BinaryFileRetriever::CreateMockRetriever(
+          {{linker_build_id, missing_path}}),
+      cache_dir, /*read_subprograms=*/true);
+  ASSERT_OK(subprogram_target.FetchWithPath({{linker_build_id, missing_path}},
+                                            /*force_update_cache=*/false));
+  EXPECT_NOT_OK(subprogram_target.GetType("Foo"));
+}
+
 TEST(DwarfMetadataFetcherTest, BasicTest) {
   const std::string raw_dwarf_dir = kDwarfMetadataFetchTestPath;
   ;
@@ -230,6 +355,30 @@ TEST(DwarfMetadataFetcherTest, UnwrapParameterizedStorageTest) {
             std::nullopt);
 }
 
+// Fields seen by several parser threads are deduplicated on their unwrapped
+// type name, as when a single thread sees them.
+TEST(DwarfMetadataFetcherTest, MergeFromDeduplicatesUnwrappedFields) {
+  DwarfMetadataFetcher::TypeData type;
+  type.AddField(std::make_unique<DwarfMetadataFetcher::FieldData>(
+      "_M_storage", 32, "std::pair<const unsigned long, A>"));
+  type.AddField(std::make_unique<DwarfMetadataFetcher::FieldData>(
+      "_M_storage", 32, "std::pair<const unsigned long, A>"));
+  type.AddField(std::make_unique<DwarfMetadataFetcher::FieldData>(
+      "no_offset", -1, "int"));
+  EXPECT_EQ(type.fields.size(), 1);
+
+  DwarfMetadataFetcher::TypeData other;
+  other.AddField(std::make_unique<DwarfMetadataFetcher::FieldData>(
+      "_M_storage", 32, "std::pair<const unsigned long, A>"));
+  other.AddField(
+      std::make_unique<DwarfMetadataFetcher::FieldData>("next", 0, "void *"));
+  type.MergeFrom(other);
+  ASSERT_EQ(type.fields.size(), 2);
+  EXPECT_EQ(type.fields[1]->name, "next");
+  EXPECT_EQ(type.offset_idx[0].size(), 1);
+  EXPECT_EQ(type.offset_idx[32].size(), 1);
+}
+
 TEST(DwarfMetadataFetcherTest, BasicMapTest) {
   const std::string raw_dwarf_dir = kDwarfMetadataFetchTestPath;
   const std::string dwarf_path =
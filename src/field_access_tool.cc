@@ -12,8 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <glob.h>
+
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
-#include <functional>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -25,15 +29,37 @@
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "flamegraph_writer.h"
 #include "histogram_builder.h"
+#include "histogram_io.h"
+#include "layout_advisor.h"
+#include "perf_stats.h"
 #include "status_macros.h"
+#include "type_layout_store.h"
+#include "type_tree.h"
+#include "zstd_ostream.h"
 
 ABSL_FLAG(bool, local, false, "Collect data from local heap profile");
-ABSL_FLAG(std::string, out, "", "Output file path, defaults to stdout");
+ABSL_FLAG(std::string, out, "",
+          "Output file path, defaults to stdout. A path ending in .zst is "
+          "written compressed with zstd.");
 ABSL_FLAG(bool, stats, false,
-          "Log stats about the type resolution and histogram building.");
+          "Log stats about the type resolution and histogram building, along "
+          "with the time spent in each phase of the run, the hit rates of its "
+          "caches and its memory use.");
+ABSL_FLAG(std::string, stats_trace, "",
+          "If set, write the phases of the run to this path as a Chrome trace "
+          "JSON file, viewable with chrome://tracing or ui.perfetto.dev. "
+          "Phases run for each allocation site are only in --stats.");
+ABSL_FLAG(std::string, verify, "once",
+          "Which resolved type trees to verify: none, once, to verify the "
+          "shape of the tree of each type once, or all, to verify every tree "
+          "along with its access counts.");
 ABSL_FLAG(bool, verify_verbose, false,
-          "Verify type trees and print out verbose information.");
+          "Print out verbose information about the type resolution, and the "
+          "mistakes of the type trees that fail verification.");
 ABSL_FLAG(std::vector<std::string>, type_prefix_filter, {},
           "List of types to filter on. If empty, will choose all types.");
 ABSL_FLAG(bool, only_records, false,
@@ -42,6 +68,18 @@ ABSL_FLAG(std::vector<std::string>, callstack_filter, {},
           "List of callstack mangled function names to filter on. If empty, "
           "will choose all callstacks.");
 ABSL_FLAG(bool, flamegraph, false, "Dump flamegraph of the type tree.");
+ABSL_FLAG(std::string, flamegraph_value, "total",
+          "Counter of the fields the flamegraph shows: total, access, llc_miss "
+          "or llc_miss_density, the LLC misses per cache line of the field.");
+ABSL_FLAG(std::string, flamegraph_format, "lines",
+          "Format of the flamegraph: lines, one line per field of each type "
+          "tree, or collapsed, where the fields of the trees of the same type "
+          "are summed into one line, as flamegraph.pl collapses them anyway.");
+ABSL_FLAG(bool, layout_advice, false,
+          "Dump reordered layouts of the record types that touch fewer cache "
+          "lines, ranked by the bytes of memory traffic they save, instead of "
+          "the type trees. Not supported with --per_profile or "
+          "--stream_memory_budget_mb.");
 ABSL_FLAG(int64_t, limit, -1,
           "Limit on the number of type trees to dump. If negative, dump all.");
 ABSL_FLAG(bool, dump_unresolved_callstacks, false,
@@ -49,10 +87,72 @@ ABSL_FLAG(bool, dump_unresolved_callstacks, false,
           "of resolved type trees.");
 ABSL_FLAG(uint32_t, parse_thread_count, 128,
           "Number of threads to use for parsing DWARF files.");
+ABSL_FLAG(uint32_t, build_thread_count, 1,
+          "Number of threads to use for resolving the allocation sites of the "
+          "profile.");
+ABSL_FLAG(std::string, histogram_out, "",
+          "If set, also write the histogram to this path as a binary histogram "
+          "file, see histogram.proto. Histogram files are summed with "
+          "histogram_merge. Not supported with --per_profile.");
+ABSL_FLAG(uint64_t, stream_memory_budget_mb, 0,
+          "If positive, dump the type trees whenever they take more than this "
+          "many MiB, instead of once the whole profile is processed. The same "
+          "callstack can then be dumped more than once. Not supported with "
+          "--per_profile.");
 
 // Local mode flags.
 ABSL_FLAG(std::string, memprof_profile, "",
           "The local path for a raw MemProf profile.");
+ABSL_FLAG(std::vector<std::string>, memprof_profiles, {},
+          "Local paths or glob patterns of several raw MemProf profiles of the "
+          "same binary, e.g. one per process. Replaces --memprof_profile. The "
+          "DWARF of the binary is parsed once, and the histograms of all "
+          "profiles are merged.");
+ABSL_FLAG(uint32_t, profile_thread_count, 1,
+          "Number of profiles of --memprof_profiles to build at the same "
+          "time.");
+ABSL_FLAG(bool, per_profile, false,
+          "With --memprof_profiles, dump the histogram and stats of each "
+          "profile apart instead of merging them.");
+ABSL_FLAG(uint32_t, shard_count, 1,
+          "Number of shards to split the allocation sites of --memprof_profile "
+          "into, e.g. to build them on several machines. Only the shard "
+          "--shard_index is built. The --histogram_out files of all shards are "
+          "summed with histogram_merge.");
+ABSL_FLAG(uint32_t, shard_index, 0,
+          "Index of the shard to build, in [0, --shard_count).");
+ABSL_FLAG(std::string, dwarf_cache_dir,
+          devtools_crosstool_fdo_field_access::LocalHistogramBuilder::
+              kDefaultDwarfCacheDir,
+          "Directory of the cache of DWARF metadata, keyed by build id. Can be "
+          "shared by the shards of a sharded build, so that the DWARF of a "
+          "binary is only parsed once.");
+ABSL_FLAG(uint32_t, memprof_histogram_granularity,
+          devtools_crosstool_fdo_field_access::LocalHistogramBuilder::
+              kMemprofHistogramGranularity,
+          "Bytes counted by each bucket of the access histograms of the "
+          "profiles, as set when running memprof. Must be a power of two.");
+ABSL_FLAG(bool, lazy_dwarf_parse, false,
+          "Only parse the DWARF types and heapalloc sites that the allocation "
+          "sites of the profile reach, instead of the whole DWARF. Cuts the "
+          "start-up time on large binaries. A DWARF metadata cache is still "
+          "read if there is one, but never written.");
+ABSL_FLAG(uint64_t, top_alloc_sites, 0,
+          "If positive, only resolve this many allocation sites, those with "
+          "the most accesses. The others are only counted in the stats. "
+          "Combined with --limit for a quick look at a large profile.");
+ABSL_FLAG(double, alloc_site_access_coverage, 0,
+          "If positive, only resolve the allocation sites with the most "
+          "accesses that together cover this percentage of the accesses of the "
+          "profile. The others are only counted in the stats.");
+ABSL_FLAG(std::string, layout_store, "",
+          "If set, the type layouts resolved by the previous run, e.g. on the "
+          "previous build of the binary, are read from this path, and reused "
+          "for the types whose DWARF type data did not change since. The "
+          "layouts of this run are then written back to it.");
+ABSL_FLAG(std::string, layout_diff_out, "",
+          "If set along with --layout_store, write how the layout of each "
+          "type changed since the previous run to this path.");
 ABSL_FLAG(std::string, memprof_profiled_binary, "",
           "The local path for the MemProf profiled binary.");
 ABSL_FLAG(std::string, memprof_profiled_binary_dwarf, "",
@@ -62,46 +162,254 @@ ABSL_FLAG(std::string, memprof_profiled_binary_dwarf, "",
 
 namespace {
 using devtools_crosstool_fdo_field_access::AbstractHistogramBuilder;
+using devtools_crosstool_fdo_field_access::DiffTypeLayouts;
+using devtools_crosstool_fdo_field_access::DumpTypeLayoutDiffs;
+using devtools_crosstool_fdo_field_access::DumpLayoutAdvice;
+using devtools_crosstool_fdo_field_access::FlameGraphWriter;
 using devtools_crosstool_fdo_field_access::HistogramBuilderResults;
+using devtools_crosstool_fdo_field_access::HistogramWriter;
+using devtools_crosstool_fdo_field_access::LayoutAdvisor;
 using devtools_crosstool_fdo_field_access::LocalHistogramBuilder;
+using devtools_crosstool_fdo_field_access::MultiProfileHistogramBuilder;
+using devtools_crosstool_fdo_field_access::PerfStats;
+using devtools_crosstool_fdo_field_access::ScopedPhase;
+using devtools_crosstool_fdo_field_access::Statistics;
+using devtools_crosstool_fdo_field_access::TypeLayoutStore;
+using devtools_crosstool_fdo_field_access::TypeTree;
 using devtools_crosstool_fdo_field_access::TypeTreeStore;
+using devtools_crosstool_fdo_field_access::VerifyMode;
+using devtools_crosstool_fdo_field_access::ZstdOstream;
 
-absl::StatusOr<std::unique_ptr<AbstractHistogramBuilder>>
-CreateLocalHistogramBuilderFromFlags() {
-  std::string memprof_profiled_binary =
-      absl::GetFlag(FLAGS_memprof_profiled_binary);
-  QCHECK(!memprof_profiled_binary.empty())
-      << "Profiled binary must be specified if with --local mode.";
-  std::string memprof_profile = absl::GetFlag(FLAGS_memprof_profile);
-  QCHECK(!memprof_profile.empty())
-      << "Memprofraw profile must be specified if with --local mode.";
+TypeTree::FlameGraphValue GetFlameGraphValueFromFlags() {
+  const std::string value = absl::GetFlag(FLAGS_flamegraph_value);
+  if (value == "access") {
+    return TypeTree::FlameGraphValue::kAccess;
+  } else if (value == "llc_miss") {
+    return TypeTree::FlameGraphValue::kLlcMiss;
+  } else if (value == "llc_miss_density") {
+    return TypeTree::FlameGraphValue::kLlcMissDensity;
+  }
+  QCHECK(value == "total") << "Unknown --flamegraph_value: " << value;
+  return TypeTree::FlameGraphValue::kTotal;
+}
 
-  std::string memprof_profiled_binary_dwarf =
-      absl::GetFlag(FLAGS_memprof_profiled_binary_dwarf);
+// The --out file if set, else stdout. Everything dumped to a --out ending in
+// .zst goes through a single ZstdOstream, so that the whole file decompresses.
+struct DumpStream {
+  std::ostream* out;
+  // Set if 'out' is compressed.
+  ZstdOstream* compressed_out = nullptr;
+};
+
+const DumpStream& GetDumpStream() {
+  static const DumpStream* const stream = []() {
+    const std::string path = absl::GetFlag(FLAGS_out);
+    if (path.empty()) {
+      return new DumpStream{.out = &std::cout};
+    }
+    auto* file = new std::ofstream(path, std::ios::binary | std::ios::trunc);
+    QCHECK(*file) << "Cannot open --out " << path;
+    if (absl::EndsWith(path, ".zst")) {
+      auto* compressed_out = new ZstdOstream(*file);
+      return new DumpStream{.out = compressed_out,
+                            .compressed_out = compressed_out};
+    }
+    return new DumpStream{.out = file};
+  }();
+  return *stream;
+}
 
-  std::vector<std::string> type_prefix_filter =
-      absl::GetFlag(FLAGS_type_prefix_filter);
+// The stream the type trees are dumped to.
+std::ostream& GetDumpStreamFromFlags() { return *GetDumpStream().out; }
 
-  std::vector<std::string> callstack_filter =
-      absl::GetFlag(FLAGS_callstack_filter);
+// Flushes the dumps to --out. Returns false, after logging why, if they could
+// not all be written.
+bool FlushDumpStream() {
+  if (ZstdOstream* compressed_out = GetDumpStream().compressed_out;
+      compressed_out != nullptr) {
+    if (absl::Status status = compressed_out->Finish(); !status.ok()) {
+      LOG(ERROR) << "Failed to write the dumps to " << absl::GetFlag(FLAGS_out)
+                 << ": " << status;
+      return false;
+    }
+  }
+  std::ostream& out = GetDumpStreamFromFlags();
+  out.flush();
+  if (!out) {
+    LOG(ERROR) << "Failed to write the dumps to "
+               << (absl::GetFlag(FLAGS_out).empty() ? "stdout"
+                                                   : absl::GetFlag(FLAGS_out));
+    return false;
+  }
+  return true;
+}
 
-  bool verify_verbose = absl::GetFlag(FLAGS_verify_verbose);
+// Writes the flamegraphs to --out in the --flamegraph_format.
+std::unique_ptr<FlameGraphWriter> CreateFlameGraphWriterFromFlags() {
+  const std::string format = absl::GetFlag(FLAGS_flamegraph_format);
+  QCHECK(format == "lines" || format == "collapsed")
+      << "Unknown --flamegraph_format: " << format;
+  return std::make_unique<FlameGraphWriter>(
+      GetDumpStreamFromFlags(),
+      format == "collapsed" ? FlameGraphWriter::Format::kCollapsed
+                            : FlameGraphWriter::Format::kLines);
+}
 
-  bool only_records = absl::GetFlag(FLAGS_only_records);
+VerifyMode GetVerifyModeFromFlags() {
+  const std::string value = absl::GetFlag(FLAGS_verify);
+  if (value == "none") {
+    return VerifyMode::kNone;
+  } else if (value == "all") {
+    return VerifyMode::kAll;
+  }
+  QCHECK(value == "once") << "Unknown --verify: " << value;
+  return VerifyMode::kOnce;
+}
 
-  uint32_t parse_thread_count = absl::GetFlag(FLAGS_parse_thread_count);
+// The layouts of --layout_store, read once. Null without --layout_store, or
+// if it cannot be read, e.g. on the first run.
+std::shared_ptr<const TypeLayoutStore> GetPriorLayoutsFromFlags() {
+  static const auto* const prior_layouts =
+      new std::shared_ptr<const TypeLayoutStore>([] {
+        const std::string path = absl::GetFlag(FLAGS_layout_store);
+        if (path.empty()) {
+          return std::shared_ptr<const TypeLayoutStore>();
+        }
+        ScopedPhase phase("ReadTypeLayouts");
+        absl::StatusOr<TypeLayoutStore> layouts = TypeLayoutStore::Read(path);
+        if (!layouts.ok()) {
+          LOG(INFO) << "No usable type layouts in " << path << ": "
+                    << layouts.status();
+          return std::shared_ptr<const TypeLayoutStore>();
+        }
+        LOG(INFO) << "Read " << layouts->Size() << " type layouts from "
+                  << path;
+        return std::make_shared<const TypeLayoutStore>(*std::move(layouts));
+      }());
+  return *prior_layouts;
+}
 
-  bool dump_unresolved_callstacks =
+// With --layout_store, writes the layouts resolved by 'builder' back to it,
+// along with those of the previous run for the types not resolved this time.
+// Dumps how the layouts changed since the previous run to --layout_diff_out.
+absl::Status WriteTypeLayoutsFromFlags(
+    const AbstractHistogramBuilder& builder) {
+  const std::string path = absl::GetFlag(FLAGS_layout_store);
+  if (path.empty()) {
+    return absl::OkStatus();
+  }
+  ScopedPhase phase("WriteTypeLayouts");
+  TypeLayoutStore layouts = builder.GetTypeLayouts();
+  const std::shared_ptr<const TypeLayoutStore> prior_layouts =
+      GetPriorLayoutsFromFlags();
+  if (const std::string diff_path = absl::GetFlag(FLAGS_layout_diff_out);
+      !diff_path.empty()) {
+    std::ofstream diff_out(diff_path, std::ios::trunc);
+    DumpTypeLayoutDiffs(
+        DiffTypeLayouts(
+            prior_layouts != nullptr ? *prior_layouts : TypeLayoutStore(),
+            layouts),
+        diff_out);
+    diff_out.close();
+    if (!diff_out) {
+      return absl::InternalError(absl::StrCat("Failed to write ", diff_path));
+    }
+  }
+  if (prior_layouts != nullptr) {
+    layouts.MergeFrom(*prior_layouts);
+  }
+  return layouts.Write(path);
+}
+
+// The options shared by the builders of all local modes.
+LocalHistogramBuilder::Options GetLocalBuilderOptionsFromFlags() {
+  LocalHistogramBuilder::Options options;
+  options.memprof_profiled_binary =
+      absl::GetFlag(FLAGS_memprof_profiled_binary);
+  QCHECK(!options.memprof_profiled_binary.empty())
+      << "Profiled binary must be specified if with --local mode.";
+  options.memprof_profiled_binary_dwarf =
+      absl::GetFlag(FLAGS_memprof_profiled_binary_dwarf);
+  options.type_prefix_filter = absl::GetFlag(FLAGS_type_prefix_filter);
+  options.callstack_filter = absl::GetFlag(FLAGS_callstack_filter);
+  options.verify_verbose = absl::GetFlag(FLAGS_verify_verbose);
+  options.only_records = absl::GetFlag(FLAGS_only_records);
+  options.parse_thread_count = absl::GetFlag(FLAGS_parse_thread_count);
+  options.build_thread_count = absl::GetFlag(FLAGS_build_thread_count);
+  options.shard = {.index = absl::GetFlag(FLAGS_shard_index),
+                   .count = absl::GetFlag(FLAGS_shard_count)};
+  options.dwarf_cache_dir = absl::GetFlag(FLAGS_dwarf_cache_dir);
+  options.histogram_granularity =
+      absl::GetFlag(FLAGS_memprof_histogram_granularity);
+  options.lazy_dwarf_parse = absl::GetFlag(FLAGS_lazy_dwarf_parse);
+  options.verify_mode = GetVerifyModeFromFlags();
+  options.prior_layouts = GetPriorLayoutsFromFlags();
+  options.sampling = {
+      .top_sites = absl::GetFlag(FLAGS_top_alloc_sites),
+      .access_coverage_percent =
+          absl::GetFlag(FLAGS_alloc_site_access_coverage),
+  };
+  options.dump_unresolved_callstacks =
       absl::GetFlag(FLAGS_dump_unresolved_callstacks);
-  if (memprof_profiled_binary_dwarf.empty()) {
-    LOG(INFO) << "Setting local .dwp file to " << memprof_profiled_binary
-              << "\n";
-    memprof_profiled_binary_dwarf = memprof_profiled_binary;
+  if (options.memprof_profiled_binary_dwarf.empty()) {
+    LOG(INFO) << "Setting local .dwp file to "
+              << options.memprof_profiled_binary << "\n";
+    options.memprof_profiled_binary_dwarf = options.memprof_profiled_binary;
   }
-  return LocalHistogramBuilder::Create(
-      memprof_profile, memprof_profiled_binary, memprof_profiled_binary_dwarf,
-      type_prefix_filter, callstack_filter, only_records, verify_verbose,
-      dump_unresolved_callstacks, parse_thread_count);
+  return options;
+}
+
+// Expands the glob patterns of --memprof_profiles. Patterns matching no file
+// are kept as is, so that opening them reports the error.
+std::vector<std::string> GetMemprofProfilesFromFlags() {
+  std::vector<std::string> memprof_profiles;
+  for (const std::string& pattern : absl::GetFlag(FLAGS_memprof_profiles)) {
+    glob_t matches;
+    if (glob(pattern.c_str(), /*flags=*/0, /*errfunc=*/nullptr, &matches) ==
+        0) {
+      for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        memprof_profiles.push_back(matches.gl_pathv[i]);
+      }
+    } else {
+      memprof_profiles.push_back(pattern);
+    }
+    globfree(&matches);
+  }
+  return memprof_profiles;
+}
+
+absl::StatusOr<std::unique_ptr<MultiProfileHistogramBuilder>>
+CreateMultiProfileHistogramBuilderFromFlags(
+    const std::vector<std::string>& memprof_profiles) {
+  const LocalHistogramBuilder::Options options =
+      GetLocalBuilderOptionsFromFlags();
+  LOG(INFO) << "Building histogram of " << memprof_profiles.size()
+            << " profiles.\n";
+  return MultiProfileHistogramBuilder::Create(
+      memprof_profiles, options, absl::GetFlag(FLAGS_profile_thread_count));
+}
+
+absl::StatusOr<std::unique_ptr<AbstractHistogramBuilder>>
+CreateLocalHistogramBuilderFromFlags() {
+  const std::vector<std::string> memprof_profiles =
+      GetMemprofProfilesFromFlags();
+  std::string memprof_profile = absl::GetFlag(FLAGS_memprof_profile);
+  QCHECK(memprof_profile.empty() != memprof_profiles.empty())
+      << "Exactly one of --memprof_profile and --memprof_profiles must be "
+         "specified if with --local mode.";
+  if (!memprof_profiles.empty()) {
+    QCHECK(absl::GetFlag(FLAGS_shard_count) == 1)
+        << "--shard_count is not supported with --memprof_profiles.";
+    return CreateMultiProfileHistogramBuilderFromFlags(memprof_profiles);
+  }
+
+  const LocalHistogramBuilder::Options options =
+      GetLocalBuilderOptionsFromFlags();
+  if (options.shard.count > 1) {
+    LOG(INFO) << "Building shard " << options.shard.index << " of "
+              << options.shard.count << ".\n";
+  }
+  return LocalHistogramBuilder::Create(memprof_profile, options);
 }
 
 absl::StatusOr<std::unique_ptr<HistogramBuilderResults>> LocalMode() {
@@ -110,19 +418,225 @@ absl::StatusOr<std::unique_ptr<HistogramBuilderResults>> LocalMode() {
   ASSIGN_OR_RETURN(
       std::unique_ptr<HistogramBuilderResults> histogram_builder_results,
       histogram_builder->BuildHistogram());
+  RETURN_IF_ERROR(WriteTypeLayoutsFromFlags(*histogram_builder));
   return std::move(histogram_builder_results);
 };
 
+// Closes the histogram file at 'path' once its HistogramWriter is destroyed.
+absl::Status CloseHistogramFile(std::ofstream& out, const std::string& path) {
+  out.close();
+  if (!out) {
+    return absl::InternalError(absl::StrCat("Failed to write ", path));
+  }
+  return absl::OkStatus();
+}
+
+// Writes 'results' to the histogram file at 'path'.
+absl::Status WriteHistogramFile(const HistogramBuilderResults& results,
+                                const std::string& path) {
+  ScopedPhase phase("WriteHistogramFile");
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return absl::InternalError(absl::StrCat("Failed to open ", path));
+  }
+  {
+    HistogramWriter writer(&out);
+    RETURN_IF_ERROR(writer.Write(*results.type_tree_store));
+    RETURN_IF_ERROR(writer.Write(results.stats));
+  }
+  return CloseHistogramFile(out, path);
+}
+
+// Builds the histogram of each profile of --memprof_profiles apart, dumping
+// each one after the path of its profile.
+absl::Status PerProfileLocalMode(int64_t limit, bool stats) {
+  const std::vector<std::string> memprof_profiles =
+      GetMemprofProfilesFromFlags();
+  QCHECK(!memprof_profiles.empty())
+      << "--per_profile requires --memprof_profiles.";
+  ASSIGN_OR_RETURN(
+      std::unique_ptr<MultiProfileHistogramBuilder> histogram_builder,
+      CreateMultiProfileHistogramBuilderFromFlags(memprof_profiles));
+  ASSIGN_OR_RETURN(
+      std::vector<std::unique_ptr<HistogramBuilderResults>> profile_results,
+      histogram_builder->BuildHistogramPerProfile());
+  RETURN_IF_ERROR(WriteTypeLayoutsFromFlags(*histogram_builder));
+  const bool dump_unresolved_callstacks =
+      absl::GetFlag(FLAGS_dump_unresolved_callstacks);
+  const bool flamegraph = absl::GetFlag(FLAGS_flamegraph);
+  std::ostream& out = GetDumpStreamFromFlags();
+  for (size_t i = 0; i < profile_results.size(); ++i) {
+    if (!dump_unresolved_callstacks) {
+      ScopedPhase phase("Dump");
+      out << "- Profile: " << memprof_profiles[i] << "\n";
+      if (flamegraph) {
+        std::unique_ptr<FlameGraphWriter> writer =
+            CreateFlameGraphWriterFromFlags();
+        profile_results[i]->type_tree_store->DumpFlamegraph(
+            *writer, limit, /*first_id=*/1, GetFlameGraphValueFromFlags());
+        RETURN_IF_ERROR(writer->Finish());
+      } else {
+        profile_results[i]->type_tree_store->Dump(out, limit);
+      }
+    }
+    if (stats) {
+      LOG(INFO) << "Stats of profile " << memprof_profiles[i] << ":\n";
+      profile_results[i]->stats.Log();
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Builds the histogram in local mode, dumping the type trees as the store
+// fills up to 'memory_budget_bytes'.
+absl::StatusOr<Statistics> StreamingLocalMode(size_t memory_budget_bytes,
+                                              int64_t limit) {
+  ASSIGN_OR_RETURN(std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
+                   CreateLocalHistogramBuilderFromFlags());
+  const bool dump_unresolved_callstacks =
+      absl::GetFlag(FLAGS_dump_unresolved_callstacks);
+  const bool flamegraph = absl::GetFlag(FLAGS_flamegraph);
+  const TypeTree::FlameGraphValue flamegraph_value =
+      GetFlameGraphValueFromFlags();
+  std::ostream& out = GetDumpStreamFromFlags();
+  // A single writer for all flushes, so that the collapsed format sums the
+  // stacks of a callstack dumped more than once.
+  std::unique_ptr<FlameGraphWriter> flamegraph_writer;
+  if (flamegraph && !dump_unresolved_callstacks) {
+    flamegraph_writer = CreateFlameGraphWriterFromFlags();
+  }
+  const std::string histogram_out_path = absl::GetFlag(FLAGS_histogram_out);
+  std::ofstream histogram_out;
+  std::unique_ptr<HistogramWriter> histogram_writer;
+  if (!histogram_out_path.empty()) {
+    histogram_out.open(histogram_out_path, std::ios::binary | std::ios::trunc);
+    if (!histogram_out) {
+      return absl::InternalError(
+          absl::StrCat("Failed to open ", histogram_out_path));
+    }
+    histogram_writer = std::make_unique<HistogramWriter>(&histogram_out);
+  }
+  // Number of type trees dumped so far, for 'limit' to apply to the whole
+  // profile.
+  int64_t dumped = 0;
+  auto flush = [&](const TypeTreeStore& store) -> absl::Status {
+    if (histogram_writer != nullptr) {
+      RETURN_IF_ERROR(histogram_writer->Write(store));
+    }
+    if (dump_unresolved_callstacks) {
+      return absl::OkStatus();
+    }
+    const int64_t size = store.callstack_to_type_tree_.size();
+    const int64_t store_limit =
+        limit < 0 ? size
+                  : std::min(size, std::max<int64_t>(limit - dumped, 0));
+    if (flamegraph) {
+      store.DumpFlamegraph(*flamegraph_writer, store_limit,
+                           /*first_id=*/dumped + 1, flamegraph_value);
+    } else {
+      store.Dump(out, store_limit);
+    }
+    dumped += store_limit;
+    return absl::OkStatus();
+  };
+  ASSIGN_OR_RETURN(
+      Statistics stats,
+      histogram_builder->BuildHistogramStreaming(memory_budget_bytes, flush));
+  if (flamegraph_writer != nullptr) {
+    RETURN_IF_ERROR(flamegraph_writer->Finish());
+  }
+  RETURN_IF_ERROR(WriteTypeLayoutsFromFlags(*histogram_builder));
+  if (histogram_writer != nullptr) {
+    RETURN_IF_ERROR(histogram_writer->Write(stats));
+    histogram_writer = nullptr;
+    RETURN_IF_ERROR(CloseHistogramFile(histogram_out, histogram_out_path));
+  }
+  return stats;
+}
+
+// Returns an error if flags are set that the selected mode would ignore.
+absl::Status CheckModeFlags() {
+  const bool per_profile = absl::GetFlag(FLAGS_per_profile);
+  const bool streaming = absl::GetFlag(FLAGS_stream_memory_budget_mb) > 0;
+  if (per_profile && streaming) {
+    return absl::InvalidArgumentError(
+        "--per_profile is not supported with --stream_memory_budget_mb.");
+  }
+  if (per_profile && !absl::GetFlag(FLAGS_histogram_out).empty()) {
+    return absl::InvalidArgumentError(
+        "--histogram_out is not supported with --per_profile.");
+  }
+  if (absl::GetFlag(FLAGS_layout_advice) && (per_profile || streaming)) {
+    return absl::InvalidArgumentError(
+        "--layout_advice is not supported with --per_profile or "
+        "--stream_memory_budget_mb.");
+  }
+  return absl::OkStatus();
+}
+
+// Logs the phases and counters of the run with --stats, and writes its trace
+// with --stats_trace.
+void ReportPerfStats(bool stats) {
+  if (stats) {
+    PerfStats::Global().Log();
+  }
+  const std::string trace_path = absl::GetFlag(FLAGS_stats_trace);
+  if (trace_path.empty()) {
+    return;
+  }
+  std::ofstream trace_out(trace_path, std::ios::trunc);
+  PerfStats::Global().WriteChromeTrace(trace_out);
+  trace_out.close();
+  if (!trace_out) {
+    LOG(ERROR) << "Failed to write trace to " << trace_path;
+  }
+}
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
   absl::ParseCommandLine(argc, argv);
   const bool local = absl::GetFlag(FLAGS_local);
   const bool stats = absl::GetFlag(FLAGS_stats);
+  if (absl::Status status = CheckModeFlags(); !status.ok()) {
+    LOG(ERROR) << status;
+    return 1;
+  }
+  // Phases are only added up for --stats.
+  PerfStats::Global().EnablePhaseTimes(stats);
+  if (!absl::GetFlag(FLAGS_stats_trace).empty()) {
+    PerfStats::Global().EnableTrace();
+  }
   const bool dump_unresolved_callstacks =
       absl::GetFlag(FLAGS_dump_unresolved_callstacks);
   const int64_t limit = absl::GetFlag(FLAGS_limit);
-  const std::string out = absl::GetFlag(FLAGS_out);
+  const uint64_t stream_memory_budget_mb =
+      absl::GetFlag(FLAGS_stream_memory_budget_mb);
+  if (local && stream_memory_budget_mb > 0) {
+    LOG(INFO) << "Running field access tool in local streaming mode.\n";
+    absl::StatusOr<Statistics> streaming_stats =
+        StreamingLocalMode(stream_memory_budget_mb << 20, limit);
+    if (!streaming_stats.ok()) {
+      LOG(ERROR) << "Failed to build histogram: " << streaming_stats.status();
+      return 1;
+    }
+    if (stats) {
+      streaming_stats->Log();
+    }
+    ReportPerfStats(stats);
+    return FlushDumpStream() ? 0 : 1;
+  }
+  if (local && absl::GetFlag(FLAGS_per_profile)) {
+    LOG(INFO) << "Running field access tool in local per profile mode.\n";
+    if (absl::Status status = PerProfileLocalMode(limit, stats);
+        !status.ok()) {
+      LOG(ERROR) << "Failed to build histogram: " << status;
+      return 1;
+    }
+    ReportPerfStats(stats);
+    return FlushDumpStream() ? 0 : 1;
+  }
+
   absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
       histogram_builder_results;
   if (local) {
@@ -139,23 +653,42 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  std::function<void(std::ostream&)> dump_fn;
-  if (dump_unresolved_callstacks) {
-    // do nothing.
-  } else if (absl::GetFlag(FLAGS_flamegraph)) {
-    dump_fn = [&](std::ostream& out) {
-      histogram_builder_results.value()->type_tree_store->DumpFlamegraph(out,
-                                                                         limit);
-    };
-  } else {
-    auto dump_fn = [&](std::ostream& out) {
-      histogram_builder_results.value()->type_tree_store->Dump(out, limit);
-    };
-    dump_fn(std::cout);
+  {
+    ScopedPhase phase("Dump");
+    const TypeTreeStore& type_tree_store =
+        *histogram_builder_results.value()->type_tree_store;
+    if (dump_unresolved_callstacks) {
+      // do nothing.
+    } else if (absl::GetFlag(FLAGS_layout_advice)) {
+      LayoutAdvisor advisor;
+      advisor.AddTypeTreeStore(type_tree_store);
+      DumpLayoutAdvice(advisor.Advise(), GetDumpStreamFromFlags(), limit);
+    } else if (absl::GetFlag(FLAGS_flamegraph)) {
+      std::unique_ptr<FlameGraphWriter> writer =
+          CreateFlameGraphWriterFromFlags();
+      type_tree_store.DumpFlamegraph(*writer, limit, /*first_id=*/1,
+                                     GetFlameGraphValueFromFlags());
+      if (absl::Status status = writer->Finish(); !status.ok()) {
+        LOG(ERROR) << "Failed to dump flamegraph: " << status;
+        return 1;
+      }
+    } else {
+      type_tree_store.Dump(GetDumpStreamFromFlags(), limit);
+    }
   }
-
   if (stats) {
     histogram_builder_results.value()->stats.Log();
   }
-  return 0;
+
+  if (const std::string histogram_out = absl::GetFlag(FLAGS_histogram_out);
+      !histogram_out.empty()) {
+    if (absl::Status status =
+            WriteHistogramFile(**histogram_builder_results, histogram_out);
+        !status.ok()) {
+      LOG(ERROR) << "Failed to write histogram: " << status;
+      return 1;
+    }
+  }
+  ReportPerfStats(stats);
+  return FlushDumpStream() ? 0 : 1;
 }
@@ -0,0 +1,73 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flamegraph_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+void FlameGraphWriter::Write(absl::string_view stack, uint64_t value) {
+  if (format_ == Format::kCollapsed) {
+    if (value != 0) {
+      collapsed_[stack] += value;
+    }
+    return;
+  }
+  AppendLine(stack, value);
+}
+
+absl::Status FlameGraphWriter::Finish() {
+  if (!collapsed_.empty()) {
+    std::vector<std::pair<absl::string_view, uint64_t>> lines(
+        collapsed_.begin(), collapsed_.end());
+    std::sort(lines.begin(), lines.end());
+    for (const auto& [stack, value] : lines) {
+      AppendLine(stack, value);
+    }
+    collapsed_.clear();
+  }
+  FlushBuffer();
+  out_.flush();
+  if (status_.ok() && !out_) {
+    status_ = absl::InternalError("Failed to write flamegraph");
+  }
+  return status_;
+}
+
+void FlameGraphWriter::AppendLine(absl::string_view stack, uint64_t value) {
+  absl::StrAppend(&buffer_, stack, " ", value, "\n");
+  if (buffer_.size() >= kBufferBytes) {
+    FlushBuffer();
+  }
+}
+
+void FlameGraphWriter::FlushBuffer() {
+  if (buffer_.empty() || !status_.ok()) {
+    buffer_.clear();
+    return;
+  }
+  out_.write(buffer_.data(), buffer_.size());
+  buffer_.clear();
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLAMEGRAPH_WRITER_H_
+#define FLAMEGRAPH_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Writes the lines of a flamegraph, "frame;...;frame value" as read by
+// flamegraph.pl, to a stream. Lines are appended to a buffer that is written
+// out in large blocks, instead of a stream write per frame.
+class FlameGraphWriter {
+ public:
+  enum class Format {
+    // One line per stack, in the order they are written.
+    kLines,
+    // Identical stacks summed into a single line, sorted by stack. Stacks
+    // without a value are left out, flamegraph.pl infers them from the stacks
+    // they prefix.
+    kCollapsed,
+  };
+
+  // Size of the blocks written to the stream.
+  static constexpr size_t kBufferBytes = 1 << 20;
+
+  explicit FlameGraphWriter(std::ostream& out, Format format = Format::kLines)
+      : out_(out), format_(format) {}
+  FlameGraphWriter(const FlameGraphWriter&) = delete;
+  FlameGraphWriter& operator=(const FlameGraphWriter&) = delete;
+
+  Format format() const { return format_; }
+
+  // Writes 'value' for 'stack', whose frames are joined with ';'.
+  void Write(absl::string_view stack, uint64_t value);
+
+  // Writes the buffered lines, and all lines of the collapsed format, to the
+  // stream. Must be called once all stacks are written. Returns the first
+  // error of the writes so far.
+  absl::Status Finish();
+
+ private:
+  void AppendLine(absl::string_view stack, uint64_t value);
+  void FlushBuffer();
+
+  std::ostream& out_;
+  Format format_;
+  std::string buffer_;
+  // The summed values of the collapsed format, by stack.
+  absl::flat_hash_map<std::string, uint64_t> collapsed_;
+  absl::Status status_;
+};
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // FLAMEGRAPH_WRITER_H_
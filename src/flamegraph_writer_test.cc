@@ -0,0 +1,78 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flamegraph_writer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+constexpr char kLines[] =
+    "A_0|A| 0\n"
+    "A_0|A|;0|int|x 3\n"
+    "A_0|A|;4|int|y 0\n"
+    "B_0|B| 0\n"
+    "A_0|A|;0|int|x 2\n";
+
+void WriteStacks(FlameGraphWriter& writer) {
+  writer.Write("A_0|A|", 0);
+  writer.Write("A_0|A|;0|int|x", 3);
+  writer.Write("A_0|A|;4|int|y", 0);
+  writer.Write("B_0|B|", 0);
+  writer.Write("A_0|A|;0|int|x", 2);
+}
+
+TEST(FlameGraphWriterTest, WritesLinesInOrder) {
+  std::ostringstream out;
+  FlameGraphWriter writer(out);
+  WriteStacks(writer);
+  ASSERT_TRUE(writer.Finish().ok());
+  EXPECT_EQ(out.str(), kLines);
+}
+
+TEST(FlameGraphWriterTest, SumsCollapsedStacks) {
+  std::ostringstream out;
+  FlameGraphWriter writer(out, FlameGraphWriter::Format::kCollapsed);
+  WriteStacks(writer);
+  writer.Write("0|B|;0|char|c", 1);
+  ASSERT_TRUE(writer.Finish().ok());
+  EXPECT_EQ(out.str(),
+            "0|B|;0|char|c 1\n"
+            "A_0|A|;0|int|x 5\n");
+}
+
+TEST(FlameGraphWriterTest, WritesLargeOutputInBlocks) {
+  std::ostringstream out;
+  FlameGraphWriter writer(out);
+  const std::string stack(100, 'a');
+  std::string expected;
+  for (size_t i = 0; i < 2 * FlameGraphWriter::kBufferBytes / stack.size();
+       ++i) {
+    writer.Write(stack, i);
+    expected += stack + " " + std::to_string(i) + "\n";
+  }
+  // Blocks are written before Finish.
+  EXPECT_GE(out.str().size(), FlameGraphWriter::kBufferBytes);
+  ASSERT_TRUE(writer.Finish().ok());
+  EXPECT_EQ(out.str(), expected);
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
@@ -16,10 +16,12 @@
 
 #include <sys/types.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -38,6 +40,7 @@
 #include "absl/types/span.h"
 #include "binary_file_retriever.h"
 #include "dwarf_metadata_fetcher.h"
+#include "flamegraph_writer.h"
 #include "llvm/include/llvm/ADT/StringExtras.h"
 #include "llvm/include/llvm/Demangle/Demangle.h"
 #include "llvm/include/llvm/Object/Binary.h"
@@ -48,6 +51,8 @@
 #include "llvm/include/llvm/Support/Error.h"
 #include "llvm/include/llvm/Support/ErrorOr.h"
 #include "llvm/include/llvm/Support/MemoryBuffer.h"
+#include "parallel_for.h"
+#include "perf_stats.h"
 #include "src/object_layout.pb.h"
 #include "status_macros.h"
 #include "type_resolver.h"
@@ -57,15 +62,72 @@ namespace devtools_crosstool_fdo_field_access {
 
 using llvm::memprof::RawMemProfReader;
 
-constexpr char kCacheDir[] = "/tmp/dwarf_metadata";
+// Number of shards of allocation sites per build thread.
+constexpr size_t kAllocSiteShardsPerThread = 4;
+
+// Number of allocation sites per build thread read at once by a streaming
+// build.
+constexpr size_t kStreamingAllocSitesPerThread = 1024;
 
 namespace {
 
 double Percentify(uint64_t value, uint64_t total) {
   return 100.0 * ((double)value / (double)total);
 }
+
+// Returns the histograms of all counters memprof recorded for 'alloc_info',
+// so that they are attributed to the fields in a single walk of the type
+// tree. Raw memprof profiles only have access counts for now; the histograms
+// of other counters, e.g. of LLC misses, go here once memprof records them.
+std::vector<TypeTree::CounterHistogram> GetCounterHistograms(
+    const llvm::memprof::AllocationInfo& alloc_info) {
+  return {{.type = TypeTree::AccessCounters::kAccess,
+           .histogram = absl::MakeConstSpan(
+               reinterpret_cast<const uint64_t*>(
+                   alloc_info.Info.getAccessHistogram()),
+               alloc_info.Info.getAccessHistogramSize())}};
+}
+
+absl::Status CheckAllocSiteSampling(const AllocSiteSampling& sampling) {
+  if (!(sampling.access_coverage_percent >= 0 &&
+        sampling.access_coverage_percent <= 100)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid access coverage ",
+                     sampling.access_coverage_percent,
+                     "%, must be in [0, 100]."));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CheckHistogramGranularity(uint32_t histogram_granularity) {
+  if (!TypeTree::IsSupportedAccessGranularity(histogram_granularity)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Invalid histogram granularity ", histogram_granularity,
+        ", must be a power of two of at most ",
+        TypeTree::kMaxAccessGranularity, " bytes."));
+  }
+  return absl::OkStatus();
+}
 }  // namespace
 
+void Statistics::MergeFrom(const Statistics& other) {
+  total_allocations_count += other.total_allocations_count;
+  total_found_type += other.total_found_type;
+  total_verified += other.total_verified;
+  heap_alloc_count += other.heap_alloc_count;
+  container_alloc_count += other.container_alloc_count;
+  total_record_count += other.total_record_count;
+  total_after_filtering += other.total_after_filtering;
+  duplicate_callstack_count += other.duplicate_callstack_count;
+  misaligned_histogram_count += other.misaligned_histogram_count;
+  total_accesses += other.total_accesses;
+  total_accesses_on_heapallocs += other.total_accesses_on_heapallocs;
+  total_accesses_on_containers += other.total_accesses_on_containers;
+  total_accesses_on_records += other.total_accesses_on_records;
+  sampled_out_alloc_count += other.sampled_out_alloc_count;
+  sampled_out_accesses += other.sampled_out_accesses;
+}
+
 void Statistics::Log() const {
   LOG(INFO) << "- \n"
             << " ====== Statistics ======\n"
@@ -77,6 +139,9 @@ void Statistics::Log() const {
             << "Total duplicate callstack: " << duplicate_callstack_count << "("
             << Percentify(duplicate_callstack_count, total_allocations_count)
             << "%)\n"
+            << "Misaligned histograms: " << misaligned_histogram_count << "("
+            << Percentify(misaligned_histogram_count, total_allocations_count)
+            << "%)\n"
             << "Total verified: " << total_verified << "("
             << Percentify(total_verified, total_allocations_count) << "%)\n"
             << "Heap alloc count: " << heap_alloc_count << "("
@@ -99,6 +164,8 @@ void Statistics::Log() const {
             << "%)\n"
             << "Total accesses on records: " << total_accesses_on_records << "("
             << Percentify(total_accesses_on_records, total_accesses) << "%)\n"
+            << "Sampled out allocations: " << sampled_out_alloc_count << "\n"
+            << "Sampled out accesses: " << sampled_out_accesses << "\n"
             << " ======    End    ======\n";
 }
 
@@ -116,7 +183,7 @@ absl::StatusOr<std::string> GetBuildIdForLocalFile(
                      /*lowercase=*/true);
 }  // namespace
 
-void LogCallStackAndTypeTree(const TypeTreeStore::CallStack& callstack,
+void LogCallStackAndTypeTree(const TypeTreeStore::CallStackView& callstack,
                              const TypeTree* type_tree, bool verify_verbose) {
   if (verify_verbose) {
     std::stringstream error_string;
@@ -132,103 +199,332 @@ void LogCallStackAndTypeTree(const TypeTreeStore::CallStack& callstack,
   }
 }
 
-absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
-LocalHistogramBuilder::BuildHistogram() {
-  Statistics stats;
-  auto type_tree_store = std::make_unique<TypeTreeStore>();
-  for (const auto& [unused, record] : *memprof_reader_) {
-    for (const llvm::memprof::AllocationInfo& alloc_info : record.AllocSites) {
-      bool log = false;
-      QCHECK(!alloc_info.CallStack.empty()) << "Empty callstack for allocation";
-      TypeTreeStore::CallStack callstack =
-          TypeTreeStore::ConvertCallStack(alloc_info.CallStack);
-      if (FilterCallstack(callstack)) {
-        continue;
-      }
-      stats.total_allocations_count++;
-
-      auto status_or_type_tree = dwarf_type_resolver_->ResolveTypeFromCallstack(
-          callstack, alloc_info.Info.getAccessHistogramSize() * 8);
-
-      if (!status_or_type_tree.ok()) {
-        if (verify_verbose_) {
-          LOG(WARNING) << "Failed to resolve type from callstack: \n"
-                       << status_or_type_tree.status();
-          LogCallStackAndTypeTree(callstack, nullptr, verify_verbose_);
-        }
-        if (dump_unresolved_callstacks_) {
-          TypeTreeStore::DumpCallStack(callstack, std::cout, /*level=*/0,
-                                       /*as_entry=*/true);
-        }
-        continue;
-      }
-      stats.total_found_type++;
+absl::Status LocalHistogramBuilder::BuildHistogramForAllocSite(
+    const llvm::memprof::AllocationInfo& alloc_info, Statistics* stats,
+    TypeTreeStore* type_tree_store, std::ostream& unresolved_out) const {
+  bool log = false;
+  QCHECK(!alloc_info.CallStack.empty()) << "Empty callstack for allocation";
+  // The frames borrow the symbol names of the profile, no string is copied
+  // until the callstack is interned into the store.
+  const TypeTreeStore::CallStackView callstack =
+      TypeTreeStore::ViewCallStack(alloc_info.CallStack);
+  if (FilterCallstack(callstack)) {
+    return absl::OkStatus();
+  }
+  stats->total_allocations_count++;
 
-      std::unique_ptr<TypeTree> type_tree =
-          std::move(status_or_type_tree.value());
+  // The resolver times the resolution by strategy.
+  auto status_or_type_tree = dwarf_type_resolver_->ResolveTypeFromCallstack(
+      callstack,
+      alloc_info.Info.getAccessHistogramSize() * histogram_granularity_);
 
-      if (FilterType(type_tree->Name())) {
-        continue;
-      }
+  if (!status_or_type_tree.ok()) {
+    if (verify_verbose_) {
+      LOG(WARNING) << "Failed to resolve type from callstack: \n"
+                   << status_or_type_tree.status();
+      LogCallStackAndTypeTree(callstack, nullptr, verify_verbose_);
+    }
+    if (dump_unresolved_callstacks_) {
+      TypeTreeStore::DumpCallStack(callstack, unresolved_out, /*level=*/0,
+                                   /*as_entry=*/true);
+    }
+    return absl::OkStatus();
+  }
+  stats->total_found_type++;
 
-      stats.total_after_filtering++;
+  std::unique_ptr<TypeTree> type_tree = std::move(status_or_type_tree.value());
 
-      if (type_tree->IsRecordType()) {
-        stats.total_record_count++;
-      }
+  if (FilterType(type_tree->Name())) {
+    return absl::OkStatus();
+  }
 
-      if (only_records_ && !type_tree->IsRecordType()) {
-        continue;
-      }
+  stats->total_after_filtering++;
 
-      absl::Status status = type_tree->RecordAccessHistogram<
-          kMemprofHistogramGranularity,
-          TypeTree::AccessCounters::AccessType::kAccess>(
-          (uint64_t*)alloc_info.Info.getAccessHistogram(),
-          alloc_info.Info.getAccessHistogramSize());
-      if (!status.ok()) {
-        log = true;
-        if (verify_verbose_) {
-          LOG(WARNING) << "Collapsing histogram does not precisely align with "
-                          "type size, counters may be distorted for: \n";
-        }
-      }
+  if (type_tree->IsRecordType()) {
+    stats->total_record_count++;
+  }
 
-      if (!type_tree->Verify(verify_verbose_)) {
-        LogCallStackAndTypeTree(callstack, type_tree.get(), verify_verbose_);
-      }
+  if (only_records_ && !type_tree->IsRecordType()) {
+    return absl::OkStatus();
+  }
 
-      stats.total_verified++;
+  const std::vector<TypeTree::CounterHistogram> counter_histograms =
+      GetCounterHistograms(alloc_info);
+  uint32_t remainder_buckets = 0;
+  absl::Status status;
+  {
+    static PerfPhase& record_phase =
+        PerfStats::Global().Phase("RecordAccessHistograms");
+    ScopedPhase phase(record_phase, /*trace=*/false);
+    status = type_tree->RecordAccessHistograms(
+        histogram_granularity_, counter_histograms, &remainder_buckets);
+  }
+  if (!status.ok()) {
+    log = true;
+    if (verify_verbose_) {
+      LOG(WARNING) << "Failed to record access histogram: " << status
+                   << "\n";
+    }
+  } else if (remainder_buckets != 0) {
+    log = true;
+    stats->misaligned_histogram_count++;
+    if (verify_verbose_) {
+      LOG(WARNING) << "Collapsing histogram does not precisely align with "
+                      "type size, "
+                   << remainder_buckets
+                   << " remainder buckets, counters may be distorted for: \n";
+    }
+  }
 
-      stats.total_accesses += type_tree->Root()->GetTotalAccessCount();
+  bool verified = true;
+  if (verify_mode_ == VerifyMode::kOnce &&
+      type_tree->SkeletonVerified().has_value()) {
+    verified = *type_tree->SkeletonVerified();
+  } else if (verify_mode_ != VerifyMode::kNone) {
+    static PerfPhase& verify_phase =
+        PerfStats::Global().Phase("VerifyTypeTree");
+    ScopedPhase phase(verify_phase, /*trace=*/false);
+    verified = type_tree->Verify(verify_verbose_);
+  }
+  if (!verified) {
+    LogCallStackAndTypeTree(callstack, type_tree.get(), verify_verbose_);
+  }
 
-      if (type_tree->FromContainer()) {
-        stats.container_alloc_count++;
-        stats.total_accesses_on_containers +=
-            type_tree->Root()->GetTotalAccessCount();
-      } else {
-        stats.heap_alloc_count++;
-        stats.total_accesses_on_heapallocs +=
-            type_tree->Root()->GetTotalAccessCount();
-      }
+  stats->total_verified++;
+
+  stats->total_accesses += type_tree->Root()->GetTotalAccessCount();
+
+  if (type_tree->FromContainer()) {
+    stats->container_alloc_count++;
+    stats->total_accesses_on_containers +=
+        type_tree->Root()->GetTotalAccessCount();
+  } else {
+    stats->heap_alloc_count++;
+    stats->total_accesses_on_heapallocs +=
+        type_tree->Root()->GetTotalAccessCount();
+  }
+
+  if (type_tree->IsRecordType()) {
+    stats->total_accesses_on_records +=
+        type_tree->Root()->GetTotalAccessCount();
+  }
+
+  if (log) {
+    LogCallStackAndTypeTree(callstack, type_tree.get(), verify_verbose_);
+  }
+  static PerfPhase& insert_phase =
+      PerfStats::Global().Phase("TypeTreeStore::Insert");
+  ScopedPhase phase(insert_phase, /*trace=*/false);
+  return type_tree_store->Insert(alloc_info.CallStack, std::move(type_tree));
+}
+
+absl::Status LocalHistogramBuilder::BuildHistogramForAllocSites(
+    absl::Span<const llvm::memprof::AllocationInfo> alloc_sites,
+    Statistics* stats, TypeTreeStore* type_tree_store) const {
+  if (build_thread_count_ <= 1) {
+    for (const llvm::memprof::AllocationInfo& alloc_info : alloc_sites) {
+      RETURN_IF_ERROR(BuildHistogramForAllocSite(alloc_info, stats,
+                                                 type_tree_store, std::cout));
+    }
+    return absl::OkStatus();
+  }
+
+  // Shards are contiguous ranges of allocation sites, merged in order, which
+  // keeps the results and the dumped callstacks in the same order as the
+  // serial build. There are more shards than threads, so that a few slow
+  // shards do not leave the other threads idle.
+  struct Shard {
+    size_t begin = 0;
+    size_t end = 0;
+    Statistics stats;
+    TypeTreeStore type_tree_store;
+    std::ostringstream unresolved_out;
+    absl::Status status;
+  };
+  const size_t shard_count = std::min<size_t>(
+      alloc_sites.size(), build_thread_count_ * kAllocSiteShardsPerThread);
+  std::vector<Shard> shards(shard_count);
+  for (size_t i = 0; i < shard_count; ++i) {
+    shards[i].begin = alloc_sites.size() * i / shard_count;
+    shards[i].end = alloc_sites.size() * (i + 1) / shard_count;
+  }
 
-      if (type_tree->IsRecordType()) {
-        stats.total_accesses_on_records +=
-            type_tree->Root()->GetTotalAccessCount();
+  ParallelFor(shard_count, build_thread_count_, [&](size_t i) {
+    ScopedPhase phase("BuildHistogramShard");
+    Shard& shard = shards[i];
+    for (size_t site = shard.begin; site < shard.end && shard.status.ok();
+         ++site) {
+      shard.status = BuildHistogramForAllocSite(
+          alloc_sites[site], &shard.stats, &shard.type_tree_store,
+          shard.unresolved_out);
+    }
+  });
+
+  ScopedPhase phase("MergeHistogramShards");
+  for (Shard& shard : shards) {
+    std::cout << shard.unresolved_out.str();
+    RETURN_IF_ERROR(shard.status);
+    stats->MergeFrom(shard.stats);
+    RETURN_IF_ERROR(type_tree_store->MergeFrom(shard.type_tree_store));
+  }
+  return absl::OkStatus();
+}
+
+std::vector<bool> LocalHistogramBuilder::SampleAllocSites(
+    Statistics* stats) const {
+  if (!sampling_.Enabled()) {
+    return {};
+  }
+  ScopedPhase phase("SampleAllocSites");
+  // Only the access counts are read here, no site is resolved. The sites
+  // outside of the shard, or left out by the callstack filter, are never
+  // built, so they are not ranked: they would otherwise take places among the
+  // top sites and count towards the coverage.
+  std::vector<uint64_t> access_counts;
+  std::vector<size_t> ranked;
+  uint64_t total_accesses = 0;
+  for (const auto& [unused, record] : *memprof_reader_) {
+    for (const llvm::memprof::AllocationInfo& alloc_info : record.AllocSites) {
+      const size_t index = access_counts.size();
+      access_counts.push_back(alloc_info.Info.getTotalAccessCount());
+      if (shard_.Contains(index) &&
+          !FilterCallstack(
+              TypeTreeStore::ViewCallStack(alloc_info.CallStack))) {
+        ranked.push_back(index);
+        total_accesses += access_counts[index];
       }
+    }
+  }
+  // Ties are kept in profile order, so that the same sites are selected on
+  // every run.
+  std::stable_sort(ranked.begin(), ranked.end(), [&](size_t a, size_t b) {
+    return access_counts[a] > access_counts[b];
+  });
 
-      if (log) {
-        LogCallStackAndTypeTree(callstack, type_tree.get(), verify_verbose_);
+  const double coverage_target = sampling_.access_coverage_percent / 100.0 *
+                                 static_cast<double>(total_accesses);
+  std::vector<bool> sampled(access_counts.size(), false);
+  uint64_t covered_accesses = 0;
+  for (size_t rank = 0; rank < ranked.size(); ++rank) {
+    const size_t index = ranked[rank];
+    const bool top = sampling_.top_sites == 0 || rank < sampling_.top_sites;
+    const bool uncovered =
+        sampling_.access_coverage_percent <= 0 ||
+        static_cast<double>(covered_accesses) < coverage_target;
+    if (top && uncovered) {
+      sampled[index] = true;
+      covered_accesses += access_counts[index];
+    } else {
+      stats->sampled_out_alloc_count++;
+      stats->sampled_out_accesses += access_counts[index];
+    }
+  }
+  return sampled;
+}
+
+absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
+LocalHistogramBuilder::BuildHistogram() {
+  ScopedPhase phase("BuildHistogram");
+  Statistics stats;
+  auto type_tree_store = std::make_unique<TypeTreeStore>();
+  if (build_thread_count_ <= 1 && shard_.count <= 1 && !sampling_.Enabled()) {
+    for (const auto& [unused, record] : *memprof_reader_) {
+      RETURN_IF_ERROR(BuildHistogramForAllocSites(record.AllocSites, &stats,
+                                                  type_tree_store.get()));
+    }
+    return std::make_unique<HistogramBuilderResults>(
+        std::move(type_tree_store), stats);
+  }
+
+  // The reader hands out records one at a time, so the allocation sites of
+  // the shard are copied out before sharding them between the build threads.
+  // The access histograms they point to remain owned by the reader.
+  const std::vector<bool> sampled = SampleAllocSites(&stats);
+  std::vector<llvm::memprof::AllocationInfo> alloc_sites;
+  size_t alloc_site_index = 0;
+  for (const auto& [unused, record] : *memprof_reader_) {
+    for (const llvm::memprof::AllocationInfo& alloc_info : record.AllocSites) {
+      const size_t index = alloc_site_index++;
+      if (shard_.Contains(index) && (sampled.empty() || sampled[index])) {
+        alloc_sites.push_back(alloc_info);
       }
-      RETURN_IF_ERROR(
-          type_tree_store->Insert(alloc_info.CallStack, std::move(type_tree)));
     }
   }
+  RETURN_IF_ERROR(
+      BuildHistogramForAllocSites(alloc_sites, &stats, type_tree_store.get()));
+  return std::make_unique<HistogramBuilderResults>(std::move(type_tree_store),
+                                                   stats);
+}
 
+absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
+MergeHistogramBuilderResults(
+    absl::Span<const std::unique_ptr<HistogramBuilderResults>>
+        partial_results) {
+  Statistics stats;
+  auto type_tree_store = std::make_unique<TypeTreeStore>();
+  for (const auto& partial_result : partial_results) {
+    stats.MergeFrom(partial_result->stats);
+    RETURN_IF_ERROR(
+        type_tree_store->MergeFrom(*partial_result->type_tree_store));
+  }
   return std::make_unique<HistogramBuilderResults>(std::move(type_tree_store),
                                                    stats);
 }
 
+absl::StatusOr<Statistics> AbstractHistogramBuilder::BuildHistogramStreaming(
+    size_t memory_budget_bytes,
+    absl::FunctionRef<absl::Status(const TypeTreeStore&)> flush) {
+  ASSIGN_OR_RETURN(std::unique_ptr<HistogramBuilderResults> results,
+                   BuildHistogram());
+  RETURN_IF_ERROR(flush(*results->type_tree_store));
+  return results->stats;
+}
+
+absl::StatusOr<Statistics> LocalHistogramBuilder::BuildHistogramStreaming(
+    size_t memory_budget_bytes,
+    absl::FunctionRef<absl::Status(const TypeTreeStore&)> flush) {
+  ScopedPhase phase("BuildHistogramStreaming");
+  Statistics stats;
+  TypeTreeStore type_tree_store;
+  // Allocation sites are copied out of the reader records, like in
+  // BuildHistogram, but only one chunk at a time.
+  const size_t chunk_size =
+      std::max<size_t>(build_thread_count_, 1) * kStreamingAllocSitesPerThread;
+  std::vector<llvm::memprof::AllocationInfo> chunk;
+  chunk.reserve(chunk_size);
+  auto build_chunk = [&]() -> absl::Status {
+    RETURN_IF_ERROR(
+        BuildHistogramForAllocSites(chunk, &stats, &type_tree_store));
+    chunk.clear();
+    if (type_tree_store.ApproximateMemoryBytes() > memory_budget_bytes) {
+      ScopedPhase flush_phase("FlushTypeTreeStore");
+      RETURN_IF_ERROR(flush(type_tree_store));
+      type_tree_store.Clear();
+    }
+    return absl::OkStatus();
+  };
+
+  const std::vector<bool> sampled = SampleAllocSites(&stats);
+  size_t alloc_site_index = 0;
+  for (const auto& [unused, record] : *memprof_reader_) {
+    for (const llvm::memprof::AllocationInfo& alloc_info : record.AllocSites) {
+      const size_t index = alloc_site_index++;
+      if (!shard_.Contains(index) || (!sampled.empty() && !sampled[index])) {
+        continue;
+      }
+      chunk.push_back(alloc_info);
+      if (chunk.size() >= chunk_size) {
+        RETURN_IF_ERROR(build_chunk());
+      }
+    }
+  }
+  RETURN_IF_ERROR(build_chunk());
+  if (!type_tree_store.callstack_to_type_tree_.empty()) {
+    RETURN_IF_ERROR(flush(type_tree_store));
+  }
+  return stats;
+}
+
 void TypeTreeStore::Dump(std::ostream& os, int64_t limit) const {
   // If negative, print all.
   int64_t N = limit < 0 ? callstack_to_type_tree_.size() : limit;
@@ -241,12 +537,22 @@ void TypeTreeStore::Dump(std::ostream& os, int64_t limit) const {
     os << "    type_tree: \n";
     type_tree->Dump(os, 3);
     os << "    callstack: \n";
-    DumpCallStack(callstack, os, 3);
+    DumpCallStack(GetCallStack(callstack), os, 3);
     i++;
   }
 }
 
-void TypeTreeStore::DumpFlamegraph(std::ostream& os, int64_t limit) const {
+void TypeTreeStore::DumpFlamegraph(std::ostream& os, int64_t limit,
+                                   int64_t first_id,
+                                   TypeTree::FlameGraphValue value) const {
+  FlameGraphWriter writer(os);
+  DumpFlamegraph(writer, limit, first_id, value);
+  writer.Finish().IgnoreError();
+}
+
+void TypeTreeStore::DumpFlamegraph(FlameGraphWriter& writer, int64_t limit,
+                                   int64_t first_id,
+                                   TypeTree::FlameGraphValue value) const {
   // If negative, print all.
   int64_t N = limit < 0 ? callstack_to_type_tree_.size() : limit;
   int64_t i = 0;
@@ -254,33 +560,205 @@ void TypeTreeStore::DumpFlamegraph(std::ostream& os, int64_t limit) const {
     if (i >= N) {
       return;
     }
-    type_tree->DumpFlameGraph(os, i + 1);
+    type_tree->DumpFlameGraph(writer, first_id + i, value);
     i++;
   }
 }
 
+size_t TypeTreeStore::EntryMemoryBytes(const InternedCallStack& callstack,
+                                       const TypeTree& type_tree) {
+  return sizeof(callstack) + sizeof(std::shared_ptr<TypeTree>) +
+         sizeof(TypeTree) +
+         callstack.frame_ids().size() * sizeof(FrameTable::FrameId) +
+         type_tree.NodeCount() *
+             (sizeof(TypeTree::Node) + sizeof(TypeTree::AccessCounters));
+}
+
+void TypeTreeStore::Clear() {
+  callstack_to_type_tree_.clear();
+  frame_table_.Clear();
+  callstack_trie_.clear();
+  frame_trie_nodes_.clear();
+  type_index_.clear();
+  memory_bytes_ = 0;
+}
+
+namespace {
+
+DwarfMetadataFetcher::FrameView ViewFrame(const llvm::memprof::Frame& frame) {
+  if (!frame.hasSymbolName()) {
+    return DwarfMetadataFetcher::FrameView("<none>", frame.LineOffset,
+                                           frame.Column);
+  }
+  const llvm::StringRef name = frame.getSymbolName();
+  return DwarfMetadataFetcher::FrameView(
+      absl::string_view(name.data(), name.size()), frame.LineOffset,
+      frame.Column);
+}
+
+}  // namespace
+
 TypeTreeStore::CallStack TypeTreeStore::ConvertCallStack(
     absl::Span<const llvm::memprof::Frame> callstack) {
   std::vector<DwarfMetadataFetcher::Frame> dwarf_callstack;
   dwarf_callstack.reserve(callstack.size());
   for (const auto& frame : callstack) {
-    dwarf_callstack.push_back(DwarfMetadataFetcher::Frame(
-        frame.hasSymbolName() ? frame.getSymbolName().str() : "<none>",
-        frame.LineOffset, frame.Column));
+    dwarf_callstack.push_back(ViewFrame(frame).ToFrame());
   }
   return dwarf_callstack;
 }
 
+TypeTreeStore::CallStackView TypeTreeStore::ViewCallStack(
+    absl::Span<const llvm::memprof::Frame> callstack) {
+  CallStackView view;
+  view.reserve(callstack.size());
+  for (const auto& frame : callstack) {
+    view.push_back(ViewFrame(frame));
+  }
+  return view;
+}
+
+FrameTable::FrameId FrameTable::Intern(
+    const DwarfMetadataFetcher::FrameView& frame) {
+  auto it = ids_.find(frame);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  const FrameId id = static_cast<FrameId>(frames_.size());
+  // The key views the name owned by the table, not the one passed in.
+  const DwarfMetadataFetcher::Frame& interned =
+      frames_.emplace_back(frame.ToFrame());
+  ids_.emplace(interned, id);
+  auto [function_it, inserted] =
+      ids_by_function_.try_emplace(interned.function_name);
+  function_it->second.push_back(id);
+  memory_bytes_ += sizeof(interned) + sizeof(DwarfMetadataFetcher::FrameView) +
+                   2 * sizeof(FrameId) + interned.function_name.capacity();
+  if (inserted) {
+    memory_bytes_ += sizeof(absl::string_view) + sizeof(std::vector<FrameId>);
+  }
+  return id;
+}
+
+void FrameTable::Clear() {
+  ids_.clear();
+  ids_by_function_.clear();
+  frames_.clear();
+  memory_bytes_ = 0;
+}
+
+std::optional<FrameTable::FrameId> FrameTable::Find(
+    const DwarfMetadataFetcher::FrameView& frame) const {
+  auto it = ids_.find(frame);
+  if (it == ids_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+absl::Span<const FrameTable::FrameId> FrameTable::FindFunction(
+    absl::string_view function_name) const {
+  auto it = ids_by_function_.find(function_name);
+  if (it == ids_by_function_.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+namespace {
+
+template <typename Frames>
+InternedCallStack InternFrames(const Frames& callstack,
+                               FrameTable& frame_table) {
+  std::vector<FrameTable::FrameId> frame_ids;
+  frame_ids.reserve(callstack.size());
+  for (const auto& frame : callstack) {
+    frame_ids.push_back(frame_table.Intern(frame));
+  }
+  return InternedCallStack(std::move(frame_ids));
+}
+
+template <typename Frames>
+std::optional<InternedCallStack> FindFrames(const Frames& callstack,
+                                            const FrameTable& frame_table) {
+  std::vector<FrameTable::FrameId> frame_ids;
+  frame_ids.reserve(callstack.size());
+  for (const auto& frame : callstack) {
+    std::optional<FrameTable::FrameId> id = frame_table.Find(frame);
+    if (!id.has_value()) {
+      return std::nullopt;
+    }
+    frame_ids.push_back(*id);
+  }
+  return InternedCallStack(std::move(frame_ids));
+}
+
+}  // namespace
+
+InternedCallStack TypeTreeStore::Intern(const CallStack& callstack) {
+  return InternFrames(callstack, frame_table_);
+}
+
+InternedCallStack TypeTreeStore::Intern(const CallStackView& callstack) {
+  return InternFrames(callstack, frame_table_);
+}
+
+InternedCallStack TypeTreeStore::Intern(
+    absl::Span<const llvm::memprof::Frame> callstack) {
+  // Same frames as ConvertCallStack, without building their strings.
+  std::vector<FrameTable::FrameId> frame_ids;
+  frame_ids.reserve(callstack.size());
+  for (const auto& frame : callstack) {
+    frame_ids.push_back(frame_table_.Intern(ViewFrame(frame)));
+  }
+  return InternedCallStack(std::move(frame_ids));
+}
+
+std::optional<InternedCallStack> TypeTreeStore::Find(
+    const CallStack& callstack) const {
+  return FindFrames(callstack, frame_table_);
+}
+
+std::optional<InternedCallStack> TypeTreeStore::Find(
+    const CallStackView& callstack) const {
+  return FindFrames(callstack, frame_table_);
+}
+
+TypeTreeStore::CallStack TypeTreeStore::GetCallStack(
+    const InternedCallStack& callstack) const {
+  CallStack frames;
+  frames.reserve(callstack.frame_ids().size());
+  for (FrameTable::FrameId id : callstack.frame_ids()) {
+    frames.push_back(frame_table_.Get(id));
+  }
+  return frames;
+}
+
 absl::StatusOr<const TypeTree*> TypeTreeStore::InsertAndGet(
     const CallStack& callstack,
     std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree> type_tree) {
-  RETURN_IF_ERROR(Insert(callstack, std::move(type_tree)));
-  return callstack_to_type_tree_[callstack].get();
+  InternedCallStack interned = Intern(callstack);
+  RETURN_IF_ERROR(Insert(interned, std::move(type_tree)));
+  return callstack_to_type_tree_[interned].get();
+}
+
+absl::StatusOr<const TypeTree*> TypeTreeStore::InsertAndGet(
+    const CallStackView& callstack,
+    std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree> type_tree) {
+  InternedCallStack interned = Intern(callstack);
+  RETURN_IF_ERROR(Insert(interned, std::move(type_tree)));
+  return callstack_to_type_tree_[interned].get();
 }
 
 absl::Status TypeTreeStore::Insert(
     const CallStack& callstack,
     std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree> type_tree) {
+  return Insert(Intern(callstack), std::move(type_tree));
+}
+
+absl::Status TypeTreeStore::Insert(
+    InternedCallStack callstack,
+    std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree> type_tree) {
   if (!type_tree) {
     return absl::InvalidArgumentError("TypeTree is null.");
   }
@@ -292,26 +770,235 @@ absl::Status TypeTreeStore::Insert(
           "Trying to insert different type trees for the same callstack",
           curr_type_tree->Name(), " vs ", type_tree->Name()));
     }
+    IndexTypeTree(callstack, *type_tree, /*is_new=*/false);
     RETURN_IF_ERROR(type_tree->MergeCounts(curr_type_tree));
+    memory_bytes_ += EntryMemoryBytes(callstack, *type_tree) -
+                     EntryMemoryBytes(callstack, *curr_type_tree);
+    it->second = std::move(type_tree);
+    return absl::OkStatus();
   }
-  callstack_to_type_tree_[callstack] = std::move(type_tree);
+  IndexTypeTree(callstack, *type_tree, /*is_new=*/true);
+  memory_bytes_ += EntryMemoryBytes(callstack, *type_tree);
+  callstack_to_type_tree_.emplace(std::move(callstack), std::move(type_tree));
   return absl::OkStatus();
 }
 
+absl::Status TypeTreeStore::MergeFrom(TypeTreeStore& other) {
+  // The frame ids of 'other' are translated to the frame table of this store,
+  // interning each frame of 'other' at most once.
+  constexpr FrameTable::FrameId kNotInterned = ~FrameTable::FrameId{0};
+  std::vector<FrameTable::FrameId> frame_ids(other.frame_table_.size(),
+                                             kNotInterned);
+  for (auto& [other_callstack, type_tree] : other.callstack_to_type_tree_) {
+    std::vector<FrameTable::FrameId> callstack_frame_ids;
+    callstack_frame_ids.reserve(other_callstack.frame_ids().size());
+    for (FrameTable::FrameId id : other_callstack.frame_ids()) {
+      if (frame_ids[id] == kNotInterned) {
+        frame_ids[id] = frame_table_.Intern(other.frame_table_.Get(id));
+      }
+      callstack_frame_ids.push_back(frame_ids[id]);
+    }
+    InternedCallStack callstack(std::move(callstack_frame_ids));
+    auto it = callstack_to_type_tree_.find(callstack);
+    if (it == callstack_to_type_tree_.end()) {
+      IndexTypeTree(callstack, *type_tree, /*is_new=*/true);
+      memory_bytes_ += EntryMemoryBytes(callstack, *type_tree);
+      callstack_to_type_tree_.emplace(std::move(callstack),
+                                      std::move(type_tree));
+      continue;
+    }
+    if (it->second->Name() != type_tree->Name()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Trying to insert different type trees for the same callstack",
+          it->second->Name(), " vs ", type_tree->Name()));
+    }
+    IndexTypeTree(callstack, *type_tree, /*is_new=*/false);
+    // Like Insert, keep the later tree with the counts of both.
+    RETURN_IF_ERROR(type_tree->MergeCounts(it->second.get()));
+    memory_bytes_ += EntryMemoryBytes(callstack, *type_tree) -
+                     EntryMemoryBytes(callstack, *it->second);
+    it->second = std::move(type_tree);
+  }
+  other.callstack_to_type_tree_.clear();
+  other.callstack_trie_.clear();
+  other.frame_trie_nodes_.clear();
+  other.type_index_.clear();
+  other.memory_bytes_ = 0;
+  return absl::OkStatus();
+}
+
+void TypeTreeStore::IndexTypeTree(const InternedCallStack& callstack,
+                                  const TypeTree& type_tree, bool is_new) {
+  auto [it, inserted] = type_index_.try_emplace(type_tree.Name());
+  TypeIndex& index = it->second;
+  if (inserted) {
+    memory_bytes_ += sizeof(index) + it->first.capacity();
+  }
+  if (type_tree.Root() != nullptr) {
+    index.counters.total.Add(type_tree.Root()->GetAccessCounters());
+    std::vector<std::pair<absl::string_view, TypeTree::AccessCounters>>&
+        fields = index.counters.fields;
+    for (size_t i = 0; i < type_tree.Root()->NumChildren(); ++i) {
+      const TypeTree::Node& child = *type_tree.Root()->GetChild(i);
+      // The trees of a type usually have the same fields, in the same order.
+      auto field = fields.begin() + std::min(i, fields.size());
+      if (field == fields.end() || field->first != child.GetName()) {
+        field = std::find_if(fields.begin(), fields.end(), [&](const auto& f) {
+          return f.first == child.GetName();
+        });
+      }
+      if (field == fields.end()) {
+        fields.emplace_back(child.GetName(), TypeTree::AccessCounters());
+        field = fields.end() - 1;
+        memory_bytes_ += sizeof(*field);
+      }
+      field->second.Add(child.GetAccessCounters());
+    }
+  }
+  if (!is_new) {
+    return;
+  }
+  index.counters.callstack_count++;
+
+  // Each trie node but the root is a child of another one, and is listed
+  // under its frame.
+  constexpr size_t kTrieNodeBytes = sizeof(CallStackTrieNode) +
+                                    2 * sizeof(uint32_t) +
+                                    sizeof(FrameTable::FrameId);
+  // The frames of a callstack go from its allocation frame outwards.
+  if (callstack_trie_.empty()) {
+    callstack_trie_.emplace_back();
+    memory_bytes_ += kTrieNodeBytes;
+  }
+  uint32_t node = 0;
+  for (auto frame = callstack.frame_ids().rbegin();
+       frame != callstack.frame_ids().rend(); ++frame) {
+    auto [child, inserted] = callstack_trie_[node].children.try_emplace(
+        *frame, static_cast<uint32_t>(callstack_trie_.size()));
+    if (inserted) {
+      CallStackTrieNode& child_node = callstack_trie_.emplace_back();
+      memory_bytes_ += kTrieNodeBytes;
+      child_node.parent = node;
+      child_node.frame_id = *frame;
+      if (frame_trie_nodes_.size() <= *frame) {
+        frame_trie_nodes_.resize(*frame + 1);
+      }
+      frame_trie_nodes_[*frame].push_back(child->second);
+    }
+    node = child->second;
+  }
+  callstack_trie_[node].has_callstack = true;
+  index.callstack_nodes.push_back(node);
+  memory_bytes_ += sizeof(uint32_t);
+}
+
+std::vector<TypeTreeStore::CallStack> TypeTreeStore::CollectCallStacks(
+    std::vector<uint32_t> nodes) const {
+  std::vector<CallStack> callstacks;
+  std::vector<bool> visited(callstack_trie_.size(), false);
+  while (!nodes.empty()) {
+    const uint32_t node = nodes.back();
+    nodes.pop_back();
+    if (visited[node]) {
+      continue;
+    }
+    visited[node] = true;
+    if (callstack_trie_[node].has_callstack) {
+      CallStack callstack;
+      for (uint32_t n = node; n != 0; n = callstack_trie_[n].parent) {
+        callstack.push_back(frame_table_.Get(callstack_trie_[n].frame_id));
+      }
+      callstacks.push_back(std::move(callstack));
+    }
+    for (const auto& [unused, child] : callstack_trie_[node].children) {
+      nodes.push_back(child);
+    }
+  }
+  return callstacks;
+}
+
 std::vector<TypeTreeStore::CallStack> TypeTreeStore::GetCallStacksForTypeName(
     std::string root_type_name) const {
   std::vector<CallStack> callstacks;
-  for (const auto& [callstack, type_tree] : callstack_to_type_tree_) {
-    if (type_tree->Name() == root_type_name) {
-      callstacks.push_back(callstack);
+  auto it = type_index_.find(root_type_name);
+  if (it == type_index_.end()) {
+    return callstacks;
+  }
+  for (uint32_t node : it->second.callstack_nodes) {
+    CallStack& callstack = callstacks.emplace_back();
+    for (uint32_t n = node; n != 0; n = callstack_trie_[n].parent) {
+      callstack.push_back(frame_table_.Get(callstack_trie_[n].frame_id));
     }
   }
   return callstacks;
 }
 
+const TypeTreeStore::TypeFieldCounters* TypeTreeStore::GetTypeFieldCounters(
+    absl::string_view root_type_name) const {
+  auto it = type_index_.find(root_type_name);
+  return it == type_index_.end() ? nullptr : &it->second.counters;
+}
+
+std::vector<std::string> TypeTreeStore::GetTypeNamesByTotalCount() const {
+  std::vector<std::string> type_names;
+  type_names.reserve(type_index_.size());
+  for (const auto& [type_name, unused] : type_index_) {
+    type_names.push_back(type_name);
+  }
+  std::sort(type_names.begin(), type_names.end(),
+            [&](const std::string& a, const std::string& b) {
+              const uint64_t a_total = type_index_.at(a).counters.total.total;
+              const uint64_t b_total = type_index_.at(b).counters.total.total;
+              return a_total != b_total ? a_total > b_total : a < b;
+            });
+  return type_names;
+}
+
+std::vector<TypeTreeStore::CallStack> TypeTreeStore::GetCallStacksForFunction(
+    absl::string_view function_name) const {
+  std::vector<uint32_t> nodes;
+  for (FrameTable::FrameId id : frame_table_.FindFunction(function_name)) {
+    // Not all the interned frames are in the trie.
+    if (id < frame_trie_nodes_.size()) {
+      nodes.insert(nodes.end(), frame_trie_nodes_[id].begin(),
+                   frame_trie_nodes_[id].end());
+    }
+  }
+  return CollectCallStacks(std::move(nodes));
+}
+
+std::vector<TypeTreeStore::CallStack> TypeTreeStore::GetCallStacksWithPrefix(
+    const CallStack& prefix) const {
+  if (callstack_trie_.empty()) {
+    return {};
+  }
+  uint32_t node = 0;
+  for (const DwarfMetadataFetcher::Frame& frame : prefix) {
+    std::optional<FrameTable::FrameId> id = frame_table_.Find(frame);
+    if (!id.has_value()) {
+      return {};
+    }
+    auto it = callstack_trie_[node].children.find(*id);
+    if (it == callstack_trie_[node].children.end()) {
+      return {};
+    }
+    node = it->second;
+  }
+  return CollectCallStacks({node});
+}
+
 absl::StatusOr<std::shared_ptr<TypeTree>> TypeTreeStore::GetTypeTree(
     const std::vector<DwarfMetadataFetcher::Frame>& callstack) const {
-  auto it = callstack_to_type_tree_.find(callstack);
+  return GetTypeTree(CallStackView(callstack.begin(), callstack.end()));
+}
+
+absl::StatusOr<std::shared_ptr<TypeTree>> TypeTreeStore::GetTypeTree(
+    const CallStackView& callstack) const {
+  std::optional<InternedCallStack> interned = Find(callstack);
+  if (!interned.has_value()) {
+    return absl::NotFoundError("TypeTree not found for callstack.");
+  }
+  auto it = callstack_to_type_tree_.find(*interned);
   if (it != callstack_to_type_tree_.end()) {
     return it->second;
   }
@@ -331,7 +1018,7 @@ bool LocalHistogramBuilder::FilterType(absl::string_view type_name) const {
 }
 
 bool LocalHistogramBuilder::FilterCallstack(
-    const TypeTreeStore::CallStack& callstack) const {
+    const TypeTreeStore::CallStackView& callstack) const {
   if (callstack_filter_.empty()) {
     return false;
   }
@@ -345,24 +1032,13 @@ bool LocalHistogramBuilder::FilterCallstack(
   return true;
 }
 
-absl::StatusOr<std::unique_ptr<AbstractHistogramBuilder>>
-LocalHistogramBuilder::Create(
-    std::string memprof_profile, std::string memprof_profiled_binary,
-    std::string memprof_profiled_binary_dwarf,
-    const std::vector<std::string>& type_prefix_filter,
-    const std::vector<std::string>& callstack_filter, bool only_records,
-    bool verify_verbose, bool dump_unresolved_callstacks,
-    uint32_t parse_thread_count) {
-  std::string build_id;
-  auto status_or = GetBuildIdForLocalFile(memprof_profiled_binary);
-  if (status_or.ok()) {
-    build_id = status_or.value();
-  } else {
-    build_id = "";
-    LOG(WARNING) << "Failed to get build id for local file: "
-                 << status_or.status() << " continuing with empty build id.";
-  }
+namespace {
 
+absl::StatusOr<std::unique_ptr<RawMemProfReader>> CreateRawMemProfReader(
+    const std::string& memprof_profile,
+    const std::string& memprof_profiled_binary) {
+  // The reader symbolizes the profile when created.
+  ScopedPhase phase("ReadAndSymbolizeProfile");
   llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer_or_error =
       llvm::MemoryBuffer::getFile(memprof_profile);
   if (auto ec = buffer_or_error.getError()) {
@@ -377,6 +1053,23 @@ LocalHistogramBuilder::Create(
     return absl::InternalError(absl::StrFormat(
         "Could not create reader: %s", llvm::toString(std::move(error))));
   }
+  return std::move(rawmemprof_reader.get());
+}
+
+absl::StatusOr<std::unique_ptr<DwarfTypeResolver>> CreateLocalTypeResolver(
+    const std::string& memprof_profiled_binary,
+    const std::string& memprof_profiled_binary_dwarf,
+    uint32_t parse_thread_count, const std::string& dwarf_cache_dir,
+    bool lazy_dwarf_parse) {
+  std::string build_id;
+  auto status_or = GetBuildIdForLocalFile(memprof_profiled_binary);
+  if (status_or.ok()) {
+    build_id = status_or.value();
+  } else {
+    build_id = "";
+    LOG(WARNING) << "Failed to get build id for local file: "
+                 << status_or.status() << " continuing with empty build id.";
+  }
 
   // Create BinaryFileRetriever that tries to lookup the dwarf binary in
   // the symbol server. Since we are running on local file, it will not
@@ -388,27 +1081,115 @@ LocalHistogramBuilder::Create(
                    BinaryFileRetriever::CreateBinaryFileRetriever());
 
   auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
-      std::move(binary_file_retriever), kCacheDir,
-      /*should_read_subprogram=*/true, parse_thread_count);
+      std::move(binary_file_retriever), dwarf_cache_dir,
+      /*should_read_subprogram=*/true, /*write_to_cache=*/true,
+      parse_thread_count, lazy_dwarf_parse);
 
   LOG(INFO) << "Fetching DWP with path: " << memprof_profiled_binary_dwarf
             << " for build id: " << build_id << "\n";
-  // Read the dwarf file into the cache before we pass to type_resolver.
+  // Read the dwarf file into the cache before we pass to type_resolver. Only
+  // the first run for a given build id parses the dwarf file, later runs read
+  // the metadata back from dwarf_cache_dir.
   RETURN_IF_ERROR(dwarf_metadata_fetcher->FetchDWPWithPath(
       {{.build_id = build_id, .path = memprof_profiled_binary_dwarf}},
-      /*force_update_cache=*/true));
-      
-  auto type_resolver = std::make_unique<DwarfTypeResolver>(
-      std::move(dwarf_metadata_fetcher), /*is_local=*/true);
+      /*force_update_cache=*/false));
+
+  return std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher),
+                                             /*is_local=*/true);
+}
 
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<AbstractHistogramBuilder>>
+LocalHistogramBuilder::Create(std::string memprof_profile,
+                              const Options& options) {
+  const AllocSiteShard& shard = options.shard;
+  if (shard.count == 0 || shard.index >= shard.count) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Invalid shard ", shard.index, " of ", shard.count, " shards."));
+  }
+  RETURN_IF_ERROR(CheckHistogramGranularity(options.histogram_granularity));
+  RETURN_IF_ERROR(CheckAllocSiteSampling(options.sampling));
+  ASSIGN_OR_RETURN(
+      std::unique_ptr<RawMemProfReader> rawmemprof_reader,
+      CreateRawMemProfReader(memprof_profile, options.memprof_profiled_binary));
+  ASSIGN_OR_RETURN(
+      std::unique_ptr<DwarfTypeResolver> type_resolver,
+      CreateLocalTypeResolver(options.memprof_profiled_binary,
+                              options.memprof_profiled_binary_dwarf,
+                              options.parse_thread_count,
+                              options.dwarf_cache_dir,
+                              options.lazy_dwarf_parse));
+  type_resolver->SetPriorLayouts(options.prior_layouts);
   return std::make_unique<LocalHistogramBuilder>(
-      std::move(rawmemprof_reader.get()), std::move(type_resolver),
-      type_prefix_filter, callstack_filter, only_records, verify_verbose,
-      dump_unresolved_callstacks);
+      std::move(rawmemprof_reader), std::move(type_resolver), options);
+}
+
+absl::StatusOr<std::unique_ptr<MultiProfileHistogramBuilder>>
+MultiProfileHistogramBuilder::Create(
+    const std::vector<std::string>& memprof_profiles,
+    const LocalHistogramBuilder::Options& options,
+    uint32_t profile_thread_count) {
+  if (memprof_profiles.empty()) {
+    return absl::InvalidArgumentError("No memprof profile given.");
+  }
+  if (options.shard.count > 1) {
+    return absl::InvalidArgumentError(
+        "Sharded builds of several profiles are not supported.");
+  }
+  RETURN_IF_ERROR(CheckHistogramGranularity(options.histogram_granularity));
+  RETURN_IF_ERROR(CheckAllocSiteSampling(options.sampling));
+  ASSIGN_OR_RETURN(
+      std::shared_ptr<DwarfTypeResolver> type_resolver,
+      CreateLocalTypeResolver(options.memprof_profiled_binary,
+                              options.memprof_profiled_binary_dwarf,
+                              options.parse_thread_count,
+                              options.dwarf_cache_dir,
+                              options.lazy_dwarf_parse));
+  type_resolver->SetPriorLayouts(options.prior_layouts);
+  std::vector<std::unique_ptr<LocalHistogramBuilder>> profile_builders;
+  profile_builders.reserve(memprof_profiles.size());
+  for (const std::string& memprof_profile : memprof_profiles) {
+    ASSIGN_OR_RETURN(std::unique_ptr<RawMemProfReader> rawmemprof_reader,
+                     CreateRawMemProfReader(memprof_profile,
+                                            options.memprof_profiled_binary));
+    profile_builders.push_back(std::make_unique<LocalHistogramBuilder>(
+        std::move(rawmemprof_reader), type_resolver, options));
+  }
+  return std::make_unique<MultiProfileHistogramBuilder>(
+      std::move(profile_builders), profile_thread_count);
+}
+
+absl::StatusOr<std::vector<std::unique_ptr<HistogramBuilderResults>>>
+MultiProfileHistogramBuilder::BuildHistogramPerProfile() {
+  const size_t profile_count = profile_builders_.size();
+  std::vector<absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>>
+      profile_results(profile_count);
+  // Profiles are claimed one at a time, so that a large profile does not
+  // hold back the ones after it.
+  ParallelFor(profile_count, profile_thread_count_, [&](size_t i) {
+    profile_results[i] = profile_builders_[i]->BuildHistogram();
+  });
+
+  std::vector<std::unique_ptr<HistogramBuilderResults>> results;
+  results.reserve(profile_count);
+  for (auto& profile_result : profile_results) {
+    RETURN_IF_ERROR(profile_result.status());
+    results.push_back(std::move(profile_result.value()));
+  }
+  return results;
+}
+
+absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
+MultiProfileHistogramBuilder::BuildHistogram() {
+  ASSIGN_OR_RETURN(
+      std::vector<std::unique_ptr<HistogramBuilderResults>> profile_results,
+      BuildHistogramPerProfile());
+  return MergeHistogramBuilderResults(profile_results);
 }
 
-void TypeTreeStore::DumpCallStack(const CallStack& callstack, std::ostream& os,
-                                  int level, bool as_entry) {
+void TypeTreeStore::DumpCallStack(const CallStackView& callstack,
+                                  std::ostream& os, int level, bool as_entry) {
   if (as_entry) {
     os << "- entry: \n";
     level += 2;
@@ -17,14 +17,19 @@
 #ifndef HISTOGRAM_BUILDER_H_
 #define HISTOGRAM_BUILDER_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
+#include "absl/hash/hash.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
@@ -32,43 +37,141 @@
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "dwarf_metadata_fetcher.h"
+#include "flamegraph_writer.h"
 #include "llvm/include/llvm/ProfileData/MemProf.h"
 #include "llvm/include/llvm/ProfileData/MemProfReader.h"
 #include "status_macros.h"
+#include "type_layout_store.h"
 #include "type_resolver.h"
 #include "type_tree.h"
 
 namespace devtools_crosstool_fdo_field_access {
 
+// Interns the frames of call stacks, so that each distinct frame, along with
+// its function name, is stored only once however many call stacks share it.
+class FrameTable {
+ public:
+  using FrameId = uint32_t;
+
+  FrameTable() = default;
+  FrameTable(const FrameTable&) = delete;
+  FrameTable& operator=(const FrameTable&) = delete;
+
+  // Returns the id of the given frame, adding it to the table if needed.
+  FrameId Intern(const DwarfMetadataFetcher::FrameView& frame);
+
+  // Returns the id of the given frame if it is in the table.
+  std::optional<FrameId> Find(
+      const DwarfMetadataFetcher::FrameView& frame) const;
+
+  // Returns the ids of the frames in 'function_name', in interning order.
+  absl::Span<const FrameId> FindFunction(
+      absl::string_view function_name) const;
+
+  const DwarfMetadataFetcher::Frame& Get(FrameId id) const {
+    return frames_[id];
+  }
+  size_t size() const { return frames_.size(); }
+
+  // Approximate number of bytes held by the table, kept up to date as frames
+  // are interned.
+  size_t ApproximateMemoryBytes() const { return memory_bytes_; }
+
+  // Removes all frames, invalidating their ids.
+  void Clear();
+
+ private:
+  // A deque, so that the function names the keys view never move.
+  std::deque<DwarfMetadataFetcher::Frame> frames_;
+  absl::flat_hash_map<DwarfMetadataFetcher::FrameView, FrameId> ids_;
+  // The ids of the frames of each function, keyed by the names of frames_.
+  absl::flat_hash_map<absl::string_view, std::vector<FrameId>>
+      ids_by_function_;
+  size_t memory_bytes_ = 0;
+};
+
+// A call stack made of the ids of its frames in a FrameTable. The hash is
+// computed once, when the call stack is created.
+class InternedCallStack {
+ public:
+  explicit InternedCallStack(std::vector<FrameTable::FrameId> frame_ids)
+      : frame_ids_(std::move(frame_ids)),
+        hash_(absl::HashOf(absl::MakeConstSpan(frame_ids_))) {}
+
+  absl::Span<const FrameTable::FrameId> frame_ids() const {
+    return frame_ids_;
+  }
+
+  bool operator==(const InternedCallStack& other) const {
+    return hash_ == other.hash_ && frame_ids_ == other.frame_ids_;
+  }
+  template <typename H>
+  friend H AbslHashValue(H h, const InternedCallStack& callstack) {
+    return H::combine(std::move(h), callstack.hash_);
+  }
+
+ private:
+  std::vector<FrameTable::FrameId> frame_ids_;
+  size_t hash_;
+};
+
 // This class is used to store the callstack and the corresponding type tree
 // for a given allocation. It is used to store the histogram data for the
 // memprof profile, with the resolved field access counts.
 
-// For now, the underlying data structure is a map from callstack to type
-// tree. In the future, we may consider using a CallStackTrie, which would be
-// more efficient in some cases. However, we do not expect to have a large
-// number of allocation call stacks and type trees in the profile, so this
-// should not be a problem.
+// The call stacks are kept in a trie of interned frames, outermost frame
+// first, whose nodes hold the type trees of the call stacks ending there.
+// Call stacks sharing their outer frames share the trie nodes of those
+// frames.
 
 // This data structure is designed to support the following operations:
 // 1. For a given callstack, return the corresponding type tree.
 // 2. For a given type name, return all call stacks that have that type name
-// as the root of the type tree.
-// 3. Iterate over all call stacks and type tree pairs.
+// as the root of the type tree, along with the access counts of its fields
+// added up over all of them.
+// 3. For a given function or outermost frames, return all call stacks that
+// go through them.
+// 4. Iterate over all call stacks and type tree pairs.
+// Operations 2 and 3 are served by indexes kept up to date as type trees are
+// inserted.
 class TypeTreeStore {
  public:
   using CallStack = std::vector<DwarfMetadataFetcher::Frame>;
+  // A callstack borrowing the function names of the frames it was made from.
+  using CallStackView = AbstractTypeResolver::CallStack;
+
+  // The access counters of the fields of a type, added up over all the type
+  // trees of that type inserted into the store.
+  struct TypeFieldCounters {
+    // Number of callstacks whose type tree has the type as its root.
+    uint64_t callstack_count = 0;
+    // Counters of the whole type.
+    TypeTree::AccessCounters total;
+    // Counters of each top-level field of the type, by order of first
+    // appearance. The names are interned, see TypeTree::Node::Layout.
+    std::vector<std::pair<absl::string_view, TypeTree::AccessCounters>> fields;
+  };
   TypeTreeStore() = default;
   ~TypeTreeStore() = default;
 
-  static void DumpCallStack(const CallStack& callstack, std::ostream& os,
+  static void DumpCallStack(const CallStackView& callstack, std::ostream& os,
                             int level = 0, bool as_entry = false);
+  static void DumpCallStack(const CallStack& callstack, std::ostream& os,
+                            int level = 0, bool as_entry = false) {
+    DumpCallStack(CallStackView(callstack.begin(), callstack.end()), os, level,
+                  as_entry);
+  }
 
   // Converts a callstack of memprof Frames to a callstack of
   // DwarfMetadataFetcher Frames.
   static CallStack ConvertCallStack(
       absl::Span<const llvm::memprof::Frame> callstack);
 
+  // Same as above, but the frames borrow the symbol names of the memprof
+  // Frames instead of copying them, so 'callstack' must outlive the result.
+  static CallStackView ViewCallStack(
+      absl::Span<const llvm::memprof::Frame> callstack);
+
   // Inserts the given callstack and type tree into the type tree store. If the
   // callstack already exists in the trie, the access counts of the existing
   // type tree are merged with the new type tree. If the types do not match, an
@@ -82,9 +185,15 @@ class TypeTreeStore {
       absl::Span<const llvm::memprof::Frame> callstack,
       std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree>
           type_tree) {
-    return Insert(ConvertCallStack(callstack), std::move(type_tree));
+    return Insert(Intern(callstack), std::move(type_tree));
   };
 
+  // Same as above, but takes an already interned callstack.
+  absl::Status Insert(
+      InternedCallStack callstack,
+      std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree>
+          type_tree);
+
   // Same as Insert, but returns the type tree for the given callstack.
   absl::StatusOr<const TypeTree*> InsertAndGet(
       const CallStack& callstack,
@@ -95,30 +204,136 @@ class TypeTreeStore {
       const std::vector<llvm::memprof::Frame>& callstack,
       std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree>
           type_tree) {
-    return InsertAndGet(ConvertCallStack(callstack), std::move(type_tree));
+    return InsertAndGet(ViewCallStack(callstack), std::move(type_tree));
   }
 
+  // Same as above, but takes a callstack of borrowed frames.
+  absl::StatusOr<const TypeTree*> InsertAndGet(
+      const CallStackView& callstack,
+      std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree>
+          type_tree);
+
   // Returns the type tree for the given callstack.
   absl::StatusOr<std::shared_ptr<TypeTree>> GetTypeTree(
       absl::Span<const llvm::memprof::Frame> callstack) const {
-    return GetTypeTree(ConvertCallStack(callstack));
+    return GetTypeTree(ViewCallStack(callstack));
   }
 
+  // Same as above, but takes a callstack of borrowed frames.
+  absl::StatusOr<std::shared_ptr<TypeTree>> GetTypeTree(
+      const CallStackView& callstack) const;
+
   // Same as above, but takes a callstack of memprof Frames.
   absl::StatusOr<std::shared_ptr<TypeTree>> GetTypeTree(
       const std::vector<DwarfMetadataFetcher::Frame>& callstack) const;
 
   // Returns all call stacks that have the given type name as the root of the
-  // type tree.
+  // type tree, in insertion order.
   std::vector<CallStack> GetCallStacksForTypeName(
       std::string root_type_name) const;
 
+  // Returns the counters of the fields of 'root_type_name', or null if no type
+  // tree of the store has it as its root.
+  const TypeFieldCounters* GetTypeFieldCounters(
+      absl::string_view root_type_name) const;
+
+  // Returns the root type names of the store, ordered by decreasing total
+  // access count.
+  std::vector<std::string> GetTypeNamesByTotalCount() const;
+
+  // Returns all call stacks with a frame in 'function_name'.
+  std::vector<CallStack> GetCallStacksForFunction(
+      absl::string_view function_name) const;
+
+  // Returns all call stacks whose outermost frames are 'prefix', given from
+  // the outermost frame inwards, e.g. starting with main.
+  std::vector<CallStack> GetCallStacksWithPrefix(const CallStack& prefix) const;
+
+  // Interns the frames of 'callstack' into the frame table of the store.
+  InternedCallStack Intern(const CallStack& callstack);
+  InternedCallStack Intern(const CallStackView& callstack);
+  InternedCallStack Intern(absl::Span<const llvm::memprof::Frame> callstack);
+
+  // Returns the interned form of 'callstack' if all its frames are in the
+  // frame table of the store.
+  std::optional<InternedCallStack> Find(const CallStack& callstack) const;
+  std::optional<InternedCallStack> Find(const CallStackView& callstack) const;
+
+  // Returns the frames of an interned callstack.
+  CallStack GetCallStack(const InternedCallStack& callstack) const;
+
+  // Moves all type trees of 'other' into this store, as if they had been
+  // inserted one by one with Insert. 'other' is left empty.
+  absl::Status MergeFrom(TypeTreeStore& other);
+
   void Dump(std::ostream& os, int64_t limit) const;
 
-  void DumpFlamegraph(std::ostream& os, int64_t limit) const;
+  // Dumps the flamegraph of each type tree, numbering the trees from
+  // 'first_id'.
+  void DumpFlamegraph(std::ostream& os, int64_t limit, int64_t first_id = 1,
+                      TypeTree::FlameGraphValue value =
+                          TypeTree::FlameGraphValue::kTotal) const;
+  // Same as above, through 'writer', which the flamegraphs of several stores
+  // can be written to before it is finished.
+  void DumpFlamegraph(FlameGraphWriter& writer, int64_t limit,
+                      int64_t first_id = 1,
+                      TypeTree::FlameGraphValue value =
+                          TypeTree::FlameGraphValue::kTotal) const;
+
+  // Approximate number of bytes held by the type trees and callstacks of the
+  // store, kept up to date as they are inserted, so that it is cheap enough to
+  // be checked after every insertion. Does not account for changes made to
+  // callstack_to_type_tree_ directly.
+  size_t ApproximateMemoryBytes() const {
+    return frame_table_.ApproximateMemoryBytes() + memory_bytes_;
+  }
+
+  // Removes all type trees and callstacks.
+  void Clear();
 
-  absl::flat_hash_map<CallStack, std::shared_ptr<TypeTree>>
+  absl::flat_hash_map<InternedCallStack, std::shared_ptr<TypeTree>>
       callstack_to_type_tree_;
+
+ protected:
+  FrameTable frame_table_;
+
+ private:
+  // A node of the trie of the callstacks of the store, which goes from the
+  // outermost frame of the callstacks to their allocation frame.
+  struct CallStackTrieNode {
+    uint32_t parent = 0;
+    FrameTable::FrameId frame_id = 0;
+    // Whether a callstack of the store ends at this node.
+    bool has_callstack = false;
+    absl::flat_hash_map<FrameTable::FrameId, uint32_t> children;
+  };
+
+  struct TypeIndex {
+    TypeFieldCounters counters;
+    // Trie nodes of the callstacks of the type, in insertion order.
+    std::vector<uint32_t> callstack_nodes;
+  };
+
+  // Adds the counters of 'type_tree', inserted for 'callstack', to the
+  // indexes. 'is_new' tells if the callstack was not in the store yet.
+  void IndexTypeTree(const InternedCallStack& callstack,
+                     const TypeTree& type_tree, bool is_new);
+
+  // Approximate number of bytes of an entry of callstack_to_type_tree_.
+  static size_t EntryMemoryBytes(const InternedCallStack& callstack,
+                                 const TypeTree& type_tree);
+
+  // Returns the callstacks ending in the subtrees of the trie 'nodes', each
+  // once.
+  std::vector<CallStack> CollectCallStacks(std::vector<uint32_t> nodes) const;
+
+  // The root is node 0, created with the first callstack.
+  std::vector<CallStackTrieNode> callstack_trie_;
+  // Trie nodes of each frame of frame_table_, by frame id.
+  std::vector<std::vector<uint32_t>> frame_trie_nodes_;
+  absl::flat_hash_map<std::string, TypeIndex> type_index_;
+  // See ApproximateMemoryBytes. Excludes the bytes of frame_table_.
+  size_t memory_bytes_ = 0;
 };
 
 class TypeTreeStoreList : public TypeTreeStore {
@@ -134,8 +349,11 @@ class TypeTreeStoreList : public TypeTreeStore {
       const std::vector<DwarfMetadataFetcher::Frame>& callstack,
       std::unique_ptr<devtools_crosstool_fdo_field_access::TypeTree>
           type_tree) {
+    InternedCallStack interned = Intern(callstack);
+    // Lookups return the first tree inserted for a callstack.
+    index_.try_emplace(interned, type_tree_stores_.size());
     type_tree_stores_.push_back(std::move(type_tree));
-    callstacks_.push_back(callstack);
+    callstacks_.push_back(std::move(interned));
     return absl::OkStatus();
   }
 
@@ -150,16 +368,22 @@ class TypeTreeStoreList : public TypeTreeStore {
 
   absl::StatusOr<std::shared_ptr<TypeTree>> GetTypeTree(
       const std::vector<DwarfMetadataFetcher::Frame>& callstack) const {
-    for (int i = 0; i < type_tree_stores_.size(); ++i) {
-      if (callstacks_[i] == callstack) {
-        return type_tree_stores_[i];
+    std::optional<InternedCallStack> interned = Find(callstack);
+    if (interned.has_value()) {
+      auto it = index_.find(*interned);
+      if (it != index_.end()) {
+        return type_tree_stores_[it->second];
       }
     }
     return absl::NotFoundError("Type tree not found");
   }
 
   std::vector<std::shared_ptr<TypeTree>> type_tree_stores_;
-  std::vector<CallStack> callstacks_;
+  std::vector<InternedCallStack> callstacks_;
+
+ private:
+  // Index into type_tree_stores_ of the first tree of each callstack.
+  absl::flat_hash_map<InternedCallStack, size_t> index_;
 };
 
 struct Statistics {
@@ -172,12 +396,20 @@ struct Statistics {
   uint64_t total_record_count = 0;
   uint64_t total_after_filtering = 0;
   uint64_t duplicate_callstack_count = 0;
+  // Allocations whose histogram size is not a multiple of their type size.
+  uint64_t misaligned_histogram_count = 0;
   // Access tracking.
   uint64_t total_accesses = 0;
   uint64_t total_accesses_on_heapallocs = 0;
   uint64_t total_accesses_on_containers = 0;
   uint64_t total_accesses_on_records = 0;
+  // Allocation sites left out by AllocSiteSampling, and the accesses memprof
+  // recorded for them. These sites are neither resolved nor counted above.
+  uint64_t sampled_out_alloc_count = 0;
+  uint64_t sampled_out_accesses = 0;
   void Log() const;
+  // Adds the counts of 'other' to this.
+  void MergeFrom(const Statistics& other);
 };
 
 struct HistogramBuilderResults {
@@ -188,6 +420,52 @@ struct HistogramBuilderResults {
       : type_tree_store(std::move(type_tree_store)), stats(stats) {}
 };
 
+// Merges 'partial_results', e.g. those of the shards of a sharded build, in
+// order, as if they had been built together. The type tree stores of the
+// partial results are left empty.
+absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
+MergeHistogramBuilderResults(
+    absl::Span<const std::unique_ptr<HistogramBuilderResults>> partial_results);
+
+// Selects the allocation sites of a profile that a shard of a sharded build
+// resolves: those whose index in the profile is 'index' modulo 'count'. Each
+// shard can be built on another machine, and the merged results of all shards
+// of a profile are those of a single build.
+struct AllocSiteShard {
+  uint32_t index = 0;
+  uint32_t count = 1;
+
+  bool Contains(size_t alloc_site_index) const {
+    return count <= 1 || alloc_site_index % count == index;
+  }
+};
+
+// Selects the hottest allocation sites of a profile, ranked by the total
+// access count memprof recorded for them, for a quick build of a large
+// profile. Only the selected sites are resolved, the others are only counted
+// in Statistics. With both limits set, the sites must be within both.
+struct AllocSiteSampling {
+  // If positive, at most this many sites are resolved.
+  uint64_t top_sites = 0;
+  // If positive, only the hottest sites that together cover this percentage
+  // of the accesses of the profile are resolved.
+  double access_coverage_percent = 0;
+
+  bool Enabled() const { return top_sites > 0 || access_coverage_percent > 0; }
+};
+
+// Which resolved type trees are checked with TypeTree::Verify.
+enum class VerifyMode {
+  kNone,
+  // The resolver verifies the tree of each type once, when it first builds
+  // it, and the trees copied from it are taken as verified. Only their shape
+  // is checked, not their access counts. Trees not copied from the resolver's
+  // cache are verified in full.
+  kOnce,
+  // Every tree is verified in full, once its accesses are recorded.
+  kAll,
+};
+
 // Abstract class for receiving a field access histogram consisting of a set of
 // type trees with field access counts indexed by their allocation callstacks.
 class AbstractHistogramBuilder {
@@ -196,6 +474,21 @@ class AbstractHistogramBuilder {
 
   virtual absl::StatusOr<std::unique_ptr<HistogramBuilderResults>>
   BuildHistogram() = 0;
+
+  // Same as BuildHistogram, but bounds the memory taken by the type trees:
+  // whenever the store grows past 'memory_budget_bytes', it is handed to
+  // 'flush' and emptied. A callstack seen again after a flush starts over
+  // from zero counts, so it can be flushed more than once, with the counts
+  // adding up to those BuildHistogram would return. The statistics cover the
+  // whole profile. By default, builds the whole histogram and flushes it
+  // once.
+  virtual absl::StatusOr<Statistics> BuildHistogramStreaming(
+      size_t memory_budget_bytes,
+      absl::FunctionRef<absl::Status(const TypeTreeStore&)> flush);
+
+  // The layouts of the types resolved by the builds so far, see
+  // DwarfTypeResolver::ExportLayouts. Empty by default.
+  virtual TypeLayoutStore GetTypeLayouts() const { return TypeLayoutStore(); }
 };
 
 // This class is used to build a histogram for a local memprof profile. It
@@ -204,41 +497,110 @@ class AbstractHistogramBuilder {
 class LocalHistogramBuilder : public AbstractHistogramBuilder {
  public:
   constexpr static uint32_t kMemprofHistogramGranularity = 8UL;
+  constexpr static char kDefaultDwarfCacheDir[] = "/tmp/dwarf_metadata";
+
+  // The options of the builder.
+  struct Options {
+    std::string memprof_profiled_binary;
+    // The binary, or dwp file, holding the DWARF of the profiled binary.
+    std::string memprof_profiled_binary_dwarf;
+    std::vector<std::string> type_prefix_filter;
+    std::vector<std::string> callstack_filter;
+    bool only_records = false;
+    bool verify_verbose = false;
+    bool dump_unresolved_callstacks = false;
+    uint32_t parse_thread_count = 1;
+    uint32_t build_thread_count = 1;
+    // Only the allocation sites of 'shard' are resolved.
+    AllocSiteShard shard;
+    // The DWARF metadata of the binary is cached in 'dwarf_cache_dir', which
+    // the shards of a sharded build can share, so that only the first of them
+    // parses the DWARF.
+    std::string dwarf_cache_dir = kDefaultDwarfCacheDir;
+    // The number of bytes counted by each bucket of the access histograms of
+    // the profile, as set when running memprof. It must be a power of two.
+    uint32_t histogram_granularity = kMemprofHistogramGranularity;
+    // Only the DWARF types and heapalloc sites the allocation sites of the
+    // profile reach are parsed, see DwarfMetadataFetcher.
+    bool lazy_dwarf_parse = false;
+    // The resolved type trees that are verified.
+    VerifyMode verify_mode = VerifyMode::kOnce;
+    // If set, the layouts of the types that did not change since are reused,
+    // see DwarfTypeResolver::SetPriorLayouts.
+    std::shared_ptr<const TypeLayoutStore> prior_layouts;
+    // Only the hottest allocation sites of the shard are resolved.
+    AllocSiteSampling sampling;
+  };
 
   static absl::StatusOr<std::unique_ptr<AbstractHistogramBuilder>> Create(
-      std::string memprof_profile, std::string memprof_profiled_binary,
-      std::string memprof_profiled_binary_dwarf,
-      const std::vector<std::string>& type_prefix_filter,
-      const std::vector<std::string>& callstack_filter, bool only_records,
-      bool verify_verbose, bool dump_unresolved_callstacks,
-      uint32_t parse_thread_count = 1);
+      std::string memprof_profile, const Options& options);
 
   explicit LocalHistogramBuilder(
       std::unique_ptr<llvm::memprof::RawMemProfReader> memprof_reader,
-      std::unique_ptr<DwarfTypeResolver> dwarf_type_resolver,
-      std::vector<std::string> type_prefix_filter,
-      std::vector<std::string> callstack_filter, bool only_records,
-      bool verify_verbose, bool dump_unresolved_callstacks)
+      std::shared_ptr<DwarfTypeResolver> dwarf_type_resolver,
+      const Options& options)
       : memprof_reader_(std::move(memprof_reader)),
         dwarf_type_resolver_(std::move(dwarf_type_resolver)),
-        type_prefix_filter_(type_prefix_filter),
-        callstack_filter_(callstack_filter),
-        only_records_(only_records),
-        verify_verbose_(verify_verbose),
-        dump_unresolved_callstacks_(dump_unresolved_callstacks) {}
+        type_prefix_filter_(options.type_prefix_filter),
+        callstack_filter_(options.callstack_filter),
+        only_records_(options.only_records),
+        verify_verbose_(options.verify_verbose),
+        dump_unresolved_callstacks_(options.dump_unresolved_callstacks),
+        build_thread_count_(options.build_thread_count),
+        shard_(options.shard),
+        histogram_granularity_(options.histogram_granularity),
+        verify_mode_(options.verify_mode),
+        sampling_(options.sampling) {}
   ~LocalHistogramBuilder() override = default;
 
+  // Resolves and counts the accesses of every allocation site of the profile.
+  // With more than one build thread, the allocation sites are split into
+  // contiguous shards, each built into its own store and statistics, and the
+  // shards are then merged in order. The results are the same as with a
+  // single thread. With sampling, the sites left out are only counted in the
+  // statistics.
   absl::StatusOr<std::unique_ptr<HistogramBuilderResults>> BuildHistogram()
       override;
 
+  // Reads the allocation sites of the profile by chunks, and checks the size
+  // of the store after each chunk.
+  absl::StatusOr<Statistics> BuildHistogramStreaming(
+      size_t memory_budget_bytes,
+      absl::FunctionRef<absl::Status(const TypeTreeStore&)> flush) override;
+
+  TypeLayoutStore GetTypeLayouts() const override {
+    return dwarf_type_resolver_->ExportLayouts();
+  }
+
  private:
   bool FilterType(absl::string_view type_name) const;
-  bool FilterCallstack(const TypeTreeStore::CallStack& callstack) const;
+  bool FilterCallstack(const TypeTreeStore::CallStackView& callstack) const;
+
+  // Resolves the type tree of a single allocation site, records its accesses
+  // and inserts it into 'type_tree_store'. Unresolved callstacks are dumped to
+  // 'unresolved_out' if requested.
+  absl::Status BuildHistogramForAllocSite(
+      const llvm::memprof::AllocationInfo& alloc_info, Statistics* stats,
+      TypeTreeStore* type_tree_store, std::ostream& unresolved_out) const;
+
+  // Same as above, for a batch of allocation sites, built on all build
+  // threads.
+  absl::Status BuildHistogramForAllocSites(
+      absl::Span<const llvm::memprof::AllocationInfo> alloc_sites,
+      Statistics* stats, TypeTreeStore* type_tree_store) const;
+
+  // Ranks the allocation sites of the shard that pass the callstack filter by
+  // access count, and returns whether each allocation site of the profile, by
+  // index, is selected by 'sampling_'. The ranked sites left out are counted
+  // in 'stats'. Returns an empty vector, selecting all sites, without
+  // sampling.
+  std::vector<bool> SampleAllocSites(Statistics* stats) const;
 
   // The reader for the memprof profile.
   std::unique_ptr<llvm::memprof::RawMemProfReader> memprof_reader_;
-  // The type resolver for resolving the type tree for a given type name.
-  std::unique_ptr<DwarfTypeResolver> dwarf_type_resolver_;
+  // The type resolver for resolving the type tree for a given type name. Can
+  // be shared with the builders of other profiles of the same binary.
+  std::shared_ptr<DwarfTypeResolver> dwarf_type_resolver_;
   // The type prefix filter for filtering out types to include in the histogram.
   // Any type that has a matching prefix held in the prefix filter will be
   // included.
@@ -255,6 +617,62 @@ class LocalHistogramBuilder : public AbstractHistogramBuilder {
   bool verify_verbose_;
   // If true, print out callstacks of types that are not resolved.
   bool dump_unresolved_callstacks_;
+  // Number of threads to resolve allocation sites on.
+  uint32_t build_thread_count_;
+  // The allocation sites of the profile to resolve.
+  AllocSiteShard shard_;
+  // Bytes counted by each bucket of the access histograms of the profile.
+  uint32_t histogram_granularity_;
+  // Which of the resolved type trees are verified.
+  VerifyMode verify_mode_;
+  // Which of the allocation sites of the shard are resolved.
+  AllocSiteSampling sampling_;
+};
+
+// This class is used to build a single histogram out of several local memprof
+// profiles of the same binary, e.g. one per process of a benchmark run. The
+// DWARF metadata of the binary is only parsed once, and a single type resolver
+// is shared by the builders of all profiles.
+class MultiProfileHistogramBuilder : public AbstractHistogramBuilder {
+ public:
+  // Same as LocalHistogramBuilder::Create, for each of 'memprof_profiles'.
+  // Up to 'profile_thread_count' profiles are built at the same time, each of
+  // them on 'options.build_thread_count' threads. Sharded builds are not
+  // supported.
+  static absl::StatusOr<std::unique_ptr<MultiProfileHistogramBuilder>> Create(
+      const std::vector<std::string>& memprof_profiles,
+      const LocalHistogramBuilder::Options& options,
+      uint32_t profile_thread_count = 1);
+
+  explicit MultiProfileHistogramBuilder(
+      std::vector<std::unique_ptr<LocalHistogramBuilder>> profile_builders,
+      uint32_t profile_thread_count = 1)
+      : profile_builders_(std::move(profile_builders)),
+        profile_thread_count_(profile_thread_count) {}
+  ~MultiProfileHistogramBuilder() override = default;
+
+  // Builds the histogram of every profile and merges them, in the order of
+  // the profiles, as if all allocation sites were in a single profile.
+  absl::StatusOr<std::unique_ptr<HistogramBuilderResults>> BuildHistogram()
+      override;
+
+  // Same as BuildHistogram, but returns the histogram of each profile apart,
+  // in the order of the profiles.
+  absl::StatusOr<std::vector<std::unique_ptr<HistogramBuilderResults>>>
+  BuildHistogramPerProfile();
+
+  // The builders of all profiles share the same type resolver.
+  TypeLayoutStore GetTypeLayouts() const override {
+    return profile_builders_.empty()
+               ? TypeLayoutStore()
+               : profile_builders_.front()->GetTypeLayouts();
+  }
+
+ private:
+  // Builders of the profiles, all sharing the same type resolver.
+  std::vector<std::unique_ptr<LocalHistogramBuilder>> profile_builders_;
+  // Number of profiles to build at the same time.
+  uint32_t profile_thread_count_;
 };
 
 }  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,118 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the insertion into, and the dumps of, a TypeTreeStore. Run
+// with --benchmark_format=json, or --benchmark_out=<file>
+// --benchmark_out_format=json, for machine-readable results.
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "benchmark/benchmark.h"
+#include "histogram_builder.h"
+#include "src/histogram.pb.h"
+#include "src/main/cpp/util/path.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+constexpr const char* kBenchmarkTestdataPath = "src/testdata";
+
+// The store built from the profile of supported_stl_containers, built once
+// for all benchmarks.
+const TypeTreeStore& GetTypeTreeStore() {
+  static const HistogramBuilderResults* const results = [] {
+    const std::string binary = blaze_util::JoinPath(
+        kBenchmarkTestdataPath, "supported_stl_containers.exe");
+    const std::string profile = blaze_util::JoinPath(
+        kBenchmarkTestdataPath, "supported_stl_containers.memprofraw");
+    auto histogram_builder = LocalHistogramBuilder::Create(
+        profile, {.memprof_profiled_binary = binary,
+                  .memprof_profiled_binary_dwarf = binary});
+    QCHECK_OK(histogram_builder.status());
+    auto results = (*histogram_builder)->BuildHistogram();
+    QCHECK_OK(results.status());
+    return results->release();
+  }();
+  return *results->type_tree_store;
+}
+
+// Args: number of times each type tree of the store is inserted. Inserting a
+// callstack again merges the counts of its tree into the stored one.
+void BM_TypeTreeStoreInsert(benchmark::State& state) {
+  const TypeTreeStore& store = GetTypeTreeStore();
+  std::vector<TypeTreeStore::CallStack> callstacks;
+  std::vector<TypeTreeProto> type_trees;
+  for (const auto& [callstack, type_tree] : store.callstack_to_type_tree_) {
+    callstacks.push_back(store.GetCallStack(callstack));
+    type_trees.push_back(type_tree->ToProto());
+  }
+  const int64_t copies = state.range(0);
+  std::unique_ptr<TypeTreeStore> inserted;
+  for (auto _ : state) {
+    state.PauseTiming();
+    inserted = std::make_unique<TypeTreeStore>();
+    std::vector<std::unique_ptr<TypeTree>> trees;
+    trees.reserve(type_trees.size() * copies);
+    for (int64_t i = 0; i < copies; ++i) {
+      for (const TypeTreeProto& type_tree : type_trees) {
+        auto tree = TypeTree::CreateTreeFromProto(type_tree);
+        QCHECK_OK(tree.status());
+        trees.push_back(*std::move(tree));
+      }
+    }
+    state.ResumeTiming();
+    for (size_t i = 0; i < trees.size(); ++i) {
+      QCHECK_OK(inserted->Insert(callstacks[i % callstacks.size()],
+                                 std::move(trees[i])));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * callstacks.size() * copies);
+}
+BENCHMARK(BM_TypeTreeStoreInsert)->ArgName("copies")->Arg(1)->Arg(8);
+
+void BM_TypeTreeStoreDump(benchmark::State& state) {
+  const TypeTreeStore& store = GetTypeTreeStore();
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    std::ostringstream out;
+    store.Dump(out, /*limit=*/-1);
+    bytes += out.tellp();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_TypeTreeStoreDump);
+
+void BM_TypeTreeStoreDumpFlamegraph(benchmark::State& state) {
+  const TypeTreeStore& store = GetTypeTreeStore();
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    std::ostringstream out;
+    store.DumpFlamegraph(out, /*limit=*/-1);
+    bytes += out.tellp();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_TypeTreeStoreDumpFlamegraph);
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
+
+BENCHMARK_MAIN();
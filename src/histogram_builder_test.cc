@@ -16,10 +16,13 @@
 
 #include <cstdint>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/span.h"
@@ -209,6 +212,245 @@ TEST(HistogramBuilderTest, TypeTreeStoreTest) {
   EXPECT_EQ(type_tree_a->Root()->GetSizeBytes(), 8);
 }
 
+// struct Pair {
+//   int64_t first;
+//   int64_t second;
+// };
+// with 'first' accessed 'first_count' times and 'second' 'second_count' times.
+std::unique_ptr<TypeTree> CreatePairTree(uint64_t first_count,
+                                         uint64_t second_count) {
+  ObjectLayout layout;
+  ObjectLayout::Properties* properties = layout.mutable_properties();
+  properties->set_name("Pair");
+  properties->set_type_name("Pair");
+  properties->set_type_kind(ObjectLayout::Properties::RECORD_TYPE);
+  properties->set_size_bits(16 * 8);
+  properties->set_multiplicity(1);
+  for (const auto& [name, offset] :
+       {std::pair<std::string, int64_t>{"first", 0}, {"second", 8}}) {
+    ObjectLayout::Properties* field =
+        layout.add_subobjects()->mutable_properties();
+    field->set_name(name);
+    field->set_type_name("int64_t");
+    field->set_kind(ObjectLayout::Properties::FIELD);
+    field->set_type_kind(ObjectLayout::Properties::BUILTIN_TYPE);
+    field->set_offset_bits(offset * 8);
+    field->set_size_bits(8 * 8);
+    field->set_multiplicity(1);
+  }
+  std::unique_ptr<TypeTree> type_tree =
+      TypeTree::CreateTreeFromObjectLayout(layout, "Pair");
+  if (first_count > 0) {
+    type_tree->RecordAccess(0, first_count);
+  }
+  if (second_count > 0) {
+    type_tree->RecordAccess(8, second_count);
+  }
+  return type_tree;
+}
+
+TEST(HistogramBuilderTest, TypeTreeStoreIndexTest) {
+  // Callstacks go from the allocation frame outwards.
+  const std::vector<llvm::memprof::Frame> alloc_in_foo = [] {
+    std::vector<llvm::memprof::Frame> callstack;
+    callstack.push_back(CreateFrame("alloc", 1, 1));
+    callstack.push_back(CreateFrame("foo", 2, 1));
+    callstack.push_back(CreateFrame("main", 3, 1));
+    return callstack;
+  }();
+  const std::vector<llvm::memprof::Frame> alloc_in_bar = [] {
+    std::vector<llvm::memprof::Frame> callstack;
+    callstack.push_back(CreateFrame("alloc", 1, 1));
+    callstack.push_back(CreateFrame("bar", 4, 1));
+    callstack.push_back(CreateFrame("main", 3, 1));
+    return callstack;
+  }();
+  const std::vector<llvm::memprof::Frame> new_in_foo = [] {
+    std::vector<llvm::memprof::Frame> callstack;
+    callstack.push_back(CreateFrame("new", 5, 1));
+    callstack.push_back(CreateFrame("foo", 6, 1));
+    return callstack;
+  }();
+
+  TypeTreeStore store;
+  EXPECT_EQ(store.ApproximateMemoryBytes(), 0);
+  ASSERT_OK(store.Insert(alloc_in_foo, CreatePairTree(10, 0)));
+  ASSERT_OK(store.Insert(alloc_in_bar, CreatePairTree(1, 5)));
+  const size_t memory_bytes = store.ApproximateMemoryBytes();
+  EXPECT_GT(memory_bytes, 0);
+  // Inserting a callstack again adds up its counts, without holding more.
+  ASSERT_OK(store.Insert(alloc_in_foo, CreatePairTree(10, 0)));
+  EXPECT_EQ(store.ApproximateMemoryBytes(), memory_bytes);
+  ASSERT_OK(store.Insert(new_in_foo, TypeTree::CreateTreeFromObjectLayout(
+                                         ObjectLayout(), "Empty")));
+
+  const TypeTreeStore::TypeFieldCounters* counters =
+      store.GetTypeFieldCounters("Pair");
+  ASSERT_NE(counters, nullptr);
+  EXPECT_EQ(counters->callstack_count, 2);
+  EXPECT_EQ(counters->total.total, 26);
+  ASSERT_EQ(counters->fields.size(), 2);
+  EXPECT_EQ(counters->fields[0].first, "first");
+  EXPECT_EQ(counters->fields[0].second.total, 21);
+  EXPECT_EQ(counters->fields[1].first, "second");
+  EXPECT_EQ(counters->fields[1].second.total, 5);
+  EXPECT_EQ(store.GetTypeFieldCounters("Missing"), nullptr);
+  EXPECT_EQ(store.GetTypeNamesByTotalCount(),
+            std::vector<std::string>({"Pair", "Empty"}));
+
+  EXPECT_EQ(store.GetCallStacksForTypeName("Pair"),
+            std::vector<TypeTreeStore::CallStack>(
+                {TypeTreeStore::ConvertCallStack(alloc_in_foo),
+                 TypeTreeStore::ConvertCallStack(alloc_in_bar)}));
+
+  // 'foo' is in two frames, of two callstacks.
+  std::vector<TypeTreeStore::CallStack> callstacks =
+      store.GetCallStacksForFunction("foo");
+  ASSERT_EQ(callstacks.size(), 2);
+  EXPECT_TRUE(IsCallStackInVector(
+      TypeTreeStore::ConvertCallStack(alloc_in_foo), callstacks));
+  EXPECT_TRUE(IsCallStackInVector(TypeTreeStore::ConvertCallStack(new_in_foo),
+                                  callstacks));
+  EXPECT_EQ(store.GetCallStacksForFunction("alloc").size(), 2);
+  EXPECT_TRUE(store.GetCallStacksForFunction("missing").empty());
+
+  const TypeTreeStore::CallStack main_frame = {
+      TypeTreeStore::ConvertCallStack(alloc_in_foo).back()};
+  EXPECT_EQ(store.GetCallStacksWithPrefix(main_frame).size(), 2);
+  const TypeTreeStore::CallStack main_foo = {
+      main_frame[0], TypeTreeStore::ConvertCallStack(alloc_in_foo)[1]};
+  EXPECT_EQ(store.GetCallStacksWithPrefix(main_foo),
+            std::vector<TypeTreeStore::CallStack>(
+                {TypeTreeStore::ConvertCallStack(alloc_in_foo)}));
+  EXPECT_EQ(store.GetCallStacksWithPrefix({}).size(), 3);
+
+  // The indexes follow the trees merged into another store.
+  TypeTreeStore merged;
+  ASSERT_OK(merged.Insert(alloc_in_bar, CreatePairTree(0, 1)));
+  ASSERT_OK(merged.MergeFrom(store));
+  EXPECT_EQ(store.GetTypeFieldCounters("Pair"), nullptr);
+  EXPECT_TRUE(store.GetCallStacksForFunction("foo").empty());
+  ASSERT_NE(merged.GetTypeFieldCounters("Pair"), nullptr);
+  EXPECT_EQ(merged.GetTypeFieldCounters("Pair")->callstack_count, 2);
+  EXPECT_EQ(merged.GetTypeFieldCounters("Pair")->total.total, 27);
+  EXPECT_EQ(merged.GetCallStacksForFunction("foo").size(), 2);
+
+  EXPECT_GT(merged.ApproximateMemoryBytes(), memory_bytes);
+
+  merged.Clear();
+  EXPECT_EQ(merged.GetTypeFieldCounters("Pair"), nullptr);
+  EXPECT_TRUE(merged.GetCallStacksWithPrefix({}).empty());
+  EXPECT_EQ(merged.ApproximateMemoryBytes(), 0);
+}
+
+TEST(FrameTableTest, FindsFramesByFunction) {
+  FrameTable table;
+  const FrameTable::FrameId foo_1 = table.Intern({"foo", 1, 0});
+  const FrameTable::FrameId bar = table.Intern({"bar", 1, 0});
+  const FrameTable::FrameId foo_2 = table.Intern({"foo", 2, 0});
+  EXPECT_EQ(table.Intern({"foo", 1, 0}), foo_1);
+
+  EXPECT_EQ(std::vector<FrameTable::FrameId>(table.FindFunction("foo").begin(),
+                                             table.FindFunction("foo").end()),
+            std::vector<FrameTable::FrameId>({foo_1, foo_2}));
+  ASSERT_EQ(table.FindFunction("bar").size(), 1);
+  EXPECT_EQ(table.FindFunction("bar")[0], bar);
+  EXPECT_TRUE(table.FindFunction("missing").empty());
+
+  table.Clear();
+  EXPECT_TRUE(table.FindFunction("foo").empty());
+}
+
+TEST(HistogramBuilderTest, ViewCallStackTest) {
+  std::vector<llvm::memprof::Frame> callstack = {CreateFrame("foo", 1, 2),
+                                                 CreateFrame("bar", 3, 4)};
+  llvm::memprof::Frame no_symbol(kDummyFrameGUID, 5, 6, false);
+  callstack.push_back(std::move(no_symbol));
+
+  // The views borrow the symbol names of the memprof frames.
+  TypeTreeStore::CallStackView view = TypeTreeStore::ViewCallStack(callstack);
+  ASSERT_EQ(view.size(), 3);
+  EXPECT_EQ(view.at(0).function_name.data(),
+            callstack.at(0).SymbolName->data());
+  EXPECT_EQ(view.at(1).function_name, "bar");
+  EXPECT_EQ(view.at(1).line_offset, 3);
+  EXPECT_EQ(view.at(1).column, 4);
+  EXPECT_EQ(view.at(2).function_name, "<none>");
+
+  // Views and owning frames of the same callstack are interchangeable.
+  const TypeTreeStore::CallStack converted =
+      TypeTreeStore::ConvertCallStack(callstack);
+  for (size_t i = 0; i < view.size(); ++i) {
+    EXPECT_EQ(view.at(i), DwarfMetadataFetcher::FrameView(converted.at(i)));
+    EXPECT_EQ(view.at(i).ToFrame(), converted.at(i));
+    EXPECT_EQ(DwarfMetadataFetcher::FrameHash()(view.at(i)),
+              DwarfMetadataFetcher::FrameHash()(converted.at(i)));
+  }
+
+  ObjectLayout object_layout;
+  object_layout.mutable_properties()->set_name("A");
+  object_layout.mutable_properties()->set_type_name("A");
+  object_layout.mutable_properties()->set_type_kind(
+      ObjectLayout::Properties::BUILTIN_TYPE);
+  object_layout.mutable_properties()->set_size_bits(8 * 8);
+  object_layout.mutable_properties()->set_offset_bits(0);
+
+  TypeTreeStore store;
+  ASSERT_OK(store.Insert(
+      callstack, TypeTree::CreateTreeFromObjectLayout(object_layout, "A")));
+  ASSERT_OK_AND_ASSIGN(std::shared_ptr<TypeTree> by_view,
+                       store.GetTypeTree(view));
+  ASSERT_OK_AND_ASSIGN(std::shared_ptr<TypeTree> by_frames,
+                       store.GetTypeTree(converted));
+  EXPECT_EQ(by_view, by_frames);
+  EXPECT_EQ(store.GetCallStack(*store.Find(view)), converted);
+}
+
+TEST(HistogramBuilderTest, TypeTreeStoreListTest) {
+  ObjectLayout object_layout;
+  object_layout.mutable_properties()->set_name("A");
+  object_layout.mutable_properties()->set_type_name("A");
+  object_layout.mutable_properties()->set_type_kind(
+      ObjectLayout::Properties::BUILTIN_TYPE);
+  object_layout.mutable_properties()->set_size_bits(8 * 8);
+
+  const TypeTreeStore::CallStack callstack = {
+      DwarfMetadataFetcher::Frame("foo", 1, 2),
+      DwarfMetadataFetcher::Frame("bar", 3, 4)};
+  const TypeTreeStore::CallStack callstack_2 = {
+      DwarfMetadataFetcher::Frame("foo", 1, 2),
+      DwarfMetadataFetcher::Frame("baz", 5, 6)};
+
+  TypeTreeStoreList list;
+  ASSERT_OK(list.Insert(
+      callstack, TypeTree::CreateTreeFromObjectLayout(object_layout, "A")));
+  ASSERT_OK(list.Insert(
+      callstack_2, TypeTree::CreateTreeFromObjectLayout(object_layout, "A")));
+  ASSERT_OK_AND_ASSIGN(
+      const TypeTree* duplicate,
+      list.InsertAndGet(callstack, TypeTree::CreateTreeFromObjectLayout(
+                                       object_layout, "A")));
+  ASSERT_EQ(list.type_tree_stores_.size(), 3);
+
+  // Lookups return the first tree inserted for a callstack.
+  ASSERT_OK_AND_ASSIGN(std::shared_ptr<TypeTree> first,
+                       list.GetTypeTree(callstack));
+  EXPECT_EQ(first, list.type_tree_stores_[0]);
+  EXPECT_NE(first.get(), duplicate);
+  ASSERT_OK_AND_ASSIGN(std::shared_ptr<TypeTree> second,
+                       list.GetTypeTree(callstack_2));
+  EXPECT_EQ(second, list.type_tree_stores_[1]);
+  EXPECT_NOT_OK(list.GetTypeTree(
+      {DwarfMetadataFetcher::Frame("foo", 1, 2),
+       DwarfMetadataFetcher::Frame("qux", 6, 7)}));
+
+  // Frames shared by the callstacks are only interned once.
+  EXPECT_EQ(list.callstacks_[0].frame_ids()[0],
+            list.callstacks_[1].frame_ids()[0]);
+  EXPECT_EQ(list.callstacks_[0], list.callstacks_[2]);
+  EXPECT_EQ(list.GetCallStack(list.callstacks_[1]), callstack_2);
+}
+
 // This test checks that the histogram builder can correctly build a histogram
 // for all the supported STL containers.
 TEST(HistogramBuilderTest, SupportedContainersTest) {
@@ -220,9 +462,10 @@ TEST(HistogramBuilderTest, SupportedContainersTest) {
   ASSERT_OK_AND_ASSIGN(
       std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
       LocalHistogramBuilder::Create(
-          profile_path, exe_path, exe_path, /*type_prefix_filter=*/{},
-          /*callstack_filter=*/{}, /*only_records=*/false,
-          /*verify_verbose=*/true, /*dump_unresolved_callstacks=*/true));
+          profile_path, {.memprof_profiled_binary = exe_path,
+                         .memprof_profiled_binary_dwarf = exe_path,
+                         .verify_verbose = true,
+                         .dump_unresolved_callstacks = true}));
   ASSERT_OK_AND_ASSIGN(
       std::unique_ptr<HistogramBuilderResults> histogram_builder_results,
       histogram_builder->BuildHistogram());
@@ -315,9 +558,9 @@ TEST(HistogramBuilderTest, SupportedAbseilContainersTest) {
   ASSERT_OK_AND_ASSIGN(
       std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
       LocalHistogramBuilder::Create(
-          profile_path, exe_path, exe_path, /*type_prefix_filter=*/{},
-          /*callstack_filter=*/{}, /*only_records=*/true,
-          /*verify_verbose=*/false, /*dump_unresolved_callstacks=*/false));
+          profile_path, {.memprof_profiled_binary = exe_path,
+                         .memprof_profiled_binary_dwarf = exe_path,
+                         .only_records = true}));
   ASSERT_OK_AND_ASSIGN(
       std::unique_ptr<HistogramBuilderResults> histogram_builder_results,
       histogram_builder->BuildHistogram());
@@ -353,12 +596,9 @@ TEST(HistogramBuilderTest, SupportedADTContainersTest) {
 
   ASSERT_OK_AND_ASSIGN(
       std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
-      LocalHistogramBuilder::Create(profile_path, exe_path, exe_path,
-                                    /*type_prefix_filter=*/{},
-                                    /*callstack_filter=*/{},
-                                    /*only_records=*/false,
-                                    /*verify_verbose=*/false,
-                                    /*dump_unresolved_callstacks=*/false));
+      LocalHistogramBuilder::Create(
+          profile_path, {.memprof_profiled_binary = exe_path,
+                         .memprof_profiled_binary_dwarf = exe_path}));
   ASSERT_OK_AND_ASSIGN(
       std::unique_ptr<HistogramBuilderResults> histogram_builder_results,
       histogram_builder->BuildHistogram());
@@ -385,5 +625,374 @@ TEST(HistogramBuilderTest, SupportedADTContainersTest) {
       type_tree_store, "llvm::DenseMapBase", "llvm::detail::DenseSetPair<A>",
       "A"));
 }
+// Building the histogram on multiple threads must give the same results as
+// building it on a single thread.
+TEST(HistogramBuilderTest, MultipleBuildThreadsTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+
+  std::unique_ptr<HistogramBuilderResults> results[2];
+  for (uint32_t build_thread_count : {1, 4}) {
+    ASSERT_OK_AND_ASSIGN(
+        std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
+        LocalHistogramBuilder::Create(
+            profile_path, {.memprof_profiled_binary = exe_path,
+                           .memprof_profiled_binary_dwarf = exe_path,
+                           .build_thread_count = build_thread_count}));
+    ASSERT_OK_AND_ASSIGN(results[build_thread_count > 1],
+                         histogram_builder->BuildHistogram());
+  }
+
+  const Statistics& serial_stats = results[0]->stats;
+  const Statistics& parallel_stats = results[1]->stats;
+  EXPECT_EQ(parallel_stats.total_allocations_count,
+            serial_stats.total_allocations_count);
+  EXPECT_EQ(parallel_stats.total_found_type, serial_stats.total_found_type);
+  EXPECT_EQ(parallel_stats.total_verified, serial_stats.total_verified);
+  EXPECT_EQ(parallel_stats.heap_alloc_count, serial_stats.heap_alloc_count);
+  EXPECT_EQ(parallel_stats.container_alloc_count,
+            serial_stats.container_alloc_count);
+  EXPECT_EQ(parallel_stats.total_accesses, serial_stats.total_accesses);
+
+  const TypeTreeStore* serial_store = results[0]->type_tree_store.get();
+  const TypeTreeStore* parallel_store = results[1]->type_tree_store.get();
+  ASSERT_EQ(parallel_store->callstack_to_type_tree_.size(),
+            serial_store->callstack_to_type_tree_.size());
+  for (const auto& [callstack, type_tree] :
+       serial_store->callstack_to_type_tree_) {
+    ASSERT_OK_AND_ASSIGN(
+        std::shared_ptr<TypeTree> parallel_type_tree,
+        parallel_store->GetTypeTree(serial_store->GetCallStack(callstack)));
+    std::stringstream serial_dump;
+    std::stringstream parallel_dump;
+    type_tree->Dump(serial_dump);
+    parallel_type_tree->Dump(parallel_dump);
+    EXPECT_EQ(parallel_dump.str(), serial_dump.str());
+  }
+}
+
+// Verifying fewer type trees does not change the histogram.
+TEST(HistogramBuilderTest, VerifyModeTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+
+  std::vector<std::unique_ptr<HistogramBuilderResults>> results;
+  for (VerifyMode verify_mode :
+       {VerifyMode::kAll, VerifyMode::kOnce, VerifyMode::kNone}) {
+    ASSERT_OK_AND_ASSIGN(
+        std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
+        LocalHistogramBuilder::Create(
+            profile_path, {.memprof_profiled_binary = exe_path,
+                           .memprof_profiled_binary_dwarf = exe_path,
+                           .verify_mode = verify_mode}));
+    ASSERT_OK_AND_ASSIGN(results.emplace_back(),
+                         histogram_builder->BuildHistogram());
+  }
+
+  const TypeTreeStore* all_store = results[0]->type_tree_store.get();
+  for (size_t i = 1; i < results.size(); ++i) {
+    EXPECT_EQ(results[i]->stats.total_verified,
+              results[0]->stats.total_verified);
+    EXPECT_EQ(results[i]->stats.total_accesses,
+              results[0]->stats.total_accesses);
+    const TypeTreeStore* store = results[i]->type_tree_store.get();
+    ASSERT_EQ(store->callstack_to_type_tree_.size(),
+              all_store->callstack_to_type_tree_.size());
+    for (const auto& [callstack, type_tree] :
+         all_store->callstack_to_type_tree_) {
+      ASSERT_OK_AND_ASSIGN(
+          std::shared_ptr<TypeTree> other_type_tree,
+          store->GetTypeTree(all_store->GetCallStack(callstack)));
+      std::stringstream all_dump;
+      std::stringstream dump;
+      type_tree->Dump(all_dump);
+      other_type_tree->Dump(dump);
+      EXPECT_EQ(dump.str(), all_dump.str());
+    }
+  }
+}
+
+// Total access count of every type tree of 'store', keyed by callstack.
+void AddAccessCountsByCallStack(
+    const TypeTreeStore& store,
+    absl::flat_hash_map<std::string, uint64_t>& access_counts) {
+  for (const auto& [callstack, type_tree] : store.callstack_to_type_tree_) {
+    std::stringstream callstack_dump;
+    TypeTreeStore::DumpCallStack(store.GetCallStack(callstack),
+                                 callstack_dump);
+    access_counts[callstack_dump.str()] +=
+        type_tree->Root()->GetTotalAccessCount();
+  }
+}
+
+TEST(HistogramBuilderTest, StreamingBuildTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+  auto CreateBuilder = [&]() {
+    return LocalHistogramBuilder::Create(
+        profile_path, {.memprof_profiled_binary = exe_path,
+                       .memprof_profiled_binary_dwarf = exe_path});
+  };
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AbstractHistogramBuilder> builder,
+                       CreateBuilder());
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> results,
+                       builder->BuildHistogram());
+  absl::flat_hash_map<std::string, uint64_t> expected_access_counts;
+  AddAccessCountsByCallStack(*results->type_tree_store,
+                             expected_access_counts);
+  ASSERT_FALSE(expected_access_counts.empty());
+
+  for (size_t memory_budget_bytes : {size_t{0}, ~size_t{0}}) {
+    ASSERT_OK_AND_ASSIGN(std::unique_ptr<AbstractHistogramBuilder> builder,
+                         CreateBuilder());
+    int flush_count = 0;
+    absl::flat_hash_map<std::string, uint64_t> access_counts;
+    ASSERT_OK_AND_ASSIGN(
+        Statistics stats,
+        builder->BuildHistogramStreaming(
+            memory_budget_bytes, [&](const TypeTreeStore& store) {
+              EXPECT_FALSE(store.callstack_to_type_tree_.empty());
+              ++flush_count;
+              AddAccessCountsByCallStack(store, access_counts);
+              return absl::OkStatus();
+            }));
+    // Without a budget, the store is only flushed at the end.
+    EXPECT_GE(flush_count, 1);
+    if (memory_budget_bytes == ~size_t{0}) {
+      EXPECT_EQ(flush_count, 1);
+    }
+    EXPECT_EQ(stats.total_allocations_count,
+              results->stats.total_allocations_count);
+    EXPECT_EQ(stats.total_accesses, results->stats.total_accesses);
+    EXPECT_EQ(access_counts, expected_access_counts);
+  }
+}
+
+TEST(HistogramBuilderTest, MultiProfileTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+
+  ASSERT_OK_AND_ASSIGN(
+      std::unique_ptr<AbstractHistogramBuilder> single_builder,
+      LocalHistogramBuilder::Create(
+          profile_path, {.memprof_profiled_binary = exe_path,
+                         .memprof_profiled_binary_dwarf = exe_path}));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> single_results,
+                       single_builder->BuildHistogram());
+  absl::flat_hash_map<std::string, uint64_t> single_access_counts;
+  AddAccessCountsByCallStack(*single_results->type_tree_store,
+                             single_access_counts);
+
+  // The same profile twice, built on two threads.
+  auto CreateBuilder = [&]() {
+    return MultiProfileHistogramBuilder::Create(
+        {profile_path, profile_path},
+        {.memprof_profiled_binary = exe_path,
+         .memprof_profiled_binary_dwarf = exe_path},
+        /*profile_thread_count=*/2);
+  };
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<MultiProfileHistogramBuilder> builder,
+                       CreateBuilder());
+  ASSERT_OK_AND_ASSIGN(
+      std::vector<std::unique_ptr<HistogramBuilderResults>> profile_results,
+      builder->BuildHistogramPerProfile());
+  ASSERT_EQ(profile_results.size(), 2);
+  for (const auto& profile_result : profile_results) {
+    absl::flat_hash_map<std::string, uint64_t> access_counts;
+    AddAccessCountsByCallStack(*profile_result->type_tree_store,
+                               access_counts);
+    EXPECT_EQ(access_counts, single_access_counts);
+  }
+
+  ASSERT_OK_AND_ASSIGN(builder, CreateBuilder());
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> results,
+                       builder->BuildHistogram());
+  EXPECT_EQ(results->stats.total_allocations_count,
+            2 * single_results->stats.total_allocations_count);
+  EXPECT_EQ(results->stats.total_accesses,
+            2 * single_results->stats.total_accesses);
+  absl::flat_hash_map<std::string, uint64_t> access_counts;
+  AddAccessCountsByCallStack(*results->type_tree_store, access_counts);
+  ASSERT_EQ(access_counts.size(), single_access_counts.size());
+  for (const auto& [callstack, count] : single_access_counts) {
+    EXPECT_EQ(access_counts[callstack], 2 * count);
+  }
+
+  EXPECT_NOT_OK(MultiProfileHistogramBuilder::Create(
+      /*memprof_profiles=*/{}, {.memprof_profiled_binary = exe_path,
+                                .memprof_profiled_binary_dwarf = exe_path}));
+  EXPECT_NOT_OK(MultiProfileHistogramBuilder::Create(
+      {profile_path}, {.memprof_profiled_binary = exe_path,
+                       .memprof_profiled_binary_dwarf = exe_path,
+                       .shard = {.index = 0, .count = 2}}));
+}
+
+TEST(HistogramBuilderTest, ShardedBuildTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+  auto CreateBuilder = [&](AllocSiteShard shard) {
+    return LocalHistogramBuilder::Create(
+        profile_path, {.memprof_profiled_binary = exe_path,
+                       .memprof_profiled_binary_dwarf = exe_path,
+                       .shard = shard});
+  };
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AbstractHistogramBuilder> builder,
+                       CreateBuilder({}));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> results,
+                       builder->BuildHistogram());
+  absl::flat_hash_map<std::string, uint64_t> expected_access_counts;
+  AddAccessCountsByCallStack(*results->type_tree_store,
+                             expected_access_counts);
+
+  constexpr uint32_t kShardCount = 3;
+  std::vector<std::unique_ptr<HistogramBuilderResults>> shard_results;
+  for (uint32_t i = 0; i < kShardCount; ++i) {
+    ASSERT_OK_AND_ASSIGN(builder,
+                         CreateBuilder({.index = i, .count = kShardCount}));
+    ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> shard_result,
+                         builder->BuildHistogram());
+    EXPECT_LT(shard_result->stats.total_allocations_count,
+              results->stats.total_allocations_count);
+    shard_results.push_back(std::move(shard_result));
+  }
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> merged,
+                       MergeHistogramBuilderResults(shard_results));
+  EXPECT_EQ(merged->stats.total_allocations_count,
+            results->stats.total_allocations_count);
+  EXPECT_EQ(merged->stats.total_found_type, results->stats.total_found_type);
+  EXPECT_EQ(merged->stats.total_accesses, results->stats.total_accesses);
+  absl::flat_hash_map<std::string, uint64_t> access_counts;
+  AddAccessCountsByCallStack(*merged->type_tree_store, access_counts);
+  EXPECT_EQ(access_counts, expected_access_counts);
+
+  EXPECT_NOT_OK(CreateBuilder({.index = 3, .count = 3}));
+  EXPECT_NOT_OK(CreateBuilder({.index = 0, .count = 0}));
+}
+
+TEST(HistogramBuilderTest, HistogramGranularityTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+  auto CreateBuilder = [&](uint32_t histogram_granularity) {
+    return LocalHistogramBuilder::Create(
+        profile_path, {.memprof_profiled_binary = exe_path,
+                       .memprof_profiled_binary_dwarf = exe_path,
+                       .histogram_granularity = histogram_granularity});
+  };
+
+  EXPECT_OK(
+      CreateBuilder(LocalHistogramBuilder::kMemprofHistogramGranularity));
+  EXPECT_OK(CreateBuilder(64));
+  EXPECT_NOT_OK(CreateBuilder(0));
+  EXPECT_NOT_OK(CreateBuilder(24));
+  EXPECT_NOT_OK(MultiProfileHistogramBuilder::Create(
+      {profile_path}, {.memprof_profiled_binary = exe_path,
+                       .memprof_profiled_binary_dwarf = exe_path,
+                       .histogram_granularity = 3}));
+}
+
+TEST(HistogramBuilderTest, AllocSiteSamplingTest) {
+  const std::string exe_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.exe");
+  const std::string profile_path = blaze_util::JoinPath(
+      kHistogramBuilderTestPath, "supported_stl_containers.memprofraw");
+  auto CreateBuilder = [&](AllocSiteSampling sampling,
+                           uint32_t build_thread_count,
+                           std::vector<std::string> callstack_filter = {}) {
+    return LocalHistogramBuilder::Create(
+        profile_path, {.memprof_profiled_binary = exe_path,
+                       .memprof_profiled_binary_dwarf = exe_path,
+                       .callstack_filter = callstack_filter,
+                       .build_thread_count = build_thread_count,
+                       .sampling = sampling});
+  };
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AbstractHistogramBuilder> builder,
+                       CreateBuilder({}, /*build_thread_count=*/1));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> results,
+                       builder->BuildHistogram());
+  EXPECT_EQ(results->stats.sampled_out_alloc_count, 0);
+  absl::flat_hash_map<std::string, uint64_t> expected_access_counts;
+  AddAccessCountsByCallStack(*results->type_tree_store,
+                             expected_access_counts);
+  ASSERT_GT(expected_access_counts.size(), 1);
+
+  for (uint32_t build_thread_count : {1, 4}) {
+    ASSERT_OK_AND_ASSIGN(
+        builder, CreateBuilder({.top_sites = 1}, build_thread_count));
+    ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> sampled,
+                         builder->BuildHistogram());
+    EXPECT_EQ(sampled->stats.total_allocations_count, 1);
+    EXPECT_EQ(sampled->stats.sampled_out_alloc_count,
+              results->stats.total_allocations_count - 1);
+    // The sites that are resolved get the same counts as without sampling.
+    absl::flat_hash_map<std::string, uint64_t> access_counts;
+    AddAccessCountsByCallStack(*sampled->type_tree_store, access_counts);
+    ASSERT_LE(access_counts.size(), 1);
+    for (const auto& [callstack, count] : access_counts) {
+      EXPECT_EQ(count, expected_access_counts[callstack]);
+    }
+  }
+
+  // All accesses are covered, only sites without accesses can be left out.
+  ASSERT_OK_AND_ASSIGN(builder,
+                       CreateBuilder({.access_coverage_percent = 100},
+                                     /*build_thread_count=*/1));
+  ASSERT_OK_AND_ASSIGN(
+      Statistics stats,
+      builder->BuildHistogramStreaming(
+          /*memory_budget_bytes=*/~size_t{0},
+          [](const TypeTreeStore&) { return absl::OkStatus(); }));
+  EXPECT_EQ(stats.sampled_out_accesses, 0);
+  EXPECT_EQ(stats.total_allocations_count + stats.sampled_out_alloc_count,
+            results->stats.total_allocations_count);
+  EXPECT_EQ(stats.total_accesses, results->stats.total_accesses);
+
+  EXPECT_NOT_OK(CreateBuilder({.access_coverage_percent = 101},
+                              /*build_thread_count=*/1));
+
+  // The sites left out by the callstack filter are not ranked: the top site is
+  // the top site of those that pass the filter. Filter on a function in the
+  // callstack of a single site.
+  absl::flat_hash_map<std::string, int> callstack_counts;
+  for (const auto& [callstack, type_tree] :
+       results->type_tree_store->callstack_to_type_tree_) {
+    absl::flat_hash_set<std::string> functions;
+    for (const DwarfMetadataFetcher::Frame& frame :
+         results->type_tree_store->GetCallStack(callstack)) {
+      functions.insert(frame.function_name);
+    }
+    for (const std::string& function : functions) {
+      ++callstack_counts[function];
+    }
+  }
+  std::string function;
+  for (const auto& [name, count] : callstack_counts) {
+    if (count == 1 && (function.empty() || name < function)) {
+      function = name;
+    }
+  }
+  ASSERT_FALSE(function.empty());
+  ASSERT_OK_AND_ASSIGN(builder, CreateBuilder({.top_sites = 1},
+                                              /*build_thread_count=*/1,
+                                              {function}));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> filtered,
+                       builder->BuildHistogram());
+  EXPECT_EQ(filtered->stats.total_allocations_count, 1);
+}
+
 }  // namespace
 }  // namespace devtools_crosstool_fdo_field_access
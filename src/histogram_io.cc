@@ -0,0 +1,221 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "histogram_io.h"
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "dwarf_metadata_fetcher.h"
+#include "histogram_builder.h"
+#include "parallel_for.h"
+#include "src/histogram.pb.h"
+#include "status_macros.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+namespace {
+
+// Version of the histogram files, see histogram.proto. Bump it whenever the
+// meaning of the records changes.
+constexpr uint32_t kHistogramVersion = 1;
+
+void StatisticsToProto(const Statistics& stats,
+                       HistogramRecord::Statistics* proto) {
+  proto->set_total_allocations_count(stats.total_allocations_count);
+  proto->set_total_found_type(stats.total_found_type);
+  proto->set_total_verified(stats.total_verified);
+  proto->set_heap_alloc_count(stats.heap_alloc_count);
+  proto->set_container_alloc_count(stats.container_alloc_count);
+  proto->set_total_record_count(stats.total_record_count);
+  proto->set_total_after_filtering(stats.total_after_filtering);
+  proto->set_duplicate_callstack_count(stats.duplicate_callstack_count);
+  proto->set_misaligned_histogram_count(stats.misaligned_histogram_count);
+  proto->set_total_accesses(stats.total_accesses);
+  proto->set_total_accesses_on_heapallocs(stats.total_accesses_on_heapallocs);
+  proto->set_total_accesses_on_containers(stats.total_accesses_on_containers);
+  proto->set_total_accesses_on_records(stats.total_accesses_on_records);
+  proto->set_sampled_out_alloc_count(stats.sampled_out_alloc_count);
+  proto->set_sampled_out_accesses(stats.sampled_out_accesses);
+}
+
+Statistics StatisticsFromProto(const HistogramRecord::Statistics& proto) {
+  Statistics stats;
+  stats.total_allocations_count = proto.total_allocations_count();
+  stats.total_found_type = proto.total_found_type();
+  stats.total_verified = proto.total_verified();
+  stats.heap_alloc_count = proto.heap_alloc_count();
+  stats.container_alloc_count = proto.container_alloc_count();
+  stats.total_record_count = proto.total_record_count();
+  stats.total_after_filtering = proto.total_after_filtering();
+  stats.duplicate_callstack_count = proto.duplicate_callstack_count();
+  stats.misaligned_histogram_count = proto.misaligned_histogram_count();
+  stats.total_accesses = proto.total_accesses();
+  stats.total_accesses_on_heapallocs = proto.total_accesses_on_heapallocs();
+  stats.total_accesses_on_containers = proto.total_accesses_on_containers();
+  stats.total_accesses_on_records = proto.total_accesses_on_records();
+  stats.sampled_out_alloc_count = proto.sampled_out_alloc_count();
+  stats.sampled_out_accesses = proto.sampled_out_accesses();
+  return stats;
+}
+
+}  // namespace
+
+absl::Status HistogramWriter::WriteRecord(const HistogramRecord& record) {
+  if (!wrote_header_) {
+    HistogramHeader header;
+    header.set_version(kHistogramVersion);
+    if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(
+            header, &output_)) {
+      return absl::InternalError("Failed to serialize histogram header");
+    }
+    wrote_header_ = true;
+  }
+  if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(record,
+                                                                  &output_)) {
+    return absl::InternalError("Failed to serialize histogram record");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status HistogramWriter::Write(const TypeTreeStore& store) {
+  HistogramRecord record;
+  for (const auto& [callstack, type_tree] : store.callstack_to_type_tree_) {
+    HistogramRecord::Entry* entry = record.mutable_entry();
+    entry->Clear();
+    for (const DwarfMetadataFetcher::Frame& frame :
+         store.GetCallStack(callstack)) {
+      HistogramRecord::Frame* proto_frame = entry->add_callstack();
+      proto_frame->set_function_name(frame.function_name);
+      proto_frame->set_line_offset(frame.line_offset);
+      proto_frame->set_column(frame.column);
+    }
+    *entry->mutable_type_tree() = type_tree->ToProto();
+    RETURN_IF_ERROR(WriteRecord(record));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status HistogramWriter::Write(const Statistics& stats) {
+  HistogramRecord record;
+  StatisticsToProto(stats, record.mutable_statistics());
+  return WriteRecord(record);
+}
+
+absl::Status ReadHistogram(std::istream& in, TypeTreeStore* store,
+                           Statistics* stats) {
+  google::protobuf::io::IstreamInputStream input(&in);
+  bool clean_eof = false;
+  HistogramHeader header;
+  if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+          &header, &input, &clean_eof)) {
+    return absl::DataLossError("Failed to parse histogram header");
+  }
+  if (header.version() != kHistogramVersion) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Histogram version ", header.version(), " is not ",
+                     kHistogramVersion));
+  }
+
+  // Start every record from an empty message.
+  for (HistogramRecord record;
+       google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+           &record, &input, &clean_eof);
+       record.Clear()) {
+    switch (record.record_case()) {
+      case HistogramRecord::kEntry: {
+        // The frames borrow the function names of the record until they are
+        // interned.
+        TypeTreeStore::CallStackView callstack;
+        callstack.reserve(record.entry().callstack_size());
+        for (const HistogramRecord::Frame& frame :
+             record.entry().callstack()) {
+          callstack.emplace_back(frame.function_name(), frame.line_offset(),
+                                 frame.column());
+        }
+        ASSIGN_OR_RETURN(
+            std::unique_ptr<TypeTree> type_tree,
+            TypeTree::CreateTreeFromProto(record.entry().type_tree()));
+        RETURN_IF_ERROR(
+            store->Insert(store->Intern(callstack), std::move(type_tree)));
+        break;
+      }
+      case HistogramRecord::kStatistics:
+        stats->MergeFrom(StatisticsFromProto(record.statistics()));
+        break;
+      default:
+        return absl::DataLossError("Unknown record in histogram");
+    }
+  }
+  if (!clean_eof) {
+    return absl::DataLossError("Histogram file is truncated or corrupted");
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<HistogramBuilderResults>> ReadHistogramFiles(
+    absl::Span<const std::string> paths, uint32_t thread_count) {
+  const size_t worker_count = ParallelWorkerCount(paths.size(), thread_count);
+  std::vector<std::unique_ptr<HistogramBuilderResults>> worker_results;
+  worker_results.reserve(worker_count);
+  for (size_t i = 0; i < worker_count; ++i) {
+    worker_results.push_back(std::make_unique<HistogramBuilderResults>(
+        std::make_unique<TypeTreeStore>(), Statistics()));
+  }
+  std::vector<absl::Status> worker_statuses(worker_count);
+
+  // Files are claimed one at a time, so that a large file does not hold back
+  // the ones after it.
+  ParallelFor(paths.size(), thread_count, [&](size_t worker, size_t i) {
+    // A worker that failed skips the files left.
+    if (!worker_statuses[worker].ok()) {
+      return;
+    }
+    HistogramBuilderResults& results = *worker_results[worker];
+    std::ifstream in(paths[i], std::ios::binary);
+    if (!in) {
+      worker_statuses[worker] = absl::NotFoundError(
+          absl::StrCat("Failed to open histogram file ", paths[i]));
+      return;
+    }
+    absl::Status status =
+        ReadHistogram(in, results.type_tree_store.get(), &results.stats);
+    if (!status.ok()) {
+      worker_statuses[worker] = absl::Status(
+          status.code(), absl::StrCat(paths[i], ": ", status.message()));
+    }
+  });
+
+  for (const absl::Status& status : worker_statuses) {
+    RETURN_IF_ERROR(status);
+  }
+  return MergeHistogramBuilderResults(worker_results);
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
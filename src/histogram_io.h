@@ -0,0 +1,74 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HISTOGRAM_IO_H_
+#define HISTOGRAM_IO_H_
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "histogram_builder.h"
+#include "src/histogram.pb.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Writes a field access histogram as a histogram file, see histogram.proto.
+// The writes are buffered until the writer is destroyed.
+class HistogramWriter {
+ public:
+  // 'out' must outlive the writer.
+  explicit HistogramWriter(std::ostream* out) : output_(out) {}
+  HistogramWriter(const HistogramWriter&) = delete;
+  HistogramWriter& operator=(const HistogramWriter&) = delete;
+
+  // Writes each type tree of 'store' along with its callstack. Can be called
+  // more than once, e.g. for each flush of a streaming build.
+  absl::Status Write(const TypeTreeStore& store);
+
+  // Writes 'stats'. The statistics of all calls add up.
+  absl::Status Write(const Statistics& stats);
+
+ private:
+  absl::Status WriteRecord(const HistogramRecord& record);
+
+  google::protobuf::io::OstreamOutputStream output_;
+  bool wrote_header_ = false;
+};
+
+// Reads the histogram file 'in', inserting its type trees into 'store' and
+// adding its statistics to 'stats'. The counters of a callstack that is
+// already in 'store' add up, so reading several files into the same store
+// sums them.
+absl::Status ReadHistogram(std::istream& in, TypeTreeStore* store,
+                           Statistics* stats);
+
+// Reads and sums the histogram files at 'paths', on up to 'thread_count'
+// threads. Each thread sums the files it reads into its own store, and the
+// stores are merged once all files are read.
+absl::StatusOr<std::unique_ptr<HistogramBuilderResults>> ReadHistogramFiles(
+    absl::Span<const std::string> paths, uint32_t thread_count = 1);
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // HISTOGRAM_IO_H_
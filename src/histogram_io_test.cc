@@ -0,0 +1,175 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "histogram_io.h"
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "histogram_builder.h"
+#include "src/main/cpp/util/path.h"
+#include "test_status_macros.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+constexpr const char* kHistogramIoTestPath = "src/testdata";
+
+class HistogramIoTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const std::string exe_path = blaze_util::JoinPath(
+        kHistogramIoTestPath, "supported_stl_containers.exe");
+    const std::string profile_path = blaze_util::JoinPath(
+        kHistogramIoTestPath, "supported_stl_containers.memprofraw");
+    ASSERT_OK_AND_ASSIGN(
+        std::unique_ptr<AbstractHistogramBuilder> histogram_builder,
+        LocalHistogramBuilder::Create(
+            profile_path, {.memprof_profiled_binary = exe_path,
+                           .memprof_profiled_binary_dwarf = exe_path}));
+    ASSERT_OK_AND_ASSIGN(results_, histogram_builder->BuildHistogram());
+    ASSERT_FALSE(results_->type_tree_store->callstack_to_type_tree_.empty());
+
+    std::stringstream out;
+    {
+      HistogramWriter writer(&out);
+      ASSERT_OK(writer.Write(*results_->type_tree_store));
+      ASSERT_OK(writer.Write(results_->stats));
+    }
+    histogram_ = out.str();
+  }
+
+  std::unique_ptr<HistogramBuilderResults> results_;
+  std::string histogram_;
+};
+
+TEST_F(HistogramIoTest, WriteAndRead) {
+  std::stringstream in(histogram_);
+  TypeTreeStore store;
+  Statistics stats;
+  ASSERT_OK(ReadHistogram(in, &store, &stats));
+
+  EXPECT_EQ(stats.total_allocations_count,
+            results_->stats.total_allocations_count);
+  EXPECT_EQ(stats.total_found_type, results_->stats.total_found_type);
+  EXPECT_EQ(stats.total_accesses, results_->stats.total_accesses);
+  const TypeTreeStore& expected_store = *results_->type_tree_store;
+  ASSERT_EQ(store.callstack_to_type_tree_.size(),
+            expected_store.callstack_to_type_tree_.size());
+  for (const auto& [callstack, type_tree] :
+       expected_store.callstack_to_type_tree_) {
+    ASSERT_OK_AND_ASSIGN(
+        std::shared_ptr<TypeTree> read_type_tree,
+        store.GetTypeTree(expected_store.GetCallStack(callstack)));
+    std::stringstream expected_dump;
+    std::stringstream read_dump;
+    type_tree->Dump(expected_dump);
+    read_type_tree->Dump(read_dump);
+    EXPECT_EQ(read_dump.str(), expected_dump.str());
+    EXPECT_EQ(read_type_tree->ContainerName(), type_tree->ContainerName());
+    EXPECT_EQ(read_type_tree->FromContainer(), type_tree->FromContainer());
+  }
+}
+
+TEST_F(HistogramIoTest, WriteAndReadSampledOutCounts) {
+  Statistics sampled_stats = results_->stats;
+  sampled_stats.sampled_out_alloc_count = 3;
+  sampled_stats.sampled_out_accesses = 42;
+  std::stringstream out;
+  {
+    HistogramWriter writer(&out);
+    ASSERT_OK(writer.Write(sampled_stats));
+  }
+
+  std::stringstream in(out.str());
+  TypeTreeStore store;
+  Statistics stats;
+  ASSERT_OK(ReadHistogram(in, &store, &stats));
+  EXPECT_EQ(stats.total_allocations_count,
+            sampled_stats.total_allocations_count);
+  EXPECT_EQ(stats.sampled_out_alloc_count, 3);
+  EXPECT_EQ(stats.sampled_out_accesses, 42);
+}
+
+TEST_F(HistogramIoTest, ReadTwiceSums) {
+  TypeTreeStore store;
+  Statistics stats;
+  for (int i = 0; i < 2; ++i) {
+    std::stringstream in(histogram_);
+    ASSERT_OK(ReadHistogram(in, &store, &stats));
+  }
+
+  EXPECT_EQ(stats.total_allocations_count,
+            2 * results_->stats.total_allocations_count);
+  EXPECT_EQ(stats.total_accesses, 2 * results_->stats.total_accesses);
+  const TypeTreeStore& expected_store = *results_->type_tree_store;
+  ASSERT_EQ(store.callstack_to_type_tree_.size(),
+            expected_store.callstack_to_type_tree_.size());
+  for (const auto& [callstack, type_tree] :
+       expected_store.callstack_to_type_tree_) {
+    ASSERT_OK_AND_ASSIGN(
+        std::shared_ptr<TypeTree> read_type_tree,
+        store.GetTypeTree(expected_store.GetCallStack(callstack)));
+    EXPECT_EQ(read_type_tree->Root()->GetTotalAccessCount(),
+              2 * type_tree->Root()->GetTotalAccessCount());
+  }
+}
+
+TEST_F(HistogramIoTest, ReadHistogramFiles) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < 3; ++i) {
+    paths.push_back(blaze_util::JoinPath(::testing::TempDir(),
+                                         absl::StrCat("histogram_", i)));
+    std::ofstream out(paths.back(), std::ios::binary | std::ios::trunc);
+    out << histogram_;
+  }
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<HistogramBuilderResults> merged,
+                       ReadHistogramFiles(paths, /*thread_count=*/2));
+  EXPECT_EQ(merged->stats.total_allocations_count,
+            3 * results_->stats.total_allocations_count);
+  const TypeTreeStore& expected_store = *results_->type_tree_store;
+  ASSERT_EQ(merged->type_tree_store->callstack_to_type_tree_.size(),
+            expected_store.callstack_to_type_tree_.size());
+  for (const auto& [callstack, type_tree] :
+       expected_store.callstack_to_type_tree_) {
+    ASSERT_OK_AND_ASSIGN(std::shared_ptr<TypeTree> merged_type_tree,
+                         merged->type_tree_store->GetTypeTree(
+                             expected_store.GetCallStack(callstack)));
+    EXPECT_EQ(merged_type_tree->Root()->GetTotalAccessCount(),
+              3 * type_tree->Root()->GetTotalAccessCount());
+  }
+
+  paths.push_back(
+      blaze_util::JoinPath(::testing::TempDir(), "missing_histogram"));
+  EXPECT_NOT_OK(ReadHistogramFiles(paths, /*thread_count=*/2));
+}
+
+TEST_F(HistogramIoTest, ReadRejectsCorruptFiles) {
+  TypeTreeStore store;
+  Statistics stats;
+  std::stringstream truncated(histogram_.substr(0, histogram_.size() - 1));
+  EXPECT_NOT_OK(ReadHistogram(truncated, &store, &stats));
+  std::stringstream empty;
+  EXPECT_NOT_OK(ReadHistogram(empty, &store, &stats));
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,89 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Sums histogram files written by field_access_tool --histogram_out into a
+// single histogram file.
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "histogram_builder.h"
+#include "histogram_io.h"
+#include "status_macros.h"
+
+ABSL_FLAG(std::vector<std::string>, histograms, {},
+          "Histogram files to sum.");
+ABSL_FLAG(std::string, out, "", "Path of the summed histogram file.");
+ABSL_FLAG(uint32_t, thread_count, 16,
+          "Number of threads to use for reading the histogram files.");
+ABSL_FLAG(bool, stats, false, "Log the summed stats.");
+
+namespace {
+
+using devtools_crosstool_fdo_field_access::HistogramBuilderResults;
+using devtools_crosstool_fdo_field_access::HistogramWriter;
+using devtools_crosstool_fdo_field_access::ReadHistogramFiles;
+
+absl::Status MergeHistograms(const std::vector<std::string>& histograms,
+                             const std::string& out_path,
+                             uint32_t thread_count, bool stats) {
+  ASSIGN_OR_RETURN(std::unique_ptr<HistogramBuilderResults> merged,
+                   ReadHistogramFiles(histograms, thread_count));
+  if (stats) {
+    merged->stats.Log();
+  }
+  std::ofstream out(out_path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return absl::InternalError(absl::StrCat("Failed to open ", out_path));
+  }
+  {
+    HistogramWriter writer(&out);
+    RETURN_IF_ERROR(writer.Write(*merged->type_tree_store));
+    RETURN_IF_ERROR(writer.Write(merged->stats));
+  }
+  out.close();
+  if (!out) {
+    return absl::InternalError(absl::StrCat("Failed to write ", out_path));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  const std::vector<std::string> histograms = absl::GetFlag(FLAGS_histograms);
+  const std::string out = absl::GetFlag(FLAGS_out);
+  if (histograms.empty() || out.empty()) {
+    LOG(ERROR) << "Both --histograms and --out must be specified.";
+    return 1;
+  }
+  absl::Status status =
+      MergeHistograms(histograms, out, absl::GetFlag(FLAGS_thread_count),
+                      absl::GetFlag(FLAGS_stats));
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to merge histograms: " << status;
+    return 1;
+  }
+  return 0;
+}
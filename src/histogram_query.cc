@@ -0,0 +1,162 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Answers queries on histogram files written by field_access_tool
+// --histogram_out, e.g. the hottest fields of a type across all its
+// allocation sites, or the allocations made under a function. The histogram
+// files are summed before being queried.
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "histogram_builder.h"
+#include "histogram_io.h"
+#include "status_macros.h"
+#include "type_tree.h"
+
+ABSL_FLAG(std::vector<std::string>, histograms, {},
+          "Histogram files to query, summed.");
+ABSL_FLAG(std::string, type, "",
+          "Dump the fields of this type, by decreasing access count, added up "
+          "over all the allocation sites of the type.");
+ABSL_FLAG(std::string, function, "",
+          "Dump the type trees of the allocations with this function, "
+          "mangled, in their callstack.");
+ABSL_FLAG(int64_t, limit, -1,
+          "Limit on the number of types, fields or type trees to dump. If "
+          "negative, dump all.");
+ABSL_FLAG(uint32_t, thread_count, 16,
+          "Number of threads to use for reading the histogram files.");
+
+namespace {
+
+using devtools_crosstool_fdo_field_access::HistogramBuilderResults;
+using devtools_crosstool_fdo_field_access::ReadHistogramFiles;
+using devtools_crosstool_fdo_field_access::TypeTree;
+using devtools_crosstool_fdo_field_access::TypeTreeStore;
+
+size_t Limit(size_t size, int64_t limit) {
+  return limit < 0 ? size : std::min<size_t>(size, limit);
+}
+
+// Dumps the root types of 'store' by decreasing access count.
+void DumpTypes(const TypeTreeStore& store, int64_t limit, std::ostream& os) {
+  const std::vector<std::string> type_names =
+      store.GetTypeNamesByTotalCount();
+  for (size_t i = 0; i < Limit(type_names.size(), limit); ++i) {
+    const TypeTreeStore::TypeFieldCounters* counters =
+        store.GetTypeFieldCounters(type_names[i]);
+    os << "- type_name: " << type_names[i] << "\n"
+       << "  callstacks: " << counters->callstack_count << "\n"
+       << "  total: " << counters->total.total << "\n";
+  }
+}
+
+// Dumps the top-level fields of 'type_name' by decreasing access count.
+absl::Status DumpTypeFields(const TypeTreeStore& store,
+                            const std::string& type_name, int64_t limit,
+                            std::ostream& os) {
+  const TypeTreeStore::TypeFieldCounters* counters =
+      store.GetTypeFieldCounters(type_name);
+  if (counters == nullptr) {
+    return absl::NotFoundError(absl::StrCat("No type tree of ", type_name));
+  }
+  std::vector<std::pair<absl::string_view, TypeTree::AccessCounters>> fields =
+      counters->fields;
+  std::stable_sort(fields.begin(), fields.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.second.total > b.second.total;
+                   });
+  os << "- type_name: " << type_name << "\n"
+     << "  callstacks: " << counters->callstack_count << "\n"
+     << "  total: " << counters->total.total << "\n"
+     << "  fields:\n";
+  for (size_t i = 0; i < Limit(fields.size(), limit); ++i) {
+    os << "    - name: " << fields[i].first << "\n"
+       << "      total: " << fields[i].second.total << "\n"
+       << "      access: " << fields[i].second.access << "\n"
+       << "      llc_miss: " << fields[i].second.llc_miss << "\n";
+  }
+  return absl::OkStatus();
+}
+
+// Dumps the type trees allocated with 'function' in their callstack, in the
+// format of TypeTreeStore::Dump.
+absl::Status DumpFunctionTypeTrees(const TypeTreeStore& store,
+                                   const std::string& function, int64_t limit,
+                                   std::ostream& os) {
+  const std::vector<TypeTreeStore::CallStack> callstacks =
+      store.GetCallStacksForFunction(function);
+  for (size_t i = 0; i < Limit(callstacks.size(), limit); ++i) {
+    ASSIGN_OR_RETURN(std::shared_ptr<TypeTree> type_tree,
+                     store.GetTypeTree(callstacks[i]));
+    os << "- Entry: \n";
+    os << "    type_tree: \n";
+    type_tree->Dump(os, 3);
+    os << "    callstack: \n";
+    TypeTreeStore::DumpCallStack(callstacks[i], os, 3);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Query(const std::vector<std::string>& histograms,
+                   uint32_t thread_count) {
+  ASSIGN_OR_RETURN(std::unique_ptr<HistogramBuilderResults> results,
+                   ReadHistogramFiles(histograms, thread_count));
+  const TypeTreeStore& store = *results->type_tree_store;
+  const int64_t limit = absl::GetFlag(FLAGS_limit);
+  const std::string type = absl::GetFlag(FLAGS_type);
+  const std::string function = absl::GetFlag(FLAGS_function);
+  if (!type.empty()) {
+    RETURN_IF_ERROR(DumpTypeFields(store, type, limit, std::cout));
+  }
+  if (!function.empty()) {
+    RETURN_IF_ERROR(DumpFunctionTypeTrees(store, function, limit, std::cout));
+  }
+  if (type.empty() && function.empty()) {
+    DumpTypes(store, limit, std::cout);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+  const std::vector<std::string> histograms = absl::GetFlag(FLAGS_histograms);
+  if (histograms.empty()) {
+    LOG(ERROR) << "--histograms must be specified.";
+    return 1;
+  }
+  absl::Status status =
+      Query(histograms, absl::GetFlag(FLAGS_thread_count));
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to query histograms: " << status;
+    return 1;
+  }
+  return 0;
+}
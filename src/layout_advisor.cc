@@ -0,0 +1,514 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "layout_advisor.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "histogram_builder.h"
+#include "src/object_layout.pb.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+namespace {
+
+constexpr int64_t kCacheLineBytes = 64;
+
+// Smallest fraction of the accesses of a type its hot fields account for.
+constexpr double kHotAccessFraction = 0.9;
+
+enum class Cluster { kHot, kWarm, kCold };
+
+int64_t AlignUp(int64_t value, int64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Natural alignment, in bytes, of the type of 'node', inferred from the size
+// of its leaves.
+int64_t InferAlignmentBytes(const TypeTree::Node& node) {
+  if (node.NumChildren() == 0) {
+    return absl::bit_floor(static_cast<uint64_t>(
+        std::clamp<int64_t>(node.GetSizeBytes(), 1, 16)));
+  }
+  int64_t align_bytes = 1;
+  for (size_t i = 0; i < node.NumChildren(); ++i) {
+    if (!node.GetChild(i)->IsPadding()) {
+      align_bytes =
+          std::max(align_bytes, InferAlignmentBytes(*node.GetChild(i)));
+    }
+  }
+  return align_bytes;
+}
+
+int64_t PaddingBits(const TypeTree::Node& node) {
+  if (node.IsPadding()) {
+    return node.GetFullSizeBits();
+  }
+  int64_t padding_bits = 0;
+  for (size_t i = 0; i < node.NumChildren(); ++i) {
+    padding_bits += PaddingBits(*node.GetChild(i));
+  }
+  return padding_bits;
+}
+
+// Arrays are leaves: the counts of their elements are not told apart.
+template <typename Leaf>
+void CollectLeaves(const TypeTree::Node& node, int64_t unit_offset_bits,
+                   std::vector<Leaf>& leaves) {
+  if (node.IsPadding()) {
+    return;
+  }
+  if (node.NumChildren() == 0 || node.IsArrayType() ||
+      node.GetMultiplicity() > 1) {
+    const int64_t begin_bits = node.GetGlobalOffsetBits() - unit_offset_bits;
+    const int64_t end_bits = begin_bits + node.GetFullSizeBits();
+    const int64_t offset_bytes = begin_bits / 8;
+    leaves.push_back(
+        {.offset_bytes = offset_bytes,
+         .size_bytes = std::max<int64_t>(1, (end_bits + 7) / 8 - offset_bytes),
+         .count = node.GetTotalAccessCount()});
+    return;
+  }
+  for (size_t i = 0; i < node.NumChildren(); ++i) {
+    CollectLeaves(*node.GetChild(i), unit_offset_bits, leaves);
+  }
+}
+
+}  // namespace
+
+LayoutAdvisor::TypeProfile LayoutAdvisor::CreateTypeProfile(
+    const TypeTree& type_tree) {
+  const TypeTree::Node* root = type_tree.Root();
+  TypeProfile profile;
+  profile.layout = TypeTree::CreateObjectLayoutFromTree(type_tree);
+  profile.size_bits = root->GetSizeBits();
+  profile.type_tree_count = 1;
+  profile.total_accesses = root->GetTotalAccessCount();
+  for (size_t i = 0; i < root->NumChildren(); ++i) {
+    const TypeTree::Node* child = root->GetChild(i);
+    if (child->IsPadding()) {
+      continue;
+    }
+    const int64_t begin_bits = child->GetOffsetBits();
+    const int64_t end_bits = begin_bits + child->GetFullSizeBits();
+    const bool bitfield = begin_bits % 8 != 0 || end_bits % 8 != 0;
+    const int64_t begin_bytes = begin_bits / 8;
+    const int64_t end_bytes = (end_bits + 7) / 8;
+    // A bitfield sharing bytes with the previous unit joins it.
+    if (!profile.units.empty() &&
+        begin_bytes * 8 <
+            profile.units.back().offset_bits + profile.units.back().size_bits) {
+      Unit& unit = profile.units.back();
+      absl::StrAppend(&unit.name, "+", child->GetName());
+      unit.last_subobject = i;
+      unit.size_bits =
+          std::max(unit.size_bits, end_bytes * 8 - unit.offset_bits);
+      unit.align_bytes = 1;
+      CollectLeaves(*child, unit.offset_bits, unit.leaves);
+      unit.count += child->GetTotalAccessCount();
+      continue;
+    }
+    Unit unit;
+    unit.name = child->GetName();
+    unit.first_subobject = i;
+    unit.last_subobject = i;
+    unit.offset_bits = begin_bytes * 8;
+    unit.size_bits = (end_bytes - begin_bytes) * 8;
+    unit.align_bytes = bitfield ? 1 : InferAlignmentBytes(*child);
+    unit.inner_padding_bits = PaddingBits(*child);
+    CollectLeaves(*child, unit.offset_bits, unit.leaves);
+    unit.count = child->GetTotalAccessCount();
+    // Virtual pointers and base classes are laid out by the ABI ahead of the
+    // members, so they keep their place.
+    unit.movable = !child->IsBase() &&
+                   child->GetObjectKind() != ObjectLayout::Properties::VPTR &&
+                   !absl::StartsWith(child->GetName(), "_vptr");
+    profile.units.push_back(std::move(unit));
+  }
+
+  // Fields out of their natural alignment are those of a packed type.
+  int64_t max_align_bytes = 1;
+  bool packed = false;
+  for (const Unit& unit : profile.units) {
+    max_align_bytes = std::max(max_align_bytes, unit.align_bytes);
+    packed |= (unit.offset_bits / 8) % unit.align_bytes != 0;
+  }
+  packed |= profile.size_bits % (max_align_bytes * 8) != 0;
+  if (packed) {
+    for (Unit& unit : profile.units) {
+      unit.align_bytes = 1;
+    }
+  }
+  return profile;
+}
+
+void LayoutAdvisor::AddTypeTree(const TypeTree& type_tree) {
+  if (type_tree.Empty() || !type_tree.IsRecordType() ||
+      type_tree.Root()->IsUnion()) {
+    return;
+  }
+  TypeProfile profile = CreateTypeProfile(type_tree);
+  auto it = profiles_.find(type_tree.Name());
+  if (it == profiles_.end()) {
+    profiles_.emplace(type_tree.Name(), std::move(profile));
+    return;
+  }
+  TypeProfile& existing = it->second;
+  auto same_layout = [&]() {
+    if (existing.size_bits != profile.size_bits ||
+        existing.units.size() != profile.units.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < profile.units.size(); ++i) {
+      const Unit& a = existing.units[i];
+      const Unit& b = profile.units[i];
+      if (a.offset_bits != b.offset_bits || a.size_bits != b.size_bits ||
+          a.leaves.size() != b.leaves.size()) {
+        return false;
+      }
+      for (size_t j = 0; j < a.leaves.size(); ++j) {
+        if (a.leaves[j].offset_bytes != b.leaves[j].offset_bytes ||
+            a.leaves[j].size_bytes != b.leaves[j].size_bytes) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+  if (!same_layout()) {
+    return;
+  }
+  existing.type_tree_count++;
+  existing.total_accesses += profile.total_accesses;
+  for (size_t i = 0; i < profile.units.size(); ++i) {
+    existing.units[i].count += profile.units[i].count;
+    for (size_t j = 0; j < profile.units[i].leaves.size(); ++j) {
+      existing.units[i].leaves[j].count += profile.units[i].leaves[j].count;
+    }
+  }
+}
+
+void LayoutAdvisor::AddTypeTreeStore(const TypeTreeStore& store) {
+  for (const auto& [callstack, type_tree] : store.callstack_to_type_tree_) {
+    AddTypeTree(*type_tree);
+  }
+}
+
+LayoutAdvice LayoutAdvisor::AdviseType(absl::string_view type_name,
+                                       const TypeProfile& profile) {
+  const std::vector<Unit>& units = profile.units;
+
+  // The hot fields are the densest fields making up kHotAccessFraction of the
+  // accesses to the fields.
+  std::vector<size_t> by_density(units.size());
+  uint64_t field_accesses = 0;
+  for (size_t i = 0; i < units.size(); ++i) {
+    by_density[i] = i;
+    field_accesses += units[i].count;
+  }
+  auto density = [&](size_t i) {
+    return static_cast<double>(units[i].count) /
+           std::max<int64_t>(1, units[i].size_bits / 8);
+  };
+  std::stable_sort(by_density.begin(), by_density.end(),
+                   [&](size_t a, size_t b) { return density(a) > density(b); });
+  std::vector<Cluster> clusters(units.size(), Cluster::kCold);
+  uint64_t hot_accesses = 0;
+  for (size_t i : by_density) {
+    if (units[i].count == 0) {
+      break;
+    }
+    clusters[i] = hot_accesses < kHotAccessFraction * field_accesses
+                      ? Cluster::kHot
+                      : Cluster::kWarm;
+    if (clusters[i] == Cluster::kHot) {
+      hot_accesses += units[i].count;
+    }
+  }
+
+  // Returns the cost of the units placed at 'offsets_bytes'.
+  auto evaluate = [&](absl::Span<const int64_t> offsets_bytes,
+                      int64_t size_bits) {
+    LayoutCost cost;
+    cost.size_bits = size_bits;
+    cost.padding_bits = size_bits;
+    const size_t line_count = std::max<int64_t>(
+        1, (size_bits / 8 + kCacheLineBytes - 1) / kCacheLineBytes);
+    std::vector<uint64_t> line_fetches(line_count, 0);
+    std::vector<bool> hot_lines(line_count, false);
+    double spanned_lines = 0;
+    uint64_t leaf_accesses = 0;
+    for (size_t i = 0; i < units.size(); ++i) {
+      cost.padding_bits -= units[i].size_bits - units[i].inner_padding_bits;
+      for (const Unit::Leaf& leaf : units[i].leaves) {
+        const int64_t begin = offsets_bytes[i] + leaf.offset_bytes;
+        const int64_t end = begin + leaf.size_bytes;
+        const size_t first_line = begin / kCacheLineBytes;
+        const size_t last_line = (end - 1) / kCacheLineBytes;
+        if (last_line >= line_fetches.size()) {
+          line_fetches.resize(last_line + 1, 0);
+          hot_lines.resize(last_line + 1, false);
+        }
+        // An access to a leaf larger than a line, e.g. an array, only
+        // touches some of its lines.
+        const bool large = leaf.size_bytes > kCacheLineBytes;
+        spanned_lines +=
+            static_cast<double>(leaf.count) *
+            (large ? 1 : static_cast<double>(last_line - first_line + 1));
+        leaf_accesses += leaf.count;
+        for (size_t line = first_line; line <= last_line; ++line) {
+          const int64_t overlap =
+              std::min<int64_t>(end, (line + 1) * kCacheLineBytes) -
+              std::max<int64_t>(begin, line * kCacheLineBytes);
+          const uint64_t share =
+              large ? (leaf.count * overlap + leaf.size_bytes - 1) /
+                          leaf.size_bytes
+                    : leaf.count;
+          line_fetches[line] = std::max(line_fetches[line], share);
+          hot_lines[line] =
+              hot_lines[line] || (clusters[i] == Cluster::kHot && share > 0);
+        }
+      }
+    }
+    for (size_t line = 0; line < line_fetches.size(); ++line) {
+      cost.line_fetches += line_fetches[line];
+      cost.lines_touched += line_fetches[line] > 0;
+      cost.hot_lines += hot_lines[line];
+    }
+    cost.lines_per_access =
+        leaf_accesses == 0 ? 0 : spanned_lines / leaf_accesses;
+    return cost;
+  };
+
+  // Lays out the units in 'order', each at its alignment, and returns the
+  // offsets of the units and the size of the type.
+  int64_t max_align_bytes = 1;
+  for (const Unit& unit : units) {
+    max_align_bytes = std::max(max_align_bytes, unit.align_bytes);
+  }
+  auto place = [&](absl::Span<const size_t> order,
+                   std::vector<int64_t>& offsets_bytes) {
+    offsets_bytes.assign(units.size(), 0);
+    int64_t offset_bytes = 0;
+    for (size_t i : order) {
+      offset_bytes = AlignUp(offset_bytes, units[i].align_bytes);
+      offsets_bytes[i] = offset_bytes;
+      offset_bytes += units[i].size_bits / 8;
+    }
+    return AlignUp(offset_bytes, max_align_bytes) * 8;
+  };
+
+  // The fixed units come first, then each cluster, sorted by density or by
+  // alignment. The cold fields are always sorted by alignment.
+  auto make_order = [&](bool by_alignment) {
+    std::vector<size_t> order;
+    for (size_t i = 0; i < units.size(); ++i) {
+      if (!units[i].movable) {
+        order.push_back(i);
+      }
+    }
+    for (Cluster cluster : {Cluster::kHot, Cluster::kWarm, Cluster::kCold}) {
+      std::vector<size_t> members;
+      for (size_t i : by_density) {
+        if (units[i].movable && clusters[i] == cluster) {
+          members.push_back(i);
+        }
+      }
+      if (by_alignment || cluster == Cluster::kCold) {
+        std::stable_sort(members.begin(), members.end(),
+                         [&](size_t a, size_t b) {
+                           return units[a].align_bytes > units[b].align_bytes;
+                         });
+      }
+      order.insert(order.end(), members.begin(), members.end());
+    }
+    return order;
+  };
+
+  LayoutAdvice advice;
+  advice.type_name = type_name;
+  advice.type_tree_count = profile.type_tree_count;
+  advice.total_accesses = profile.total_accesses;
+  std::vector<size_t> current_order(units.size());
+  std::vector<int64_t> current_offsets(units.size());
+  for (size_t i = 0; i < units.size(); ++i) {
+    current_order[i] = i;
+    current_offsets[i] = units[i].offset_bits / 8;
+  }
+  advice.cost = evaluate(current_offsets, profile.size_bits);
+
+  std::vector<size_t> best_order = current_order;
+  std::vector<int64_t> best_offsets = current_offsets;
+  advice.proposed_cost = advice.cost;
+  for (bool by_alignment : {false, true}) {
+    const std::vector<size_t> order = make_order(by_alignment);
+    std::vector<int64_t> offsets;
+    const int64_t size_bits = place(order, offsets);
+    const LayoutCost cost = evaluate(offsets, size_bits);
+    if (std::tie(cost.line_fetches, cost.size_bits) <
+        std::tie(advice.proposed_cost.line_fetches,
+                 advice.proposed_cost.size_bits)) {
+      best_order = order;
+      best_offsets = std::move(offsets);
+      advice.proposed_cost = cost;
+    }
+  }
+  if (advice.proposed_cost.line_fetches < advice.cost.line_fetches) {
+    advice.weighted_bytes_saved =
+        (advice.cost.line_fetches - advice.proposed_cost.line_fetches) *
+        kCacheLineBytes;
+  }
+
+  for (size_t i : current_order) {
+    switch (clusters[i]) {
+      case Cluster::kHot:
+        advice.hot_fields.push_back(units[i].name);
+        break;
+      case Cluster::kWarm:
+        advice.warm_fields.push_back(units[i].name);
+        break;
+      case Cluster::kCold:
+        advice.cold_fields.push_back(units[i].name);
+        break;
+    }
+  }
+
+  advice.layout = profile.layout;
+  advice.layout.mutable_summary()->set_total_padding_bits(
+      advice.cost.padding_bits);
+  advice.proposed_layout = profile.layout;
+  advice.proposed_layout.clear_subobjects();
+  advice.proposed_layout.mutable_properties()->set_size_bits(
+      advice.proposed_cost.size_bits);
+  advice.proposed_layout.mutable_summary()->set_total_padding_bits(
+      advice.proposed_cost.padding_bits);
+  auto add_padding = [&](int64_t from_bits, int64_t to_bits) {
+    if (from_bits >= to_bits) {
+      return;
+    }
+    ObjectLayout::Properties* padding =
+        advice.proposed_layout.add_subobjects()->mutable_properties();
+    padding->set_kind(ObjectLayout::Properties::PADDING);
+    padding->set_type_kind(ObjectLayout::Properties::PADDING_TYPE);
+    padding->set_offset_bits(from_bits);
+    padding->set_size_bits(to_bits - from_bits);
+    padding->set_multiplicity(1);
+  };
+  int64_t end_bits = 0;
+  for (size_t i : best_order) {
+    const int64_t offset_bits = best_offsets[i] * 8;
+    add_padding(end_bits, offset_bits);
+    for (int s = units[i].first_subobject; s <= units[i].last_subobject; ++s) {
+      const ObjectLayout& subobject = profile.layout.subobjects(s);
+      if (subobject.properties().type_kind() ==
+          ObjectLayout::Properties::PADDING_TYPE) {
+        continue;
+      }
+      ObjectLayout* moved = advice.proposed_layout.add_subobjects();
+      *moved = subobject;
+      moved->mutable_properties()->set_offset_bits(
+          subobject.properties().offset_bits() - units[i].offset_bits +
+          offset_bits);
+    }
+    end_bits = offset_bits + units[i].size_bits;
+  }
+  add_padding(end_bits, advice.proposed_cost.size_bits);
+
+  if (best_order != current_order) {
+    ObjectLayout::Replacement* replacement =
+        advice.layout.mutable_replacement();
+    replacement->set_type_name(advice.type_name);
+    replacement->set_size_bits(advice.proposed_cost.size_bits);
+  }
+  return advice;
+}
+
+std::vector<LayoutAdvice> LayoutAdvisor::Advise() const {
+  std::vector<LayoutAdvice> advice;
+  advice.reserve(profiles_.size());
+  for (const auto& [type_name, profile] : profiles_) {
+    advice.push_back(AdviseType(type_name, profile));
+  }
+  std::sort(advice.begin(), advice.end(),
+            [](const LayoutAdvice& a, const LayoutAdvice& b) {
+              const int64_t a_padding_saved =
+                  a.cost.padding_bits - a.proposed_cost.padding_bits;
+              const int64_t b_padding_saved =
+                  b.cost.padding_bits - b.proposed_cost.padding_bits;
+              return std::tie(b.weighted_bytes_saved, b_padding_saved,
+                              a.type_name) <
+                     std::tie(a.weighted_bytes_saved, a_padding_saved,
+                              b.type_name);
+            });
+  return advice;
+}
+
+void DumpLayoutAdvice(absl::Span<const LayoutAdvice> advice, std::ostream& os,
+                      int64_t limit) {
+  for (size_t i = 0; i < advice.size(); ++i) {
+    if (limit >= 0 && i >= static_cast<size_t>(limit)) {
+      break;
+    }
+    const LayoutAdvice& type_advice = advice[i];
+    const LayoutCost& cost = type_advice.cost;
+    const LayoutCost& proposed = type_advice.proposed_cost;
+    os << "Type: " << type_advice.type_name << "\n"
+       << "  type trees: " << type_advice.type_tree_count
+       << ", accesses: " << type_advice.total_accesses << "\n"
+       << "  weighted bytes saved: " << type_advice.weighted_bytes_saved
+       << "\n"
+       << "  size bytes: " << cost.size_bits / 8 << " -> "
+       << proposed.size_bits / 8 << "\n"
+       << "  padding bytes: " << cost.padding_bits / 8 << " -> "
+       << proposed.padding_bits / 8 << "\n"
+       << "  lines touched: " << cost.lines_touched << " -> "
+       << proposed.lines_touched << "\n"
+       << "  hot lines: " << cost.hot_lines << " -> " << proposed.hot_lines
+       << "\n"
+       << "  line fetches: " << cost.line_fetches << " -> "
+       << proposed.line_fetches << "\n"
+       << "  lines per access: " << cost.lines_per_access << " -> "
+       << proposed.lines_per_access << "\n"
+       << "  hot: " << absl::StrJoin(type_advice.hot_fields, ", ") << "\n"
+       << "  warm: " << absl::StrJoin(type_advice.warm_fields, ", ") << "\n"
+       << "  cold: " << absl::StrJoin(type_advice.cold_fields, ", ") << "\n"
+       << "  proposed layout:\n";
+    for (const ObjectLayout& subobject :
+         type_advice.proposed_layout.subobjects()) {
+      const ObjectLayout::Properties& properties = subobject.properties();
+      os << "    " << properties.offset_bits() / 8 << ": "
+         << (properties.kind() == ObjectLayout::Properties::PADDING
+                 ? "<padding>"
+                 : properties.name())
+         << " (" << properties.size_bits() * properties.multiplicity() / 8
+         << " bytes)\n";
+    }
+  }
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LAYOUT_ADVISOR_H_
+#define LAYOUT_ADVISOR_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "histogram_builder.h"
+#include "src/object_layout.pb.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// The cost of a layout of a record type, assuming that objects start at a
+// cache line boundary.
+struct LayoutCost {
+  int64_t size_bits = 0;
+  // Padding in the type or its fields.
+  int64_t padding_bits = 0;
+  // Cache lines holding an accessed field.
+  uint64_t lines_touched = 0;
+  // Cache lines holding a hot field.
+  uint64_t hot_lines = 0;
+  // Estimated number of cache line fetches: for each cache line, the largest
+  // access count of the fields it holds, accesses to the other fields of the
+  // line being assumed to hit the fetched line.
+  uint64_t line_fetches = 0;
+  // Average number of cache lines an access to a field spans.
+  double lines_per_access = 0;
+};
+
+// The layout proposed for a record type by the LayoutAdvisor.
+struct LayoutAdvice {
+  std::string type_name;
+  // Number of type trees, i.e. allocation sites, the counts add up from.
+  uint64_t type_tree_count = 0;
+  uint64_t total_accesses = 0;
+  // The profiled layout. Its Summary holds its padding, and its Replacement
+  // the size of the proposed layout.
+  ObjectLayout layout;
+  // The fields of 'layout' reordered, with the padding they need.
+  ObjectLayout proposed_layout;
+  LayoutCost cost;
+  LayoutCost proposed_cost;
+  // The fields clustered by how much they are accessed: the hot fields are
+  // the densest fields making up most of the accesses, the warm fields the
+  // other accessed fields, and the cold fields are never accessed.
+  std::vector<std::string> hot_fields;
+  std::vector<std::string> warm_fields;
+  std::vector<std::string> cold_fields;
+  // Access-weighted bytes saved by the proposed layout: the cache line
+  // fetches it saves, times the cache line size.
+  uint64_t weighted_bytes_saved = 0;
+};
+
+// Proposes layouts of the record types of a histogram that touch fewer cache
+// lines, from the access counts of their fields. The top-level fields of a
+// type are reordered as a whole: hot fields first, then warm, then cold ones,
+// each cluster ordered to limit the lines touched and the padding. Fields are
+// assumed to be naturally aligned, as inferred from the sizes of their
+// leaves; the fields of packed types are not aligned. A virtual pointer and
+// the base classes stay first, in their order, and bitfields sharing bytes
+// are moved together. Unions and non-record types are left alone.
+class LayoutAdvisor {
+ public:
+  LayoutAdvisor() = default;
+  LayoutAdvisor(const LayoutAdvisor&) = delete;
+  LayoutAdvisor& operator=(const LayoutAdvisor&) = delete;
+
+  // Adds the access counts of 'type_tree' to those of its type. The trees of a
+  // type whose layout differs from the first tree added for it are ignored.
+  void AddTypeTree(const TypeTree& type_tree);
+
+  // Same as above, for each type tree of 'store'.
+  void AddTypeTreeStore(const TypeTreeStore& store);
+
+  // Returns the advice for every type added, ranked by weighted bytes saved,
+  // then by padding saved.
+  std::vector<LayoutAdvice> Advise() const;
+
+ private:
+  // A part of a type moved as a whole: a field, or bitfields sharing bytes.
+  struct Unit {
+    std::string name;
+    // Indexes of the subobjects of the type making up the unit.
+    int first_subobject = 0;
+    int last_subobject = 0;
+    int64_t offset_bits = 0;
+    int64_t size_bits = 0;
+    int64_t align_bytes = 1;
+    // Padding inside of the fields of the unit.
+    int64_t inner_padding_bits = 0;
+    // Leaves of the unit, with byte offsets from the start of the unit.
+    struct Leaf {
+      int64_t offset_bytes;
+      int64_t size_bytes;
+      uint64_t count;
+    };
+    std::vector<Leaf> leaves;
+    uint64_t count = 0;
+    bool movable = true;
+  };
+
+  struct TypeProfile {
+    ObjectLayout layout;
+    int64_t size_bits = 0;
+    std::vector<Unit> units;
+    uint64_t type_tree_count = 0;
+    uint64_t total_accesses = 0;
+  };
+
+  static TypeProfile CreateTypeProfile(const TypeTree& type_tree);
+  static LayoutAdvice AdviseType(absl::string_view type_name,
+                                 const TypeProfile& profile);
+
+  absl::flat_hash_map<std::string, TypeProfile> profiles_;
+};
+
+// Dumps the first 'limit' entries of 'advice', or all of them if 'limit' is
+// negative.
+void DumpLayoutAdvice(absl::Span<const LayoutAdvice> advice, std::ostream& os,
+                      int64_t limit = -1);
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // LAYOUT_ADVISOR_H_
@@ -0,0 +1,189 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "layout_advisor.h"
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+#include "object_layout_test_util.h"
+#include "src/object_layout.pb.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+// struct Hot {
+//   int64_t a;
+//   int64_t c1, ..., c7;
+//   int64_t b;
+// };
+// with 'a' and 'b' accessed 'count' times each, on two cache lines.
+std::unique_ptr<TypeTree> CreateHotTree(uint64_t count) {
+  ObjectLayout layout = CreateRecordLayout("Hot", 72);
+  AddField(layout, "a", 0, 8);
+  for (int i = 1; i <= 7; ++i) {
+    AddField(layout, absl::StrCat("c", i), 8 * i, 8);
+  }
+  AddField(layout, "b", 64, 8);
+  std::unique_ptr<TypeTree> type_tree =
+      TypeTree::CreateTreeFromObjectLayout(layout, "Hot");
+  type_tree->RecordAccess(0, count);
+  type_tree->RecordAccess(64, count);
+  return type_tree;
+}
+
+TEST(LayoutAdvisorTest, GroupsHotFieldsOnOneLine) {
+  LayoutAdvisor advisor;
+  advisor.AddTypeTree(*CreateHotTree(100));
+  const std::vector<LayoutAdvice> advice = advisor.Advise();
+  ASSERT_EQ(advice.size(), 1);
+  const LayoutAdvice& hot = advice[0];
+  EXPECT_EQ(hot.type_name, "Hot");
+  EXPECT_EQ(hot.hot_fields, std::vector<std::string>({"a", "b"}));
+  EXPECT_EQ(hot.warm_fields, std::vector<std::string>());
+  EXPECT_EQ(hot.cold_fields.size(), 7);
+
+  EXPECT_EQ(hot.cost.lines_touched, 2);
+  EXPECT_EQ(hot.cost.hot_lines, 2);
+  EXPECT_EQ(hot.cost.line_fetches, 200);
+  EXPECT_EQ(hot.proposed_cost.lines_touched, 1);
+  EXPECT_EQ(hot.proposed_cost.hot_lines, 1);
+  EXPECT_EQ(hot.proposed_cost.line_fetches, 100);
+  EXPECT_EQ(hot.proposed_cost.size_bits, 72 * 8);
+  EXPECT_EQ(hot.proposed_cost.padding_bits, 0);
+  EXPECT_EQ(hot.weighted_bytes_saved, 100 * 64);
+
+  ASSERT_EQ(hot.proposed_layout.subobjects_size(), 9);
+  EXPECT_EQ(hot.proposed_layout.subobjects(0).properties().name(), "a");
+  EXPECT_EQ(hot.proposed_layout.subobjects(1).properties().name(), "b");
+  EXPECT_EQ(hot.proposed_layout.subobjects(1).properties().offset_bits(), 64);
+  EXPECT_EQ(hot.layout.replacement().type_name(), "Hot");
+  EXPECT_EQ(hot.layout.replacement().size_bits(), 72 * 8);
+  EXPECT_EQ(hot.layout.summary().total_padding_bits(), 0);
+}
+
+TEST(LayoutAdvisorTest, AddsCountsOfSameType) {
+  LayoutAdvisor advisor;
+  advisor.AddTypeTree(*CreateHotTree(100));
+  advisor.AddTypeTree(*CreateHotTree(50));
+  const std::vector<LayoutAdvice> advice = advisor.Advise();
+  ASSERT_EQ(advice.size(), 1);
+  EXPECT_EQ(advice[0].type_tree_count, 2);
+  EXPECT_EQ(advice[0].cost.line_fetches, 300);
+  EXPECT_EQ(advice[0].weighted_bytes_saved, 150 * 64);
+}
+
+TEST(LayoutAdvisorTest, RemovesPaddingAndRanksBySavings) {
+  // struct Padded {
+  //   char c1;
+  //   int64_t x;
+  //   char c2;
+  // };
+  ObjectLayout layout = CreateRecordLayout("Padded", 24);
+  AddField(layout, "c1", 0, 1);
+  AddField(layout, "x", 8, 8);
+  AddField(layout, "c2", 16, 1);
+  std::unique_ptr<TypeTree> padded =
+      TypeTree::CreateTreeFromObjectLayout(layout, "Padded");
+
+  LayoutAdvisor advisor;
+  advisor.AddTypeTree(*padded);
+  advisor.AddTypeTree(*CreateHotTree(1));
+  const std::vector<LayoutAdvice> advice = advisor.Advise();
+  ASSERT_EQ(advice.size(), 2);
+  EXPECT_EQ(advice[0].type_name, "Hot");
+  const LayoutAdvice& padded_advice = advice[1];
+  EXPECT_EQ(padded_advice.type_name, "Padded");
+  EXPECT_EQ(padded_advice.weighted_bytes_saved, 0);
+  EXPECT_EQ(padded_advice.cost.padding_bits, 14 * 8);
+  EXPECT_EQ(padded_advice.proposed_cost.size_bits, 16 * 8);
+  EXPECT_EQ(padded_advice.proposed_cost.padding_bits, 6 * 8);
+  EXPECT_EQ(padded_advice.layout.summary().total_padding_bits(), 14 * 8);
+  EXPECT_EQ(padded_advice.proposed_layout.summary().total_padding_bits(),
+            6 * 8);
+  EXPECT_EQ(padded_advice.layout.replacement().size_bits(), 16 * 8);
+  ASSERT_GE(padded_advice.proposed_layout.subobjects_size(), 3);
+  EXPECT_EQ(padded_advice.proposed_layout.subobjects(0).properties().name(),
+            "x");
+
+  std::stringstream dump;
+  DumpLayoutAdvice(advice, dump, /*limit=*/1);
+  EXPECT_NE(dump.str().find("Type: Hot"), std::string::npos);
+  EXPECT_EQ(dump.str().find("Type: Padded"), std::string::npos);
+}
+
+TEST(LayoutAdvisorTest, KeepsBaseClassesFirst) {
+  // struct Derived : Base1, Base2 {
+  //   int64_t a;
+  //   int64_t c1, ..., c5;
+  //   int64_t b;
+  // };
+  // with 'a' and 'b' accessed on two cache lines, and the bases never.
+  ObjectLayout layout = CreateRecordLayout("Derived", 72);
+  for (absl::string_view base : {"Base1", "Base2"}) {
+    AddField(layout, base, layout.subobjects_size() * 8, 8);
+    ObjectLayout::Properties* properties =
+        layout.mutable_subobjects(layout.subobjects_size() - 1)
+            ->mutable_properties();
+    properties->set_type_name(base);
+    properties->set_kind(ObjectLayout::Properties::BASE);
+  }
+  AddField(layout, "a", 16, 8);
+  for (int i = 1; i <= 5; ++i) {
+    AddField(layout, absl::StrCat("c", i), 16 + 8 * i, 8);
+  }
+  AddField(layout, "b", 64, 8);
+  std::unique_ptr<TypeTree> type_tree =
+      TypeTree::CreateTreeFromObjectLayout(layout, "Derived");
+  type_tree->RecordAccess(16, 100);
+  type_tree->RecordAccess(64, 100);
+
+  LayoutAdvisor advisor;
+  advisor.AddTypeTree(*type_tree);
+  const std::vector<LayoutAdvice> advice = advisor.Advise();
+  ASSERT_EQ(advice.size(), 1);
+  const LayoutAdvice& derived = advice[0];
+  EXPECT_EQ(derived.proposed_cost.line_fetches, 100);
+  ASSERT_EQ(derived.proposed_layout.subobjects_size(), 9);
+  // The bases keep their place and order, the hot members follow them.
+  const ObjectLayout& proposed = derived.proposed_layout;
+  EXPECT_EQ(proposed.subobjects(0).properties().name(), "Base1");
+  EXPECT_EQ(proposed.subobjects(1).properties().name(), "Base2");
+  EXPECT_EQ(proposed.subobjects(2).properties().name(), "a");
+  EXPECT_EQ(proposed.subobjects(3).properties().name(), "b");
+  EXPECT_EQ(proposed.subobjects(3).properties().offset_bits(), 24 * 8);
+}
+
+TEST(LayoutAdvisorTest, IgnoresNonRecordTypes) {
+  ObjectLayout layout;
+  layout.mutable_properties()->set_name("int64_t");
+  layout.mutable_properties()->set_type_name("int64_t");
+  layout.mutable_properties()->set_type_kind(
+      ObjectLayout::Properties::BUILTIN_TYPE);
+  layout.mutable_properties()->set_size_bits(64);
+  layout.mutable_properties()->set_multiplicity(1);
+  LayoutAdvisor advisor;
+  advisor.AddTypeTree(*TypeTree::CreateTreeFromObjectLayout(layout, "int64_t"));
+  EXPECT_TRUE(advisor.Advise().empty());
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
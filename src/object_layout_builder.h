@@ -0,0 +1,85 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef OBJECT_LAYOUT_BUILDER_H_
+#define OBJECT_LAYOUT_BUILDER_H_
+
+// Helpers to build ObjectLayouts in code, such as the container blueprints of
+// type_tree_container_blueprints.h.
+
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "src/object_layout.pb.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Sets the properties of 'layout', other than its offset.
+inline void SetLayoutProperties(ObjectLayout& layout, absl::string_view name,
+                                absl::string_view type_name,
+                                ObjectLayout::Properties::ObjectKind kind,
+                                ObjectLayout::Properties::TypeKind type_kind,
+                                int64_t size_bits, int64_t multiplicity = 1) {
+  ObjectLayout::Properties* properties = layout.mutable_properties();
+  properties->set_name(std::string(name));
+  properties->set_type_name(std::string(type_name));
+  properties->set_kind(kind);
+  properties->set_type_kind(type_kind);
+  properties->set_size_bits(size_bits);
+  properties->set_multiplicity(multiplicity);
+}
+
+// Adds the field 'name' to 'parent' and returns it.
+inline ObjectLayout* AddFieldLayout(
+    ObjectLayout& parent, absl::string_view name, absl::string_view type_name,
+    ObjectLayout::Properties::TypeKind type_kind, int64_t size_bits) {
+  ObjectLayout* field = parent.add_subobjects();
+  SetLayoutProperties(*field, name, type_name, ObjectLayout::Properties::FIELD,
+                      type_kind, size_bits);
+  return field;
+}
+
+// Adds 'size_bits' of padding to 'parent' and returns it.
+inline ObjectLayout* AddPaddingLayout(ObjectLayout& parent, int64_t size_bits) {
+  ObjectLayout* padding = parent.add_subobjects();
+  SetLayoutProperties(*padding, "", "", ObjectLayout::Properties::PADDING,
+                      ObjectLayout::Properties::PADDING_TYPE, size_bits);
+  return padding;
+}
+
+// Adds the array field 'name' of 'count' elements of type 'element_type_name'
+// to 'parent' and returns it. The array itself is left without a size, it is
+// made of the size of its elements.
+inline ObjectLayout* AddArrayLayout(
+    ObjectLayout& parent, absl::string_view name,
+    absl::string_view element_type_name,
+    ObjectLayout::Properties::TypeKind element_type_kind,
+    int64_t element_size_bits, int64_t count) {
+  ObjectLayout* array = parent.add_subobjects();
+  SetLayoutProperties(*array, name,
+                      absl::StrCat(element_type_name, "[", count, "]"),
+                      ObjectLayout::Properties::FIELD,
+                      ObjectLayout::Properties::ARRAY_TYPE, 0);
+  SetLayoutProperties(*array->add_subobjects(), "[_]", element_type_name,
+                      ObjectLayout::Properties::ARRAY_ELEMENTS,
+                      element_type_kind, element_size_bits, count);
+  return array;
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // OBJECT_LAYOUT_BUILDER_H_
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef OBJECT_LAYOUT_TEST_UTIL_H_
+#define OBJECT_LAYOUT_TEST_UTIL_H_
+
+// Helpers for tests to write the ObjectLayouts of records field by field, with
+// sizes and offsets in bytes.
+
+#include <cstdint>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "object_layout_builder.h"
+#include "src/object_layout.pb.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Returns the layout of the record type 'name', without fields.
+inline ObjectLayout CreateRecordLayout(absl::string_view name,
+                                       int64_t size_bytes) {
+  ObjectLayout layout;
+  SetLayoutProperties(layout, name, name, ObjectLayout::Properties::FIELD,
+                      ObjectLayout::Properties::RECORD_TYPE, size_bytes * 8);
+  return layout;
+}
+
+// Adds the builtin field 'name' of type 'type_name' to 'layout' and returns
+// it.
+inline ObjectLayout* AddField(ObjectLayout& layout, absl::string_view name,
+                              absl::string_view type_name,
+                              int64_t offset_bytes, int64_t size_bytes) {
+  ObjectLayout* field =
+      AddFieldLayout(layout, name, type_name,
+                     ObjectLayout::Properties::BUILTIN_TYPE, size_bytes * 8);
+  field->mutable_properties()->set_offset_bits(offset_bytes * 8);
+  return field;
+}
+
+// Same as above, with an integer type of the size of the field.
+inline ObjectLayout* AddField(ObjectLayout& layout, absl::string_view name,
+                              int64_t offset_bytes, int64_t size_bytes) {
+  return AddField(layout, name, absl::StrCat("int", size_bytes * 8, "_t"),
+                  offset_bytes, size_bytes);
+}
+
+// Adds padding to 'layout'.
+inline void AddPadding(ObjectLayout& layout, int64_t offset_bytes,
+                       int64_t size_bytes) {
+  AddPaddingLayout(layout, size_bytes * 8)
+      ->mutable_properties()
+      ->set_offset_bits(offset_bytes * 8);
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // OBJECT_LAYOUT_TEST_UTIL_H_
@@ -0,0 +1,65 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+size_t ParallelWorkerCount(size_t count, uint32_t thread_count) {
+  return std::max<size_t>(std::min<size_t>(thread_count, count), 1);
+}
+
+void ParallelFor(size_t count, uint32_t thread_count,
+                 absl::FunctionRef<void(size_t worker, size_t index)> fn) {
+  const size_t worker_count = ParallelWorkerCount(count, thread_count);
+  if (worker_count == 1) {
+    for (size_t i = 0; i < count; ++i) {
+      fn(0, i);
+    }
+    return;
+  }
+  std::atomic<size_t> next_index = 0;
+  auto run = [&](size_t worker) {
+    for (size_t i = next_index++; i < count; i = next_index++) {
+      fn(worker, i);
+    }
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(worker_count - 1);
+  for (size_t worker = 1; worker < worker_count; ++worker) {
+    workers.emplace_back(run, worker);
+  }
+  // The calling thread is the first worker.
+  run(0);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void ParallelFor(size_t count, uint32_t thread_count,
+                 absl::FunctionRef<void(size_t index)> fn) {
+  ParallelFor(count, thread_count,
+              [fn](size_t /*worker*/, size_t index) { fn(index); });
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
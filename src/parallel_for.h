@@ -0,0 +1,47 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARALLEL_FOR_H_
+#define PARALLEL_FOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/functional/function_ref.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Number of threads ParallelFor runs 'count' items on: at most 'thread_count',
+// at most one per item, and at least one.
+size_t ParallelWorkerCount(size_t count, uint32_t thread_count);
+
+// Calls 'fn(worker, index)' for each index in [0, count), on
+// ParallelWorkerCount(count, thread_count) threads, and returns once all the
+// calls returned. 'worker' is the index of the calling thread, in
+// [0, ParallelWorkerCount(count, thread_count)), e.g. to accumulate results
+// per thread. The indexes are claimed one at a time, in increasing order, so
+// that a slow item does not hold back the ones after it. With a single worker,
+// the calls are made on the calling thread.
+void ParallelFor(size_t count, uint32_t thread_count,
+                 absl::FunctionRef<void(size_t worker, size_t index)> fn);
+
+// Same as above, for 'fn' that does not need the worker.
+void ParallelFor(size_t count, uint32_t thread_count,
+                 absl::FunctionRef<void(size_t index)> fn);
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // PARALLEL_FOR_H_
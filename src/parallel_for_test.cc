@@ -0,0 +1,66 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel_for.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+TEST(ParallelForTest, CallsEachIndexOnce) {
+  for (uint32_t thread_count : {0, 1, 4}) {
+    std::vector<std::atomic<int>> calls(100);
+    ParallelFor(calls.size(), thread_count,
+                [&](size_t index) { calls[index]++; });
+    for (const std::atomic<int>& count : calls) {
+      EXPECT_EQ(count, 1);
+    }
+  }
+}
+
+TEST(ParallelForTest, NumbersWorkers) {
+  EXPECT_EQ(ParallelWorkerCount(/*count=*/10, /*thread_count=*/4), 4);
+  EXPECT_EQ(ParallelWorkerCount(/*count=*/2, /*thread_count=*/4), 2);
+  EXPECT_EQ(ParallelWorkerCount(/*count=*/0, /*thread_count=*/4), 1);
+  EXPECT_EQ(ParallelWorkerCount(/*count=*/10, /*thread_count=*/0), 1);
+
+  // Each worker only writes to its own slot.
+  std::vector<size_t> per_worker(ParallelWorkerCount(1000, 4), 0);
+  ParallelFor(1000, 4, [&](size_t worker, size_t index) {
+    ASSERT_LT(worker, per_worker.size());
+    per_worker[worker] += index;
+  });
+  size_t total = 0;
+  for (size_t sum : per_worker) {
+    total += sum;
+  }
+  EXPECT_EQ(total, 999 * 1000 / 2);
+}
+
+TEST(ParallelForTest, RunsOnTheCallingThreadWithOneWorker) {
+  const std::thread::id caller = std::this_thread::get_id();
+  ParallelFor(3, 1, [&](size_t /*index*/) {
+    EXPECT_EQ(std::this_thread::get_id(), caller);
+  });
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
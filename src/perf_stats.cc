@@ -0,0 +1,181 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "perf_stats.h"
+
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+constexpr absl::string_view kHitsSuffix = "_hits";
+constexpr absl::string_view kMissesSuffix = "_misses";
+
+// Writes 'str' as a JSON string.
+void WriteJsonString(absl::string_view str, std::ostream& os) {
+  os << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << ' ';
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+}  // namespace
+
+PerfStats& PerfStats::Global() {
+  static PerfStats* const stats = new PerfStats();
+  return *stats;
+}
+
+PerfCounter& PerfStats::Counter(absl::string_view name) {
+  absl::MutexLock lock(&mu_);
+  return counters_[name];
+}
+
+PerfPhase& PerfStats::Phase(absl::string_view name) {
+  absl::MutexLock lock(&mu_);
+  return phases_.try_emplace(name, name).first->second;
+}
+
+void PerfStats::AddPhase(PerfPhase& phase, absl::Time start, absl::Time end,
+                         bool trace) {
+  phase.Add(end - start);
+  if (!trace || !tracing_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  absl::MutexLock lock(&mu_);
+  const uint32_t thread =
+      threads_.emplace(std::this_thread::get_id(), threads_.size())
+          .first->second;
+  trace_events_.push_back({.phase = phase.name(),
+                           .start = start,
+                           .duration = end - start,
+                           .thread = thread});
+}
+
+void PerfStats::EnableTrace() {
+  absl::MutexLock lock(&mu_);
+  if (!tracing_.load(std::memory_order_relaxed)) {
+    trace_start_ = absl::Now();
+    tracing_.store(true, std::memory_order_relaxed);
+  }
+}
+
+PhaseTime PerfStats::GetPhaseTime(absl::string_view phase) const {
+  absl::MutexLock lock(&mu_);
+  auto it = phases_.find(phase);
+  return it == phases_.end() ? PhaseTime() : it->second.time();
+}
+
+void PerfStats::Log() const {
+  absl::MutexLock lock(&mu_);
+  std::vector<std::pair<absl::string_view, PhaseTime>> phases;
+  phases.reserve(phases_.size());
+  for (const auto& [name, phase] : phases_) {
+    phases.emplace_back(name, phase.time());
+  }
+  std::sort(phases.begin(), phases.end(), [](const auto& a, const auto& b) {
+    return a.second.total > b.second.total ||
+           (a.second.total == b.second.total && a.first < b.first);
+  });
+  std::vector<std::pair<absl::string_view, int64_t>> counters;
+  for (const auto& [name, counter] : counters_) {
+    counters.emplace_back(name, counter.value());
+  }
+  std::sort(counters.begin(), counters.end());
+
+  std::stringstream log;
+  log << "- \n ====== Performance ======\n";
+  for (const auto& [phase, time] : phases) {
+    log << phase << ": " << time.total << " in " << time.count << " run(s)\n";
+  }
+  for (const auto& [name, value] : counters) {
+    log << name << ": " << value << "\n";
+    if (!absl::EndsWith(name, kHitsSuffix)) {
+      continue;
+    }
+    const std::string misses_name = absl::StrCat(
+        absl::StripSuffix(name, kHitsSuffix), kMissesSuffix);
+    auto misses = counters_.find(misses_name);
+    if (misses != counters_.end() && value + misses->second.value() > 0) {
+      log << absl::StripSuffix(name, kHitsSuffix) << " hit rate: "
+          << 100.0 * value / (value + misses->second.value()) << "%\n";
+    }
+  }
+  log << "Peak RSS: " << GetPeakRssBytes() << " bytes\n";
+  if (const int64_t heap_bytes = GetHeapBytesInUse(); heap_bytes >= 0) {
+    log << "Heap in use: " << heap_bytes << " bytes\n";
+  }
+  log << " ======     End     ======\n";
+  LOG(INFO) << log.str();
+}
+
+void PerfStats::WriteChromeTrace(std::ostream& os) const {
+  absl::MutexLock lock(&mu_);
+  // Complete events, with timestamps and durations in microseconds.
+  os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (size_t i = 0; i < trace_events_.size(); ++i) {
+    const TraceEvent& event = trace_events_[i];
+    os << (i == 0 ? "\n" : ",\n") << "{\"name\":";
+    WriteJsonString(event.phase, os);
+    os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+       << ",\"ts\":" << absl::ToInt64Microseconds(event.start - trace_start_)
+       << ",\"dur\":" << absl::ToInt64Microseconds(event.duration) << "}";
+  }
+  os << "\n]}\n";
+}
+
+int64_t GetPeakRssBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // In KiB on Linux.
+  return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+}
+
+int64_t GetHeapBytesInUse() {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return static_cast<int64_t>(mallinfo2().uordblks);
+#else
+  return -1;
+#endif
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PERF_STATS_H_
+#define PERF_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Wall time spent in a phase, added up over all its runs. Runs on several
+// threads at once add up to more than the elapsed time.
+struct PhaseTime {
+  absl::Duration total;
+  uint64_t count = 0;
+};
+
+// A counter of PerfStats. Adding to it is a relaxed atomic add, cheap enough
+// for the hot paths.
+class PerfCounter {
+ public:
+  PerfCounter() = default;
+  PerfCounter(const PerfCounter&) = delete;
+  PerfCounter& operator=(const PerfCounter&) = delete;
+
+  void Add(int64_t delta = 1) {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_ = 0;
+};
+
+// The wall time of a phase of PerfStats, added up with relaxed atomic adds,
+// so that phases run for each allocation site do not contend on a lock.
+class PerfPhase {
+ public:
+  explicit PerfPhase(absl::string_view name) : name_(name) {}
+  PerfPhase(const PerfPhase&) = delete;
+  PerfPhase& operator=(const PerfPhase&) = delete;
+
+  void Add(absl::Duration duration) {
+    nanoseconds_.fetch_add(absl::ToInt64Nanoseconds(duration),
+                           std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  PhaseTime time() const {
+    return {.total = absl::Nanoseconds(
+                nanoseconds_.load(std::memory_order_relaxed)),
+            .count = count_.load(std::memory_order_relaxed)};
+  }
+  absl::string_view name() const { return name_; }
+
+ private:
+  const std::string name_;
+  std::atomic<int64_t> nanoseconds_ = 0;
+  std::atomic<uint64_t> count_ = 0;
+};
+
+// The wall time of the phases of a run, e.g. DWARF parsing or type resolution,
+// and counters of its caches, for --stats. When tracing, also records an
+// event for each run of a traced phase, which can be exported as a Chrome
+// trace and viewed with chrome://tracing or ui.perfetto.dev. Safe to use from
+// multiple threads.
+class PerfStats {
+ public:
+  PerfStats() = default;
+  PerfStats(const PerfStats&) = delete;
+  PerfStats& operator=(const PerfStats&) = delete;
+
+  // The statistics of the whole process. Never destroyed.
+  static PerfStats& Global();
+
+  // Returns the counter 'name', created on first use. Counters live as long
+  // as their PerfStats, so callers can keep them in a static. A pair of
+  // counters '<name>_hits' and '<name>_misses' is logged with its hit rate.
+  PerfCounter& Counter(absl::string_view name);
+
+  // Returns the phase 'name', created on first use. Like counters, phases
+  // can be kept in a static, which saves looking them up on every run.
+  PerfPhase& Phase(absl::string_view name);
+
+  // Adds a run of 'phase' from 'start' to 'end' on the calling thread. Only
+  // recorded as a trace event if 'trace' is set and tracing is enabled.
+  void AddPhase(PerfPhase& phase, absl::Time start, absl::Time end,
+                bool trace = true);
+  void AddPhase(absl::string_view phase, absl::Time start, absl::Time end,
+                bool trace = true) {
+    AddPhase(Phase(phase), start, end, trace);
+  }
+
+  // Starts recording trace events of the phases run from now on.
+  void EnableTrace();
+
+  // Whether ScopedPhase adds up the time of phases, which is the default.
+  // Without it, only the traced phases are timed, and only while tracing, so
+  // that the phases run for each allocation site cost nothing without
+  // --stats.
+  void EnablePhaseTimes(bool enabled) {
+    phase_times_.store(enabled, std::memory_order_relaxed);
+  }
+
+  // Whether a run of a phase, traced or not, needs to be timed.
+  bool ShouldTime(bool trace) const {
+    return phase_times_.load(std::memory_order_relaxed) ||
+           (trace && tracing_.load(std::memory_order_relaxed));
+  }
+
+  // Returns the time spent in 'phase' so far.
+  PhaseTime GetPhaseTime(absl::string_view phase) const;
+
+  // Logs the phases, by decreasing total time, the counters, the peak RSS and
+  // the heap in use.
+  void Log() const;
+
+  // Writes the trace events recorded so far in the JSON trace event format of
+  // Chrome.
+  void WriteChromeTrace(std::ostream& os) const;
+
+ private:
+  struct TraceEvent {
+    // Name of the phase, owned by its PerfPhase.
+    absl::string_view phase;
+    absl::Time start;
+    absl::Duration duration;
+    uint32_t thread;
+  };
+
+  mutable absl::Mutex mu_;
+  absl::node_hash_map<std::string, PerfPhase> phases_ ABSL_GUARDED_BY(mu_);
+  absl::node_hash_map<std::string, PerfCounter> counters_ ABSL_GUARDED_BY(mu_);
+  std::atomic<bool> phase_times_ = true;
+  // Set once by EnableTrace, then read without the lock.
+  std::atomic<bool> tracing_ = false;
+  absl::Time trace_start_ ABSL_GUARDED_BY(mu_);
+  std::vector<TraceEvent> trace_events_ ABSL_GUARDED_BY(mu_);
+  // Small ids of the threads of the trace events, by order of appearance.
+  absl::flat_hash_map<std::thread::id, uint32_t> threads_ ABSL_GUARDED_BY(mu_);
+};
+
+// Adds the wall time from its construction to its destruction to 'phase', if
+// the stats time it, see PerfStats::ShouldTime. Phases run for each allocation
+// site should not be traced, as their events would flood the trace: their
+// runs are only added up. They should also pass a PerfPhase kept in a static
+// rather than a name, which would be looked up under the lock of the stats.
+class ScopedPhase {
+ public:
+  explicit ScopedPhase(absl::string_view phase, bool trace = true,
+                       PerfStats& stats = PerfStats::Global())
+      : phase_(stats.ShouldTime(trace) ? &stats.Phase(phase) : nullptr),
+        trace_(trace),
+        stats_(stats),
+        start_(phase_ != nullptr ? absl::Now() : absl::InfinitePast()) {}
+  explicit ScopedPhase(PerfPhase& phase, bool trace = true,
+                       PerfStats& stats = PerfStats::Global())
+      : phase_(stats.ShouldTime(trace) ? &phase : nullptr),
+        trace_(trace),
+        stats_(stats),
+        start_(phase_ != nullptr ? absl::Now() : absl::InfinitePast()) {}
+  ~ScopedPhase() {
+    if (phase_ != nullptr) {
+      stats_.AddPhase(*phase_, start_, absl::Now(), trace_);
+    }
+  }
+  ScopedPhase(const ScopedPhase&) = delete;
+  ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+ private:
+  PerfPhase* const phase_;
+  const bool trace_;
+  PerfStats& stats_;
+  const absl::Time start_;
+};
+
+// Peak resident set size of the process, in bytes.
+int64_t GetPeakRssBytes();
+
+// Bytes of heap allocated and not yet freed, or -1 if malloc does not report
+// them.
+int64_t GetHeapBytesInUse();
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // PERF_STATS_H_
@@ -0,0 +1,107 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "perf_stats.h"
+
+#include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+TEST(PerfStatsTest, AddsUpPhases) {
+  PerfStats stats;
+  const absl::Time start = absl::Now();
+  stats.AddPhase("parse", start, start + absl::Milliseconds(2));
+  stats.AddPhase("parse", start, start + absl::Milliseconds(3));
+  { ScopedPhase phase("resolve", /*trace=*/false, stats); }
+
+  const PhaseTime parse = stats.GetPhaseTime("parse");
+  EXPECT_EQ(parse.count, 2);
+  EXPECT_EQ(parse.total, absl::Milliseconds(5));
+  EXPECT_EQ(stats.GetPhaseTime("resolve").count, 1);
+  EXPECT_EQ(stats.GetPhaseTime("dump").count, 0);
+}
+
+TEST(PerfStatsTest, CountersAreShared) {
+  PerfStats stats;
+  PerfCounter& hits = stats.Counter("cache_hits");
+  hits.Add();
+  hits.Add(2);
+  EXPECT_EQ(&stats.Counter("cache_hits"), &hits);
+  EXPECT_EQ(stats.Counter("cache_hits").value(), 3);
+  EXPECT_EQ(stats.Counter("cache_misses").value(), 0);
+}
+
+TEST(PerfStatsTest, TracesOnlyTracedPhasesOnceEnabled) {
+  PerfStats stats;
+  const absl::Time start = absl::Now();
+  stats.AddPhase("before", start, start + absl::Milliseconds(1));
+  stats.EnableTrace();
+  const absl::Time traced_start = absl::Now();
+  stats.AddPhase("parse", traced_start,
+                 traced_start + absl::Milliseconds(2));
+  stats.AddPhase("resolve", traced_start,
+                 traced_start + absl::Milliseconds(1), /*trace=*/false);
+  std::thread([&stats] { ScopedPhase phase("thread", true, stats); }).join();
+
+  std::stringstream trace;
+  stats.WriteChromeTrace(trace);
+  const std::string json = trace.str();
+  EXPECT_EQ(json.find("\"before\""), std::string::npos);
+  EXPECT_EQ(json.find("\"resolve\""), std::string::npos);
+  EXPECT_NE(json.find("{\"name\":\"parse\",\"ph\":\"X\",\"pid\":1,\"tid\":0,"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"dur\":2000}"), std::string::npos);
+  EXPECT_NE(json.find("{\"name\":\"thread\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"),
+            std::string::npos);
+}
+
+TEST(PerfStatsTest, PhasesAreShared) {
+  PerfStats stats;
+  PerfPhase& resolve = stats.Phase("resolve");
+  EXPECT_EQ(&stats.Phase("resolve"), &resolve);
+  { ScopedPhase phase(resolve, /*trace=*/false, stats); }
+  stats.AddPhase(resolve, absl::UnixEpoch(),
+                 absl::UnixEpoch() + absl::Milliseconds(1));
+  EXPECT_EQ(stats.GetPhaseTime("resolve").count, 2);
+  EXPECT_GE(stats.GetPhaseTime("resolve").total, absl::Milliseconds(1));
+}
+
+TEST(PerfStatsTest, OnlyTimesTracedPhasesWithoutPhaseTimes) {
+  PerfStats stats;
+  stats.EnablePhaseTimes(false);
+  { ScopedPhase phase("resolve", /*trace=*/false, stats); }
+  { ScopedPhase phase("parse", /*trace=*/true, stats); }
+  EXPECT_EQ(stats.GetPhaseTime("resolve").count, 0);
+  EXPECT_EQ(stats.GetPhaseTime("parse").count, 0);
+
+  stats.EnableTrace();
+  { ScopedPhase phase("resolve", /*trace=*/false, stats); }
+  { ScopedPhase phase("parse", /*trace=*/true, stats); }
+  EXPECT_EQ(stats.GetPhaseTime("resolve").count, 0);
+  EXPECT_EQ(stats.GetPhaseTime("parse").count, 1);
+}
+
+TEST(PerfStatsTest, ReportsMemory) {
+  EXPECT_GT(GetPeakRssBytes(), 0);
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,71 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "prefix_matcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+PrefixMatcher::PrefixMatcher(absl::Span<const absl::string_view> keywords)
+    : keywords_(keywords.begin(), keywords.end()), nodes_(1) {
+  for (uint32_t i = 0; i < keywords_.size(); ++i) {
+    uint32_t node = 0;
+    for (char c : keywords_[i]) {
+      auto [it, inserted] =
+          nodes_[node].children.try_emplace(c, nodes_.size());
+      const uint32_t child = it->second;
+      if (inserted) {
+        // May reallocate nodes_ and with it the map 'it' points into.
+        nodes_.emplace_back();
+      }
+      node = child;
+    }
+    if (!nodes_[node].keyword.has_value()) {
+      nodes_[node].keyword = i;
+    }
+  }
+}
+
+std::optional<absl::string_view> PrefixMatcher::FirstMatch(
+    absl::string_view str) const {
+  std::optional<uint32_t> first;
+  auto Visit = [&first](const Node& node) {
+    if (node.keyword.has_value()) {
+      first = std::min(first.value_or(*node.keyword), *node.keyword);
+    }
+  };
+
+  uint32_t node = 0;
+  Visit(nodes_[node]);
+  for (char c : str) {
+    auto it = nodes_[node].children.find(c);
+    if (it == nodes_[node].children.end()) {
+      break;
+    }
+    node = it->second;
+    Visit(nodes_[node]);
+  }
+  if (!first.has_value()) {
+    return std::nullopt;
+  }
+  return keywords_[*first];
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
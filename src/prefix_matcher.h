@@ -0,0 +1,56 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PREFIX_MATCHER_H_
+#define PREFIX_MATCHER_H_
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Matches a string against a fixed set of keywords, finding the keywords that
+// are a prefix of it. The keywords are stored in a trie, so a match walks the
+// string once instead of comparing it with every keyword in turn.
+class PrefixMatcher {
+ public:
+  // The keywords are not copied and must outlive the matcher.
+  explicit PrefixMatcher(absl::Span<const absl::string_view> keywords);
+
+  // Returns the first keyword, in the order given to the constructor, that is
+  // a prefix of 'str'.
+  std::optional<absl::string_view> FirstMatch(absl::string_view str) const;
+
+ private:
+  struct Node {
+    absl::flat_hash_map<char, uint32_t> children;
+    // Smallest index of the keywords ending at this node.
+    std::optional<uint32_t> keyword;
+  };
+
+  std::vector<absl::string_view> keywords_;
+  // The root is nodes_[0].
+  std::vector<Node> nodes_;
+};
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // PREFIX_MATCHER_H_
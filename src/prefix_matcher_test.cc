@@ -0,0 +1,50 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "prefix_matcher.h"
+
+#include <optional>
+
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+constexpr absl::string_view kKeywords[] = {
+    "std::vector", "std::__u::vector", "std::", "std::vector<int>", "absl::",
+};
+
+TEST(PrefixMatcherTest, FirstMatchInKeywordOrder) {
+  PrefixMatcher matcher(kKeywords);
+  EXPECT_EQ(matcher.FirstMatch("std::vector<int>::push_back"), "std::vector");
+  EXPECT_EQ(matcher.FirstMatch("std::__u::vector<char>"), "std::__u::vector");
+  EXPECT_EQ(matcher.FirstMatch("std::map<int, int>"), "std::");
+  EXPECT_EQ(matcher.FirstMatch("absl::Cord"), "absl::");
+  EXPECT_EQ(matcher.FirstMatch("absl::"), "absl::");
+}
+
+TEST(PrefixMatcherTest, NoMatch) {
+  PrefixMatcher matcher(kKeywords);
+  EXPECT_EQ(matcher.FirstMatch(""), std::nullopt);
+  EXPECT_EQ(matcher.FirstMatch("std:"), std::nullopt);
+  EXPECT_EQ(matcher.FirstMatch("llvm::SmallVector"), std::nullopt);
+  EXPECT_EQ(matcher.FirstMatch(" std::vector"), std::nullopt);
+
+  PrefixMatcher empty_matcher({});
+  EXPECT_EQ(empty_matcher.FirstMatch("std::vector"), std::nullopt);
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,77 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "string_interner.h"
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+StringInterner& StringInterner::Global() {
+  static StringInterner* const interner = new StringInterner();
+  return *interner;
+}
+
+absl::string_view StringInterner::Intern(absl::string_view str) {
+  if (str.empty()) {
+    return absl::string_view();
+  }
+  Shard& shard = shards_[absl::HashOf(str) % kShardCount];
+  absl::MutexLock lock(&shard.mu);
+  auto it = shard.strings.find(str);
+  if (it != shard.strings.end()) {
+    return *it;
+  }
+  absl::string_view copy = shard.Copy(str);
+  shard.strings.insert(copy);
+  return copy;
+}
+
+size_t StringInterner::size() const {
+  size_t size = 0;
+  for (const Shard& shard : shards_) {
+    absl::MutexLock lock(&shard.mu);
+    size += shard.strings.size();
+  }
+  return size;
+}
+
+absl::string_view StringInterner::Shard::Copy(absl::string_view str) {
+  char* dest;
+  if (str.size() > kBlockSize / 4) {
+    // Long strings get a block of their own, so that they do not waste the
+    // free space of the current block.
+    blocks.push_back(std::make_unique<char[]>(str.size()));
+    dest = blocks.back().get();
+  } else {
+    if (str.size() > free_size) {
+      blocks.push_back(std::make_unique<char[]>(kBlockSize));
+      free_begin = blocks.back().get();
+      free_size = kBlockSize;
+    }
+    dest = free_begin;
+    free_begin += str.size();
+    free_size -= str.size();
+  }
+  std::memcpy(dest, str.data(), str.size());
+  return absl::string_view(dest, str.size());
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
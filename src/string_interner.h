@@ -0,0 +1,79 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef STRING_INTERNER_H_
+#define STRING_INTERNER_H_
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// Keeps a single copy of each distinct string it is given. The copies are
+// carved out of large blocks, which are only freed, all at once, with the
+// interner. Type trees intern the names and type names of their nodes, so that
+// the many trees of a type share them instead of each node owning its own
+// strings. Safe to call from multiple threads.
+class StringInterner {
+ public:
+  StringInterner() = default;
+  StringInterner(const StringInterner&) = delete;
+  StringInterner& operator=(const StringInterner&) = delete;
+
+  // The interner of the type trees. Never destroyed, the names it holds are
+  // bounded by the types of the profiled binaries.
+  static StringInterner& Global();
+
+  // Returns the copy of 'str' held by the interner, valid as long as the
+  // interner is.
+  absl::string_view Intern(absl::string_view str);
+
+  // Number of distinct strings interned.
+  size_t size() const;
+
+ private:
+  // Interned strings are spread over shards by hash, so that threads
+  // interning different strings rarely contend.
+  static constexpr size_t kShardCount = 16;
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  struct Shard {
+    mutable absl::Mutex mu;
+    absl::flat_hash_set<absl::string_view> strings ABSL_GUARDED_BY(mu);
+    std::vector<std::unique_ptr<char[]>> blocks ABSL_GUARDED_BY(mu);
+    // Free space at the end of the last block.
+    char* free_begin ABSL_GUARDED_BY(mu) = nullptr;
+    size_t free_size ABSL_GUARDED_BY(mu) = 0;
+
+    // Copies 'str' into the blocks of the shard.
+    absl::string_view Copy(absl::string_view str)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu);
+  };
+
+  std::array<Shard, kShardCount> shards_;
+};
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // STRING_INTERNER_H_
@@ -0,0 +1,82 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "string_interner.h"
+
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+TEST(StringInternerTest, InternsOneCopyPerString) {
+  StringInterner interner;
+  std::string name = "std::vector<int>";
+  const absl::string_view interned = interner.Intern(name);
+  EXPECT_EQ(interned, "std::vector<int>");
+  EXPECT_NE(interned.data(), name.data());
+  name[0] = 'x';
+  EXPECT_EQ(interned, "std::vector<int>");
+  EXPECT_EQ(interner.Intern("std::vector<int>").data(), interned.data());
+  EXPECT_NE(interner.Intern("std::vector<char>").data(), interned.data());
+  EXPECT_EQ(interner.Intern(""), "");
+  EXPECT_EQ(interner.size(), 2);
+}
+
+TEST(StringInternerTest, InternsLongStrings) {
+  StringInterner interner;
+  const std::string long_name(100 * 1024, 'a');
+  std::vector<absl::string_view> interned;
+  for (int i = 0; i < 1000; ++i) {
+    interned.push_back(interner.Intern(absl::StrCat("name_", i)));
+  }
+  const absl::string_view interned_long = interner.Intern(long_name);
+  EXPECT_EQ(interned_long, long_name);
+  EXPECT_EQ(interner.Intern(long_name).data(), interned_long.data());
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(interned[i], absl::StrCat("name_", i));
+  }
+  EXPECT_EQ(interner.size(), 1001);
+}
+
+TEST(StringInternerTest, InternsConcurrently) {
+  StringInterner interner;
+  constexpr int kThreadCount = 8;
+  std::vector<std::vector<absl::string_view>> interned(kThreadCount);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([&interner, &interned, t]() {
+      for (int i = 0; i < 1000; ++i) {
+        interned[t].push_back(interner.Intern(absl::StrCat("type_", i)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(interner.size(), 1000);
+  for (int t = 1; t < kThreadCount; ++t) {
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(interned[t][i].data(), interned[0][i].data());
+    }
+  }
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,274 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "type_layout_store.h"
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "atomic_file_writer.h"
+#include "src/object_layout.pb.h"
+#include "src/type_layout_store.pb.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+namespace {
+
+// Version of the store files, see type_layout_store.proto. Bump it whenever
+// the format, the way the fingerprints are computed, or the trees built from
+// the same type data change. Version 2 marks base classes as such.
+constexpr uint32_t kTypeLayoutStoreVersion = 2;
+
+// The fields of a type layout, in pre-order, keyed by path.
+using FlatLayout = std::vector<std::pair<std::string, FieldLayout>>;
+
+// Appends the fields nested in 'layout', which starts 'offset_bits' into the
+// type, to 'fields'. 'paths' counts the fields of each path, so that fields
+// without a unique name, e.g. anonymous unions, get one.
+void FlattenLayout(const ObjectLayout& layout, absl::string_view prefix,
+                   int64_t offset_bits,
+                   absl::flat_hash_map<std::string, int>& paths,
+                   FlatLayout& fields) {
+  for (const ObjectLayout& subobject : layout.subobjects()) {
+    const ObjectLayout::Properties& properties = subobject.properties();
+    if (properties.kind() == ObjectLayout::Properties::PADDING) {
+      continue;
+    }
+    std::string path = prefix.empty()
+                           ? properties.name()
+                           : absl::StrCat(prefix, ".", properties.name());
+    if (const int count = ++paths[path]; count > 1) {
+      absl::StrAppend(&path, "#", count);
+    }
+    const int64_t field_offset_bits = offset_bits + properties.offset_bits();
+    fields.push_back(
+        {path,
+         FieldLayout{
+             .type_name = properties.type_name(),
+             .offset_bits = field_offset_bits,
+             .size_bits = properties.size_bits() * properties.multiplicity(),
+         }});
+    FlattenLayout(subobject, path, field_offset_bits, paths, fields);
+  }
+}
+
+FlatLayout FlattenLayout(const ObjectLayout& layout) {
+  absl::flat_hash_map<std::string, int> paths;
+  FlatLayout fields;
+  FlattenLayout(layout, /*prefix=*/"", /*offset_bits=*/0, paths, fields);
+  return fields;
+}
+
+void DumpFieldLayout(const FieldLayout& field, std::ostream& os) {
+  os << field.type_name << " at bit " << field.offset_bits << ", "
+     << field.size_bits << " bits";
+}
+
+}  // namespace
+
+void TypeLayoutStore::Add(absl::string_view type_name, uint64_t fingerprint,
+                          bool verified, const TypeTree::Node& root) {
+  const TypeTree tree(root.CloneWithoutCounts(), type_name,
+                      /*from_container=*/false, /*container_name=*/"");
+  entries_.insert_or_assign(std::string(type_name),
+                            Entry{
+                                .fingerprint = fingerprint,
+                                .verified = verified,
+                                .tree = tree.ToProto(),
+                            });
+}
+
+void TypeLayoutStore::MergeFrom(const TypeLayoutStore& other) {
+  for (const auto& [type_name, entry] : other.entries_) {
+    entries_.try_emplace(type_name, entry);
+  }
+}
+
+const TypeLayoutStore::Entry* TypeLayoutStore::Find(
+    absl::string_view type_name) const {
+  auto it = entries_.find(type_name);
+  return it == entries_.end() ? nullptr : &it->second;
+}
+
+std::vector<absl::string_view> TypeLayoutStore::TypeNames() const {
+  std::vector<absl::string_view> type_names;
+  type_names.reserve(entries_.size());
+  for (const auto& [type_name, entry] : entries_) {
+    type_names.push_back(type_name);
+  }
+  std::sort(type_names.begin(), type_names.end());
+  return type_names;
+}
+
+absl::Status TypeLayoutStore::Serialize(std::ostream& out) const {
+  google::protobuf::io::OstreamOutputStream output(&out);
+  TypeLayoutStoreHeader header;
+  header.set_version(kTypeLayoutStoreVersion);
+  if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(header,
+                                                                  &output)) {
+    return absl::InternalError("Failed to serialize type layout store header");
+  }
+  // Sorted, so that the stores of the same layouts are the same files.
+  TypeLayoutStoreRecord record;
+  for (absl::string_view type_name : TypeNames()) {
+    const Entry& entry = *Find(type_name);
+    record.set_type_name(std::string(type_name));
+    record.set_fingerprint(entry.fingerprint);
+    record.set_verified(entry.verified);
+    *record.mutable_tree() = entry.tree;
+    if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(record,
+                                                                    &output)) {
+      return absl::InternalError(
+          absl::StrCat("Failed to serialize type layout of ", type_name));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<TypeLayoutStore> TypeLayoutStore::Deserialize(
+    std::istream& in) {
+  google::protobuf::io::IstreamInputStream input(&in);
+  bool clean_eof = false;
+  TypeLayoutStoreHeader header;
+  if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+          &header, &input, &clean_eof)) {
+    return absl::DataLossError("Failed to parse type layout store header");
+  }
+  if (header.version() != kTypeLayoutStoreVersion) {
+    return absl::NotFoundError(
+        absl::StrCat("Type layout store version ", header.version(),
+                     " is not ", kTypeLayoutStoreVersion));
+  }
+  TypeLayoutStore store;
+  for (TypeLayoutStoreRecord record;
+       google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+           &record, &input, &clean_eof);
+       record.Clear()) {
+    store.entries_.insert_or_assign(
+        record.type_name(), Entry{
+                                .fingerprint = record.fingerprint(),
+                                .verified = record.verified(),
+                                .tree = std::move(*record.mutable_tree()),
+                            });
+  }
+  if (!clean_eof) {
+    return absl::DataLossError(
+        "Type layout store is truncated or corrupted");
+  }
+  return store;
+}
+
+absl::Status TypeLayoutStore::Write(const std::string& path) const {
+  return WriteFileAtomically(
+      path, [this](std::ostream& out) { return Serialize(out); });
+}
+
+absl::StatusOr<TypeLayoutStore> TypeLayoutStore::Read(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return absl::NotFoundError(absl::StrCat("Cannot open ", path));
+  }
+  return Deserialize(in);
+}
+
+std::vector<TypeLayoutDiff> DiffTypeLayouts(const TypeLayoutStore& before,
+                                            const TypeLayoutStore& after) {
+  std::vector<TypeLayoutDiff> diffs;
+  for (absl::string_view type_name : after.TypeNames()) {
+    const TypeLayoutStore::Entry* before_entry = before.Find(type_name);
+    const TypeLayoutStore::Entry* after_entry = after.Find(type_name);
+    // The same type data gives the same layout.
+    if (before_entry == nullptr ||
+        before_entry->fingerprint == after_entry->fingerprint) {
+      continue;
+    }
+    const ObjectLayout& before_layout = before_entry->tree.object_layout();
+    const ObjectLayout& after_layout = after_entry->tree.object_layout();
+    TypeLayoutDiff diff = {
+        .type_name = std::string(type_name),
+        .size_bits_before = before_layout.properties().size_bits(),
+        .size_bits_after = after_layout.properties().size_bits(),
+    };
+    const FlatLayout before_fields = FlattenLayout(before_layout);
+    const FlatLayout after_fields = FlattenLayout(after_layout);
+    absl::flat_hash_map<absl::string_view, const FieldLayout*> before_index;
+    for (const auto& [path, field] : before_fields) {
+      before_index[path] = &field;
+    }
+    absl::flat_hash_map<absl::string_view, const FieldLayout*> after_index;
+    for (const auto& [path, field] : after_fields) {
+      after_index[path] = &field;
+      auto it = before_index.find(path);
+      if (it == before_index.end()) {
+        diff.fields.push_back({.path = path, .after = field});
+      } else if (*it->second != field) {
+        diff.fields.push_back(
+            {.path = path, .before = *it->second, .after = field});
+      }
+    }
+    for (const auto& [path, field] : before_fields) {
+      if (!after_index.contains(path)) {
+        diff.fields.push_back({.path = path, .before = field});
+      }
+    }
+    if (diff.fields.empty() && diff.size_bits_before == diff.size_bits_after) {
+      continue;
+    }
+    diffs.push_back(std::move(diff));
+  }
+  return diffs;
+}
+
+void DumpTypeLayoutDiffs(absl::Span<const TypeLayoutDiff> diffs,
+                         std::ostream& os) {
+  for (const TypeLayoutDiff& diff : diffs) {
+    os << "Type: " << diff.type_name << "\n"
+       << "  size bytes: " << diff.size_bits_before / 8 << " -> "
+       << diff.size_bits_after / 8 << "\n";
+    for (const FieldLayoutChange& field : diff.fields) {
+      if (!field.before.has_value()) {
+        os << "  + " << field.path << ": ";
+        DumpFieldLayout(*field.after, os);
+      } else if (!field.after.has_value()) {
+        os << "  - " << field.path << ": ";
+        DumpFieldLayout(*field.before, os);
+      } else {
+        os << "  ~ " << field.path << ": ";
+        DumpFieldLayout(*field.before, os);
+        os << " -> ";
+        DumpFieldLayout(*field.after, os);
+      }
+      os << "\n";
+    }
+  }
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
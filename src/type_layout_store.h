@@ -0,0 +1,136 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TYPE_LAYOUT_STORE_H_
+#define TYPE_LAYOUT_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "src/histogram.pb.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// The type layouts resolved by a run, keyed by type name, along with the
+// fingerprint of the DWARF type data each of them was built from. Kept from
+// one build of a binary to the next, so that the types whose type data did
+// not change are not resolved again, see DwarfTypeResolver::SetPriorLayouts,
+// and so that the layouts of the two builds can be compared.
+class TypeLayoutStore {
+ public:
+  struct Entry {
+    // See DwarfTypeResolver::FingerprintType.
+    uint64_t fingerprint = 0;
+    // Whether the layout passed TypeTree::Verify.
+    bool verified = false;
+    // The layout, with all counters zero.
+    TypeTreeProto tree;
+  };
+
+  // Adds the layout of the tree rooted at 'root' as that of 'type_name',
+  // replacing any previous one.
+  void Add(absl::string_view type_name, uint64_t fingerprint, bool verified,
+           const TypeTree::Node& root);
+
+  // Adds the entries of 'other' for the types that have none in this store.
+  void MergeFrom(const TypeLayoutStore& other);
+
+  // Returns the entry of 'type_name', or null if there is none.
+  const Entry* Find(absl::string_view type_name) const;
+
+  // Type names of all entries, sorted.
+  std::vector<absl::string_view> TypeNames() const;
+
+  size_t Size() const { return entries_.size(); }
+
+  // Writes the store in the format of type_layout_store.proto.
+  absl::Status Serialize(std::ostream& out) const;
+
+  // Reads a store written by Serialize. Returns NotFoundError if the store
+  // has another version.
+  static absl::StatusOr<TypeLayoutStore> Deserialize(std::istream& in);
+
+  // Same as Serialize, to the file at 'path', which is replaced atomically.
+  absl::Status Write(const std::string& path) const;
+
+  // Same as Deserialize, from the file at 'path'. Returns NotFoundError if
+  // there is no such file.
+  static absl::StatusOr<TypeLayoutStore> Read(const std::string& path);
+
+ private:
+  absl::flat_hash_map<std::string, Entry> entries_;
+};
+
+// A field of a type layout, as compared by DiffTypeLayouts.
+struct FieldLayout {
+  std::string type_name;
+  // Offset from the start of the type.
+  int64_t offset_bits = 0;
+  // Size of the field, all elements included for an array.
+  int64_t size_bits = 0;
+
+  bool operator==(const FieldLayout& other) const {
+    return type_name == other.type_name && offset_bits == other.offset_bits &&
+           size_bits == other.size_bits;
+  }
+  bool operator!=(const FieldLayout& other) const { return !(*this == other); }
+};
+
+// A field whose layout differs between two builds. 'before' or 'after' is
+// unset if the field is not part of the type in that build.
+struct FieldLayoutChange {
+  // Names of the field and of the fields enclosing it, joined with '.'.
+  std::string path;
+  std::optional<FieldLayout> before;
+  std::optional<FieldLayout> after;
+};
+
+// How the layout of a type changed between two builds.
+struct TypeLayoutDiff {
+  std::string type_name;
+  int64_t size_bits_before = 0;
+  int64_t size_bits_after = 0;
+  // The changed and added fields, in the order of the layout after, followed
+  // by the removed fields.
+  std::vector<FieldLayoutChange> fields;
+};
+
+// Compares the layouts of the types found in both 'before' and 'after', e.g.
+// the stores of two builds of a binary, field by field, nested fields
+// included. Returns the diff of each type whose size or any field changed,
+// sorted by type name. Padding is not compared, as it follows from the
+// fields.
+std::vector<TypeLayoutDiff> DiffTypeLayouts(const TypeLayoutStore& before,
+                                            const TypeLayoutStore& after);
+
+// Dumps 'diffs' in a human readable format.
+void DumpTypeLayoutDiffs(absl::Span<const TypeLayoutDiff> diffs,
+                         std::ostream& os);
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // TYPE_LAYOUT_STORE_H_
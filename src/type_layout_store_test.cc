@@ -0,0 +1,159 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "type_layout_store.h"
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+#include "object_layout_test_util.h"
+#include "src/object_layout.pb.h"
+#include "test_status_macros.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+void AddLayout(TypeLayoutStore& store, const ObjectLayout& layout,
+               uint64_t fingerprint) {
+  std::unique_ptr<TypeTree> tree = TypeTree::CreateTreeFromObjectLayout(
+      layout, layout.properties().type_name());
+  store.Add(layout.properties().type_name(), fingerprint, /*verified=*/true,
+            *tree->Root());
+}
+
+// struct Inner { int32_t x; int32_t y; };
+ObjectLayout CreateInnerLayout() {
+  ObjectLayout layout = CreateRecordLayout("Inner", 8);
+  AddField(layout, "x", "int32_t", 0, 4);
+  AddField(layout, "y", "int32_t", 4, 4);
+  return layout;
+}
+
+TEST(TypeLayoutStoreTest, SerializeRoundTrip) {
+  TypeLayoutStore store;
+  AddLayout(store, CreateInnerLayout(), /*fingerprint=*/42);
+  ObjectLayout outer = CreateRecordLayout("Outer", 16);
+  AddField(outer, "a", "int8_t", 0, 1);
+  AddPadding(outer, 1, 7);
+  AddField(outer, "b", "int64_t", 8, 8);
+  AddLayout(store, outer, /*fingerprint=*/7);
+
+  std::stringstream stream;
+  ASSERT_OK(store.Serialize(stream));
+  ASSERT_OK_AND_ASSIGN(const TypeLayoutStore read,
+                       TypeLayoutStore::Deserialize(stream));
+  EXPECT_EQ(read.TypeNames(),
+            (std::vector<absl::string_view>{"Inner", "Outer"}));
+  const TypeLayoutStore::Entry* entry = read.Find("Outer");
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->fingerprint, 7);
+  EXPECT_TRUE(entry->verified);
+  ASSERT_EQ(entry->tree.object_layout().subobjects_size(), 3);
+  EXPECT_EQ(entry->tree.object_layout().subobjects(2).properties().name(),
+            "b");
+  EXPECT_EQ(read.Find("Missing"), nullptr);
+
+  std::stringstream truncated(stream.str().substr(0, stream.str().size() - 1));
+  EXPECT_EQ(TypeLayoutStore::Deserialize(truncated).status().code(),
+            absl::StatusCode::kDataLoss);
+}
+
+TEST(TypeLayoutStoreTest, MergeFromKeepsExistingEntries) {
+  TypeLayoutStore store;
+  AddLayout(store, CreateInnerLayout(), /*fingerprint=*/1);
+  TypeLayoutStore other;
+  AddLayout(other, CreateInnerLayout(), /*fingerprint=*/2);
+  AddLayout(other, CreateRecordLayout("Empty", 1), /*fingerprint=*/3);
+  store.MergeFrom(other);
+  EXPECT_EQ(store.Size(), 2);
+  EXPECT_EQ(store.Find("Inner")->fingerprint, 1);
+  EXPECT_EQ(store.Find("Empty")->fingerprint, 3);
+}
+
+TEST(TypeLayoutStoreTest, DiffReportsMovedAddedAndRemovedFields) {
+  // struct Outer { int8_t a; Inner inner; int32_t gone; };
+  TypeLayoutStore before;
+  ObjectLayout outer_before = CreateRecordLayout("Outer", 16);
+  AddField(outer_before, "a", "int8_t", 0, 1);
+  AddPadding(outer_before, 1, 3);
+  *AddField(outer_before, "inner", "Inner", 4, 8) = [] {
+    ObjectLayout inner = CreateInnerLayout();
+    inner.mutable_properties()->set_name("inner");
+    inner.mutable_properties()->set_offset_bits(4 * 8);
+    return inner;
+  }();
+  AddField(outer_before, "gone", "int32_t", 12, 4);
+  AddLayout(before, outer_before, /*fingerprint=*/1);
+  AddLayout(before, CreateInnerLayout(), /*fingerprint=*/2);
+  AddLayout(before, CreateRecordLayout("OnlyBefore", 1), /*fingerprint=*/3);
+
+  // struct Outer { Inner inner; int8_t a; int64_t added; };
+  TypeLayoutStore after;
+  ObjectLayout outer_after = CreateRecordLayout("Outer", 24);
+  *AddField(outer_after, "inner", "Inner", 0, 8) = [] {
+    ObjectLayout inner = CreateInnerLayout();
+    inner.mutable_properties()->set_name("inner");
+    return inner;
+  }();
+  AddField(outer_after, "a", "int8_t", 8, 1);
+  AddPadding(outer_after, 9, 7);
+  AddField(outer_after, "added", "int64_t", 16, 8);
+  AddLayout(after, outer_after, /*fingerprint=*/4);
+  // Same fingerprint, same layout.
+  AddLayout(after, CreateInnerLayout(), /*fingerprint=*/2);
+
+  const std::vector<TypeLayoutDiff> diffs = DiffTypeLayouts(before, after);
+  ASSERT_EQ(diffs.size(), 1);
+  const TypeLayoutDiff& diff = diffs[0];
+  EXPECT_EQ(diff.type_name, "Outer");
+  EXPECT_EQ(diff.size_bits_before, 16 * 8);
+  EXPECT_EQ(diff.size_bits_after, 24 * 8);
+  std::vector<std::string> paths;
+  for (const FieldLayoutChange& field : diff.fields) {
+    paths.push_back(field.path);
+  }
+  EXPECT_EQ(paths, (std::vector<std::string>{"inner", "inner.x", "inner.y",
+                                             "a", "added", "gone"}));
+  // inner.x moved from byte 4 to byte 0 of Outer.
+  ASSERT_TRUE(diff.fields[1].before.has_value());
+  ASSERT_TRUE(diff.fields[1].after.has_value());
+  EXPECT_EQ(diff.fields[1].before->offset_bits, 4 * 8);
+  EXPECT_EQ(diff.fields[1].after->offset_bits, 0);
+  EXPECT_FALSE(diff.fields[4].before.has_value());
+  EXPECT_FALSE(diff.fields[5].after.has_value());
+
+  std::ostringstream out;
+  DumpTypeLayoutDiffs(diffs, out);
+  EXPECT_EQ(out.str(),
+            "Type: Outer\n"
+            "  size bytes: 16 -> 24\n"
+            "  ~ inner: Inner at bit 32, 64 bits -> Inner at bit 0, 64 bits\n"
+            "  ~ inner.x: int32_t at bit 32, 32 bits -> int32_t at bit 0, 32 "
+            "bits\n"
+            "  ~ inner.y: int32_t at bit 64, 32 bits -> int32_t at bit 32, 32 "
+            "bits\n"
+            "  ~ a: int8_t at bit 0, 8 bits -> int8_t at bit 64, 8 bits\n"
+            "  + added: int64_t at bit 128, 64 bits\n"
+            "  - gone: int32_t at bit 96, 32 bits\n");
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
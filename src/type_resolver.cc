@@ -26,6 +26,8 @@
 #include <utility>
 #include <vector>
 
+#include "absl/base/call_once.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
@@ -36,17 +38,20 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
 #include "dwarf_metadata_fetcher.h"
 #include "llvm/include/llvm/Demangle/Demangle.h"
+#include "llvm/include/llvm/Support/xxhash.h"
+#include "perf_stats.h"
+#include "prefix_matcher.h"
 #include "re2/re2.h"
 #include "status_macros.h"
+#include "type_layout_store.h"
 #include "type_tree.h"
 #include "type_tree_container_blueprints.h"
 
 namespace devtools_crosstool_fdo_field_access {
 
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
-
 constexpr absl::string_view kSTLContainerTypes[] = {
     "std::_Vector_base",
     "std::__u::_Vector_base",
@@ -162,14 +167,24 @@ static std::string stripTrailingColons(const std::string& str) {
   }
 }
 
-std::optional<const std::string> StartsWithAnyOf(
-    absl::string_view str, const absl::string_view keywords[], size_t N) {
-  for (int i = 0; i < N; ++i) {
-    if (absl::StartsWith(str, keywords[i])) {
-      return std::string(keywords[i]);
-    }
-  }
-  return std::nullopt;
+// Prefix matchers of the above keyword lists.
+struct ContainerMatchers {
+  PrefixMatcher stl_containers{kSTLContainerTypes};
+  PrefixMatcher stl_leaf_check_containers{kSTLContainerLeafCheckTypes};
+  PrefixMatcher smart_pointers{kSmartPointersTypes};
+  PrefixMatcher adt_containers{kADTContainerTypes};
+  PrefixMatcher adt_dense_containers{kADTDenseContainerTypes};
+  PrefixMatcher char_containers{kCharContainerTypesLeafFrame};
+  PrefixMatcher absl_swiss_map_containers{kABSLContainerSwissMapTypes};
+  PrefixMatcher absl_flat_hash_policies{kABSLContainerFlatHashTypes};
+  PrefixMatcher absl_btree_containers{kABSLContainerBtreeTypes};
+  PrefixMatcher special_allocating_functions{kSpecialAllocatingFunctions};
+  PrefixMatcher allocator_wrappers{kAllocatorWrappers};
+};
+
+const ContainerMatchers& GetContainerMatchers() {
+  static const ContainerMatchers* const kMatchers = new ContainerMatchers();
+  return *kMatchers;
 }
 
 std::string BuildCallstackString(
@@ -450,6 +465,7 @@ absl::StatusOr<std::unique_ptr<TypeTree::Node>> DwarfTypeResolver::BuildTree(
         .field_index = field_index,
         .field_offset = field_data->offset * 8,
         .multiplicity = 1,
+        .inherited = field_data->inherited,
         .parent_node = root_node.get(),
         .resolved_fields = resolved_fields,
     });
@@ -463,6 +479,165 @@ absl::StatusOr<std::unique_ptr<TypeTree::Node>> DwarfTypeResolver::BuildTree(
   return root_node;
 }
 
+absl::StatusOr<std::unique_ptr<TypeTree::Node>>
+DwarfTypeResolver::BuildTreeFromSkeleton(
+    absl::string_view type_name,
+    std::shared_ptr<TypeTree::AccessIndexCache>* access_index_cache,
+    bool* verified) {
+  static PerfCounter& hits =
+      PerfStats::Global().Counter("type_tree_skeleton_hits");
+  static PerfCounter& misses =
+      PerfStats::Global().Counter("type_tree_skeleton_misses");
+  // The lock is only held to find the entry. Entries are never removed, so
+  // the entry outlives the lock.
+  SkeletonEntry* entry;
+  {
+    absl::MutexLock lock(&skeletons_mu_);
+    std::unique_ptr<SkeletonEntry>& slot = skeletons_[type_name];
+    if (slot == nullptr) {
+      slot = std::make_unique<SkeletonEntry>();
+    }
+    entry = slot.get();
+  }
+  bool built = false;
+  absl::call_once(entry->once, [&] {
+    built = true;
+    // Stored atomically for ExportLayouts, which does not wait for it.
+    std::atomic_store(&entry->skeleton, BuildSkeleton(type_name));
+  });
+  (built ? misses : hits).Add();
+
+  const Skeleton& skeleton = *entry->skeleton;
+  if (!skeleton.root.ok()) {
+    return skeleton.root.status();
+  }
+  *access_index_cache = skeleton.access_index_cache;
+  *verified = skeleton.verified;
+  return (*skeleton.root)->CloneWithoutCounts();
+}
+
+std::shared_ptr<const DwarfTypeResolver::Skeleton>
+DwarfTypeResolver::BuildSkeleton(absl::string_view type_name) {
+  auto skeleton = std::make_shared<Skeleton>();
+  skeleton->access_index_cache = std::make_shared<TypeTree::AccessIndexCache>();
+  if (!ReusePriorLayout(type_name, skeleton.get())) {
+    skeleton->root = BuildTree(type_name);
+    if (skeleton->root.ok()) {
+      static PerfPhase& verify_phase =
+          PerfStats::Global().Phase("VerifyTypeTreeSkeleton");
+      ScopedPhase phase(verify_phase, /*trace=*/false);
+      skeleton->verified = (*skeleton->root)
+                               ->Verify(/*parent=*/nullptr,
+                                        /*older_sibling=*/nullptr,
+                                        /*verify_verbose=*/false);
+    }
+  }
+  return skeleton;
+}
+
+bool DwarfTypeResolver::ReusePriorLayout(absl::string_view type_name,
+                                         Skeleton* skeleton) {
+  static PerfCounter& reused =
+      PerfStats::Global().Counter("type_tree_skeleton_reused");
+  if (prior_layouts_ == nullptr) {
+    return false;
+  }
+  const TypeLayoutStore::Entry* entry = prior_layouts_->Find(type_name);
+  if (entry == nullptr) {
+    return false;
+  }
+  skeleton->fingerprint = FingerprintType(type_name);
+  if (entry->fingerprint != *skeleton->fingerprint) {
+    return false;
+  }
+  absl::StatusOr<std::unique_ptr<TypeTree>> tree =
+      TypeTree::CreateTreeFromProto(entry->tree);
+  if (!tree.ok()) {
+    LOG(WARNING) << "Ignoring the prior layout of " << type_name << ": "
+                 << tree.status();
+    return false;
+  }
+  reused.Add();
+  skeleton->root = (*tree)->Root()->CloneWithoutCounts();
+  skeleton->verified = entry->verified;
+  return true;
+}
+
+uint64_t DwarfTypeResolver::FingerprintType(absl::string_view type_name) {
+  // Walks the type names the same way BuildTreeRecursive does: indirections
+  // have no type data, and arrays are built from their elements. The fields
+  // of a type are all walked, not only those ResolveFieldConflicts keeps, as
+  // the others take part in the choice.
+  std::string fingerprints =
+      absl::StrCat(metadata_fetcher_->GetPointerSize());
+  absl::flat_hash_set<std::string> visited;
+  std::vector<std::string> pending = {std::string(type_name)};
+  while (!pending.empty()) {
+    std::string name = std::move(pending.back());
+    pending.pop_back();
+    while (GetArrayMultiplicity(name) > 1) {
+      name = GetArrayChildTypeName(name);
+    }
+    if (IsIndirection(name) || !visited.insert(name).second) {
+      continue;
+    }
+    absl::StatusOr<const DwarfMetadataFetcher::TypeData*> type_data =
+        metadata_fetcher_->GetType(name);
+    if (!type_data.ok()) {
+      // Types without type data are part of the fingerprint as well, as the
+      // tree changes once they have some.
+      absl::StrAppend(&fingerprints, "\n", name, " -");
+      continue;
+    }
+    uint64_t type_data_fingerprint;
+    {
+      absl::MutexLock lock(&fingerprints_mu_);
+      auto it = type_data_fingerprints_.find(*type_data);
+      if (it == type_data_fingerprints_.end()) {
+        it = type_data_fingerprints_
+                 .emplace(*type_data, (*type_data)->Fingerprint())
+                 .first;
+      }
+      type_data_fingerprint = it->second;
+    }
+    absl::StrAppend(&fingerprints, "\n", name, " ", type_data_fingerprint);
+    for (auto field = (*type_data)->fields.rbegin();
+         field != (*type_data)->fields.rend(); ++field) {
+      pending.push_back((*field)->type_name);
+    }
+  }
+  return llvm::xxh3_64bits(
+      llvm::StringRef(fingerprints.data(), fingerprints.size()));
+}
+
+TypeLayoutStore DwarfTypeResolver::ExportLayouts() {
+  std::vector<std::pair<std::string, std::shared_ptr<const Skeleton>>>
+      skeletons;
+  {
+    absl::MutexLock lock(&skeletons_mu_);
+    skeletons.reserve(skeletons_.size());
+    for (const auto& [type_name, entry] : skeletons_) {
+      // Skeletons still being built are left out.
+      std::shared_ptr<const Skeleton> skeleton =
+          std::atomic_load(&entry->skeleton);
+      if (skeleton != nullptr) {
+        skeletons.emplace_back(type_name, std::move(skeleton));
+      }
+    }
+  }
+  TypeLayoutStore layouts;
+  for (const auto& [type_name, skeleton] : skeletons) {
+    if (!skeleton->root.ok()) {
+      continue;
+    }
+    layouts.Add(type_name,
+                skeleton->fingerprint.has_value() ? *skeleton->fingerprint
+                                                  : FingerprintType(type_name),
+                skeleton->verified, **skeleton->root);
+  }
+  return layouts;
+}
+
 std::unique_ptr<TypeTree::Node> DwarfTypeResolver::BuildTreeRecursive(
     BuilderCtxt ctxt) {
   QCHECK(ctxt.parent_node != nullptr) << "Parent can't be null.";
@@ -529,7 +704,7 @@ std::unique_ptr<TypeTree::Node> DwarfTypeResolver::BuildTreeRecursive(
   std::unique_ptr<TypeTree::Node> curr_node =
       TypeTree::Node::CreateNodeFromTypedata(
           ctxt.field_name, ctxt.type_name, ctxt.field_offset, ctxt.multiplicity,
-          type_data, ctxt.parent_node);
+          type_data, ctxt.parent_node, ctxt.inherited);
 
   absl::StatusOr<std::vector<const DwarfMetadataFetcher::FieldData*>>
       resolved_fields_or = ResolveFieldConflicts(type_data);
@@ -552,6 +727,7 @@ std::unique_ptr<TypeTree::Node> DwarfTypeResolver::BuildTreeRecursive(
         .field_index = field_index,
         .field_offset = field_data->offset * 8,
         .multiplicity = 1,
+        .inherited = field_data->inherited,
         .parent_node = curr_node.get(),
         .resolved_fields = resolved_fields,
     });
@@ -566,10 +742,18 @@ absl::StatusOr<std::unique_ptr<TypeTree>>
 DwarfTypeResolver::CreateTreeFromDwarf(absl::string_view type_name,
                                        bool from_container,
                                        absl::string_view container_name) {
-  ASSIGN_OR_RETURN(std::unique_ptr<TypeTree::Node> root, BuildTree(type_name));
-  return std::make_unique<TypeTree>(std::move(root), type_name,
-                                    /*from_container=*/from_container,
-                                    /*container_name=*/container_name);
+  std::shared_ptr<TypeTree::AccessIndexCache> access_index_cache;
+  bool verified = false;
+  ASSIGN_OR_RETURN(
+      std::unique_ptr<TypeTree::Node> root,
+      BuildTreeFromSkeleton(type_name, &access_index_cache, &verified));
+  auto type_tree = std::make_unique<TypeTree>(
+      std::move(root), type_name,
+      /*from_container=*/from_container,
+      /*container_name=*/container_name);
+  type_tree->ShareAccessIndexCache(std::move(access_index_cache));
+  type_tree->SetSkeletonVerified(verified);
+  return type_tree;
 }
 
 absl::StatusOr<std::unique_ptr<TypeTree>>
@@ -577,219 +761,70 @@ DwarfTypeResolver::ResolveTypeFromTypeName(absl::string_view type_name) {
   return CreateTreeFromDwarf(type_name);
 }
 
-// Abseil metadata is allocated separate from user data when using memprof.
-// This function checks if a callstack contains a memprof inserted function to
-// mark that this allocation is metadata.
-std::optional<std::string> CallStackContainsMemprof(
-    const AbstractTypeResolver::CallStack& callstack) {
-  for (const auto& frame : callstack) {
-    for (absl::string_view memprof : kMemprofInsertedFunctions) {
-      if (absl::StrContains(frame.function_name, memprof)) {
-        return frame.function_name;
-      }
-    }
-  }
-  return std::nullopt;
-}
-
 absl::StatusOr<DwarfTypeResolver::ContainerResolutionStrategy>
 DwarfTypeResolver::GetCallStackContainerResolutionStrategy(
     const CallStack& callstack) {
   ContainerResolutionStrategy fallthrough_strategy;
 
   bool has_seen_alloc = false;
-  bool last_frame_has_allocator_formal_param = true;
 
   if (callstack.empty()) {
     return absl::InvalidArgumentError("Empty callstack.");
   }
 
-  if (auto memprof_func_name = CallStackContainsMemprof(callstack)) {
-    return ContainerResolutionStrategy(
-        "__memprof::abseil_container_internal::raw_hash_set",
-        *memprof_func_name,
-        ContainerResolutionStrategy::kAbseilContainerInserted);
-  }
-
-  bool is_leaf = true;
+  std::vector<const FrameMatch*> frame_matches;
+  frame_matches.reserve(callstack.size());
   for (const auto& frame : callstack) {
-    const std::string& func_name = frame.function_name;
-    if (func_name.empty()) {
-      return absl::InvalidArgumentError("Empty function name in callstack.");
-    }
+    frame_matches.push_back(&GetFrameMatch(frame.function_name));
+  }
 
-    if (const auto smart_ptr_type = StartsWithAnyOf(
-            func_name, kSmartPointersTypes, ARRAY_SIZE(kSmartPointersTypes))) {
+  // Abseil metadata is allocated separate from user data when using memprof.
+  // A callstack containing a memprof inserted function is that of metadata.
+  for (size_t i = 0; i < callstack.size(); ++i) {
+    if (frame_matches[i]->memprof_inserted) {
       return ContainerResolutionStrategy(
-          *smart_ptr_type, func_name,
-          ContainerResolutionStrategy::kSpecialAllocatingFunction);
+          "__memprof::abseil_container_internal::raw_hash_set",
+          callstack[i].function_name,
+          ContainerResolutionStrategy::kAbseilContainerInserted);
     }
+  }
 
-    auto status_or_formal_params =
-        metadata_fetcher_->GetFormalParameters(func_name);
-    if (!status_or_formal_params.ok()) {
-      continue;
+  bool is_leaf = true;
+  for (size_t i = 0; i < callstack.size(); ++i) {
+    const absl::string_view func_name = callstack[i].function_name;
+    if (func_name.empty()) {
+      return absl::InvalidArgumentError("Empty function name in callstack.");
     }
-    const std::vector<std::string>& formal_params =
-        status_or_formal_params.value();
-
-    char* demangled_name_no_params_char =
-        llvm::itaniumDemangle(func_name, /*ParseParams*/ false);
-    if (demangled_name_no_params_char != nullptr) {
-      std::string demangled_name_no_params(demangled_name_no_params_char);
-      free(demangled_name_no_params_char);
-      if (auto special_allocating_function = StartsWithAnyOf(
-              demangled_name_no_params, kSpecialAllocatingFunctions,
-              ARRAY_SIZE(kSpecialAllocatingFunctions))) {
-        return ContainerResolutionStrategy(
-            *special_allocating_function, func_name,
-            ContainerResolutionStrategy::kSpecialAllocatingFunction);
-      }
 
-      if (const auto container_name = StartsWithAnyOf(
-              demangled_name_no_params, kCharContainerTypesLeafFrame,
-              ARRAY_SIZE(kCharContainerTypesLeafFrame))) {
-        return ContainerResolutionStrategy(
-            stripTrailingColons(*container_name), func_name,
-            ContainerResolutionStrategy::kCharContainer);
-      }
+    const FrameMatch& frame_match = *frame_matches[i];
+    if (frame_match.strategy.has_value()) {
+      return *frame_match.strategy;
     }
 
-    last_frame_has_allocator_formal_param = false;
     // Check if the function is in the list of supported containers.
-    for (const absl::string_view formal_param_dirty : formal_params) {
-      // Make sure unnecessary qualifiers do not pollute the type name we are
-      // looking for.
-      std::string formal_param(formal_param_dirty);
-      formal_param = absl::StripPrefix(formal_param, "const");
-      formal_param = absl::StripLeadingAsciiWhitespace(formal_param);
-
-      // Cleaned formal parameter prepared for output.
-      std::string cleaned_formal_param(formal_param);
-      DereferencePointer(&cleaned_formal_param);
-      CleanTypeName(&cleaned_formal_param);
-
-      if (const auto allocator_type =
-              StartsWithAnyOf(formal_param, kAllocatorWrappers,
-                              ARRAY_SIZE(kAllocatorWrappers))) {
-        if (!has_seen_alloc &&
-            absl::StartsWith(formal_param, *allocator_type)) {
-          std::string type_name = UnwrapAndCleanTypeName(formal_param);
-
-          fallthrough_strategy.container_type =
-              ContainerResolutionStrategy::kDefaultStrategy;
-          fallthrough_strategy.func_name = func_name;
-          fallthrough_strategy.container_name = "unknown";
-          fallthrough_strategy.lookup_type = type_name;
-          // Do not return the fallthrough strategy yet, we may find a more
-          // specific strategy later in the callstack.
-        }
-      }
-
-      if (is_leaf) {
-        if (const auto container_type =
-                StartsWithAnyOf(formal_param, kSTLContainerLeafCheckTypes,
-                                ARRAY_SIZE(kSTLContainerLeafCheckTypes))) {
-          return ContainerResolutionStrategy(
-              *container_type, frame.function_name,
-              ContainerResolutionStrategy::kLeafContainerGWPStrategy,
-              formal_param);
-        }
+    for (const FormalParamMatch& param_match : frame_match.formal_params) {
+      if (!has_seen_alloc && param_match.allocator_lookup_type.has_value()) {
+        // Do not return the fallthrough strategy yet, we may find a more
+        // specific strategy later in the callstack.
+        fallthrough_strategy = ContainerResolutionStrategy(
+            "unknown", func_name, ContainerResolutionStrategy::kDefaultStrategy,
+            *param_match.allocator_lookup_type);
       }
 
-      if (const auto container_type =
-              StartsWithAnyOf(formal_param, kSTLContainerTypes,
-                              ARRAY_SIZE(kSTLContainerTypes))) {
-        return ContainerResolutionStrategy(
-            *container_type, callstack.at(0).function_name,
-            ContainerResolutionStrategy::kAllocatorAllocate);
+      if (is_leaf && param_match.leaf_strategy.has_value()) {
+        return *param_match.leaf_strategy;
       }
 
-      if (const auto container_type =
-              StartsWithAnyOf(formal_param, kADTContainerTypes,
-                              ARRAY_SIZE(kADTContainerTypes))) {
-        return ContainerResolutionStrategy(
-            container_type->substr(0, container_type->length() - 1), func_name,
-            ContainerResolutionStrategy::kADTContainer, cleaned_formal_param);
-      }
-      if (const auto container_type =
-              StartsWithAnyOf(formal_param, kADTDenseContainerTypes,
-                              ARRAY_SIZE(kADTDenseContainerTypes))) {
-        return ContainerResolutionStrategy(
-            *container_type, func_name,
-            ContainerResolutionStrategy::kADTDenseContainer,
-            cleaned_formal_param);
-      }
-
-      if (const auto container_type =
-              StartsWithAnyOf(formal_param, kABSLContainerSwissMapTypes,
-                              ARRAY_SIZE(kABSLContainerSwissMapTypes))) {
-        // In some special cases node_hash_set uses normal allocator type. Then
-        // we can just use STL container strategy.
-        absl::StatusOr<int64_t> alignment =
-            GetAlignmentFromAbslAllocatorCall(callstack.at(0).function_name);
-        if (!alignment.ok()) {
-          alignment = 64;
-          /* ======== HARCODED ABSL CONTAINER VALUES for now ======== */
-          // return ContainerResolutionStrategy(
-          //     container_type->substr(0, container_type->length() - 1),
-          //     callstack.at(0).function_name,
-          //     ContainerResolutionStrategy::kAbslAllocatorAllocate,
-          //     cleaned_formal_param);
-          /* ======== END HARCODED ABSL CONTAINER VALUES for now ======== */
-        }
-
-        absl::StatusOr<const DwarfMetadataFetcher::TypeData*>
-            hash_set_typedata_status = metadata_fetcher_->GetType(formal_param);
-        if (!hash_set_typedata_status.ok()) {
-          return ContainerResolutionStrategy(
-              container_type->substr(0, container_type->length() - 1),
-              callstack.at(0).function_name,
-              ContainerResolutionStrategy::kAbslAllocatorAllocate,
-              cleaned_formal_param);
-        }
-        const DwarfMetadataFetcher::TypeData* hash_set_typedata =
-            hash_set_typedata_status.value();
-
-        if (hash_set_typedata->formal_parameters.empty()) {
-          return absl::NotFoundError(
-              "No formal parameters found for the hash set type.");
-        }
-
-        const std::string& policy_param =
-            hash_set_typedata->formal_parameters[0];
-        if (const auto policy =
-                StartsWithAnyOf(policy_param, kABSLContainerFlatHashTypes,
-                                ARRAY_SIZE(kABSLContainerFlatHashTypes))) {
-          return ContainerResolutionStrategy(
-              container_type->substr(0, container_type->length() - 1),
-              func_name,
-              ContainerResolutionStrategy::kAbseilContainerSwissMapFlatHash,
-              cleaned_formal_param);
-        } else {
-          return ContainerResolutionStrategy(
-              container_type->substr(0, container_type->length() - 1),
-              func_name,
-              ContainerResolutionStrategy::kAbseilContainerSwissMapNodeHash,
-              cleaned_formal_param);
+      if (param_match.strategy.has_value()) {
+        RETURN_IF_ERROR(param_match.strategy->status());
+        ContainerResolutionStrategy strategy = **param_match.strategy;
+        if (param_match.strategy_uses_leaf_function_name) {
+          strategy.func_name = callstack.at(0).function_name;
         }
-      }
-      if (const auto container_type =
-              StartsWithAnyOf(formal_param, kABSLContainerBtreeTypes,
-                              ARRAY_SIZE(kABSLContainerBtreeTypes))) {
-        return ContainerResolutionStrategy(
-            container_type->substr(0, container_type->length() - 1), func_name,
-            ContainerResolutionStrategy::kAbseilContainerBtree,
-            cleaned_formal_param);
+        return strategy;
       }
 
-      for (const absl::string_view allocator_type : kAllocatorWrappers) {
-        if (absl::StartsWith(formal_param, allocator_type) ||
-            absl::StartsWith(formal_param, "absl::container_internal::")) {
-          last_frame_has_allocator_formal_param = true;
-          has_seen_alloc = true;
-        }
-      }
+      has_seen_alloc |= param_match.is_allocator;
       is_leaf = false;
     }
   }
@@ -805,6 +840,187 @@ DwarfTypeResolver::GetCallStackContainerResolutionStrategy(
   return fallthrough_strategy;
 }
 
+const DwarfTypeResolver::FrameMatch& DwarfTypeResolver::GetFrameMatch(
+    absl::string_view function_name) {
+  {
+    absl::MutexLock lock(&frame_matches_mu_);
+    auto it = frame_matches_.find(function_name);
+    if (it != frame_matches_.end()) {
+      return *it->second;
+    }
+  }
+  // Matched without the lock so that threads resolving other frames are not
+  // blocked. Threads racing on the same frame compute the same match, and
+  // only the first one is kept. Entries are never removed, so the returned
+  // reference outlives the lock.
+  auto frame_match = std::make_unique<FrameMatch>(MatchFrame(function_name));
+  absl::MutexLock lock(&frame_matches_mu_);
+  return *frame_matches_.try_emplace(function_name, std::move(frame_match))
+              .first->second;
+}
+
+DwarfTypeResolver::FrameMatch DwarfTypeResolver::MatchFrame(
+    absl::string_view func_name) {
+  const ContainerMatchers& matchers = GetContainerMatchers();
+  FrameMatch frame_match;
+  for (absl::string_view memprof : kMemprofInsertedFunctions) {
+    if (absl::StrContains(func_name, memprof)) {
+      frame_match.memprof_inserted = true;
+    }
+  }
+
+  if (const auto smart_ptr_type =
+          matchers.smart_pointers.FirstMatch(func_name)) {
+    frame_match.strategy = ContainerResolutionStrategy(
+        *smart_ptr_type, func_name,
+        ContainerResolutionStrategy::kSpecialAllocatingFunction);
+    return frame_match;
+  }
+
+  auto status_or_formal_params =
+      metadata_fetcher_->GetFormalParameters(func_name);
+  if (!status_or_formal_params.ok()) {
+    return frame_match;
+  }
+  const std::vector<std::string>& formal_params =
+      status_or_formal_params.value();
+
+  char* demangled_name_no_params_char =
+      llvm::itaniumDemangle(func_name, /*ParseParams*/ false);
+  if (demangled_name_no_params_char != nullptr) {
+    std::string demangled_name_no_params(demangled_name_no_params_char);
+    free(demangled_name_no_params_char);
+    if (auto special_allocating_function =
+            matchers.special_allocating_functions.FirstMatch(
+                demangled_name_no_params)) {
+      frame_match.strategy = ContainerResolutionStrategy(
+          *special_allocating_function, func_name,
+          ContainerResolutionStrategy::kSpecialAllocatingFunction);
+      return frame_match;
+    }
+
+    if (const auto container_name =
+            matchers.char_containers.FirstMatch(demangled_name_no_params)) {
+      frame_match.strategy = ContainerResolutionStrategy(
+          stripTrailingColons(std::string(*container_name)), func_name,
+          ContainerResolutionStrategy::kCharContainer);
+      return frame_match;
+    }
+  }
+
+  frame_match.formal_params.reserve(formal_params.size());
+  for (const absl::string_view formal_param : formal_params) {
+    frame_match.formal_params.push_back(
+        MatchFormalParam(func_name, formal_param));
+  }
+  return frame_match;
+}
+
+DwarfTypeResolver::FormalParamMatch DwarfTypeResolver::MatchFormalParam(
+    absl::string_view func_name, absl::string_view formal_param_dirty) {
+  const ContainerMatchers& matchers = GetContainerMatchers();
+  FormalParamMatch param_match;
+
+  // Make sure unnecessary qualifiers do not pollute the type name we are
+  // looking for.
+  std::string formal_param(formal_param_dirty);
+  formal_param = absl::StripPrefix(formal_param, "const");
+  formal_param = absl::StripLeadingAsciiWhitespace(formal_param);
+
+  // Cleaned formal parameter prepared for output.
+  std::string cleaned_formal_param(formal_param);
+  DereferencePointer(&cleaned_formal_param);
+  CleanTypeName(&cleaned_formal_param);
+
+  if (matchers.allocator_wrappers.FirstMatch(formal_param).has_value()) {
+    param_match.allocator_lookup_type = UnwrapAndCleanTypeName(formal_param);
+    param_match.is_allocator = true;
+  }
+  if (absl::StartsWith(formal_param, "absl::container_internal::")) {
+    param_match.is_allocator = true;
+  }
+
+  if (const auto container_type =
+          matchers.stl_leaf_check_containers.FirstMatch(formal_param)) {
+    param_match.leaf_strategy = ContainerResolutionStrategy(
+        *container_type, func_name,
+        ContainerResolutionStrategy::kLeafContainerGWPStrategy, formal_param);
+  }
+
+  if (const auto container_type =
+          matchers.stl_containers.FirstMatch(formal_param)) {
+    param_match.strategy = ContainerResolutionStrategy(
+        *container_type, func_name,
+        ContainerResolutionStrategy::kAllocatorAllocate);
+    param_match.strategy_uses_leaf_function_name = true;
+    return param_match;
+  }
+
+  if (const auto container_type =
+          matchers.adt_containers.FirstMatch(formal_param)) {
+    param_match.strategy = ContainerResolutionStrategy(
+        container_type->substr(0, container_type->length() - 1), func_name,
+        ContainerResolutionStrategy::kADTContainer, cleaned_formal_param);
+    return param_match;
+  }
+  if (const auto container_type =
+          matchers.adt_dense_containers.FirstMatch(formal_param)) {
+    param_match.strategy = ContainerResolutionStrategy(
+        *container_type, func_name,
+        ContainerResolutionStrategy::kADTDenseContainer, cleaned_formal_param);
+    return param_match;
+  }
+
+  if (const auto container_type =
+          matchers.absl_swiss_map_containers.FirstMatch(formal_param)) {
+    const absl::string_view container_name =
+        container_type->substr(0, container_type->length() - 1);
+    absl::StatusOr<const DwarfMetadataFetcher::TypeData*>
+        hash_set_typedata_status = metadata_fetcher_->GetType(formal_param);
+    if (!hash_set_typedata_status.ok()) {
+      // In some special cases node_hash_set uses normal allocator type. Then
+      // we can just use STL container strategy.
+      param_match.strategy = ContainerResolutionStrategy(
+          container_name, func_name,
+          ContainerResolutionStrategy::kAbslAllocatorAllocate,
+          cleaned_formal_param);
+      param_match.strategy_uses_leaf_function_name = true;
+      return param_match;
+    }
+    const DwarfMetadataFetcher::TypeData* hash_set_typedata =
+        hash_set_typedata_status.value();
+
+    if (hash_set_typedata->formal_parameters.empty()) {
+      param_match.strategy = absl::NotFoundError(
+          "No formal parameters found for the hash set type.");
+      return param_match;
+    }
+
+    const std::string& policy_param = hash_set_typedata->formal_parameters[0];
+    if (matchers.absl_flat_hash_policies.FirstMatch(policy_param)) {
+      param_match.strategy = ContainerResolutionStrategy(
+          container_name, func_name,
+          ContainerResolutionStrategy::kAbseilContainerSwissMapFlatHash,
+          cleaned_formal_param);
+    } else {
+      param_match.strategy = ContainerResolutionStrategy(
+          container_name, func_name,
+          ContainerResolutionStrategy::kAbseilContainerSwissMapNodeHash,
+          cleaned_formal_param);
+    }
+    return param_match;
+  }
+  if (const auto container_type =
+          matchers.absl_btree_containers.FirstMatch(formal_param)) {
+    param_match.strategy = ContainerResolutionStrategy(
+        container_type->substr(0, container_type->length() - 1), func_name,
+        ContainerResolutionStrategy::kAbseilContainerBtree,
+        cleaned_formal_param);
+    return param_match;
+  }
+  return param_match;
+}
+
 absl::StatusOr<int64_t> DwarfTypeResolver::GetAlignmentFromAbslAllocatorCall(
     absl::string_view function_name) {
   ASSIGN_OR_RETURN(std::vector<std::string> formal_params,
@@ -883,8 +1099,8 @@ DwarfTypeResolver::ResolveTypeFromResolutionStrategy(
           const DwarfMetadataFetcher::TypeData* container_type_data,
           metadata_fetcher_->GetType(resolution_strategy.lookup_type));
       for (const auto& formal_param : container_type_data->formal_parameters) {
-        if (StartsWithAnyOf(formal_param, kAllocatorWrappers,
-                            ARRAY_SIZE(kAllocatorWrappers))) {
+        if (GetContainerMatchers().allocator_wrappers.FirstMatch(
+                formal_param)) {
           return CreateTreeFromDwarf(UnwrapAndCleanTypeName(formal_param),
                                      /*from_container=*/true,
                                      resolution_strategy.container_name);
@@ -1167,6 +1383,23 @@ DwarfTypeResolver::ResolveTypeFromResolutionStrategy(
   }
 }
 
+// Name of the phase of the resolutions with a strategy of type 'type'.
+static PerfPhase& GetResolutionPhase(
+    DwarfTypeResolver::ContainerResolutionStrategy::Type type) {
+  using Strategy = DwarfTypeResolver::ContainerResolutionStrategy;
+  static const std::vector<PerfPhase*>* const phases = [] {
+    auto* phases = new std::vector<PerfPhase*>();
+    for (int type = Strategy::kDefaultStrategy;
+         type <= Strategy::kADTDenseContainer; ++type) {
+      phases->push_back(&PerfStats::Global().Phase(absl::StrCat(
+          "ResolveTypeFromResolutionStrategy/",
+          Strategy::TypeToString(static_cast<Strategy::Type>(type)))));
+    }
+    return phases;
+  }();
+  return *(*phases)[type];
+}
+
 absl::StatusOr<std::unique_ptr<TypeTree>>
 DwarfTypeResolver::ResolveTypeFromCallstack(const CallStack& callstack,
                                             int64_t request_size) {
@@ -1177,19 +1410,33 @@ DwarfTypeResolver::ResolveTypeFromCallstack(const CallStack& callstack,
   // First try to resolve the type from the first frame. This works with
   // non-container heap allocations and requires dwarf extension with
   // DW_TAG_GOOGLE_heapalloc. See cl/647366639 and go/heapalloc-dwarf.
-  for (const auto& frame : callstack) {
-    absl::StatusOr<std::unique_ptr<TypeTree>> type_tree =
-        ResolveTypeFromFrame(frame);
-    if (type_tree.ok()) {
-      return type_tree;
+  {
+    static PerfPhase& frame_phase =
+        PerfStats::Global().Phase("ResolveTypeFromFrame");
+    ScopedPhase phase(frame_phase, /*trace=*/false);
+    for (const auto& frame : callstack) {
+      absl::StatusOr<std::unique_ptr<TypeTree>> type_tree =
+          ResolveTypeFromFrame(frame);
+      if (type_tree.ok()) {
+        return type_tree;
+      }
     }
   }
 
   // If we couldn't resolve the type from the first frame, try to walk
   // the callstack from the top and try to find container allocation
   // type.
+  absl::StatusOr<ContainerResolutionStrategy> strategy_or;
+  {
+    static PerfPhase& strategy_phase =
+        PerfStats::Global().Phase("GetCallStackContainerResolutionStrategy");
+    ScopedPhase phase(strategy_phase, /*trace=*/false);
+    strategy_or = GetCallStackContainerResolutionStrategy(callstack);
+  }
   ASSIGN_OR_RETURN(const ContainerResolutionStrategy resolution_strategy,
-                   GetCallStackContainerResolutionStrategy(callstack));
+                   std::move(strategy_or));
+  ScopedPhase phase(GetResolutionPhase(resolution_strategy.container_type),
+                    /*trace=*/false);
   auto type_tree_or = ResolveTypeFromResolutionStrategy(
       resolution_strategy, callstack, request_size);
   if (type_tree_or.ok()) {
@@ -1201,8 +1448,8 @@ DwarfTypeResolver::ResolveTypeFromCallstack(const CallStack& callstack,
 
 absl::StatusOr<std::unique_ptr<TypeTree>>
 DwarfTypeResolver::ResolveTypeFromFrame(
-    const DwarfMetadataFetcher::Frame& frame) {
-  DwarfMetadataFetcher::Frame frame_copy = DwarfMetadataFetcher::Frame(frame);
+    const DwarfMetadataFetcher::FrameView& frame) {
+  DwarfMetadataFetcher::FrameView frame_copy = frame;
   absl::StatusOr<std::string> type_name =
       metadata_fetcher_->GetHeapAllocType(frame_copy);
 
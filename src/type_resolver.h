@@ -18,15 +18,21 @@
 #define TYPE_RESOLVER_H_
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/base/call_once.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/span.h"
 #include "dwarf_metadata_fetcher.h"
 #include "src/object_layout.pb.h"
+#include "type_layout_store.h"
 #include "type_tree.h"
 
 namespace devtools_crosstool_fdo_field_access {
@@ -40,7 +46,9 @@ namespace devtools_crosstool_fdo_field_access {
 // that is made within a container.
 class AbstractTypeResolver {
  public:
-  using CallStack = std::vector<DwarfMetadataFetcher::Frame>;
+  // Frames borrow their function names, e.g. from the symbolized frames of the
+  // profile, which must outlive the resolution.
+  using CallStack = std::vector<DwarfMetadataFetcher::FrameView>;
 
   virtual ~AbstractTypeResolver() = default;
 
@@ -48,7 +56,7 @@ class AbstractTypeResolver {
       absl::string_view type_name) = 0;
 
   virtual absl::StatusOr<std::unique_ptr<TypeTree>> ResolveTypeFromFrame(
-      const DwarfMetadataFetcher::Frame& frame) = 0;
+      const DwarfMetadataFetcher::FrameView& frame) = 0;
 
   virtual absl::StatusOr<std::unique_ptr<TypeTree>> ResolveTypeFromCallstack(
       const CallStack& callstack, int64_t request_size) = 0;
@@ -66,6 +74,8 @@ class DwarfTypeResolver final : public AbstractTypeResolver {
     int64_t field_index;
     int64_t field_offset;
     int64_t multiplicity;
+    // Whether the field is a base class.
+    bool inherited = false;
 
     // For already built parent_node, required for setting global offset into
     // tree.
@@ -174,7 +184,7 @@ class DwarfTypeResolver final : public AbstractTypeResolver {
   // Resolve the type for an allocation made at a specific frame. Relies on
   // DW_TAG_GOOGLE_heapalloc Dwarf tag, internal llvm-patch: cl/647366639.
   absl::StatusOr<std::unique_ptr<TypeTree>> ResolveTypeFromFrame(
-      const DwarfMetadataFetcher::Frame& frame) override;
+      const DwarfMetadataFetcher::FrameView& frame) override;
 
   // Resolve the type from a callstack. First tries to resolve the type from the
   // leaf frame, similar to 'ResolveTypeFromFrame`. If no heapalloc tag is
@@ -186,6 +196,28 @@ class DwarfTypeResolver final : public AbstractTypeResolver {
   // Only public for testing.
   static std::string UnwrapAndCleanTypeName(absl::string_view type_name);
 
+  // Reuses the layouts of 'prior_layouts', e.g. those of the previous build of
+  // the binary, for the types whose fingerprint did not change, instead of
+  // building and verifying their trees again. Must be set before any type is
+  // resolved.
+  void SetPriorLayouts(std::shared_ptr<const TypeLayoutStore> prior_layouts) {
+    prior_layouts_ = std::move(prior_layouts);
+  }
+
+  // The layouts of all the types resolved so far, to be reused by the run on
+  // the next build of the binary. Types that failed to resolve are left out.
+  TypeLayoutStore ExportLayouts();
+
+  // Fingerprint of the DWARF type data the tree of 'type_name' is built from:
+  // that of the type and of every type its fields reach, along with the
+  // pointer size. Stable across runs, see TypeData::Fingerprint.
+  uint64_t FingerprintType(absl::string_view type_name);
+
+  // Returns the strategy ResolveTypeFromCallstack falls back to when the leaf
+  // frame has no heapalloc tag. Only public for benchmarking.
+  absl::StatusOr<ContainerResolutionStrategy>
+  GetCallStackContainerResolutionStrategy(const CallStack& callstack);
+
  private:
   static bool IsIndirection(absl::string_view type_name);
   static int64_t GetArrayMultiplicity(absl::string_view type_name);
@@ -200,8 +232,74 @@ class DwarfTypeResolver final : public AbstractTypeResolver {
   absl::StatusOr<std::unique_ptr<TypeTree::Node>> BuildTree(
       absl::string_view type_name);
 
-  absl::StatusOr<ContainerResolutionStrategy>
-  GetCallStackContainerResolutionStrategy(const CallStack& callstack);
+  // A tree built by BuildTree, without access counts, the access indexes
+  // shared by all the trees copied from it, and whether it passed Verify.
+  // The copies have the same shape, so their offsets and sizes need not be
+  // verified again. Immutable once built, so that it is copied without
+  // holding any lock.
+  struct Skeleton {
+    absl::StatusOr<std::unique_ptr<TypeTree::Node>> root;
+    std::shared_ptr<TypeTree::AccessIndexCache> access_index_cache;
+    bool verified = false;
+    // See FingerprintType. Only computed when needed.
+    std::optional<uint64_t> fingerprint;
+  };
+
+  // The skeleton of a type name, built by the first thread that needs it,
+  // while the others wait for it without blocking the other type names.
+  struct SkeletonEntry {
+    absl::once_flag once;
+    std::shared_ptr<const Skeleton> skeleton;
+  };
+
+  // Sets the root of 'skeleton' to the layout of 'type_name' in
+  // prior_layouts_, if its fingerprint did not change. Returns whether it did.
+  bool ReusePriorLayout(absl::string_view type_name, Skeleton* skeleton);
+
+  // Builds the skeleton of 'type_name', see BuildTreeFromSkeleton.
+  std::shared_ptr<const Skeleton> BuildSkeleton(absl::string_view type_name);
+
+  // Same as BuildTree, but only builds and verifies the tree of a given type
+  // name once. Later calls return a count-free copy of the first tree.
+  absl::StatusOr<std::unique_ptr<TypeTree::Node>> BuildTreeFromSkeleton(
+      absl::string_view type_name,
+      std::shared_ptr<TypeTree::AccessIndexCache>* access_index_cache,
+      bool* verified);
+
+  // What GetCallStackContainerResolutionStrategy learns from a formal
+  // parameter of a frame.
+  struct FormalParamMatch {
+    // Lookup type of the default strategy, if the parameter is an allocator.
+    std::optional<std::string> allocator_lookup_type;
+    // Strategy returned if the parameter is the first one of the callstack.
+    std::optional<ContainerResolutionStrategy> leaf_strategy;
+    // Strategy returned wherever the parameter is in the callstack.
+    std::optional<absl::StatusOr<ContainerResolutionStrategy>> strategy;
+    // Whether 'strategy' takes the function name of the leaf frame instead of
+    // the one of this frame.
+    bool strategy_uses_leaf_function_name = false;
+    // Whether the parameter is an allocator, or an abseil container internal.
+    bool is_allocator = false;
+  };
+
+  // What GetCallStackContainerResolutionStrategy learns from a frame. It only
+  // depends on the function name of the frame, unlike the strategy of the
+  // whole callstack.
+  struct FrameMatch {
+    // Whether the function was inserted by memprof.
+    bool memprof_inserted = false;
+    // Strategy returned as soon as the frame is seen.
+    std::optional<ContainerResolutionStrategy> strategy;
+    // Otherwise, the matches of the formal parameters of the function, in
+    // order. Empty if the function has no formal parameters.
+    std::vector<FormalParamMatch> formal_params;
+  };
+
+  // Returns the match of 'function_name', matching it only the first time.
+  const FrameMatch& GetFrameMatch(absl::string_view function_name);
+  FrameMatch MatchFrame(absl::string_view function_name);
+  FormalParamMatch MatchFormalParam(absl::string_view function_name,
+                                    absl::string_view formal_param);
 
   // This resolves cases where two fields of an object have the same
   // offset. For now, we use size heuristic, inheritance heuristic, and then
@@ -219,6 +317,30 @@ class DwarfTypeResolver final : public AbstractTypeResolver {
   // Memprof instrumentation. There are some cases where the strategy is
   // different for GWP and Memprof, for example ABSL containers.
   bool is_local_;
+
+  // Skeletons keyed by type name. The same types are resolved again and again
+  // for every allocation of a profile, and walking the DWARF metadata is far
+  // more expensive than copying the finished tree. Types that failed to
+  // resolve are kept as well.
+  absl::Mutex skeletons_mu_;
+  absl::flat_hash_map<std::string, std::unique_ptr<SkeletonEntry>> skeletons_
+      ABSL_GUARDED_BY(skeletons_mu_);
+  // Fingerprints of the type data met by FingerprintType, as most types are
+  // reached from many others.
+  absl::Mutex fingerprints_mu_;
+  absl::flat_hash_map<const DwarfMetadataFetcher::TypeData*, uint64_t>
+      type_data_fingerprints_ ABSL_GUARDED_BY(fingerprints_mu_);
+
+  // Layouts of a previous run, see SetPriorLayouts. Null if none.
+  std::shared_ptr<const TypeLayoutStore> prior_layouts_;
+
+  // Frame matches keyed by function name. The same allocator and container
+  // frames are found in almost every callstack, and matching one takes
+  // demangling it, looking up its formal parameters and comparing them with
+  // every known container. The lock is not held while matching.
+  absl::Mutex frame_matches_mu_;
+  absl::flat_hash_map<std::string, std::unique_ptr<const FrameMatch>>
+      frame_matches_ ABSL_GUARDED_BY(frame_matches_mu_);
 };
 
 }  // namespace devtools_crosstool_fdo_field_access
@@ -0,0 +1,240 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the type resolution of allocation callstacks and of the
+// recording of access histograms. Run with --benchmark_format=json, or
+// --benchmark_out=<file> --benchmark_out_format=json, for machine-readable
+// results.
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "benchmark/benchmark.h"
+#include "binary_file_retriever.h"
+#include "dwarf_metadata_fetcher.h"
+#include "histogram_builder.h"
+#include "llvm/include/llvm/ProfileData/MemProf.h"
+#include "llvm/include/llvm/ProfileData/MemProfReader.h"
+#include "llvm/include/llvm/Support/Error.h"
+#include "llvm/include/llvm/Support/MemoryBuffer.h"
+#include "src/main/cpp/util/path.h"
+#include "type_resolver.h"
+#include "type_tree.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+using llvm::memprof::RawMemProfReader;
+
+constexpr const char* kBenchmarkTestdataPath = "src/testdata";
+constexpr const char* kBenchmarkBuildId = "benchmark";
+
+// Profiled programs whose allocation callstacks are resolved, each from
+// <program>.exe and <program>.memprofraw in the test data.
+constexpr absl::string_view kPrograms[] = {
+    "supported_stl_containers",
+    "supported_abseil_containers",
+    "supported_adt_containers",
+};
+
+// Name of the callstacks that ResolveTypeFromCallstack resolves from the
+// heapalloc tag of a frame rather than from a ContainerResolutionStrategy.
+constexpr absl::string_view kHeapAllocCallStacks = "kHeapAlloc";
+
+std::unique_ptr<DwarfTypeResolver> CreateTypeResolver(const std::string& path,
+                                                      bool read_subprograms) {
+  auto fetcher = std::make_unique<DwarfMetadataFetcher>(
+      BinaryFileRetriever::CreateMockRetriever({{kBenchmarkBuildId, path}}),
+      /*cache_dir=*/"", read_subprograms, /*write_to_cache=*/false);
+  QCHECK_OK(fetcher->FetchWithPath({{kBenchmarkBuildId, path}},
+                                   /*force_update_cache=*/true));
+  return std::make_unique<DwarfTypeResolver>(std::move(fetcher),
+                                             /*is_local=*/true);
+}
+
+std::unique_ptr<RawMemProfReader> CreateRawMemProfReader(
+    const std::string& profile, const std::string& binary) {
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer_or_error =
+      llvm::MemoryBuffer::getFile(profile);
+  QCHECK(buffer_or_error) << "Error opening profile file `" << profile
+                          << "`: " << buffer_or_error.getError().message();
+  llvm::Expected<std::unique_ptr<RawMemProfReader>> reader =
+      RawMemProfReader::create(std::move(buffer_or_error.get()), binary,
+                               /*KeepName=*/true);
+  if (llvm::Error error = reader.takeError()) {
+    LOG(QFATAL) << "Could not create reader: "
+                << llvm::toString(std::move(error));
+  }
+  return std::move(reader.get());
+}
+
+// An allocation callstack of a profile, borrowing the function names of the
+// allocation sites of its ProfiledProgram.
+struct ProfiledCallStack {
+  TypeTreeStore::CallStackView callstack;
+  int64_t request_size;
+};
+
+// The resolver of a profiled program, and the callstacks of its profile
+// grouped by how ResolveTypeFromCallstack resolves them.
+struct ProfiledProgram {
+  // The reader hands out records one at a time, so the allocation sites are
+  // copied out for the callstacks to borrow from.
+  std::vector<llvm::memprof::AllocationInfo> alloc_sites;
+  std::shared_ptr<DwarfTypeResolver> type_resolver;
+  std::map<std::string, std::vector<ProfiledCallStack>> callstacks;
+};
+
+// Returns the name of the ContainerResolutionStrategy::Type that
+// ResolveTypeFromCallstack resolves 'callstack' with, kHeapAllocCallStacks if
+// a frame has a heapalloc tag, or an empty string if it does not resolve.
+std::string GetResolutionName(
+    DwarfTypeResolver& type_resolver,
+    const TypeTreeStore::CallStackView& callstack, int64_t request_size) {
+  if (!type_resolver.ResolveTypeFromCallstack(callstack, request_size).ok()) {
+    return "";
+  }
+  for (const DwarfMetadataFetcher::FrameView& frame : callstack) {
+    if (type_resolver.ResolveTypeFromFrame(frame).ok()) {
+      return std::string(kHeapAllocCallStacks);
+    }
+  }
+  auto strategy =
+      type_resolver.GetCallStackContainerResolutionStrategy(callstack);
+  QCHECK_OK(strategy.status());
+  return DwarfTypeResolver::ContainerResolutionStrategy::TypeToString(
+      strategy->container_type);
+}
+
+std::unique_ptr<ProfiledProgram> LoadProfiledProgram(
+    absl::string_view program) {
+  const std::string binary = blaze_util::JoinPath(
+      kBenchmarkTestdataPath, absl::StrCat(program, ".exe"));
+  const std::string profile = blaze_util::JoinPath(
+      kBenchmarkTestdataPath, absl::StrCat(program, ".memprofraw"));
+  auto profiled_program = std::make_unique<ProfiledProgram>();
+  std::unique_ptr<RawMemProfReader> reader =
+      CreateRawMemProfReader(profile, binary);
+  for (const auto& [unused, record] : *reader) {
+    profiled_program->alloc_sites.insert(profiled_program->alloc_sites.end(),
+                                         record.AllocSites.begin(),
+                                         record.AllocSites.end());
+  }
+  profiled_program->type_resolver =
+      CreateTypeResolver(binary, /*read_subprograms=*/true);
+  for (const llvm::memprof::AllocationInfo& alloc_info :
+       profiled_program->alloc_sites) {
+    const ProfiledCallStack profiled_callstack = {
+        .callstack = TypeTreeStore::ViewCallStack(alloc_info.CallStack),
+        .request_size = alloc_info.Info.getAccessHistogramSize() *
+                        LocalHistogramBuilder::kMemprofHistogramGranularity};
+    const std::string name = GetResolutionName(
+        *profiled_program->type_resolver, profiled_callstack.callstack,
+        profiled_callstack.request_size);
+    if (!name.empty()) {
+      profiled_program->callstacks[name].push_back(profiled_callstack);
+    }
+  }
+  return profiled_program;
+}
+
+// Resolves each of 'callstacks' once per iteration. The resolver caches the
+// frame matches and the type tree skeletons, so this measures the resolution
+// of the callstacks of a profile after the first sites of each type.
+void BM_ResolveTypeFromCallstack(
+    benchmark::State& state, DwarfTypeResolver* type_resolver,
+    const std::vector<ProfiledCallStack>* callstacks) {
+  for (auto _ : state) {
+    for (const ProfiledCallStack& profiled_callstack : *callstacks) {
+      benchmark::DoNotOptimize(type_resolver->ResolveTypeFromCallstack(
+          profiled_callstack.callstack, profiled_callstack.request_size));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * callstacks->size());
+}
+
+// Registers BM_ResolveTypeFromCallstack/<program>/<type> for each
+// resolution type of the callstacks of each profiled program. The programs
+// stay loaded until the benchmarks have run.
+std::vector<std::unique_ptr<ProfiledProgram>> RegisterResolveBenchmarks() {
+  std::vector<std::unique_ptr<ProfiledProgram>> profiled_programs;
+  for (absl::string_view program : kPrograms) {
+    std::unique_ptr<ProfiledProgram> profiled_program =
+        LoadProfiledProgram(program);
+    for (const auto& [name, callstacks] : profiled_program->callstacks) {
+      const std::string benchmark_name =
+          absl::StrCat("BM_ResolveTypeFromCallstack/", program, "/", name);
+      benchmark::RegisterBenchmark(
+          benchmark_name.c_str(), BM_ResolveTypeFromCallstack,
+          profiled_program->type_resolver.get(), &callstacks);
+    }
+    profiled_programs.push_back(std::move(profiled_program));
+  }
+  return profiled_programs;
+}
+
+// Records a histogram of Arg(0) elements of
+// struct B {
+//   A a[4];
+// };
+// struct C {
+//   B b[4];
+// };
+// into the tree of C, as for a bulk allocation of an array of C.
+void BM_RecordAccessHistogramNestedArrays(benchmark::State& state) {
+  const std::unique_ptr<DwarfTypeResolver> type_resolver = CreateTypeResolver(
+      blaze_util::JoinPath(kBenchmarkTestdataPath,
+                           "array_access_count_test.dwarf"),
+      /*read_subprograms=*/false);
+  auto type_tree = type_resolver->ResolveTypeFromTypeName("C");
+  QCHECK_OK(type_tree.status());
+  const int64_t buckets_per_element =
+      (*type_tree)->Root()->GetSizeBytes() /
+      TypeTree::kDefaultAccessGranularity;
+  std::vector<uint64_t> histogram(buckets_per_element * state.range(0));
+  for (size_t i = 0; i < histogram.size(); ++i) {
+    histogram[i] = i;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize((*type_tree)->RecordAccessHistogram(histogram));
+  }
+  state.SetItemsProcessed(state.iterations() * histogram.size());
+}
+BENCHMARK(BM_RecordAccessHistogramNestedArrays)
+    ->ArgName("elements")
+    ->RangeMultiplier(16)
+    ->Range(1, 4096);
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  const auto profiled_programs =
+      devtools_crosstool_fdo_field_access::RegisterResolveBenchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
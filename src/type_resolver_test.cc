@@ -18,15 +18,21 @@
 
 #include <cstdint>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "binary_file_retriever.h"
 #include "gtest/gtest.h"
 #include "src/dwarf_metadata_fetcher.h"
 #include "src/object_layout.pb.h"
+#include "src/perf_stats.h"
+#include "src/type_layout_store.h"
 #include "src/type_tree.h"
 #include "src/main/cpp/util/path.h"
 #include "status_macros.h"
@@ -753,6 +759,42 @@ TEST(TypeResolverTest, SimpleRecordAccessTest) {
   EXPECT_EQ(type_tree_D->Root()->GetChild(2)->GetTotalAccessCount(), 8);
 
   ASSERT_TRUE(type_tree_D->Verify(/*verify_verbose=*/true));
+
+  // The trailing bucket of a bulk allocation whose size is not a multiple of
+  // the type size is dropped, and reported.
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> type_tree_D_misaligned,
+                       type_resolver->ResolveTypeFromTypeName("D"));
+  uint64_t histogram_D_misaligned[] = {1, 2, 3, 4, 5};
+  const TypeTree::CounterHistogram histograms_D_misaligned[] = {
+      {.type = TypeTree::AccessCounters::kAccess,
+       .histogram = histogram_D_misaligned}};
+  uint32_t remainder_buckets = 0;
+  ASSERT_OK(type_tree_D_misaligned->RecordAccessHistograms(
+      histograms_D_misaligned, &remainder_buckets));
+  EXPECT_EQ(remainder_buckets, 1);
+  const TypeTree::Node* root_D_misaligned = type_tree_D_misaligned->Root();
+  EXPECT_EQ(root_D_misaligned->GetChild(0)->GetTotalAccessCount(), 4);
+  EXPECT_EQ(root_D_misaligned->GetChild(1)->GetTotalAccessCount(), 4);
+  EXPECT_EQ(root_D_misaligned->GetChild(2)->GetTotalAccessCount(), 6);
+  ASSERT_TRUE(type_tree_D_misaligned->Verify(/*verify_verbose=*/true));
+}
+
+TEST(TypeResolverTest, CollapseHistogramTest) {
+  const uint64_t histogram[] = {1, 2, 3, 4, 5, 6, 7};
+  TypeTree::CollapsedHistogram collapsed =
+      TypeTree::CollapseHistogram<8>(histogram, /*collapsed_size=*/24);
+  // The partial row {7} is dropped.
+  EXPECT_EQ(collapsed.buckets, std::vector<uint64_t>({5, 7, 9}));
+  EXPECT_EQ(collapsed.remainder_buckets, 1);
+
+  collapsed = TypeTree::CollapseHistogram<8>(histogram, /*collapsed_size=*/4);
+  EXPECT_EQ(collapsed.buckets, std::vector<uint64_t>({28}));
+  EXPECT_EQ(collapsed.remainder_buckets, 0);
+
+  collapsed = TypeTree::CollapseHistogram<4>(
+      absl::MakeConstSpan(histogram, 6), /*collapsed_size=*/12);
+  EXPECT_EQ(collapsed.buckets, std::vector<uint64_t>({5, 7, 9}));
+  EXPECT_EQ(collapsed.remainder_buckets, 0);
 }
 
 // This test checks that we can record access counts of fields of an object
@@ -912,6 +954,44 @@ TEST(TypeResolverTest, ArrayAccessCountTest) {
 }
 
 // This test checks if we can resolve unique pointers in containers.
+// Recording a histogram through the precomputed access index must give the
+// same counts as recording each bucket on its own, also for trees sharing the
+// index.
+TEST(TypeResolverTest, AccessIndexMatchesRecordAccessTest) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kTypeResolverTestPath, "array_access_count_test.dwarf");
+  const std::string linker_build_id = "158c92614fde7e6d";
+
+  std::unique_ptr<BinaryFileRetriever> mock_retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+  auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
+      std::move(mock_retriever), ::testing::TempDir());
+  ASSERT_OK(
+      dwarf_metadata_fetcher->FetchWithPath({{linker_build_id, dwarf_path}},
+                                            /*force_update_cache=*/true));
+  auto type_resolver =
+      std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher));
+
+  uint64_t histogram[] = {0, 1, 2, 3, 4, 5, 6, 7};
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> expected,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  for (uint32_t i = 0; i < 8; ++i) {
+    expected->RecordAccess(i * 8, histogram[i]);
+  }
+  std::stringstream expected_dump;
+  expected->Dump(expected_dump);
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> type_tree,
+                         type_resolver->ResolveTypeFromTypeName("B"));
+    ASSERT_OK(type_tree->RecordAccessHistogram(histogram, 8));
+    EXPECT_TRUE(type_tree->Verify(/*verify_verbose=*/true));
+    std::stringstream dump;
+    type_tree->Dump(dump);
+    EXPECT_EQ(dump.str(), expected_dump.str());
+  }
+}
+
 TEST(TypeResolverTest, VectorUniquePointerTest) {
   const std::string dwarf_path = blaze_util::JoinPath(
       kTypeResolverTestPath, "vector_unique_pointer_type.dwarf");
@@ -1391,6 +1471,313 @@ TEST(TypeResolverTest, ComplexProtoTest) {
       4);
 }
 
+// Resolving the same type twice reuses the first tree, but the trees must
+// still be independent of each other.
+TEST(TypeResolverTest, RepeatedResolutionTest) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kTypeResolverTestPath, "simple_record_access_type.dwarf");
+  const std::string linker_build_id = "f5412ed20726e01a";
+
+  std::unique_ptr<BinaryFileRetriever> mock_retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+  auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
+      std::move(mock_retriever), ::testing::TempDir());
+  ASSERT_OK(
+      dwarf_metadata_fetcher->FetchWithPath({{linker_build_id, dwarf_path}},
+                                            /*force_update_cache=*/true));
+  auto type_resolver =
+      std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher));
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> first,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  uint64_t histogram[] = {1, 2};
+  ASSERT_OK(first->RecordAccessHistogram(histogram, 2));
+  ASSERT_EQ(first->Root()->NumChildren(), 1);
+  EXPECT_EQ(first->Root()->GetChild(0)->GetTotalAccessCount(), 3);
+
+  ASSERT_OK_AND_ASSIGN(
+      std::unique_ptr<TypeTree> second,
+      type_resolver->CreateTreeFromDwarf("B", /*from_container=*/true,
+                                         "container"));
+  EXPECT_TRUE(second->Verify(/*verify_verbose=*/true));
+  EXPECT_EQ(first->SkeletonVerified(), true);
+  EXPECT_EQ(second->SkeletonVerified(), true);
+  EXPECT_TRUE(second->FromContainer());
+  EXPECT_EQ(second->Root()->GetSubtreeSize(), first->Root()->GetSubtreeSize());
+  ASSERT_EQ(second->Root()->NumChildren(), 1);
+  EXPECT_EQ(second->Root()->GetChild(0)->GetTypeName(), "A");
+  EXPECT_EQ(second->Root()->GetChild(0)->GetTotalAccessCount(), 0);
+  EXPECT_EQ(first->Root()->GetChild(0)->GetTotalAccessCount(), 3);
+
+  EXPECT_NOT_OK(type_resolver->ResolveTypeFromTypeName("DoesNotExist"));
+  EXPECT_NOT_OK(type_resolver->ResolveTypeFromTypeName("DoesNotExist"));
+}
+
+absl::StatusOr<std::unique_ptr<DwarfTypeResolver>> CreateTypeResolver(
+    absl::string_view dwarf_file, const std::string &linker_build_id) {
+  const std::string dwarf_path =
+      blaze_util::JoinPath(kTypeResolverTestPath, dwarf_file);
+  std::unique_ptr<BinaryFileRetriever> mock_retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+  auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
+      std::move(mock_retriever), ::testing::TempDir());
+  RETURN_IF_ERROR(
+      dwarf_metadata_fetcher->FetchWithPath({{linker_build_id, dwarf_path}},
+                                            /*force_update_cache=*/true));
+  return std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher));
+}
+
+// The layouts exported by a run are reused by the next one for the types whose
+// fingerprint did not change, and built again for the others.
+TEST(TypeResolverTest, PriorLayoutsTest) {
+  ASSERT_OK_AND_ASSIGN(
+      std::unique_ptr<DwarfTypeResolver> basic_resolver,
+      CreateTypeResolver("basic_type.dwarf", "056d411c166d583f"));
+  ASSERT_OK_AND_ASSIGN(
+      std::unique_ptr<DwarfTypeResolver> embedded_resolver,
+      CreateTypeResolver("embedded_type.dwarf", "79f61a072f0c57d1"));
+  // Both binaries have the same class A, B only being in the second one.
+  const uint64_t a_fingerprint = embedded_resolver->FingerprintType("A");
+  const uint64_t b_fingerprint = embedded_resolver->FingerprintType("B");
+  EXPECT_EQ(basic_resolver->FingerprintType("A"), a_fingerprint);
+  EXPECT_NE(basic_resolver->FingerprintType("B"), b_fingerprint);
+  EXPECT_NE(a_fingerprint, b_fingerprint);
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> a_tree,
+                       embedded_resolver->ResolveTypeFromTypeName("A"));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> b_tree,
+                       embedded_resolver->ResolveTypeFromTypeName("B"));
+  EXPECT_NOT_OK(embedded_resolver->ResolveTypeFromTypeName("DoesNotExist"));
+  const TypeLayoutStore layouts = embedded_resolver->ExportLayouts();
+  ASSERT_EQ(layouts.Size(), 2);
+  ASSERT_NE(layouts.Find("B"), nullptr);
+  EXPECT_EQ(layouts.Find("B")->fingerprint, b_fingerprint);
+  EXPECT_TRUE(layouts.Find("B")->verified);
+
+  // Give B the layout of A, and A a stale fingerprint, to tell reused layouts
+  // from rebuilt ones.
+  auto prior_layouts = std::make_shared<TypeLayoutStore>();
+  prior_layouts->Add("A", a_fingerprint + 1, /*verified=*/true,
+                     *a_tree->Root());
+  prior_layouts->Add("B", b_fingerprint, /*verified=*/true, *a_tree->Root());
+  ASSERT_OK_AND_ASSIGN(
+      std::unique_ptr<DwarfTypeResolver> incremental_resolver,
+      CreateTypeResolver("embedded_type.dwarf", "79f61a072f0c57d1"));
+  incremental_resolver->SetPriorLayouts(prior_layouts);
+  const PerfCounter &reused =
+      PerfStats::Global().Counter("type_tree_skeleton_reused");
+  const int64_t reused_before = reused.value();
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> reused_tree,
+                       incremental_resolver->ResolveTypeFromTypeName("B"));
+  EXPECT_EQ(reused.value(), reused_before + 1);
+  EXPECT_EQ(reused_tree->SkeletonVerified(), true);
+  EXPECT_EQ(reused_tree->Root()->GetTypeName(), "A");
+  ASSERT_EQ(reused_tree->Root()->NumChildren(), 2);
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> rebuilt_tree,
+                       incremental_resolver->ResolveTypeFromTypeName("A"));
+  EXPECT_EQ(reused.value(), reused_before + 1);
+  EXPECT_TRUE(rebuilt_tree->Verify(/*verify_verbose=*/true));
+  EXPECT_EQ(rebuilt_tree->Root()->GetSubtreeSize(),
+            a_tree->Root()->GetSubtreeSize());
+  EXPECT_EQ(incremental_resolver->ExportLayouts().Find("A")->fingerprint,
+            a_fingerprint);
+}
+
+// Trees resolved from the same type share their shape, so merging their
+// counts does not need to walk the trees.
+TEST(TypeResolverTest, MergeCountsOfSameSkeletonTest) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kTypeResolverTestPath, "array_access_count_test.dwarf");
+  const std::string linker_build_id = "158c92614fde7e6d";
+
+  std::unique_ptr<BinaryFileRetriever> mock_retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+  auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
+      std::move(mock_retriever), ::testing::TempDir());
+  ASSERT_OK(
+      dwarf_metadata_fetcher->FetchWithPath({{linker_build_id, dwarf_path}},
+                                            /*force_update_cache=*/true));
+  auto type_resolver =
+      std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher));
+
+  uint64_t histogram[] = {0, 1, 2, 3, 4, 5, 6, 7};
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> first,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(first->RecordAccessHistogram(histogram, 8));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> second,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(second->RecordAccessHistogram(histogram, 8));
+  ASSERT_OK(second->MergeCounts(first.get()));
+
+  EXPECT_TRUE(second->Verify(/*verify_verbose=*/true));
+  EXPECT_EQ(second->Root()->GetTotalAccessCount(), 56);
+  ASSERT_EQ(second->Root()->GetChild(0)->GetChild(0)->NumChildren(), 2);
+  EXPECT_EQ(second->Root()
+                ->GetChild(0)
+                ->GetChild(0)
+                ->GetChild(0)
+                ->GetTotalAccessCount(),
+            24);
+  EXPECT_EQ(first->Root()->GetTotalAccessCount(), 28);
+
+  // A tree built from its object layout does not share the skeleton, but
+  // still merges.
+  std::unique_ptr<TypeTree> from_layout = TypeTree::CreateTreeFromObjectLayout(
+      TypeTree::CreateObjectLayoutFromTree(*first), "B");
+  EXPECT_FALSE(from_layout->SkeletonVerified().has_value());
+  ASSERT_OK(from_layout->MergeCounts(second.get()));
+  EXPECT_EQ(from_layout->Root()->GetTotalAccessCount(), 56);
+}
+
+// Recording several histograms at once counts the same as recording them one
+// after the other.
+TEST(TypeResolverTest, RecordAccessHistogramsTest) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kTypeResolverTestPath, "array_access_count_test.dwarf");
+  const std::string linker_build_id = "158c92614fde7e6d";
+
+  std::unique_ptr<BinaryFileRetriever> mock_retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+  auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
+      std::move(mock_retriever), ::testing::TempDir());
+  ASSERT_OK(
+      dwarf_metadata_fetcher->FetchWithPath({{linker_build_id, dwarf_path}},
+                                            /*force_update_cache=*/true));
+  auto type_resolver =
+      std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher));
+
+  uint64_t access_histogram[] = {0, 1, 2, 3, 4, 5, 6, 7};
+  uint64_t llc_miss_histogram[] = {1, 0, 0, 0, 0, 0, 0, 2};
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> separate,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(separate->RecordAccessHistogram(access_histogram, 8));
+  ASSERT_OK((separate->RecordAccessHistogram<
+             TypeTree::kDefaultAccessGranularity,
+             TypeTree::AccessCounters::kLlcMiss>(llc_miss_histogram, 8)));
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> together,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  const TypeTree::CounterHistogram histograms[] = {
+      {.type = TypeTree::AccessCounters::kAccess,
+       .histogram = access_histogram},
+      {.type = TypeTree::AccessCounters::kLlcMiss,
+       .histogram = llc_miss_histogram},
+  };
+  ASSERT_OK(together->RecordAccessHistograms(histograms));
+
+  const TypeTree::AccessCounters& root_counters =
+      together->Root()->GetAccessCounters();
+  EXPECT_EQ(root_counters.access, 28);
+  EXPECT_EQ(root_counters.llc_miss, 3);
+  // LLC misses are not accesses of their own.
+  EXPECT_EQ(root_counters.total, 28);
+  std::stringstream separate_dump;
+  std::stringstream together_dump;
+  separate->Dump(separate_dump);
+  together->Dump(together_dump);
+  EXPECT_EQ(together_dump.str(), separate_dump.str());
+  EXPECT_NE(together_dump.str().find("llc_miss: 3"), std::string::npos);
+
+  std::stringstream separate_flamegraph;
+  std::stringstream together_flamegraph;
+  separate->DumpFlameGraph(separate_flamegraph, /*id=*/0,
+                           TypeTree::FlameGraphValue::kLlcMissDensity);
+  together->DumpFlameGraph(together_flamegraph, /*id=*/0,
+                           TypeTree::FlameGraphValue::kLlcMissDensity);
+  EXPECT_EQ(together_flamegraph.str(), separate_flamegraph.str());
+
+  const uint64_t short_histogram[] = {1};
+  const TypeTree::CounterHistogram mismatched_histograms[] = {
+      {.type = TypeTree::AccessCounters::kAccess,
+       .histogram = access_histogram},
+      {.type = TypeTree::AccessCounters::kLlcMiss,
+       .histogram = short_histogram},
+  };
+  EXPECT_NOT_OK(together->RecordAccessHistograms(mismatched_histograms));
+  EXPECT_NOT_OK(together->RecordAccessHistograms({}));
+}
+
+// Histograms of other power-of-two granularities are attributed to the fields
+// their buckets overlap.
+TEST(TypeResolverTest, AccessGranularityTest) {
+  const std::string dwarf_path = blaze_util::JoinPath(
+      kTypeResolverTestPath, "array_access_count_test.dwarf");
+  const std::string linker_build_id = "158c92614fde7e6d";
+
+  std::unique_ptr<BinaryFileRetriever> mock_retriever =
+      BinaryFileRetriever::CreateMockRetriever({{linker_build_id, dwarf_path}});
+  auto dwarf_metadata_fetcher = std::make_unique<DwarfMetadataFetcher>(
+      std::move(mock_retriever), ::testing::TempDir());
+  ASSERT_OK(
+      dwarf_metadata_fetcher->FetchWithPath({{linker_build_id, dwarf_path}},
+                                            /*force_update_cache=*/true));
+  auto type_resolver =
+      std::make_unique<DwarfTypeResolver>(std::move(dwarf_metadata_fetcher));
+
+  // struct B {
+  //   A a[4];
+  // };
+  // With 4 byte buckets, each of the two 8 byte fields of A covers two
+  // buckets out of every four.
+  uint64_t histogram_4[] = {0, 1, 2,  3,  4,  5,  6,  7,
+                            8, 9, 10, 11, 12, 13, 14, 15};
+  const TypeTree::CounterHistogram histograms_4[] = {
+      {.type = TypeTree::AccessCounters::kAccess, .histogram = histogram_4}};
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> type_tree_4,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(type_tree_4->RecordAccessHistograms(/*access_granularity=*/4,
+                                                histograms_4));
+  ASSERT_TRUE(type_tree_4->Verify(/*verify_verbose=*/true));
+  EXPECT_EQ(type_tree_4->Root()->GetTotalAccessCount(), 120);
+  const TypeTree::Node* element_4 =
+      type_tree_4->Root()->GetChild(0)->GetChild(0);
+  ASSERT_EQ(element_4->NumChildren(), 2);
+  EXPECT_EQ(element_4->GetChild(0)->GetTotalAccessCount(), 52);
+  EXPECT_EQ(element_4->GetChild(1)->GetTotalAccessCount(), 68);
+
+  // A single 64 byte bucket covers the whole of B.
+  uint64_t histogram_64[] = {5};
+  const TypeTree::CounterHistogram histograms_64[] = {
+      {.type = TypeTree::AccessCounters::kAccess, .histogram = histogram_64}};
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> type_tree_64,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(type_tree_64->RecordAccessHistograms(/*access_granularity=*/64,
+                                                 histograms_64));
+  EXPECT_EQ(type_tree_64->Root()->GetTotalAccessCount(), 5);
+  const TypeTree::Node* element_64 =
+      type_tree_64->Root()->GetChild(0)->GetChild(0);
+  ASSERT_EQ(element_64->NumChildren(), 2);
+  EXPECT_EQ(element_64->GetChild(0)->GetTotalAccessCount(), 20);
+  EXPECT_EQ(element_64->GetChild(1)->GetTotalAccessCount(), 20);
+
+  // The runtime granularity records the same as the compile-time one.
+  uint64_t histogram_8[] = {0, 1, 2, 3, 4, 5, 6, 7};
+  const TypeTree::CounterHistogram histograms_8[] = {
+      {.type = TypeTree::AccessCounters::kAccess, .histogram = histogram_8}};
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> type_tree_8,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(type_tree_8->RecordAccessHistograms(/*access_granularity=*/8,
+                                                histograms_8));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<TypeTree> type_tree_8_static,
+                       type_resolver->ResolveTypeFromTypeName("B"));
+  ASSERT_OK(type_tree_8_static->RecordAccessHistogram(histogram_8, 8));
+  std::stringstream dump_8;
+  std::stringstream dump_8_static;
+  type_tree_8->Dump(dump_8);
+  type_tree_8_static->Dump(dump_8_static);
+  EXPECT_EQ(dump_8.str(), dump_8_static.str());
+
+  EXPECT_NOT_OK(type_tree_8->RecordAccessHistograms(/*access_granularity=*/0,
+                                                    histograms_8));
+  EXPECT_NOT_OK(type_tree_8->RecordAccessHistograms(/*access_granularity=*/12,
+                                                    histograms_8));
+  EXPECT_NOT_OK(type_tree_8->RecordAccessHistograms(
+      /*access_granularity=*/2 * TypeTree::kMaxAccessGranularity,
+      histograms_8));
+}
+
 TEST(TypeResolverTest, UnwrapAndCleanTypeNameTest) {
   EXPECT_EQ(DwarfTypeResolver::UnwrapAndCleanTypeName("std::allocator<int>"),
             "int");
@@ -16,6 +16,7 @@
 
 #include <sys/types.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
@@ -31,24 +32,67 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "dwarf_metadata_fetcher.h"
+#include "flamegraph_writer.h"
+#include "perf_stats.h"
+#include "src/histogram.pb.h"
 #include "src/object_layout.pb.h"
 #include "status_macros.h"
+#include "string_interner.h"
 
 namespace devtools_crosstool_fdo_field_access {
 
 namespace {
+
+// Size of the cache lines LLC miss densities are relative to.
+constexpr int64_t kCacheLineBytes = 64;
+
 void DumpLevel(std::ostream &out, int level) {
   for (size_t i = 0; i < level; ++i) {
     out << "  ";
   }
 }
+
+// Records 'histograms' into 'type_tree' with the instantiation of
+// RecordAccessHistograms for 'access_granularity', trying each supported
+// granularity from AccessGranularity up.
+template <uint32_t AccessGranularity>
+absl::Status RecordAccessHistogramsWithGranularity(
+    TypeTree &type_tree, uint32_t access_granularity,
+    absl::Span<const TypeTree::CounterHistogram> histograms,
+    uint32_t *remainder_buckets) {
+  if (access_granularity == AccessGranularity) {
+    return type_tree.RecordAccessHistograms<AccessGranularity>(
+        histograms, remainder_buckets);
+  }
+  if constexpr (AccessGranularity < TypeTree::kMaxAccessGranularity) {
+    return RecordAccessHistogramsWithGranularity<2 * AccessGranularity>(
+        type_tree, access_granularity, histograms, remainder_buckets);
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unsupported access granularity: ", access_granularity,
+                   " bytes, must be a power of two of at most ",
+                   TypeTree::kMaxAccessGranularity));
+}
 }  // namespace
 
 void TypeTree::Node::AddChild(std::unique_ptr<Node> node) {
   children.push_back(std::move(node));
 }
 
+std::unique_ptr<TypeTree::Node> TypeTree::Node::CloneWithoutCounts() const {
+  auto clone = std::make_unique<Node>(
+      GetName(), GetTypeName(), GetOffsetBits(), GetSizeBits(),
+      GetMultiplicity(), GetTypeKind(), layout.object_kind,
+      global_offset, AccessCounters(), is_union);
+  clone->children.reserve(children.size());
+  for (const auto &child : children) {
+    clone->children.push_back(child->CloneWithoutCounts());
+  }
+  return clone;
+}
+
 void TypeTree::Node::AddChildAndInsertPaddingIfNecessary(
     std::unique_ptr<Node> child, const TypeTree::Node *parent_node,
     uint32_t field_index,
@@ -104,6 +148,44 @@ absl::string_view TypeTree::Node::NameToString(absl::string_view name) const {
   }
 }
 
+const TypeTree::AccessCounters &TypeTree::Node::GetAccessCounters() const {
+  static constexpr AccessCounters kNoAccesses;
+  return access_counters != nullptr ? *access_counters : kNoAccesses;
+}
+
+TypeTree::AccessCounters &TypeTree::Node::MutableAccessCounters() {
+  if (access_counters == nullptr) {
+    detached_counters = std::make_unique<AccessCounters>();
+    access_counters = detached_counters.get();
+  }
+  return *access_counters;
+}
+
+void TypeTree::AttachCounters() {
+  if (root_ == nullptr) {
+    return;
+  }
+  std::vector<Node *> nodes;
+  root_->CollectNodes(nodes);
+  std::vector<AccessCounters> counters;
+  counters.reserve(nodes.size());
+  for (const Node *node : nodes) {
+    counters.push_back(node->GetAccessCounters());
+  }
+  counters_ = std::move(counters);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    nodes[i]->access_counters = &counters_[i];
+    nodes[i]->detached_counters = nullptr;
+  }
+}
+
+void TypeTree::Node::CollectNodes(std::vector<Node *> &nodes) {
+  nodes.push_back(this);
+  for (auto &child : children) {
+    child->CollectNodes(nodes);
+  }
+}
+
 uint64_t TypeTree::Node::GetSubtreeSize() const {
   uint64_t result = 1;
   for (const auto &child : children) {
@@ -139,6 +221,13 @@ void TypeTree::Node::Dump(std::ostream &out, int level,
   }
   DumpLevel(out, level);
   out << "total_access: " << GetTotalAccessCount() << "\n";
+  if (GetAccessCounters().llc_miss != 0) {
+    DumpLevel(out, level);
+    out << "llc_miss: " << GetAccessCounters().llc_miss << "\n";
+    DumpLevel(out, level);
+    out << "llc_miss_density: "
+        << GetFlameGraphValue(FlameGraphValue::kLlcMissDensity) << "\n";
+  }
   DumpLevel(out, level);
   out << "global_offset: " << GetGlobalOffsetBytes() << "\n";
   if (!children.empty()) {
@@ -164,6 +253,25 @@ void TypeTree::Node::Dump(std::ostream &out, int level,
   }
 }
 
+uint64_t TypeTree::Node::GetFlameGraphValue(FlameGraphValue value) const {
+  const AccessCounters &counters = GetAccessCounters();
+  switch (value) {
+    case FlameGraphValue::kTotal:
+      return counters.total;
+    case FlameGraphValue::kAccess:
+      return counters.access;
+    case FlameGraphValue::kLlcMiss:
+      return counters.llc_miss;
+    case FlameGraphValue::kLlcMissDensity: {
+      // Rounded up, so that a field with any miss shows.
+      const uint64_t size_bytes = std::max<int64_t>(GetFullSizeBytes(), 1);
+      return (counters.llc_miss * kCacheLineBytes + size_bytes - 1) /
+             size_bytes;
+    }
+  }
+  return counters.total;
+}
+
 void TypeTree::Dump(std::ostream &out, int level, bool dump_full_unions) const {
   if (!Empty()) {
     DumpLevel(out, level);
@@ -179,31 +287,35 @@ void TypeTree::Dump(std::ostream &out, int level, bool dump_full_unions) const {
   }
 }
 
-void TypeTree::DumpFlameGraph(std::ostream &out, uint64_t id) const {
-  std::string root_name =
-      absl::StrCat(container_name_, id == 0 ? "" : absl::StrCat("", id));
-  // std::string root_name = absl::StrCat(container_name_, (id == 0 ?  : id));
-  std::vector<std::string> path;
-  root_->DumpFlameGraph(out, path, root_name);
+void TypeTree::DumpFlameGraph(std::ostream &out, uint64_t id,
+                              FlameGraphValue value) const {
+  FlameGraphWriter writer(out);
+  DumpFlameGraph(writer, id, value);
+  writer.Finish().IgnoreError();
 }
 
-void TypeTree::Node::DumpFlameGraph(std::ostream &out,
-                                    std::vector<std::string> &path,
-                                    const std::string &root_name) const {
-  // out << "<" << root_name << ">";
-  out << root_name << "_";
-  std::string name = "";
-  absl::StrAppend(&name, GetOffsetBytes(), "|", NameToString(GetTypeName()),
-                  "|", GetName());
-  for (auto &p : path) {
-    out << p << ";";
+void TypeTree::DumpFlameGraph(FlameGraphWriter &writer, uint64_t id,
+                              FlameGraphValue value) const {
+  std::string stack = container_name_;
+  if (id != 0 && writer.format() != FlameGraphWriter::Format::kCollapsed) {
+    absl::StrAppend(&stack, id);
   }
-  out << name << " " << (NumChildren() > 0 ? 0 : GetTotalAccessCount()) << "\n";
-  std::vector<std::string> new_path = path;
-  new_path.push_back(name);
+  stack.push_back('_');
+  root_->DumpFlameGraph(writer, stack, value);
+}
+
+void TypeTree::Node::DumpFlameGraph(FlameGraphWriter &writer,
+                                    std::string &stack,
+                                    FlameGraphValue value) const {
+  const size_t prefix_size = stack.size();
+  absl::StrAppend(&stack, GetOffsetBytes(), "|", NameToString(GetTypeName()),
+                  "|", GetName());
+  writer.Write(stack, NumChildren() > 0 ? 0 : GetFlameGraphValue(value));
+  stack.push_back(';');
   for (auto &child : children) {
-    child->DumpFlameGraph(out, new_path, root_name);
+    child->DumpFlameGraph(writer, stack, value);
   }
+  stack.resize(prefix_size);
 }
 
 TypeTree::Node::Node(absl::string_view name, absl::string_view type_name,
@@ -214,15 +326,38 @@ TypeTree::Node::Node(absl::string_view name, absl::string_view type_name,
                      int64_t global_offset,
                      TypeTree::AccessCounters access_counters, bool is_union)
     : global_offset(global_offset),
-      access_counters(access_counters),
+      detached_counters(access_counters.Empty()
+                            ? nullptr
+                            : std::make_unique<AccessCounters>(access_counters)),
+      access_counters(detached_counters.get()),
       is_union(is_union) {
-  object_layout.mutable_properties()->set_name(name);
-  object_layout.mutable_properties()->set_type_name(type_name);
-  object_layout.mutable_properties()->set_offset_bits(offset_bits);
-  object_layout.mutable_properties()->set_size_bits(size_bits);
-  object_layout.mutable_properties()->set_multiplicity(multiplicity);
-  object_layout.mutable_properties()->set_type_kind(type_kind);
-  object_layout.mutable_properties()->set_kind(object_kind);
+  static PerfCounter &nodes_built =
+      PerfStats::Global().Counter("type_tree_nodes_built");
+  static PerfCounter &node_bytes =
+      PerfStats::Global().Counter("type_tree_node_bytes");
+  nodes_built.Add();
+  node_bytes.Add(sizeof(Node));
+  StringInterner &interner = StringInterner::Global();
+  layout = {.name = interner.Intern(name),
+            .type_name = interner.Intern(type_name),
+            .offset_bits = offset_bits,
+            .size_bits = size_bits,
+            .multiplicity = multiplicity,
+            .type_kind = type_kind,
+            .object_kind = object_kind};
+}
+
+ObjectLayout TypeTree::Node::GetObjectLayout() const {
+  ObjectLayout object_layout;
+  ObjectLayout::Properties *properties = object_layout.mutable_properties();
+  properties->set_name(layout.name);
+  properties->set_type_name(layout.type_name);
+  properties->set_offset_bits(layout.offset_bits);
+  properties->set_size_bits(layout.size_bits);
+  properties->set_multiplicity(layout.multiplicity);
+  properties->set_type_kind(layout.type_kind);
+  properties->set_kind(layout.object_kind);
+  return object_layout;
 }
 
 bool TypeTree::Node::Verify(const Node *parent, const Node *older_sibling,
@@ -439,9 +574,9 @@ absl::Status TypeTree::Node::MergeCounts(const Node *other) {
                      GetTypeName(), " vs ", other->GetTypeName()));
   }
 
-  access_counters.total += other->access_counters.total;
-  access_counters.access += other->access_counters.access;
-  access_counters.llc_miss += other->access_counters.llc_miss;
+  if (!other->GetAccessCounters().Empty()) {
+    MutableAccessCounters().Add(other->GetAccessCounters());
+  }
   for (int i = 0; i < NumChildren(); i++) {
     // We cheat here a bit by casting away the constness of
     // the other node. This is safe because we are only
@@ -454,7 +589,25 @@ absl::Status TypeTree::Node::MergeCounts(const Node *other) {
   return absl::OkStatus();
 }
 
+absl::Status TypeTree::RecordAccessHistograms(
+    uint32_t access_granularity,
+    absl::Span<const CounterHistogram> histograms,
+    uint32_t *remainder_buckets) {
+  return RecordAccessHistogramsWithGranularity<1>(
+      *this, access_granularity, histograms, remainder_buckets);
+}
+
 absl::Status TypeTree::MergeCounts(const TypeTree *other) {
+  // Trees copied from the same skeleton, and not changed since, have the same
+  // shape, so their counters line up.
+  if (access_index_cache_ != nullptr &&
+      access_index_cache_ == other->access_index_cache_ &&
+      counters_.size() == other->counters_.size()) {
+    for (size_t i = 0; i < counters_.size(); ++i) {
+      counters_[i].Add(other->counters_[i]);
+    }
+    return absl::OkStatus();
+  }
   return root_->MergeCounts(other->Root());
 }
 
@@ -466,7 +619,6 @@ void TypeTree::Node::CreateChildFromSuboject(
     node->CreateChildFromSuboject(subobject);
     AddChild(std::move(node));
   }
-  this->object_layout.clear_subobjects();
 }
 
 std::unique_ptr<TypeTree> TypeTree::CreateTreeFromObjectLayout(
@@ -485,6 +637,65 @@ ObjectLayout TypeTree::CreateObjectLayoutFromTree(const TypeTree &type_tree) {
   type_tree.root_->CreateObjectLayoutFromChildren(object_layout);
   return object_layout;
 }
+absl::StatusOr<std::unique_ptr<TypeTree>> TypeTree::CreateTreeFromProto(
+    const TypeTreeProto &proto) {
+  std::unique_ptr<Node> root =
+      Node::CreateNodeFromObjectLayout(proto.object_layout(), nullptr);
+  root->CreateChildFromSuboject(proto.object_layout());
+  auto type_tree = std::make_unique<TypeTree>(
+      std::move(root), proto.root_type_name(), proto.from_container(),
+      proto.container_name());
+  if (static_cast<size_t>(proto.counters_size()) !=
+      type_tree->counters_.size()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Type tree ", proto.root_type_name(), " has ", proto.counters_size(),
+        " counters for ", type_tree->counters_.size(), " nodes."));
+  }
+  for (int i = 0; i < proto.counters_size(); ++i) {
+    const TypeTreeProto::AccessCounters &counters = proto.counters(i);
+    type_tree->counters_[i].total = counters.total();
+    type_tree->counters_[i].access = counters.access();
+    type_tree->counters_[i].llc_miss = counters.llc_miss();
+  }
+  if (!proto.union_nodes().empty()) {
+    std::vector<Node *> nodes;
+    type_tree->root_->CollectNodes(nodes);
+    for (uint32_t node_index : proto.union_nodes()) {
+      if (node_index >= nodes.size()) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Union node ", node_index,
+                         " out of range in type tree ",
+                         proto.root_type_name()));
+      }
+      nodes[node_index]->is_union = true;
+    }
+  }
+  return type_tree;
+}
+
+TypeTreeProto TypeTree::ToProto() const {
+  TypeTreeProto proto;
+  *proto.mutable_object_layout() = CreateObjectLayoutFromTree(*this);
+  proto.set_root_type_name(root_type_name_);
+  proto.set_from_container(from_container_);
+  proto.set_container_name(container_name_);
+  proto.mutable_counters()->Reserve(counters_.size());
+  for (const AccessCounters &counters : counters_) {
+    TypeTreeProto::AccessCounters *proto_counters = proto.add_counters();
+    proto_counters->set_total(counters.total);
+    proto_counters->set_access(counters.access);
+    proto_counters->set_llc_miss(counters.llc_miss);
+  }
+  std::vector<Node *> nodes;
+  root_->CollectNodes(nodes);
+  for (uint32_t i = 0; i < nodes.size(); ++i) {
+    if (nodes[i]->IsUnion()) {
+      proto.add_union_nodes(i);
+    }
+  }
+  return proto;
+}
+
 void TypeTree::Node::CreateObjectLayoutFromChildren(
     ObjectLayout &object_layout) const {
   for (int i = 0; i < NumChildren(); i++) {
@@ -589,8 +800,10 @@ absl::Status TypeTree::MergeTreeIntoThis(const TypeTree *other) {
   // and the merged node will be held by unique_ptr inside the vector of the
   // parent of the merged node.
   Node *merge_node = const_cast<Node *>(merge_node_const);
+  ResetAccessIndex();
   RETURN_IF_ERROR(merge_node->MergeTreeIntoThis(
       other->Root(), merge_node->GetGlobalOffsetBits()));
+  AttachCounters();
   BuildSizesBottomUp();
   InferOffsetsFromSizes();
   return absl::OkStatus();
@@ -600,7 +813,7 @@ void TypeTree::Node::InferOffsetsFromSizes() {
   int64_t curr_offset = 0;
   for (auto &child : children) {
     child->global_offset = global_offset + curr_offset;
-    child->object_layout.mutable_properties()->set_offset_bits(curr_offset);
+    child->layout.offset_bits = curr_offset;
     curr_offset += child->GetFullSizeBits();
     child->InferOffsetsFromSizes();
   }
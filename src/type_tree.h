@@ -24,17 +24,23 @@
 #include <cstdint>
 #include <memory>
 #include <numeric>
+#include <optional>
 #include <ostream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "dwarf_metadata_fetcher.h"
+#include "flamegraph_writer.h"
+#include "src/histogram.pb.h"
 #include "src/object_layout.pb.h"
 
 namespace devtools_crosstool_fdo_field_access {
@@ -46,15 +52,65 @@ class TypeTree {
       kAccess = 0, /*Load or store.*/
       kLlcMiss = 1,
     };
+    // Number of accesses. LLC misses are counted on their own, as they are
+    // a subset of the accesses rather than more of them.
     uint64_t total = 0;
     uint64_t access = 0;
     uint64_t llc_miss = 0;
+
+    template <AccessType Type>
+    void Increment(uint64_t count);
+    // Same as above, for an access type only known at run time.
+    void Increment(AccessType type, uint64_t count);
+    void Add(const AccessCounters& other) {
+      total += other.total;
+      access += other.access;
+      llc_miss += other.llc_miss;
+    }
+    bool Empty() const { return total == 0 && access == 0 && llc_miss == 0; }
   };
 
   static constexpr uint32_t kDefaultAccessGranularity = 8;
+  // Access granularities must be a power of two of at most this many bytes.
+  static constexpr uint32_t kMaxAccessGranularity = 4096;
   static constexpr TypeTree::AccessCounters::AccessType kDefaultAccessType =
       AccessCounters::kAccess;
 
+  // An access histogram of an allocation, counting accesses of 'type'.
+  struct CounterHistogram {
+    AccessCounters::AccessType type;
+    absl::Span<const uint64_t> histogram;
+  };
+
+  // The counter of each field that a flamegraph shows.
+  enum class FlameGraphValue {
+    kTotal,
+    kAccess,
+    kLlcMiss,
+    // LLC misses per cache line of the field, which ranks fields by how much
+    // moving them would save rather than by their size.
+    kLlcMissDensity,
+  };
+
+  // Precomputed attribution of the buckets of an access histogram to the
+  // nodes of a tree, equivalent to calling Node::RecordAccess for each bucket.
+  // For each bucket, it lists the nodes whose counters an access to the bucket
+  // increments, by their pre-order index in the tree, and how many times, e.g.
+  // once for each element of an array that overlaps the bucket.
+  struct AccessIndex {
+    struct Entry {
+      uint32_t node_index;
+      uint32_t times;
+    };
+    // The entries of bucket b are entries[bucket_begin[b], bucket_begin[b+1]).
+    std::vector<uint32_t> bucket_begin;
+    std::vector<Entry> entries;
+
+    size_t BucketCount() const {
+      return bucket_begin.empty() ? 0 : bucket_begin.size() - 1;
+    }
+  };
+
   struct Node {
     explicit Node(absl::string_view name, absl::string_view type_name,
                   int64_t offset_bits, int64_t size_bits, int64_t multiplicity,
@@ -64,15 +120,17 @@ class TypeTree {
                   AccessCounters access_counters = {0, 0, 0},
                   bool is_union = false);
 
+    // 'inherited' tells if the node is a base class subobject of its parent.
     static std::unique_ptr<Node> CreateNodeFromTypedata(
         absl::string_view name, absl::string_view type_name,
         int64_t offset_bits, int64_t multiplicity,
         const DwarfMetadataFetcher::TypeData* type_data,
-        const Node* parent_node) {
+        const Node* parent_node, bool inherited = false) {
       return std::make_unique<Node>(
           name, type_name, offset_bits, type_data->size * 8, multiplicity,
           DwarfTypeKindToObjectTypeKind(type_data->data_type),
           multiplicity > 1 ? ObjectLayout::Properties::ARRAY_ELEMENTS
+          : inherited      ? ObjectLayout::Properties::BASE
                            : ObjectLayout::Properties::FIELD,
           parent_node ? parent_node->GetGlobalOffsetBits() + offset_bits : 0,
           AccessCounters(),
@@ -156,16 +214,16 @@ class TypeTree {
     // Creates a copy of the values in the node without the children.
     static std::unique_ptr<Node> CopyNode(const Node& node) {
       return std::make_unique<Node>(
-          node.object_layout.properties().name(),
-          node.object_layout.properties().type_name(),
-          node.object_layout.properties().offset_bits(),
-          node.object_layout.properties().size_bits(),
-          node.object_layout.properties().multiplicity(),
-          node.object_layout.properties().type_kind(),
-          node.object_layout.properties().kind(), node.global_offset,
-          node.access_counters);
+          node.layout.name, node.layout.type_name, node.layout.offset_bits,
+          node.layout.size_bits, node.layout.multiplicity,
+          node.layout.type_kind, node.layout.object_kind, node.global_offset,
+          node.GetAccessCounters());
     }
 
+    // Creates a copy of the node and its whole subtree, with all access
+    // counters reset.
+    std::unique_ptr<Node> CloneWithoutCounts() const;
+
     void AddChild(std::unique_ptr<Node> node);
     void AddChildAndInsertPaddingIfNecessary(
         std::unique_ptr<Node> child, const TypeTree::Node* parent_node,
@@ -176,57 +234,49 @@ class TypeTree {
     size_t NumChildren() const { return children.size(); }
     int64_t GetGlobalOffsetBits() const { return global_offset; }
     int64_t GetGlobalOffsetBytes() const { return global_offset / 8; }
-    uint64_t GetTotalAccessCount() const { return access_counters.total; }
+    uint64_t GetTotalAccessCount() const { return GetAccessCounters().total; }
+    const AccessCounters& GetAccessCounters() const;
     void SetGlobalOffsetBits(int64_t offset) { global_offset = offset; }
 
-    int64_t GetOffsetBits() const {
-      return object_layout.properties().offset_bits();
-    }
-    int64_t GetOffsetBytes() const {
-      return object_layout.properties().offset_bits() / 8;
-    }
-    int64_t GetSizeBits() const {
-      return object_layout.properties().size_bits();
-    }
-    int64_t GetSizeBytes() const {
-      return object_layout.properties().size_bits() / 8;
-    }
+    int64_t GetOffsetBits() const { return layout.offset_bits; }
+    int64_t GetOffsetBytes() const { return layout.offset_bits / 8; }
+    int64_t GetSizeBits() const { return layout.size_bits; }
+    int64_t GetSizeBytes() const { return layout.size_bits / 8; }
     int64_t GetFullSizeBits() const {
-      return object_layout.properties().size_bits() *
-             object_layout.properties().multiplicity();
+      return layout.size_bits * layout.multiplicity;
     }
     int64_t GetFullSizeBytes() const {
-      return object_layout.properties().size_bits() *
-             object_layout.properties().multiplicity() / 8;
-    }
-    void SetSizeBits(int64_t size_bits) {
-      return object_layout.mutable_properties()->set_size_bits(size_bits);
-    }
-    int64_t GetMultiplicity() const {
-      return object_layout.properties().multiplicity();
-    }
-    absl::string_view GetName() const {
-      return object_layout.properties().name();
-    }
-    absl::string_view GetTypeName() const {
-      return object_layout.properties().type_name();
+      return layout.size_bits * layout.multiplicity / 8;
     }
+    void SetSizeBits(int64_t size_bits) { layout.size_bits = size_bits; }
+    int64_t GetMultiplicity() const { return layout.multiplicity; }
+    // Interned, so valid as long as the process, not only the node.
+    absl::string_view GetName() const { return layout.name; }
+    absl::string_view GetTypeName() const { return layout.type_name; }
     ObjectLayout::Properties::TypeKind GetTypeKind() const {
-      return object_layout.properties().type_kind();
+      return layout.type_kind;
     }
-    ObjectLayout GetObjectLayout() const { return object_layout; }
+    ObjectLayout::Properties::ObjectKind GetObjectKind() const {
+      return layout.object_kind;
+    }
+    // The ObjectLayout of the node, without subobjects.
+    ObjectLayout GetObjectLayout() const;
     bool IsPadding() const {
-      return object_layout.properties().type_kind() ==
-             ObjectLayout::Properties::PADDING_TYPE;
+      return layout.type_kind == ObjectLayout::Properties::PADDING_TYPE;
     }
     bool IsIndirectionType() const {
-      return object_layout.properties().type_kind() ==
-             ObjectLayout::Properties::INDIRECTION_TYPE;
+      return layout.type_kind == ObjectLayout::Properties::INDIRECTION_TYPE;
     }
     bool IsUnresolvedType() const {
       return GetTypeKind() == ObjectLayout::Properties::UNKNOWN_TYPE;
     }
 
+    // Whether the node is a base class subobject of its parent.
+    bool IsBase() const {
+      return layout.object_kind == ObjectLayout::Properties::BASE ||
+             layout.object_kind == ObjectLayout::Properties::VIRTUAL_BASE;
+    }
+
     bool IsUnion() const { return is_union; }
 
     bool IsArrayType() const {
@@ -240,8 +290,13 @@ class TypeTree {
 
     void Dump(std::ostream& out, int level,
               bool dump_full_unions = false) const;
-    void DumpFlameGraph(std::ostream& out, std::vector<std::string>& path,
-                        const std::string& root_name) const;
+    // Writes the stacks of the node and of its subtree. 'stack' holds the
+    // frames of the enclosing nodes, each followed by ';', and is restored
+    // before returning.
+    void DumpFlameGraph(FlameGraphWriter& writer, std::string& stack,
+                        FlameGraphValue value) const;
+    // The counter of the node shown by flamegraphs for 'value'.
+    uint64_t GetFlameGraphValue(FlameGraphValue value) const;
     void CreateChildFromSuboject(const ObjectLayout& object_layout);
     void CreateObjectLayoutFromChildren(ObjectLayout& object_layout) const;
     absl::string_view NameToString(absl::string_view name) const;
@@ -252,10 +307,20 @@ class TypeTree {
     template <uint32_t AccessGranularity, AccessCounters::AccessType AccessType>
     bool RecordAccess(int64_t offset_bytes, uint64_t count) {
       const std::vector<uint64_t> array_element_offsets = {0};
-      return RecordAccess<AccessGranularity, AccessType>(offset_bytes, count,
-                                                         array_element_offsets);
+      return ForEachAccessedNode<AccessGranularity>(
+          offset_bytes, array_element_offsets, [count](Node* node, int times) {
+            node->IncrementAccessCount<AccessType>(count * times);
+          });
     }
 
+    // Appends the nodes of this subtree to 'nodes' in pre-order.
+    void CollectNodes(std::vector<Node*>& nodes);
+
+    // Builds the AccessIndex of the tree rooted at this node, for
+    // 'bucket_count' buckets of AccessGranularity bytes.
+    template <uint32_t AccessGranularity>
+    AccessIndex BuildAccessIndex(size_t bucket_count);
+
     absl::StatusOr<const TypeTree::Node*> FindNodeWithTypeName(
         absl::string_view type_name) const;
     absl::Status MergeTreeIntoThis(const Node* other, int64_t starting_offset);
@@ -267,19 +332,57 @@ class TypeTree {
     friend std::ostream& operator<<(std::ostream& os, const Node& node);
 
    protected:
-    // Node is a wrapper for ObjectLayout. While ObjectLayout has repeated
-    // field subobjects, we use the Node.children to represent subobjects, so
-    // we can associate counters with each subobject.
-    ObjectLayout object_layout;
+    AccessCounters& MutableAccessCounters();
+
+    // The properties of the ObjectLayout of the node. While ObjectLayout has
+    // repeated field subobjects, we use the Node.children to represent
+    // subobjects, so we can associate counters with each subobject. The names
+    // are interned in StringInterner::Global(), so that the many trees of a
+    // type, e.g. one per allocation site, do not each hold a copy of them.
+    struct Layout {
+      absl::string_view name;
+      absl::string_view type_name;
+      int64_t offset_bits;
+      int64_t size_bits;
+      int64_t multiplicity;
+      ObjectLayout::Properties::TypeKind type_kind;
+      ObjectLayout::Properties::ObjectKind object_kind;
+    };
+    Layout layout;
     int64_t global_offset;
-    AccessCounters access_counters;
+    // The counters of a node that is part of a TypeTree live in the dense
+    // counter array of the tree, so that merging and recording counts does not
+    // touch the nodes. Other nodes keep their counters in detached_counters,
+    // allocated once they count anything. Null if the node counted nothing.
+    std::unique_ptr<AccessCounters> detached_counters;
+    AccessCounters* access_counters;
     std::vector<std::unique_ptr<Node>> children;
     bool is_union;
 
    private:
-    template <uint32_t AccessGranularity, AccessCounters::AccessType AccessType>
-    bool RecordAccess(int64_t offset_bytes, uint64_t count,
-                      const std::vector<uint64_t>& array_element_offsets);
+    friend class TypeTree;
+
+    // Calls 'visit(node, times)' for each node of this subtree that an access
+    // of AccessGranularity bytes at 'offset_bytes' touches, 'times' being the
+    // number of the node's instances it touches. Returns false if the access
+    // touches no leaf.
+    template <uint32_t AccessGranularity, typename Visitor>
+    bool ForEachAccessedNode(int64_t offset_bytes,
+                             const std::vector<uint64_t>& array_element_offsets,
+                             Visitor&& visit);
+  };
+
+  // Holds the AccessIndex of a tree for each access granularity it was
+  // recorded with. Trees cloned from the same skeleton share one.
+  class AccessIndexCache {
+   public:
+    template <uint32_t AccessGranularity>
+    std::shared_ptr<const AccessIndex> GetOrBuild(Node* root);
+
+   private:
+    absl::Mutex mu_;
+    absl::flat_hash_map<uint32_t, std::shared_ptr<const AccessIndex>> indexes_
+        ABSL_GUARDED_BY(mu_);
   };
 
   static ObjectLayout::Properties::TypeKind DwarfTypeKindToObjectTypeKind(
@@ -291,17 +394,34 @@ class TypeTree {
 
   static ObjectLayout CreateObjectLayoutFromTree(const TypeTree& type_tree);
 
+  // Creates a tree, along with its access counters, from 'proto'.
+  static absl::StatusOr<std::unique_ptr<TypeTree>> CreateTreeFromProto(
+      const TypeTreeProto& proto);
+
+  // Converts the tree, along with its access counters, to a TypeTreeProto.
+  TypeTreeProto ToProto() const;
+
   static absl::string_view TypeKindToString(
       ObjectLayout::Properties::TypeKind type_kind);
 
+  // A histogram collapsed by CollapseHistogram.
+  struct CollapsedHistogram {
+    std::vector<uint64_t> buckets;
+    // Number of trailing buckets of the histogram that only covered part of
+    // an element of the allocation, as the histogram size is not a multiple
+    // of the collapsed size. They are left out of the collapsed histogram,
+    // as they cannot be told apart from misaligned buckets.
+    uint32_t remainder_buckets = 0;
+  };
+
   //  TODO(b/352368491): This function collapses a histogram into a smaller
   //  histogram. The collapsed size should match the size of the targeted type
   //  tree. There may be misalignment between the histogram and the type tree if
   //  the histogram granularity does not match the alignment of the allocated
-  //  type.
+  //  type. 'histogram' is read in place, e.g. from the buffer of the profile.
   template <uint32_t AccessGranularity>
-  static std::vector<uint64_t> CollapseHistogram(
-      const std::vector<uint64_t>& histogram, int64_t collapsed_size);
+  static CollapsedHistogram CollapseHistogram(
+      absl::Span<const uint64_t> histogram, int64_t collapsed_size);
 
   explicit TypeTree(std::unique_ptr<Node> root,
                     absl::string_view root_type_name, bool from_container,
@@ -309,7 +429,9 @@ class TypeTree {
       : root_(std::move(root)),
         root_type_name_(root_type_name),
         from_container_(from_container),
-        container_name_(container_name) {}
+        container_name_(container_name) {
+    AttachCounters();
+  }
   ~TypeTree() = default;
   TypeTree(const TypeTree&) = delete;
   TypeTree& operator=(const TypeTree&) = delete;
@@ -318,7 +440,13 @@ class TypeTree {
   }
   void Dump(std::ostream& out, int level = 0,
             bool dump_full_unions = false) const;
-  void DumpFlameGraph(std::ostream& out, uint64_t id = 0) const;
+  void DumpFlameGraph(std::ostream& out, uint64_t id = 0,
+                      FlameGraphValue value = FlameGraphValue::kTotal) const;
+  // Same as above, through 'writer'. The root of the flamegraph is numbered
+  // with 'id', if not zero, except in the collapsed format, so that the trees
+  // of the same type are summed.
+  void DumpFlameGraph(FlameGraphWriter& writer, uint64_t id = 0,
+                      FlameGraphValue value = FlameGraphValue::kTotal) const;
   // This function is used to verify the tree structure. It will return true
   // if the tree is valid. If verify_verbose is true, it will print out the
   // error message and the node which has a mistake. The main properties that
@@ -351,15 +479,47 @@ class TypeTree {
   }
   template <uint32_t AccessGranularity = kDefaultAccessGranularity,
             AccessCounters::AccessType AccessType = kDefaultAccessType>
-  absl::Status RecordAccessHistogram(std::vector<uint64_t>& histogram);
+  absl::Status RecordAccessHistogram(std::vector<uint64_t>& histogram) {
+    const CounterHistogram counter_histogram = {.type = AccessType,
+                                                .histogram = histogram};
+    return RecordAccessHistograms<AccessGranularity>(
+        absl::MakeConstSpan(&counter_histogram, 1));
+  }
+
+  // Same as RecordAccessHistogram, for several histograms of the same
+  // allocation, e.g. of accesses and of LLC misses, which must all have the
+  // same size. The tree is walked once for all of them. If not null,
+  // 'remainder_buckets' is set to the remainder buckets of the collapsed
+  // histograms, see CollapsedHistogram.
+  template <uint32_t AccessGranularity = kDefaultAccessGranularity>
+  absl::Status RecordAccessHistograms(
+      absl::Span<const CounterHistogram> histograms,
+      uint32_t* remainder_buckets = nullptr);
+  // Same as above, for an access granularity only known at runtime, e.g. from
+  // the profile. Dispatches to the instantiation for 'access_granularity'.
+  absl::Status RecordAccessHistograms(
+      uint32_t access_granularity,
+      absl::Span<const CounterHistogram> histograms,
+      uint32_t* remainder_buckets = nullptr);
+  // Returns true if histograms of 'access_granularity' bytes can be recorded.
+  static constexpr bool IsSupportedAccessGranularity(
+      uint32_t access_granularity) {
+    return access_granularity != 0 &&
+           access_granularity <= kMaxAccessGranularity &&
+           (access_granularity & (access_granularity - 1)) == 0;
+  }
   absl::Status MergeTreeIntoThis(const TypeTree* other);
   absl::StatusOr<const TypeTree::Node*> FindNodeWithTypeName(
       absl::string_view type_name) const;
   void InferOffsetsFromSizes() {
+    ResetAccessIndex();
     root_->SetGlobalOffsetBits(0);
     root_->InferOffsetsFromSizes();
   }
-  void BuildSizesBottomUp() { root_->BuildSizesBottomUp(); }
+  void BuildSizesBottomUp() {
+    ResetAccessIndex();
+    root_->BuildSizesBottomUp();
+  }
   bool Empty() const { return root_ == nullptr; }
   bool IsRecordType() const { return root_->IsRecordType(); }
   bool FromContainer() const { return from_container_; }
@@ -367,8 +527,32 @@ class TypeTree {
   absl::string_view Name() const { return root_type_name_; }
   absl::string_view ContainerName() const { return container_name_; }
   const Node* Root() const { return root_.get(); }
+  // Number of nodes of the tree.
+  size_t NodeCount() const { return counters_.size(); }
+
+  // Shares 'cache' with this tree, which must have the same shape as all other
+  // trees sharing it.
+  void ShareAccessIndexCache(std::shared_ptr<AccessIndexCache> cache) {
+    access_index_cache_ = std::move(cache);
+  }
+
+  // Whether the skeleton this tree was cloned from passed Verify, see
+  // DwarfTypeResolver. Unset if the tree was not cloned from a skeleton, or
+  // no longer has its shape.
+  std::optional<bool> SkeletonVerified() const { return skeleton_verified_; }
+  void SetSkeletonVerified(bool verified) { skeleton_verified_ = verified; }
 
  private:
+  // Must be called whenever the offsets or sizes of the nodes change.
+  void ResetAccessIndex() {
+    access_index_cache_ = nullptr;
+    skeleton_verified_.reset();
+  }
+
+  // Moves the counters of all nodes into counters_. Must be called whenever
+  // nodes are added to the tree.
+  void AttachCounters();
+
   std::unique_ptr<Node> root_;
   const std::string root_type_name_;
   // Whether the type tree is from an allocation made within a container.
@@ -376,6 +560,11 @@ class TypeTree {
   // Name of the container that the type tree is from. Should selected from the
   // supported containers list. Empty if the type tree is not from a container.
   std::string container_name_;
+  // Access indexes of the tree, created on first use if not shared.
+  std::shared_ptr<AccessIndexCache> access_index_cache_;
+  std::optional<bool> skeleton_verified_;
+  // Counters of the nodes of the tree, in pre-order.
+  std::vector<AccessCounters> counters_;
 };
 
 // This class is used to store the histogram of field accesses. This is a flat
@@ -412,11 +601,10 @@ inline bool Overlap(int64_t a1, int64_t a2, int64_t b1, int64_t b2) {
   return std::max(a2, b2) - std::min(a1, b1) < (a2 - a1) + (b2 - b1);
 }
 
-template <uint32_t AccessGranularity,
-          TypeTree::AccessCounters::AccessType AccessType>
-bool TypeTree::Node::RecordAccess(
-    int64_t offset_bytes, uint64_t count,
-    const std::vector<uint64_t>& array_element_offsets) {
+template <uint32_t AccessGranularity, typename Visitor>
+bool TypeTree::Node::ForEachAccessedNode(
+    int64_t offset_bytes, const std::vector<uint64_t>& array_element_offsets,
+    Visitor&& visit) {
   // First check if there is any overlap possibility in the largest range of the
   // current node. We don't need to add counts or, most importantly, continue
   // recursively if there is no overlap.
@@ -427,7 +615,7 @@ bool TypeTree::Node::RecordAccess(
   //           << GetGlobalOffsetBytes() + array_element_offsets.back() +
   //                  GetFullSizeBytes()
   //           << " "
-  //           << " node: " << this->object_layout.properties().name() << "| ";
+  //           << " node: " << this->layout.name << "| ";
   if (!Overlap(offset_bytes, offset_bytes + AccessGranularity,
                GetGlobalOffsetBytes(),
                GetGlobalOffsetBytes() + array_element_offsets.back() +
@@ -438,15 +626,19 @@ bool TypeTree::Node::RecordAccess(
   // std::cout << "overlap" << std::endl;
 
   // For each array element offset (explained below), check if there is any
-  // overlap with the current node. If there is, add the count to the access
-  // count of the node.
+  // overlap with the current node. If there is, the access counts for the
+  // node.
+  int times = 0;
   for (uint64_t array_element_offset : array_element_offsets) {
     uint64_t base = GetGlobalOffsetBytes() + array_element_offset;
     if (Overlap(offset_bytes, offset_bytes + AccessGranularity, base,
                 base + GetFullSizeBytes())) {
-      IncrementAccessCount<AccessType>(count);
+      times++;
     }
   }
+  if (times > 0) {
+    visit(this, times);
+  }
 
   // The following approach is similar to a backtracking recursive algorithm.
   // Here we do the work required for the next descendants.
@@ -484,8 +676,8 @@ bool TypeTree::Node::RecordAccess(
 
   bool overlap_in_children = false | children.empty();
   for (auto& child : children) {
-    overlap_in_children |= child->RecordAccess<AccessGranularity, AccessType>(
-        offset_bytes, count, new_array_element_offsets);
+    overlap_in_children |= child->ForEachAccessedNode<AccessGranularity>(
+        offset_bytes, new_array_element_offsets, visit);
   }
   if (!overlap_in_children) {
     return false;
@@ -505,71 +697,181 @@ bool TypeTree::RecordAccess(int64_t offset_bytes, uint64_t count) {
                                                             count);
 }
 template <uint32_t AccessGranularity>
-std::vector<uint64_t> TypeTree::CollapseHistogram(
-    const std::vector<uint64_t>& histogram, int64_t collapsed_size) {
-  uint32_t histogram_size = histogram.size();
-  uint32_t new_histogram_size = 1 + (collapsed_size - 1) / AccessGranularity;
-  uint32_t collapse_num = histogram_size / new_histogram_size;
-  std::vector<uint64_t> collapsed_histogram(new_histogram_size, 0);
-  for (uint32_t i = 0; i < collapse_num; i++) {
-    for (uint32_t j = 0; j < new_histogram_size; j++) {
-      collapsed_histogram[j] += histogram[i * new_histogram_size + j];
+TypeTree::CollapsedHistogram TypeTree::CollapseHistogram(
+    absl::Span<const uint64_t> histogram, int64_t collapsed_size) {
+  const size_t histogram_size = histogram.size();
+  const size_t new_histogram_size =
+      1 + (collapsed_size - 1) / AccessGranularity;
+  CollapsedHistogram collapsed;
+  collapsed.buckets.assign(new_histogram_size, 0);
+  collapsed.remainder_buckets = histogram_size % new_histogram_size;
+  uint64_t* buckets = collapsed.buckets.data();
+  if (new_histogram_size == 1) {
+    buckets[0] =
+        std::accumulate(histogram.begin(), histogram.end(), uint64_t{0});
+    return collapsed;
+  }
+  // Adds the histogram row by row, a row covering one element of the
+  // allocation. The rows are contiguous and do not alias the buckets, so the
+  // inner loop is vectorized. The trailing partial row is dropped.
+  const size_t full_rows_size = histogram_size - collapsed.remainder_buckets;
+  for (size_t begin = 0; begin < full_rows_size; begin += new_histogram_size) {
+    const uint64_t* row = histogram.data() + begin;
+    for (size_t j = 0; j < new_histogram_size; ++j) {
+      buckets[j] += row[j];
     }
   }
-  return collapsed_histogram;
+  return collapsed;
 }
 
-template <uint32_t AccessGranularity,
-          TypeTree::AccessCounters::AccessType AccessType>
-absl::Status TypeTree::RecordAccessHistogram(std::vector<uint64_t>& histogram) {
-  uint32_t old_histogram_size = histogram.size();
-  uint64_t histogram_size_in_bytes = histogram.size() * AccessGranularity;
+template <uint32_t AccessGranularity>
+absl::Status TypeTree::RecordAccessHistograms(
+    absl::Span<const CounterHistogram> histograms,
+    uint32_t* remainder_buckets) {
+  if (histograms.empty()) {
+    return absl::InvalidArgumentError("No histogram");
+  }
+  const uint32_t old_histogram_size = histograms[0].histogram.size();
+  for (const CounterHistogram& counter_histogram : histograms) {
+    if (counter_histogram.histogram.size() != old_histogram_size) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Histograms of different sizes: ", old_histogram_size, " vs ",
+          counter_histogram.histogram.size()));
+    }
+  }
+  static_assert(IsSupportedAccessGranularity(AccessGranularity),
+                "Access granularity must be a power of two of at most "
+                "kMaxAccessGranularity bytes");
+  uint64_t histogram_size_in_bytes = old_histogram_size * AccessGranularity;
   if (histogram_size_in_bytes == 0) {
     return absl::InvalidArgumentError("Histogram size is 0");
   }
 
-  if (AccessGranularity != 8U) {
-    return absl::UnimplementedError(
-        "Access granularity must be 8 bytes for now");
+  // The histograms are collapsed, or not, all in the same way.
+  std::vector<CollapsedHistogram> collapsed_histograms;
+  std::vector<absl::Span<const uint64_t>> bucket_counts;
+  bucket_counts.reserve(histograms.size());
+  if (remainder_buckets != nullptr) {
+    *remainder_buckets = 0;
   }
-
   if (histogram_size_in_bytes > root_->GetFullSizeBytes() &&
       histogram_size_in_bytes < 2 * root_->GetFullSizeBytes()) {
     // This means the histogram is larger than the type, but we do not have a
     // bulk allocation. We may continue without collapsing.
   } else if (histogram_size_in_bytes > this->Root()->GetFullSizeBytes()) {
-    histogram = CollapseHistogram<AccessGranularity>(
-        histogram, this->Root()->GetFullSizeBytes());
+    collapsed_histograms.reserve(histograms.size());
+    for (const CounterHistogram& counter_histogram : histograms) {
+      collapsed_histograms.push_back(CollapseHistogram<AccessGranularity>(
+          counter_histogram.histogram, this->Root()->GetFullSizeBytes()));
+      bucket_counts.push_back(collapsed_histograms.back().buckets);
+    }
+    if (remainder_buckets != nullptr) {
+      *remainder_buckets = collapsed_histograms[0].remainder_buckets;
+    }
   }
-
-  for (uint32_t i = 0; i < histogram.size(); ++i) {
-    root_->RecordAccess<AccessGranularity, AccessType>(i * AccessGranularity,
-                                                       histogram[i]);
+  if (bucket_counts.empty()) {
+    for (const CounterHistogram& counter_histogram : histograms) {
+      bucket_counts.push_back(counter_histogram.histogram);
+    }
   }
+  const size_t histogram_size = bucket_counts[0].size();
 
-  // TODO(b/352368491): Investigate some scenarios where the histogram size is
-  // not a multiple of the type size.
-  if (old_histogram_size % histogram.size() != 0) {
-    return absl::FailedPreconditionError(absl::StrCat(
-        "condition failed: histogram_size % new_histogram_size != 0 ",
-        old_histogram_size, " % ", histogram.size(),
-        " == ", old_histogram_size % histogram.size()));
+  if (access_index_cache_ == nullptr) {
+    access_index_cache_ = std::make_shared<AccessIndexCache>();
+  }
+  std::shared_ptr<const AccessIndex> access_index =
+      access_index_cache_->GetOrBuild<AccessGranularity>(root_.get());
+  // Buckets past the end of the type do not touch any node.
+  const size_t bucket_count =
+      std::min<size_t>(histogram_size, access_index->BucketCount());
+  for (size_t i = 0; i < bucket_count; ++i) {
+    for (size_t h = 0; h < histograms.size(); ++h) {
+      const uint64_t count = bucket_counts[h][i];
+      if (count == 0) {
+        continue;
+      }
+      for (uint32_t e = access_index->bucket_begin[i];
+           e < access_index->bucket_begin[i + 1]; ++e) {
+        const AccessIndex::Entry& entry = access_index->entries[e];
+        counters_[entry.node_index].Increment(histograms[h].type,
+                                              count * entry.times);
+      }
+    }
   }
   return absl::OkStatus();
 }
 
-template <TypeTree::AccessCounters::AccessType AccessType>
-void TypeTree::Node::IncrementAccessCount(uint64_t count) {
-  access_counters.total += count;
-  if constexpr (AccessType == AccessCounters::kAccess) {
-    access_counters.access += count;
-  } else if constexpr (AccessType == AccessCounters::kLlcMiss) {
-    access_counters.llc_miss += count;
+template <uint32_t AccessGranularity>
+TypeTree::AccessIndex TypeTree::Node::BuildAccessIndex(size_t bucket_count) {
+  std::vector<Node*> nodes;
+  CollectNodes(nodes);
+  absl::flat_hash_map<const Node*, uint32_t> node_indices;
+  node_indices.reserve(nodes.size());
+  for (uint32_t i = 0; i < nodes.size(); ++i) {
+    node_indices[nodes[i]] = i;
+  }
+
+  AccessIndex access_index;
+  access_index.bucket_begin.reserve(bucket_count + 1);
+  const std::vector<uint64_t> array_element_offsets = {0};
+  for (size_t i = 0; i < bucket_count; ++i) {
+    access_index.bucket_begin.push_back(access_index.entries.size());
+    ForEachAccessedNode<AccessGranularity>(
+        i * AccessGranularity, array_element_offsets,
+        [&](Node* node, int times) {
+          access_index.entries.push_back(
+              {.node_index = node_indices.at(node),
+               .times = static_cast<uint32_t>(times)});
+        });
+  }
+  access_index.bucket_begin.push_back(access_index.entries.size());
+  return access_index;
+}
+
+template <uint32_t AccessGranularity>
+std::shared_ptr<const TypeTree::AccessIndex>
+TypeTree::AccessIndexCache::GetOrBuild(Node* root) {
+  absl::MutexLock lock(&mu_);
+  std::shared_ptr<const AccessIndex>& access_index =
+      indexes_[AccessGranularity];
+  if (access_index == nullptr) {
+    const int64_t size_bytes = std::max<int64_t>(root->GetFullSizeBytes(), 0);
+    access_index = std::make_shared<const AccessIndex>(
+        root->BuildAccessIndex<AccessGranularity>(
+            (size_bytes + AccessGranularity - 1) / AccessGranularity));
+  }
+  return access_index;
+}
+
+template <TypeTree::AccessCounters::AccessType Type>
+void TypeTree::AccessCounters::Increment(uint64_t count) {
+  if constexpr (Type == kAccess) {
+    total += count;
+    access += count;
+  } else if constexpr (Type == kLlcMiss) {
+    llc_miss += count;
   } else {
     static_assert(false && "Unknown access type");
   }
 }
 
+inline void TypeTree::AccessCounters::Increment(AccessType type,
+                                               uint64_t count) {
+  switch (type) {
+    case kAccess:
+      Increment<kAccess>(count);
+      break;
+    case kLlcMiss:
+      Increment<kLlcMiss>(count);
+      break;
+  }
+}
+
+template <TypeTree::AccessCounters::AccessType AccessType>
+void TypeTree::Node::IncrementAccessCount(uint64_t count) {
+  MutableAccessCounters().Increment<AccessType>(count);
+}
+
 }  // namespace devtools_crosstool_fdo_field_access
 
 #endif  // TYPE_TREE_H_
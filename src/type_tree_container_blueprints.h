@@ -19,19 +19,18 @@
 
 // This header file holds builds template type trees for containers that have
 // special allocations and metadata associated with each allocation. This
-// includes all absl::btree and all absl::raw_hash_set containers.
-
-#include <google/protobuf/text_format.h>
+// includes all absl::btree and all absl::raw_hash_set containers. The layouts
+// are built in code, as they are needed for every allocation of these
+// containers.
 
 #include <cstdint>
 #include <string>
 
-#include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
-#include "absl/strings/substitute.h"
+#include "object_layout_builder.h"
 #include "src/object_layout.pb.h"
 
 namespace devtools_crosstool_fdo_field_access {
@@ -40,261 +39,6 @@ static int64_t RoundUpTo(int64_t number, int64_t multiple) {
   return (number + multiple - 1) / multiple * multiple;
 }
 
-constexpr absl::string_view kAbslTemplatePadding = R"pb(
-  subobjects: {
-    properties: {
-      name: "",
-      type_name: "",
-      kind: PADDING,
-      type_kind: PADDING_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-)pb";
-
-constexpr absl::string_view kAbslBtreeNodeStart = R"pb(
-  properties: {
-    name: "absl::container_internal::btree_node<$1>",
-    type_name: "absl::container_internal::btree_node<$1>",
-    kind: BASE,
-    type_kind: RECORD_TYPE,
-    size_bits: 0,
-    multiplicity: 1,
-  },
-  subobjects: {
-    properties: {
-      name: "parent",
-      type_name: "btree_node *",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-)pb";
-
-constexpr absl::string_view kAbslBtreeNodeGenerationField = R"pb(
-  subobjects {
-    properties: {
-      name: "generation",
-      type_name: "uint32_t",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: 32,
-      multiplicity: 1,
-    },
-  },
-)pb";
-
-constexpr absl::string_view kAbslBtreeNodeMetadataFields = R"pb(
-  subobjects {
-    properties: {
-      name: "position",
-      type_name: "node_count_type",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-  subobjects {
-    properties: {
-      name: "start",
-      type_name: "node_count_type",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-  subobjects {
-    properties: {
-      name: "finish",
-      type_name: "node_count_type",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-  subobjects {
-    properties: {
-      name: "max_count",
-      type_name: "node_count_type",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-)pb";
-
-constexpr absl::string_view kAbslBtreeNodeSlots = R"pb(
-  subobjects {
-    properties: {
-      name: "values",
-      type_name: "$0[$1]",
-      kind: FIELD,
-      type_kind: ARRAY_TYPE,
-      size_bits: 0,
-      multiplicity: 1,
-    },
-
-    subobjects:
-    [ {
-      properties: {
-        name: "[_]",
-        type_name: "$0",
-        kind: ARRAY_ELEMENTS,
-        type_kind: RECORD_TYPE,
-        size_bits: $2,
-        multiplicity: $1,
-      },
-    }],
-  },
-)pb";
-
-constexpr absl::string_view kAbslBtreeNodeChildren = R"pb(
-  subobjects {
-    properties: {
-      name: "children",
-      type_name: "btree_node *[$1]",
-      kind: FIELD,
-      type_kind: ARRAY_TYPE,
-      size_bits: 0,
-      multiplicity: 1,
-    },
-    subobjects:
-    [ {
-      properties: {
-        name: "[_]",
-        type_name: "btree_node *",
-        kind: ARRAY_ELEMENTS,
-        type_kind: BUILTIN_TYPE,
-        size_bits: $0,
-        multiplicity: $1,
-      },
-    }],
-  },
-)pb";
-
-constexpr absl::string_view kAbslSwissMapTemplateStart = R"pb(
-  properties: {
-    name: "absl::container_internal::raw_hash_set::BackingArray<$0>",
-    type_name: "absl::container_internal::raw_hash_set::BackingArray<$0>",
-    kind: BASE,
-    type_kind: RECORD_TYPE,
-    size_bits: 0,
-    multiplicity: 1,
-  },
-)pb";
-
-constexpr absl::string_view kAbslSwissMapTemplateHashTableZ = R"pb(
-  subobjects: {
-    properties: {
-      name: "infoz_",
-      type_name: "HashtablezInfoHandle",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-)pb";
-constexpr absl::string_view kAbslSwissMapTemplateGrowthLeft = R"pb(
-  subobjects: {
-    properties: {
-      name: "growth_left",
-      type_name: "size_t",
-      kind: FIELD,
-      type_kind: BUILTIN_TYPE,
-      size_bits: $0,
-      multiplicity: 1,
-    },
-  },
-)pb";
-
-constexpr absl::string_view kAbslSwissMapTemplateFields = R"pb(
-  subobjects: {
-    properties: {
-      name: "ctrl",
-      type_name: "ctrl_t[$0]",
-      kind: FIELD,
-      type_kind: ARRAY_TYPE,
-      size_bits: 0,
-      multiplicity: 1,
-    },
-    subobjects:
-    [ {
-      properties: {
-        name: "[_]",
-        type_name: "ctrl_t",
-        kind: ARRAY_ELEMENTS,
-        type_kind: BUILTIN_TYPE,
-        size_bits: 8,
-        multiplicity: $0,
-      },
-    }],
-  },
-  subobjects: {
-    properties: {
-      name: "sentinel",
-      type_name: "ctrl_t",
-      kind: FIELD,
-      type_kind: ARRAY_TYPE,
-      size_bits: 8,
-      multiplicity: 1,
-    },
-  },
-  subobjects: {
-    properties: {
-      name: "clones",
-      type_name: "ctrl_t[$1]",
-      kind: FIELD,
-      type_kind: ARRAY_TYPE,
-      size_bits: 0,
-      multiplicity: 1,
-    },
-    subobjects:
-    [ {
-      properties: {
-        name: "[_]",
-        type_name: "ctrl_t",
-        kind: ARRAY_ELEMENTS,
-        type_kind: BUILTIN_TYPE,
-        size_bits: 8,
-        multiplicity: $1,
-      },
-    }],
-  },
-)pb";
-
-constexpr absl::string_view kAbslSwissMapTemplateSlots = R"pb(
-  subobjects {
-    properties: {
-      name: "slots",
-      type_name: "$1[$0]",
-      kind: FIELD,
-      type_kind: ARRAY_TYPE,
-      size_bits: 0,
-      multiplicity: 1,
-    },
-
-    subobjects:
-    [ {
-      properties: {
-        name: "[_]",
-        type_name: "$1",
-        kind: ARRAY_ELEMENTS,
-        type_kind: RECORD_TYPE,
-        size_bits: $2,
-        multiplicity: $0,
-      },
-    }],
-  },
-)pb";
-
 class TypeTreeContainerBlueprints {
  public:
   static absl::StatusOr<ObjectLayout> GetBtreeNodeTypeTemplate(
@@ -329,26 +73,35 @@ class TypeTreeContainerBlueprints {
           "type.");
     }
 
-    // We use absl::Substitute instead of proto fixture (go/proto-fixtures),
-    // because fixtures do not support repeated fields.
-    std::string resolved_template_string = absl::StrCat(
-        absl::Substitute(kAbslBtreeNodeStart, pointer_size, slot_type_name),
-        absl_btree_enable_generations ? kAbslBtreeNodeGenerationField : "",
-        absl::Substitute(kAbslBtreeNodeMetadataFields, field_type_size),
-        padding_size > 0 ? absl::Substitute(kAbslTemplatePadding, padding_size)
-                         : "",
-        absl::Substitute(kAbslBtreeNodeSlots, slot_type_name, number_of_slots,
-                         slot_type_size),
-        !is_leaf ? absl::Substitute(kAbslBtreeNodeChildren, pointer_size,
-                                    kNodeSlots + 1)
-                 : "");
-
-    ObjectLayout template_object_layout;
-    if (!google::protobuf::TextFormat::ParseFromString(
-            resolved_template_string, &template_object_layout)) {
-      return absl::InternalError("Failed to parse resolved template string.");
+    ObjectLayout layout;
+    const std::string node_name = absl::StrCat(
+        "absl::container_internal::btree_node<", slot_type_name, ">");
+    SetLayoutProperties(layout, node_name, node_name,
+                        ObjectLayout::Properties::BASE,
+                        ObjectLayout::Properties::RECORD_TYPE, 0);
+    AddFieldLayout(layout, "parent", "btree_node *",
+                   ObjectLayout::Properties::BUILTIN_TYPE, pointer_size);
+    if (absl_btree_enable_generations) {
+      AddFieldLayout(layout, "generation", "uint32_t",
+                     ObjectLayout::Properties::BUILTIN_TYPE, 32);
+    }
+    for (absl::string_view field_name :
+         {"position", "start", "finish", "max_count"}) {
+      AddFieldLayout(layout, field_name, "node_count_type",
+                     ObjectLayout::Properties::BUILTIN_TYPE, field_type_size);
     }
-    return template_object_layout;
+    if (padding_size > 0) {
+      AddPaddingLayout(layout, padding_size);
+    }
+    AddArrayLayout(layout, "values", slot_type_name,
+                   ObjectLayout::Properties::RECORD_TYPE, slot_type_size,
+                   number_of_slots);
+    if (!is_leaf) {
+      AddArrayLayout(layout, "children", "btree_node *",
+                     ObjectLayout::Properties::BUILTIN_TYPE, pointer_size,
+                     kNodeSlots + 1);
+    }
+    return layout;
   }
 
   static absl::StatusOr<ObjectLayout> GetSwissMapTemplate(
@@ -365,24 +118,33 @@ class TypeTreeContainerBlueprints {
     int64_t metadata_plus_padding = RoundUpTo(metadata_size, Alignment * 8);
     int64_t padding_size = metadata_plus_padding - metadata_size;
 
-    std::string resolved_template_string = absl::StrCat(
-        absl::Substitute(kAbslSwissMapTemplateStart, slot_type_name),
-        has_hash_table_z ? absl::Substitute(kAbslSwissMapTemplateHashTableZ,
-                                            hashtablez_handle_size)
-                         : "",
-        absl::Substitute(kAbslSwissMapTemplateGrowthLeft, size_t_size),
-        absl::Substitute(kAbslSwissMapTemplateFields, capacity, kWidth - 1),
-        padding_size > 0 ? absl::Substitute(kAbslTemplatePadding, padding_size)
-                         : "",
-        absl::Substitute(kAbslSwissMapTemplateSlots, capacity, slot_type_name,
-                         slot_type_size));
-
-    ObjectLayout template_object_layout;
-    if (!google::protobuf::TextFormat::ParseFromString(
-            resolved_template_string, &template_object_layout)) {
-      return absl::InternalError("Failed to parse resolved template string.");
+    ObjectLayout layout;
+    const std::string backing_array_name =
+        absl::StrCat("absl::container_internal::raw_hash_set::BackingArray<",
+                     slot_type_name, ">");
+    SetLayoutProperties(layout, backing_array_name, backing_array_name,
+                        ObjectLayout::Properties::BASE,
+                        ObjectLayout::Properties::RECORD_TYPE, 0);
+    if (has_hash_table_z) {
+      AddFieldLayout(layout, "infoz_", "HashtablezInfoHandle",
+                     ObjectLayout::Properties::BUILTIN_TYPE,
+                     hashtablez_handle_size);
+    }
+    AddFieldLayout(layout, "growth_left", "size_t",
+                   ObjectLayout::Properties::BUILTIN_TYPE, size_t_size);
+    AddArrayLayout(layout, "ctrl", "ctrl_t",
+                   ObjectLayout::Properties::BUILTIN_TYPE, 8, capacity);
+    AddFieldLayout(layout, "sentinel", "ctrl_t",
+                   ObjectLayout::Properties::ARRAY_TYPE, 8);
+    AddArrayLayout(layout, "clones", "ctrl_t",
+                   ObjectLayout::Properties::BUILTIN_TYPE, 8, kWidth - 1);
+    if (padding_size > 0) {
+      AddPaddingLayout(layout, padding_size);
     }
-    return template_object_layout;
+    AddArrayLayout(layout, "slots", slot_type_name,
+                   ObjectLayout::Properties::RECORD_TYPE, slot_type_size,
+                   capacity);
+    return layout;
   }
 };
 
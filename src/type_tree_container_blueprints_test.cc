@@ -0,0 +1,267 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "type_tree_container_blueprints.h"
+
+#include <google/protobuf/text_format.h>
+#include <google/protobuf/util/message_differencer.h>
+
+#include "gtest/gtest.h"
+#include "src/object_layout.pb.h"
+#include "test_status_macros.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+void ExpectLayoutEquals(const ObjectLayout& layout, const char* expected_text) {
+  ObjectLayout expected;
+  ASSERT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(expected_text, &expected));
+  EXPECT_TRUE(
+      google::protobuf::util::MessageDifferencer::Equals(layout, expected))
+      << layout.DebugString();
+}
+
+TEST(TypeTreeContainerBlueprintsTest, BtreeInternalNode) {
+  // parent and 4 node_count_type fields take 96 bits, padded to 128, followed
+  // by 3 slots of 32 bits and 4 children.
+  ASSERT_OK_AND_ASSIGN(
+      ObjectLayout layout,
+      TypeTreeContainerBlueprints::GetBtreeNodeTypeTemplate(
+          "int", /*slot_type_size=*/32, /*Alignment=*/64,
+          /*field_type_size=*/8, /*kNodeSlots=*/3, /*pointer_size=*/64,
+          /*request_size=*/480, /*absl_btree_enable_generations=*/false));
+  ExpectLayoutEquals(layout, R"pb(
+    properties {
+      name: "absl::container_internal::btree_node<int>"
+      type_name: "absl::container_internal::btree_node<int>"
+      kind: BASE
+      type_kind: RECORD_TYPE
+      multiplicity: 1
+    }
+    subobjects {
+      properties {
+        name: "parent"
+        type_name: "btree_node *"
+        kind: FIELD
+        type_kind: BUILTIN_TYPE
+        size_bits: 64
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "position"
+        type_name: "node_count_type"
+        kind: FIELD
+        type_kind: BUILTIN_TYPE
+        size_bits: 8
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "start"
+        type_name: "node_count_type"
+        kind: FIELD
+        type_kind: BUILTIN_TYPE
+        size_bits: 8
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "finish"
+        type_name: "node_count_type"
+        kind: FIELD
+        type_kind: BUILTIN_TYPE
+        size_bits: 8
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "max_count"
+        type_name: "node_count_type"
+        kind: FIELD
+        type_kind: BUILTIN_TYPE
+        size_bits: 8
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        kind: PADDING
+        type_kind: PADDING_TYPE
+        size_bits: 32
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "values"
+        type_name: "int[3]"
+        kind: FIELD
+        type_kind: ARRAY_TYPE
+        multiplicity: 1
+      }
+      subobjects {
+        properties {
+          name: "[_]"
+          type_name: "int"
+          kind: ARRAY_ELEMENTS
+          type_kind: RECORD_TYPE
+          size_bits: 32
+          multiplicity: 3
+        }
+      }
+    }
+    subobjects {
+      properties {
+        name: "children"
+        type_name: "btree_node *[4]"
+        kind: FIELD
+        type_kind: ARRAY_TYPE
+        multiplicity: 1
+      }
+      subobjects {
+        properties {
+          name: "[_]"
+          type_name: "btree_node *"
+          kind: ARRAY_ELEMENTS
+          type_kind: BUILTIN_TYPE
+          size_bits: 64
+          multiplicity: 4
+        }
+      }
+    }
+  )pb");
+}
+
+TEST(TypeTreeContainerBlueprintsTest, BtreeSlotsMustFit) {
+  EXPECT_FALSE(TypeTreeContainerBlueprints::GetBtreeNodeTypeTemplate(
+                   "int", /*slot_type_size=*/32, /*Alignment=*/64,
+                   /*field_type_size=*/8, /*kNodeSlots=*/3,
+                   /*pointer_size=*/64, /*request_size=*/490,
+                   /*absl_btree_enable_generations=*/true)
+                   .ok());
+}
+
+TEST(TypeTreeContainerBlueprintsTest, SwissMapBackingArray) {
+  // growth_left and 7 + 16 control bytes take 248 bits, padded to 256,
+  // followed by 7 slots of 32 bits.
+  ASSERT_OK_AND_ASSIGN(
+      ObjectLayout layout,
+      TypeTreeContainerBlueprints::GetSwissMapTemplate(
+          "int", /*slot_type_size=*/32, /*Alignment=*/4, /*size_t_size=*/64,
+          /*kWidth=*/16, /*request_size=*/464, /*has_hash_table_z=*/false,
+          /*hashtablez_handle_size=*/0));
+  ExpectLayoutEquals(layout, R"pb(
+    properties {
+      name: "absl::container_internal::raw_hash_set::BackingArray<int>"
+      type_name: "absl::container_internal::raw_hash_set::BackingArray<int>"
+      kind: BASE
+      type_kind: RECORD_TYPE
+      multiplicity: 1
+    }
+    subobjects {
+      properties {
+        name: "growth_left"
+        type_name: "size_t"
+        kind: FIELD
+        type_kind: BUILTIN_TYPE
+        size_bits: 64
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "ctrl"
+        type_name: "ctrl_t[7]"
+        kind: FIELD
+        type_kind: ARRAY_TYPE
+        multiplicity: 1
+      }
+      subobjects {
+        properties {
+          name: "[_]"
+          type_name: "ctrl_t"
+          kind: ARRAY_ELEMENTS
+          type_kind: BUILTIN_TYPE
+          size_bits: 8
+          multiplicity: 7
+        }
+      }
+    }
+    subobjects {
+      properties {
+        name: "sentinel"
+        type_name: "ctrl_t"
+        kind: FIELD
+        type_kind: ARRAY_TYPE
+        size_bits: 8
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "clones"
+        type_name: "ctrl_t[15]"
+        kind: FIELD
+        type_kind: ARRAY_TYPE
+        multiplicity: 1
+      }
+      subobjects {
+        properties {
+          name: "[_]"
+          type_name: "ctrl_t"
+          kind: ARRAY_ELEMENTS
+          type_kind: BUILTIN_TYPE
+          size_bits: 8
+          multiplicity: 15
+        }
+      }
+    }
+    subobjects {
+      properties {
+        kind: PADDING
+        type_kind: PADDING_TYPE
+        size_bits: 8
+        multiplicity: 1
+      }
+    }
+    subobjects {
+      properties {
+        name: "slots"
+        type_name: "int[7]"
+        kind: FIELD
+        type_kind: ARRAY_TYPE
+        multiplicity: 1
+      }
+      subobjects {
+        properties {
+          name: "[_]"
+          type_name: "int"
+          kind: ARRAY_ELEMENTS
+          type_kind: RECORD_TYPE
+          size_bits: 32
+          multiplicity: 7
+        }
+      }
+    }
+  )pb");
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access
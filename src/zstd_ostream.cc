@@ -0,0 +1,89 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zstd_ostream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "absl/status/status.h"
+#include "llvm/include/llvm/ADT/ArrayRef.h"
+#include "llvm/include/llvm/ADT/SmallVector.h"
+#include "llvm/include/llvm/Support/Compression.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+absl::Status ZstdOstream::Finish() {
+  flush();
+  if (buffer_.status().ok() && !*this) {
+    return absl::InternalError("Failed to write the compressed stream");
+  }
+  return buffer_.status();
+}
+
+ZstdOstream::Buffer::Buffer(std::ostream& out)
+    : out_(out), data_(kBufferBytes) {
+  setp(data_.data(), data_.data() + data_.size());
+}
+
+ZstdOstream::Buffer::int_type ZstdOstream::Buffer::overflow(int_type c) {
+  if (!WriteFrame()) {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int ZstdOstream::Buffer::sync() {
+  if (!WriteFrame()) {
+    return -1;
+  }
+  out_.flush();
+  return out_ ? 0 : -1;
+}
+
+bool ZstdOstream::Buffer::WriteFrame() {
+  const size_t size = pptr() - pbase();
+  setp(data_.data(), data_.data() + data_.size());
+  if (!status_.ok()) {
+    return false;
+  }
+  if (size == 0) {
+    return true;
+  }
+  if (!llvm::compression::zstd::isAvailable()) {
+    status_ = absl::FailedPreconditionError(
+        "Cannot compress the output, LLVM is built without zstd");
+    return false;
+  }
+  // zstd decompresses concatenated frames as a single stream.
+  llvm::SmallVector<uint8_t, 0> compressed;
+  llvm::compression::zstd::compress(
+      llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(data_.data()),
+                              size),
+      compressed);
+  out_.write(reinterpret_cast<const char*>(compressed.data()),
+             compressed.size());
+  if (!out_) {
+    status_ = absl::InternalError("Failed to write the compressed stream");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace devtools_crosstool_fdo_field_access
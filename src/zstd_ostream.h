@@ -0,0 +1,74 @@
+/*
+ * Copyright 2025 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ZSTD_OSTREAM_H_
+#define ZSTD_OSTREAM_H_
+
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+#include "absl/status/status.h"
+
+namespace devtools_crosstool_fdo_field_access {
+
+// An output stream writing everything written to it compressed with zstd to
+// another stream. The data is buffered, and each block is written as a zstd
+// frame, so that the output decompresses with `zstd -d`. Flushing the stream
+// writes the buffered data as a frame of its own.
+class ZstdOstream : public std::ostream {
+ public:
+  // Size of the blocks compressed at once.
+  static constexpr size_t kBufferBytes = 1 << 20;
+
+  explicit ZstdOstream(std::ostream& out)
+      : std::ostream(nullptr), buffer_(out) {
+    rdbuf(&buffer_);
+  }
+  ZstdOstream(const ZstdOstream&) = delete;
+  ZstdOstream& operator=(const ZstdOstream&) = delete;
+  ~ZstdOstream() override { flush(); }
+
+  // Writes the buffered data. Returns the first error of the writes so far.
+  absl::Status Finish();
+
+ private:
+  class Buffer : public std::streambuf {
+   public:
+    explicit Buffer(std::ostream& out);
+
+    const absl::Status& status() const { return status_; }
+
+   protected:
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+   private:
+    // Compresses the buffered data to 'out_' and empties the buffer. Returns
+    // false on error.
+    bool WriteFrame();
+
+    std::ostream& out_;
+    std::vector<char> data_;
+    absl::Status status_;
+  };
+
+  Buffer buffer_;
+};
+
+}  // namespace devtools_crosstool_fdo_field_access
+
+#endif  // ZSTD_OSTREAM_H_
@@ -0,0 +1,89 @@
+// Copyright 2025 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "zstd_ostream.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "flamegraph_writer.h"
+#include "gtest/gtest.h"
+#include "llvm/include/llvm/ADT/ArrayRef.h"
+#include "llvm/include/llvm/ADT/SmallVector.h"
+#include "llvm/include/llvm/Support/Compression.h"
+#include "llvm/include/llvm/Support/Error.h"
+
+namespace devtools_crosstool_fdo_field_access {
+namespace {
+
+// Decompresses 'compressed', whose decompressed size is 'size'.
+std::string Decompress(const std::string& compressed, size_t size) {
+  llvm::SmallVector<uint8_t, 0> decompressed;
+  EXPECT_FALSE(llvm::errorToBool(llvm::compression::zstd::decompress(
+      llvm::ArrayRef<uint8_t>(
+          reinterpret_cast<const uint8_t*>(compressed.data()),
+          compressed.size()),
+      decompressed, size)));
+  return std::string(decompressed.begin(), decompressed.end());
+}
+
+// The output of --per_profile with --flamegraph: a header per profile,
+// followed by the flamegraph of the profile.
+TEST(ZstdOstreamTest, CompressesPerProfileOutput) {
+  if (!llvm::compression::zstd::isAvailable()) {
+    GTEST_SKIP() << "LLVM is built without zstd";
+  }
+  std::ostringstream out;
+  ZstdOstream compressed_out(out);
+  for (const char* profile : {"a.memprofraw", "b.memprofraw"}) {
+    compressed_out << "- Profile: " << profile << "\n";
+    FlameGraphWriter writer(compressed_out);
+    writer.Write("A_0|A|", 0);
+    writer.Write("A_0|A|;0|int|x", 3);
+    ASSERT_TRUE(writer.Finish().ok());
+  }
+  ASSERT_TRUE(compressed_out.Finish().ok());
+
+  const std::string expected =
+      "- Profile: a.memprofraw\n"
+      "A_0|A| 0\n"
+      "A_0|A|;0|int|x 3\n"
+      "- Profile: b.memprofraw\n"
+      "A_0|A| 0\n"
+      "A_0|A|;0|int|x 3\n";
+  EXPECT_EQ(out.str().find("Profile"), std::string::npos);
+  EXPECT_EQ(Decompress(out.str(), expected.size()), expected);
+}
+
+TEST(ZstdOstreamTest, CompressesLargeOutputInBlocks) {
+  if (!llvm::compression::zstd::isAvailable()) {
+    GTEST_SKIP() << "LLVM is built without zstd";
+  }
+  std::ostringstream out;
+  ZstdOstream compressed_out(out);
+  const std::string line(99, 'a');
+  std::string expected;
+  for (size_t i = 0; i < 2 * ZstdOstream::kBufferBytes / 100; ++i) {
+    compressed_out << line << "\n";
+    expected += line + "\n";
+  }
+  // Blocks are written before Finish.
+  EXPECT_FALSE(out.str().empty());
+  ASSERT_TRUE(compressed_out.Finish().ok());
+  EXPECT_EQ(Decompress(out.str(), expected.size()), expected);
+}
+
+}  // namespace
+}  // namespace devtools_crosstool_fdo_field_access